@@ -0,0 +1,99 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include "tests.h"
+
+#include <kernel/event.h>
+#include <kernel/mutex.h>
+#include <kernel/thread.h>
+#include <unittest.h>
+
+struct pi_test_state {
+    mutex_t mutex;
+    event_t held;      // the holder has the mutex
+    event_t release;   // the holder may let it go
+    event_t released;  // the holder has let it go
+    event_t exit;      // the holder may exit
+};
+
+static int pi_holder_thread(void* arg) {
+    pi_test_state* state = static_cast<pi_test_state*>(arg);
+
+    mutex_acquire(&state->mutex);
+    event_signal(&state->held, true);
+    event_wait(&state->release);
+    mutex_release(&state->mutex);
+    event_signal(&state->released, true);
+    event_wait(&state->exit);
+    return 0;
+}
+
+static int pi_waiter_thread(void* arg) {
+    pi_test_state* state = static_cast<pi_test_state*>(arg);
+
+    mutex_acquire(&state->mutex);
+    mutex_release(&state->mutex);
+    return 0;
+}
+
+// waits up to a second for |t| to block
+static bool wait_for_blocked(thread_t* t) {
+    for (int i = 0; i < 1000; i++) {
+        if (t->state == THREAD_BLOCKED)
+            return true;
+        thread_sleep_relative(LK_MSEC(1));
+    }
+    return false;
+}
+
+// A high priority thread blocking on a mutex lends its priority to the low
+// priority holder, which gets its own back once it releases the mutex.
+static bool mutex_pi_boost(void* context) {
+    BEGIN_TEST;
+
+    pi_test_state state;
+    mutex_init(&state.mutex);
+    event_init(&state.held, false, 0);
+    event_init(&state.release, false, 0);
+    event_init(&state.released, false, 0);
+    event_init(&state.exit, false, 0);
+
+    thread_t* holder = thread_create("pi holder", pi_holder_thread, &state, LOW_PRIORITY,
+                                     DEFAULT_STACK_SIZE);
+    REQUIRE_NONNULL(holder, "thread_create holder");
+    thread_resume(holder);
+    event_wait(&state.held);
+    EXPECT_EQ(LOW_PRIORITY, holder->priority, "holder priority before contention");
+
+    thread_t* waiter = thread_create("pi waiter", pi_waiter_thread, &state, HIGH_PRIORITY,
+                                     DEFAULT_STACK_SIZE);
+    REQUIRE_NONNULL(waiter, "thread_create waiter");
+    thread_resume(waiter);
+    EXPECT_TRUE(wait_for_blocked(waiter), "waiter blocks on the mutex");
+
+    EXPECT_EQ(HIGH_PRIORITY, holder->priority, "holder priority while the waiter is blocked");
+    EXPECT_EQ(LOW_PRIORITY, holder->base_priority, "holder base priority");
+
+    event_signal(&state.release, true);
+    event_wait(&state.released);
+    EXPECT_EQ(LOW_PRIORITY, holder->priority, "holder priority after release");
+
+    event_signal(&state.exit, true);
+    thread_join(waiter, nullptr, INFINITE_TIME);
+    thread_join(holder, nullptr, INFINITE_TIME);
+
+    event_destroy(&state.exit);
+    event_destroy(&state.released);
+    event_destroy(&state.release);
+    event_destroy(&state.held);
+    mutex_destroy(&state.mutex);
+
+    END_TEST;
+}
+
+UNITTEST_START_TESTCASE(mutex_pi)
+UNITTEST("mutex priority inheritance", mutex_pi_boost)
+UNITTEST_END_TESTCASE(mutex_pi, "mutex_pi", "Tests of mutex priority inheritance", nullptr, nullptr);
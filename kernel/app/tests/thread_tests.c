@@ -13,8 +13,10 @@
 #include <err.h>
 #include <inttypes.h>
 #include <assert.h>
+#include <stdlib.h>
 #include <string.h>
 #include <kernel/thread.h>
+#include <kernel/mp.h>
 #include <kernel/mutex.h>
 #include <kernel/event.h>
 #include <platform.h>
@@ -664,3 +666,113 @@ int spinner(int argc, const cmd_args *argv)
 
     return 0;
 }
+
+/* wakeup throughput benchmark: pairs of threads bounce back and forth through a pair
+ * of auto-unsignaling events, with the number of pairs scaled up to the number of
+ * active cpus. Each round trip is two wakeups through the scheduler. */
+struct wakeup_bench_pair {
+    event_t ping;
+    event_t pong;
+    volatile bool done;
+    uint64_t round_trips;
+    thread_t *threads[2];
+};
+
+static int wakeup_bench_pinger(void *arg)
+{
+    struct wakeup_bench_pair *pair = arg;
+
+    while (!pair->done) {
+        event_signal(&pair->ping, false);
+        event_wait(&pair->pong);
+        pair->round_trips++;
+    }
+
+    return 0;
+}
+
+static int wakeup_bench_ponger(void *arg)
+{
+    struct wakeup_bench_pair *pair = arg;
+
+    while (!pair->done) {
+        event_wait(&pair->ping);
+        event_signal(&pair->pong, false);
+    }
+
+    return 0;
+}
+
+static uint64_t wakeup_bench_run(struct wakeup_bench_pair *pairs, uint count, lk_time_t duration)
+{
+    for (uint i = 0; i < count; i++) {
+        event_init(&pairs[i].ping, false, EVENT_FLAG_AUTOUNSIGNAL);
+        event_init(&pairs[i].pong, false, EVENT_FLAG_AUTOUNSIGNAL);
+        pairs[i].done = false;
+        pairs[i].round_trips = 0;
+        pairs[i].threads[0] = thread_create("wakeup pinger", &wakeup_bench_pinger, &pairs[i],
+                                            DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+        pairs[i].threads[1] = thread_create("wakeup ponger", &wakeup_bench_ponger, &pairs[i],
+                                            DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+    }
+
+    for (uint i = 0; i < count; i++) {
+        thread_resume(pairs[i].threads[1]);
+        thread_resume(pairs[i].threads[0]);
+    }
+
+    thread_sleep_relative(duration);
+
+    /* stop everyone, then kick both events so neither side stays blocked */
+    for (uint i = 0; i < count; i++)
+        pairs[i].done = true;
+    smp_mb();
+
+    uint64_t total = 0;
+    for (uint i = 0; i < count; i++) {
+        event_signal(&pairs[i].ping, false);
+        event_signal(&pairs[i].pong, false);
+        thread_join(pairs[i].threads[0], NULL, INFINITE_TIME);
+        thread_join(pairs[i].threads[1], NULL, INFINITE_TIME);
+        event_destroy(&pairs[i].ping);
+        event_destroy(&pairs[i].pong);
+        total += pairs[i].round_trips;
+    }
+
+    return total;
+}
+
+int wakeup_bench(int argc, const cmd_args *argv)
+{
+    const lk_time_t duration = LK_SEC(1);
+
+    uint max_pairs = __builtin_popcount(mp_get_active_mask());
+    if (argc >= 2 && argv[1].u > 0)
+        max_pairs = argv[1].u;
+
+    struct wakeup_bench_pair *pairs = calloc(max_pairs, sizeof(*pairs));
+    if (!pairs)
+        return ERR_NO_MEMORY;
+
+    printf("wakeup throughput, %u cpus active\n", __builtin_popcount(mp_get_active_mask()));
+
+    uint64_t base_rate = 0;
+    for (uint count = 1;; count = MIN(count * 2, max_pairs)) {
+        uint64_t round_trips = wakeup_bench_run(pairs, count, duration);
+        uint64_t rate = (round_trips * 2 * LK_SEC(1)) / duration;
+        if (count == 1)
+            base_rate = rate;
+
+        printf("%3u pairs: %10" PRIu64 " wakeups/sec, %8" PRIu64 " per pair, scaling %" PRIu64 ".%02" PRIu64 "x\n",
+               count, rate, rate / count,
+               base_rate ? rate / base_rate : 0,
+               base_rate ? (rate * 100 / base_rate) % 100 : 0);
+
+        if (count == max_pairs)
+            break;
+    }
+
+    free(pairs);
+
+    return 0;
+}
@@ -7,6 +7,7 @@
 #include "tests.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <err.h>
 #include <inttypes.h>
 #include <kernel/timer.h>
@@ -75,8 +76,72 @@ static void timer_test_all_cpus(void)
     printf("%u threads created, %u threads joined\n", max, joined);
 }
 
+#define COALESCE_TIMERS 64
+
+struct coalesce_state {
+    int fired;
+    int early;
+    event_t done;
+};
+
+struct coalesce_timer {
+    timer_t timer;
+    lk_time_t deadline;
+    struct coalesce_state* state;
+};
+
+static enum handler_return timer_coalesce_cb(struct timer* timer, lk_time_t now, void* arg)
+{
+    struct coalesce_timer* t = (struct coalesce_timer*)arg;
+
+    if (now < t->deadline)
+        atomic_add(&t->state->early, 1);
+    if (atomic_add(&t->state->fired, 1) + 1 == COALESCE_TIMERS / 2)
+        event_signal(&t->state->done, false);
+
+    return INT_NO_RESCHEDULE;
+}
+
+static void timer_test_coalescing(void)
+{
+    static struct coalesce_timer timers[COALESCE_TIMERS];
+    struct coalesce_state state = {};
+
+    event_init(&state.done, false, 0);
+
+    // queue timers with shuffled deadlines and windows, then cancel every other one
+    lk_time_t now = current_time();
+    for (int i = 0; i < COALESCE_TIMERS; i++) {
+        struct coalesce_timer* t = &timers[i];
+        timer_initialize(&t->timer);
+        t->state = &state;
+        t->deadline = now + LK_MSEC(5) + LK_USEC(rand() % 20000);
+        timer_set_oneshot_etc(&t->timer, t->deadline, LK_USEC(rand() % 2000),
+                              timer_coalesce_cb, t);
+    }
+    for (int i = 0; i < COALESCE_TIMERS; i += 2)
+        timer_cancel(&timers[i].timer);
+
+    status_t err = event_wait_deadline(&state.done, current_time() + LK_SEC(1), false);
+
+    // give any wrongly surviving timers a chance to fire
+    thread_sleep_relative(LK_MSEC(30));
+    for (int i = 0; i < COALESCE_TIMERS; i++)
+        timer_cancel(&timers[i].timer);
+
+    printf("coalescing: %d of %d timers fired, %d early, wait %d\n",
+           state.fired, COALESCE_TIMERS / 2, state.early, err);
+    if (err != NO_ERROR || state.fired != COALESCE_TIMERS / 2 || state.early != 0)
+        printf("coalescing test FAILED\n");
+
+    event_destroy(&state.done);
+}
+
 void timer_tests(void)
 {
     // timer fires on all cpus
     timer_test_all_cpus();
+
+    // timers with slack fire within their windows, cancelled ones don't fire
+    timer_test_coalescing();
 }
@@ -341,10 +341,109 @@ static bool page_table_is_clear(pte_t* page_table, uint page_size_shift) {
     return true;
 }
 
+// Collects the tlb invalidations for a single unmap or protect operation.
+// tlbi broadcasts to the other cpus in hardware, but issuing one per page as
+// we walk the tables costs a barrier each. Instead the vaddrs are queued up
+// and flushed back to back behind a single dsb, and past kMaxPages the whole
+// asid is invalidated.
+struct PendingTlbInvalidation {
+    static constexpr size_t kMaxPages = 32;
+
+    explicit PendingTlbInvalidation(uint asid) : asid(asid) {}
+    ~PendingTlbInvalidation() { DEBUG_ASSERT(count == 0 && !full_shootdown); }
+
+    void enqueue(vaddr_t vaddr) {
+        if (full_shootdown)
+            return;
+        if (count == kMaxPages) {
+            full_shootdown = true;
+            return;
+        }
+        pages[count++] = vaddr;
+    }
+
+    void flush();
+
+    const uint asid;
+    bool full_shootdown = false;
+    size_t count = 0;
+    vaddr_t pages[kMaxPages];
+};
+
+void PendingTlbInvalidation::flush() {
+    if (count == 0 && !full_shootdown)
+        return;
+
+    // make the page table updates visible to the walkers before invalidating
+    __asm__ volatile("dsb ishst" ::: "memory");
+    if (full_shootdown) {
+        if (asid == MMU_ARM64_GLOBAL_ASID) {
+            __asm__ volatile("tlbi vmalle1is" ::: "memory");
+        } else {
+            __asm__ volatile("tlbi aside1is, %0" :: "r"((uint64_t)asid << 48) : "memory");
+        }
+    } else {
+        for (size_t i = 0; i < count; i++) {
+            if (asid == MMU_ARM64_GLOBAL_ASID) {
+                __asm__ volatile("tlbi vaae1is, %0" :: "r"((uint64_t)(pages[i] >> 12)) : "memory");
+            } else {
+                __asm__ volatile("tlbi vae1is, %0" :: "r"((uint64_t)(pages[i] >> 12) | (uint64_t)asid << 48)
+                                 : "memory");
+            }
+        }
+    }
+    __asm__ volatile("dsb ish" ::: "memory");
+    ISB;
+
+    count = 0;
+    full_shootdown = false;
+}
+
+// Replace the block mapping at page_table[index], which maps the block
+// starting at block_vaddr, with a table of next level entries mapping the
+// same range with the same attributes, so that part of it can be changed.
+static status_t arm64_mmu_split_block(vaddr_t block_vaddr, vaddr_t index,
+                                      uint index_shift, uint page_size_shift,
+                                      pte_t* page_table,
+                                      PendingTlbInvalidation* pending) {
+    pte_t pte = page_table[index];
+    DEBUG_ASSERT(index_shift > page_size_shift);
+    DEBUG_ASSERT((pte & MMU_PTE_DESCRIPTOR_MASK) == MMU_PTE_L012_DESCRIPTOR_BLOCK);
+
+    paddr_t paddr;
+    status_t status = alloc_page_table(&paddr, page_size_shift);
+    if (status != NO_ERROR)
+        return status;
+
+    uint next_shift = index_shift - (page_size_shift - 3);
+    pte_t desc = (next_shift > page_size_shift) ? MMU_PTE_L012_DESCRIPTOR_BLOCK
+                                                : MMU_PTE_L3_DESCRIPTOR_PAGE;
+    pte_t attrs = pte & ~(MMU_PTE_OUTPUT_ADDR_MASK | MMU_PTE_DESCRIPTOR_MASK);
+    paddr_t block_paddr = pte & MMU_PTE_OUTPUT_ADDR_MASK;
+
+    pte_t* next_page_table = static_cast<pte_t*>(paddr_to_kvaddr(paddr));
+    uint count = 1U << (page_size_shift - 3);
+    for (uint i = 0; i < count; i++)
+        next_page_table[i] = (block_paddr + ((paddr_t)i << next_shift)) | attrs | desc;
+
+    LTRACEF("splitting block %#" PRIxPTR " pte %p[%#" PRIxPTR "] = %#" PRIx64 "\n",
+            block_vaddr, page_table, index, pte);
+
+    // break before make: the block has to be gone from every tlb before the
+    // table goes in, the flush also orders the new table's contents before it
+    page_table[index] = MMU_PTE_DESCRIPTOR_INVALID;
+    pending->enqueue(block_vaddr);
+    pending->flush();
+    page_table[index] = paddr | MMU_PTE_L012_DESCRIPTOR_TABLE;
+
+    return NO_ERROR;
+}
+
 static ssize_t arm64_mmu_unmap_pt(vaddr_t vaddr, vaddr_t vaddr_rel,
                                   size_t size,
                                   uint index_shift, uint page_size_shift,
-                                  pte_t* page_table, uint asid) {
+                                  pte_t* page_table,
+                                  PendingTlbInvalidation* pending) {
     pte_t* next_page_table;
     vaddr_t index;
     size_t chunk_size;
@@ -368,6 +467,16 @@ static ssize_t arm64_mmu_unmap_pt(vaddr_t vaddr, vaddr_t vaddr_rel,
 
         pte = page_table[index];
 
+        // only part of a block is going away, break it up first. if that
+        // fails the whole block is unmapped below and faults back in later.
+        if (index_shift > page_size_shift && chunk_size != block_size &&
+            (pte & MMU_PTE_DESCRIPTOR_MASK) == MMU_PTE_L012_DESCRIPTOR_BLOCK) {
+            if (arm64_mmu_split_block(vaddr - vaddr_rem, index, index_shift,
+                                      page_size_shift, page_table, pending) == NO_ERROR) {
+                pte = page_table[index];
+            }
+        }
+
         if (index_shift > page_size_shift &&
             (pte & MMU_PTE_DESCRIPTOR_MASK) == MMU_PTE_L012_DESCRIPTOR_TABLE) {
             page_table_paddr = pte & MMU_PTE_OUTPUT_ADDR_MASK;
@@ -375,23 +484,21 @@ static ssize_t arm64_mmu_unmap_pt(vaddr_t vaddr, vaddr_t vaddr_rel,
             arm64_mmu_unmap_pt(vaddr, vaddr_rem, chunk_size,
                                index_shift - (page_size_shift - 3),
                                page_size_shift,
-                               next_page_table, asid);
+                               next_page_table, pending);
             if (chunk_size == block_size ||
                 page_table_is_clear(next_page_table, page_size_shift)) {
                 LTRACEF("pte %p[0x%lx] = 0 (was page table)\n", page_table, index);
                 page_table[index] = MMU_PTE_DESCRIPTOR_INVALID;
-                __asm__ volatile("dmb ishst" ::
-                                     : "memory");
+                // the walk caches may still point at the table, so everything
+                // queued so far has to be flushed before it can be reused
+                pending->enqueue(vaddr);
+                pending->flush();
                 free_page_table(next_page_table, page_table_paddr, page_size_shift);
             }
         } else if (pte) {
             LTRACEF("pte %p[0x%lx] = 0\n", page_table, index);
             page_table[index] = MMU_PTE_DESCRIPTOR_INVALID;
-            CF;
-            if (asid == MMU_ARM64_GLOBAL_ASID)
-                ARM64_TLBI(vaae1is, vaddr >> 12);
-            else
-                ARM64_TLBI(vae1is, vaddr >> 12 | (vaddr_t)asid << 48);
+            pending->enqueue(vaddr);
         } else {
             LTRACEF("pte %p[0x%lx] already clear\n", page_table, index);
         }
@@ -482,17 +589,21 @@ static ssize_t arm64_mmu_map_pt(vaddr_t vaddr_in, vaddr_t vaddr_rel_in,
 
     return mapped_size;
 
-err:
+err: {
+    PendingTlbInvalidation pending(asid);
     arm64_mmu_unmap_pt(vaddr_in, vaddr_rel_in, size_in - size,
-                       index_shift, page_size_shift, page_table, asid);
+                       index_shift, page_size_shift, page_table, &pending);
+    pending.flush();
     DSB;
     return ERR_INTERNAL;
 }
+}
 
 static int arm64_mmu_protect_pt(vaddr_t vaddr_in, vaddr_t vaddr_rel_in,
                                 size_t size_in, pte_t attrs,
                                 uint index_shift, uint page_size_shift,
-                                pte_t* page_table, uint asid) {
+                                pte_t* page_table,
+                                PendingTlbInvalidation* pending) {
     int ret;
     pte_t* next_page_table;
     vaddr_t index;
@@ -525,6 +636,21 @@ static int arm64_mmu_protect_pt(vaddr_t vaddr_in, vaddr_t vaddr_rel_in,
         index = vaddr_rel >> index_shift;
         pte = page_table[index];
 
+        // only part of a block is changing, break it up first. if that fails
+        // unmap the whole block and let it fault back in with the new
+        // permissions.
+        if (index_shift > page_size_shift && chunk_size != block_size &&
+            (pte & MMU_PTE_DESCRIPTOR_MASK) == MMU_PTE_L012_DESCRIPTOR_BLOCK) {
+            if (arm64_mmu_split_block(vaddr - vaddr_rem, index, index_shift,
+                                      page_size_shift, page_table, pending) == NO_ERROR) {
+                pte = page_table[index];
+            } else {
+                page_table[index] = MMU_PTE_DESCRIPTOR_INVALID;
+                pending->enqueue(vaddr - vaddr_rem);
+                pte = MMU_PTE_DESCRIPTOR_INVALID;
+            }
+        }
+
         if (index_shift > page_size_shift &&
             (pte & MMU_PTE_DESCRIPTOR_MASK) == MMU_PTE_L012_DESCRIPTOR_TABLE) {
             page_table_paddr = pte & MMU_PTE_OUTPUT_ADDR_MASK;
@@ -533,7 +659,7 @@ static int arm64_mmu_protect_pt(vaddr_t vaddr_in, vaddr_t vaddr_rel_in,
                                        attrs,
                                        index_shift - (page_size_shift - 3),
                                        page_size_shift,
-                                       next_page_table, asid);
+                                       next_page_table, pending);
             if (ret != 0) {
                 goto err;
             }
@@ -542,13 +668,7 @@ static int arm64_mmu_protect_pt(vaddr_t vaddr_in, vaddr_t vaddr_rel_in,
             LTRACEF("pte %p[%#" PRIxPTR "] = %#" PRIx64 "\n",
                     page_table, index, pte);
             page_table[index] = pte;
-
-            CF;
-            if (asid == MMU_ARM64_GLOBAL_ASID) {
-                ARM64_TLBI(vaae1is, vaddr >> 12);
-            } else {
-                ARM64_TLBI(vae1is, vaddr >> 12 | (vaddr_t)asid << 48);
-            }
+            pending->enqueue(vaddr);
         } else {
             LTRACEF("page table entry does not exist, index %#" PRIxPTR
                     ", %#" PRIx64 "\n",
@@ -618,8 +738,10 @@ static ssize_t arm64_mmu_unmap(vaddr_t vaddr, size_t size,
         return ERR_INVALID_ARGS;
     }
 
+    PendingTlbInvalidation pending(asid);
     ssize_t ret = arm64_mmu_unmap_pt(vaddr, vaddr_rel, size,
-                       top_index_shift, page_size_shift, top_page_table, asid);
+                       top_index_shift, page_size_shift, top_page_table, &pending);
+    pending.flush();
     DSB;
     return ret;
 }
@@ -646,8 +768,10 @@ static status_t arm64_mmu_protect(vaddr_t vaddr, size_t size, pte_t attrs,
         return ERR_INVALID_ARGS;
     }
 
+    PendingTlbInvalidation pending(asid);
     status_t ret = arm64_mmu_protect_pt(vaddr, vaddr_rel, size, attrs,
-                           top_index_shift, page_size_shift, top_page_table, asid);
+                           top_index_shift, page_size_shift, top_page_table, &pending);
+    pending.flush();
     DSB;
     return ret;
 }
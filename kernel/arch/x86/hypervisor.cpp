@@ -811,7 +811,9 @@ status_t VmcsPerCpu::Enter(const VmcsContext& context, GuestPhysicalAddressSpace
     // FS is used for thread-local storage — save for this thread.
     vmcs_write(VmcsFieldXX::HOST_FS_BASE, read_msr(X86_MSR_IA32_FS_BASE));
     // CR3 is used to maintain the virtual address space — save for this thread.
-    vmcs_write(VmcsFieldXX::HOST_CR3, x86_get_cr3());
+    // We run on a kernel thread, so this is the kernel aspace under PCID 0;
+    // mask the PCID anyway so that only the page table address is saved.
+    vmcs_write(VmcsFieldXX::HOST_CR3, x86_get_cr3() & ~X86_CR3_PCID_MASK);
     // Kernel GS stores the user-space GS (within the kernel) — as the calling
     // user-space thread may change, save this every time.
     edit_msr_list(&host_msr_page_, 0, X86_MSR_IA32_KERNEL_GS_BASE,
@@ -33,6 +33,15 @@ struct arch_aspace {
      * actually an mp_cpu_mask_t, but header dependencies. */
     volatile int active_cpus;
 
+    /* process-context identifier tagging this aspace's tlb entries, or 0 if
+     * it doesn't have one and has to flush on every switch */
+    uint16_t pcid;
+
+    /* cpus that may still hold tlb entries under pcid that have since been
+     * invalidated, and so must flush it the next time they switch in.
+     * also an mp_cpu_mask_t. */
+    volatile int pcid_stale_cpus;
+
     /* Pointer to a bitmap::RleBitmap representing the range of ports
      * enabled in this aspace. */
     void *io_bitmap;
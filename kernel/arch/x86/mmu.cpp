@@ -17,10 +17,13 @@
 #include <arch/x86/feature.h>
 #include <arch/x86/mmu.h>
 #include <arch/x86/mmu_mem_types.h>
+#include <kernel/cmdline.h>
 #include <kernel/mp.h>
+#include <kernel/mutex.h>
 #include <kernel/vm.h>
 
 #include <bitmap/rle-bitmap.h>
+#include <mxtl/macros.h>
 
 #define LOCAL_TRACE 0
 
@@ -109,10 +112,74 @@ static bool x86_mmu_check_paddr(paddr_t paddr) {
     return paddr <= max_paddr;
 }
 
+/* Process-context identifiers handed out to user aspaces.  PCID 0 is used by
+ * the kernel aspace and by any aspace created once they have run out, and is
+ * flushed on every switch, as without PCIDs. */
+#define X86_MAX_PCIDS (X86_CR3_PCID_MASK + 1)
+static bool pcid_enabled;
+static uint64_t pcid_pool[X86_MAX_PCIDS / 64];
+static uint16_t pcid_next = 1;
+static mutex_t pcid_lock = MUTEX_INITIAL_VALUE(pcid_lock);
+
+static uint16_t x86_pcid_alloc() {
+    if (!pcid_enabled)
+        return 0;
+
+    uint16_t pcid = 0;
+    mutex_acquire(&pcid_lock);
+    for (uint i = 0; i < X86_MAX_PCIDS; i++) {
+        uint16_t candidate = static_cast<uint16_t>((pcid_next + i) & X86_CR3_PCID_MASK);
+        if (candidate == 0)
+            continue;
+        if (!(pcid_pool[candidate / 64] & (1ULL << (candidate % 64)))) {
+            pcid_pool[candidate / 64] |= 1ULL << (candidate % 64);
+            pcid_next = static_cast<uint16_t>(candidate + 1);
+            pcid = candidate;
+            break;
+        }
+    }
+    mutex_release(&pcid_lock);
+
+    LTRACEF("pcid %u\n", pcid);
+    return pcid;
+}
+
+static void x86_pcid_free(uint16_t pcid) {
+    if (pcid == 0)
+        return;
+
+    mutex_acquire(&pcid_lock);
+    DEBUG_ASSERT(pcid_pool[pcid / 64] & (1ULL << (pcid % 64)));
+    pcid_pool[pcid / 64] &= ~(1ULL << (pcid % 64));
+    mutex_release(&pcid_lock);
+}
+
+/* INVPCID invalidation types, see Intel 3A section 4.10.4.1 */
+enum invpcid_type : uint64_t {
+    INVPCID_ADDRESS = 0,
+    INVPCID_SINGLE_CONTEXT = 1,
+    INVPCID_ALL_INCLUDING_GLOBAL = 2,
+    INVPCID_ALL_NON_GLOBAL = 3,
+};
+
+static void x86_invpcid(invpcid_type type, uint16_t pcid, vaddr_t vaddr) {
+    struct {
+        uint64_t pcid;
+        uint64_t vaddr;
+    } desc = { pcid, vaddr };
+    __asm__ volatile("invpcid %0, %1" ::"m"(desc), "r"(static_cast<uint64_t>(type)) : "memory");
+}
+
 /**
  * @brief  invalidate all TLB entries, including global entries
  */
 static void x86_tlb_global_invalidate() {
+    /* one instruction rather than two cr4 writes, and covers every pcid */
+    if (x86_feature_test(X86_FEATURE_INVPCID)) {
+        x86_invpcid(INVPCID_ALL_INCLUDING_GLOBAL, 0, 0);
+        return;
+    }
+
     /* See Intel 3A section 4.10.4.1 */
     ulong cr4 = x86_get_cr4();
     if (likely(cr4 & X86_CR4_PGE)) {
@@ -123,69 +190,148 @@ static void x86_tlb_global_invalidate() {
     }
 }
 
-/* Task used for invalidating a TLB entry on each CPU */
-struct tlb_invalidate_page_context {
+/**
+ * @brief A batch of pending TLB invalidations
+ *
+ * Page table walks queue up the entries they change here rather than
+ * invalidating them one at a time, and then flush the whole batch with a
+ * single mp_sync_exec once the walk is done. Page tables that were unlinked
+ * during the walk are also held here, since other CPUs may still be caching
+ * them until the flush completes.
+ */
+struct PendingTlbInvalidation {
+    /* Past this many pages it is cheaper to flush the whole TLB */
+    static constexpr size_t kMaxPages = 32;
+
+    struct Item {
+        vaddr_t vaddr;
+        enum page_table_levels level;
+        bool is_global;
+    };
+
+    PendingTlbInvalidation() = default;
+    ~PendingTlbInvalidation() {
+        DEBUG_ASSERT(count == 0 && !full_shootdown && list_is_empty(&freed_tables));
+    }
+
+    DISALLOW_COPY_ASSIGN_AND_MOVE(PendingTlbInvalidation);
+
+    void enqueue(vaddr_t vaddr, enum page_table_levels level, bool is_global) {
+        contains_global |= is_global;
+        if (full_shootdown)
+            return;
+
+        /* Flushing a top level entry affects too much to track */
+        if (level == PML4_L || count == kMaxPages) {
+            full_shootdown = true;
+            return;
+        }
+
+        items[count++] = { vaddr, level, is_global };
+    }
+
+    void free_table(vm_page_t* page) {
+        list_add_tail(&freed_tables, &page->free.node);
+    }
+
+    bool empty() const { return count == 0 && !full_shootdown; }
+
+    void clear() {
+        count = 0;
+        full_shootdown = false;
+        contains_global = false;
+    }
+
+    Item items[kMaxPages];
+    size_t count = 0;
+    bool full_shootdown = false;
+    bool contains_global = false;
+    list_node freed_tables = LIST_INITIAL_VALUE(freed_tables);
+};
+
+/* Task used for invalidating a batch of TLB entries on each CPU */
+struct tlb_invalidate_context {
     ulong target_cr3;
-    vaddr_t vaddr;
-    enum page_table_levels level;
-    bool global_page;
+    const PendingTlbInvalidation* pending;
 };
-static void tlb_invalidate_page_task(void* raw_context) {
+static void tlb_invalidate_task(void* raw_context) {
     DEBUG_ASSERT(arch_ints_disabled());
-    tlb_invalidate_page_context* context = (tlb_invalidate_page_context*)raw_context;
+    tlb_invalidate_context* context = (tlb_invalidate_context*)raw_context;
+    const PendingTlbInvalidation* pending = context->pending;
 
     ulong cr3 = x86_get_cr3();
-    if (context->target_cr3 != cr3 && !context->global_page) {
+    bool is_target = context->target_cr3 == (cr3 & ~X86_CR3_PCID_MASK);
+    if (!is_target && !pending->contains_global) {
         /* This invalidation doesn't apply to this CPU, ignore it */
         return;
     }
 
-    switch (context->level) {
-    case PML4_L:
-        x86_tlb_global_invalidate();
-        break;
-    case PDP_L:
-    case PD_L:
-    case PT_L:
-        __asm__ volatile("invlpg %0" ::"m"(*(uint8_t*)context->vaddr));
-        break;
+    if (pending->full_shootdown) {
+        if (pending->contains_global) {
+            x86_tlb_global_invalidate();
+        } else {
+            /* reloading cr3 drops all of the non-global entries for the
+             * current pcid */
+            x86_set_cr3(cr3);
+        }
+        return;
+    }
+
+    for (size_t i = 0; i < pending->count; ++i) {
+        const auto& item = pending->items[i];
+        if (!is_target && !item.is_global)
+            continue;
+
+        __asm__ volatile("invlpg %0" ::"m"(*(uint8_t*)item.vaddr));
     }
 }
 
 /**
- * @brief Invalidate a single page at a given page table level
+ * @brief Execute a batch of TLB invalidations and free any page tables
+ * that were waiting on it
  *
  * @param aspace The aspace we're invalidating for (if NULL, assume for current one)
- * @param vaddr The virtual address we are invalidating the TLB entry for
- * @param level The page table level that maps this vaddr
- * @param global_page True if we are invalidating a global mapping
- *
- * TODO(teisenbe): Optimize this.  This is horribly inefficient.
- * We should also change this to pool invalidations from a single
- * "transaction" and then only execute a single mp_sync_exec for that
- * transaction, rather than one per page.
+ * @param pending The invalidations to perform, cleared on return
  */
-void x86_tlb_invalidate_page(arch_aspace_t* aspace, vaddr_t vaddr, enum page_table_levels level,
-                             bool global_page) {
-    ulong cr3 = aspace ? aspace->pt_phys : x86_get_cr3();
-    struct tlb_invalidate_page_context task_context = {
-        .target_cr3 = cr3, .vaddr = vaddr, .level = level, .global_page = global_page,
-    };
+static void x86_tlb_invalidate(arch_aspace_t* aspace, PendingTlbInvalidation* pending) {
+    if (!pending->empty()) {
+        /* compare page table addresses only, the pcid in cr3 tells nothing about
+         * which tables are loaded */
+        ulong cr3 = aspace ? aspace->pt_phys : (x86_get_cr3() & ~X86_CR3_PCID_MASK);
+        struct tlb_invalidate_context task_context = {
+            .target_cr3 = cr3, .pending = pending,
+        };
+
+        /* Target only CPUs this aspace is active on.  It may be the case that some
+         * other CPU will become active in it after this load, or will have left it
+         * just before this load.  In the former case, it is becoming active after
+         * the write to the page table, so it will see the change.  In the latter
+         * case, it will get a spurious request to flush. */
+        /* Cpus that aren't in the aspace right now may still have entries
+         * tagged with its pcid, have them flush it when they next switch in.
+         * This marks every cpu rather than just the ones not targeted below,
+         * which also covers a cpu switching in concurrently: it either sees
+         * the mark, or was already in active_cpus and gets the IPI. */
+        if (aspace && aspace->pcid != 0) {
+            atomic_or(&aspace->pcid_stale_cpus, -1);
+        }
 
-    /* Target only CPUs this aspace is active on.  It may be the case that some
-     * other CPU will become active in it after this load, or will have left it
-     * just before this load.  In the former case, it is becoming active after
-     * the write to the page table, so it will see the change.  In the latter
-     * case, it will get a spurious request to flush. */
-    mp_cpu_mask_t targets;
-    if (global_page || aspace == nullptr) {
-        targets = MP_CPU_ALL;
-    } else {
-        targets = atomic_load(&aspace->active_cpus);
-        static_assert(sizeof(mp_cpu_mask_t) == sizeof(aspace->active_cpus), "err");
+        mp_cpu_mask_t targets;
+        if (pending->contains_global || aspace == nullptr) {
+            targets = MP_CPU_ALL;
+        } else {
+            targets = atomic_load(&aspace->active_cpus);
+            static_assert(sizeof(mp_cpu_mask_t) == sizeof(aspace->active_cpus), "err");
+        }
+
+        mp_sync_exec(targets, tlb_invalidate_task, &task_context);
     }
 
-    mp_sync_exec(targets, tlb_invalidate_page_task, &task_context);
+    /* Nobody can be walking the freed tables anymore */
+    if (!list_is_empty(&pending->freed_tables))
+        pmm_free(&pending->freed_tables);
+
+    pending->clear();
 }
 
 template <int Level>
@@ -373,10 +519,11 @@ struct PageTable : PageTableBase<Level> {
     }
 
     /**
-     * @brief Invalidate a single page at a given page table level
+     * @brief Queue up the invalidation of a single page at this page table level
      */
-    static void tlb_invalidate_page(arch_aspace_t* aspace, vaddr_t vaddr, bool global_page) {
-        x86_tlb_invalidate_page(aspace, vaddr, Base::level, global_page);
+    static void tlb_invalidate_page(PendingTlbInvalidation* pending, vaddr_t vaddr,
+                                    bool global_page) {
+        pending->enqueue(vaddr, Base::level, global_page);
     }
 };
 
@@ -424,9 +571,10 @@ struct ExtendedPageTable : PageTableBase<Level> {
     }
 
     /**
-     * @brief Invalidate a single page at a given page table level
+     * @brief Queue up the invalidation of a single page at this page table level
      */
-    static void tlb_invalidate_page(arch_aspace_t* aspace, vaddr_t vaddr, bool global_page) {
+    static void tlb_invalidate_page(PendingTlbInvalidation* pending, vaddr_t vaddr,
+                                    bool global_page) {
         // TODO(abdulla): Implement this.
     }
 };
@@ -504,8 +652,8 @@ struct MappingCursor {
 };
 
 template <typename PageTable>
-static void update_entry(arch_aspace_t* aspace, vaddr_t vaddr, pt_entry_t* pte, paddr_t paddr,
-                         arch_flags_t flags) {
+static void update_entry(PendingTlbInvalidation* pending, vaddr_t vaddr, pt_entry_t* pte,
+                         paddr_t paddr, arch_flags_t flags) {
     DEBUG_ASSERT(pte);
     DEBUG_ASSERT(IS_PAGE_ALIGNED(paddr));
 
@@ -517,12 +665,12 @@ static void update_entry(arch_aspace_t* aspace, vaddr_t vaddr, pt_entry_t* pte,
 
     /* attempt to invalidate the page */
     if (IS_PAGE_PRESENT(olde)) {
-        PageTable::tlb_invalidate_page(aspace, vaddr, is_kernel_address(vaddr));
+        PageTable::tlb_invalidate_page(pending, vaddr, is_kernel_address(vaddr));
     }
 }
 
 template <typename PageTable>
-static void unmap_entry(arch_aspace_t* aspace, vaddr_t vaddr, pt_entry_t* pte) {
+static void unmap_entry(PendingTlbInvalidation* pending, vaddr_t vaddr, pt_entry_t* pte) {
     DEBUG_ASSERT(pte);
 
     pt_entry_t olde = *pte;
@@ -531,7 +679,7 @@ static void unmap_entry(arch_aspace_t* aspace, vaddr_t vaddr, pt_entry_t* pte) {
 
     /* attempt to invalidate the page */
     if (IS_PAGE_PRESENT(olde)) {
-        PageTable::tlb_invalidate_page(aspace, vaddr, is_kernel_address(vaddr));
+        PageTable::tlb_invalidate_page(pending, vaddr, is_kernel_address(vaddr));
     }
 }
 
@@ -555,7 +703,7 @@ static pt_entry_t* _map_alloc_page(void) {
  * @brief Split the given large page into smaller pages
  */
 template <typename PageTable>
-static status_t x86_mmu_split(arch_aspace_t* aspace, vaddr_t vaddr, pt_entry_t* pte) {
+static status_t x86_mmu_split(PendingTlbInvalidation* pending, vaddr_t vaddr, pt_entry_t* pte) {
     static_assert(PageTable::level != PT_L, "tried splitting PT_L");
     LTRACEF_LEVEL(2, "splitting table %p at level %d\n", pte, PageTable::level);
 
@@ -576,14 +724,14 @@ static status_t x86_mmu_split(arch_aspace_t* aspace, vaddr_t vaddr, pt_entry_t*
         pt_entry_t* e = m + i;
         // If this is a PDP_L (i.e. huge page), flags will include the
         // PS bit still, so the new PD entries will be large pages.
-        update_entry<typename PageTable::LowerTable>(aspace, new_vaddr, e, new_paddr, flags);
+        update_entry<typename PageTable::LowerTable>(pending, new_vaddr, e, new_paddr, flags);
         new_vaddr += ps;
         new_paddr += ps;
     }
     DEBUG_ASSERT(new_vaddr == vaddr + PageTable::page_size());
 
     flags = PageTable::intermediate_arch_flags();
-    update_entry<PageTable>(aspace, vaddr, pte, X86_VIRT_TO_PHYS(m), flags);
+    update_entry<PageTable>(pending, vaddr, pte, X86_VIRT_TO_PHYS(m), flags);
     return NO_ERROR;
 }
 
@@ -675,12 +823,15 @@ status_t x86_mmu_get_mapping<ExtendedPageTable<PT_L>>(pt_entry_t* table, vaddr_t
  * unmap within table
  * @param new_cursor A returned cursor describing how much work was not
  * completed.  Must be non-null.
+ * @param pending TLB invalidations and freed page tables are queued here for
+ * the caller to flush.
  *
  * @return true if at least one page was unmapped at this level
  */
 template <typename PageTable>
 static bool x86_mmu_remove_mapping(arch_aspace_t* aspace, pt_entry_t* table,
-                                   const MappingCursor& start_cursor, MappingCursor* new_cursor) {
+                                   const MappingCursor& start_cursor, MappingCursor* new_cursor,
+                                   PendingTlbInvalidation* pending) {
     DEBUG_ASSERT(table);
     LTRACEF("L: %d, %016" PRIxPTR " %016zx\n", PageTable::level, start_cursor.vaddr,
             start_cursor.size);
@@ -714,7 +865,7 @@ static bool x86_mmu_remove_mapping(arch_aspace_t* aspace, pt_entry_t* table,
             bool vaddr_level_aligned = PageTable::page_aligned(new_cursor->vaddr);
             // If the request covers the entire large page, just unmap it
             if (vaddr_level_aligned && new_cursor->size >= ps) {
-                unmap_entry<PageTable>(aspace, new_cursor->vaddr, e);
+                unmap_entry<PageTable>(pending, new_cursor->vaddr, e);
                 unmapped = true;
 
                 new_cursor->vaddr += ps;
@@ -724,11 +875,11 @@ static bool x86_mmu_remove_mapping(arch_aspace_t* aspace, pt_entry_t* table,
             }
             // Otherwise, we need to split it
             vaddr_t page_vaddr = new_cursor->vaddr & ~(ps - 1);
-            status_t status = x86_mmu_split<PageTable>(aspace, page_vaddr, e);
+            status_t status = x86_mmu_split<PageTable>(pending, page_vaddr, e);
             if (status != NO_ERROR) {
                 // If split fails, just unmap the whole thing, and let a
                 // subsequent page fault clean it up.
-                unmap_entry<PageTable>(aspace, new_cursor->vaddr, e);
+                unmap_entry<PageTable>(pending, new_cursor->vaddr, e);
                 unmapped = true;
 
                 const size_t size = (new_cursor->size > ps) ? ps : new_cursor->size;
@@ -741,7 +892,7 @@ static bool x86_mmu_remove_mapping(arch_aspace_t* aspace, pt_entry_t* table,
         MappingCursor cursor;
         pt_entry_t* next_table = get_next_table_from_entry(*e);
         bool lower_unmapped = x86_mmu_remove_mapping<typename PageTable::LowerTable>(
-            aspace, next_table, *new_cursor, &cursor);
+            aspace, next_table, *new_cursor, &cursor, pending);
 
         // If we were requesting to unmap everything in the lower page table,
         // we know we can unmap the lower level page table.  Otherwise, if
@@ -761,8 +912,8 @@ static bool x86_mmu_remove_mapping(arch_aspace_t* aspace, pt_entry_t* table,
             }
         }
         if (unmap_page_table) {
-            unmap_entry<PageTable>(aspace, new_cursor->vaddr, e);
-            pmm_free_page(paddr_to_vm_page(X86_VIRT_TO_PHYS(next_table)));
+            unmap_entry<PageTable>(pending, new_cursor->vaddr, e);
+            pending->free_table(paddr_to_vm_page(X86_VIRT_TO_PHYS(next_table)));
             unmapped = true;
         }
         *new_cursor = cursor;
@@ -778,7 +929,8 @@ static bool x86_mmu_remove_mapping(arch_aspace_t* aspace, pt_entry_t* table,
 template <typename PageTable>
 static bool x86_mmu_remove_mapping_l0(arch_aspace_t* aspace, pt_entry_t* table,
                                       const MappingCursor& start_cursor,
-                                      MappingCursor* new_cursor) {
+                                      MappingCursor* new_cursor,
+                                      PendingTlbInvalidation* pending) {
     static_assert(PageTable::level == PT_L, "x86_mmu_remove_mapping_l0 used with wrong level");
     LTRACEF("%016" PRIxPTR " %016zx\n", start_cursor.vaddr, start_cursor.size);
     DEBUG_ASSERT(IS_PAGE_ALIGNED(start_cursor.size));
@@ -790,7 +942,7 @@ static bool x86_mmu_remove_mapping_l0(arch_aspace_t* aspace, pt_entry_t* table,
     for (; index != NO_OF_PT_ENTRIES && new_cursor->size != 0; ++index) {
         pt_entry_t* e = table + index;
         if (IS_PAGE_PRESENT(*e)) {
-            unmap_entry<PageTable>(aspace, new_cursor->vaddr, e);
+            unmap_entry<PageTable>(pending, new_cursor->vaddr, e);
             unmapped = true;
         }
 
@@ -804,16 +956,19 @@ static bool x86_mmu_remove_mapping_l0(arch_aspace_t* aspace, pt_entry_t* table,
 template <>
 bool x86_mmu_remove_mapping<PageTable<PT_L>>(arch_aspace_t* aspace, pt_entry_t* table,
                                              const MappingCursor& start_cursor,
-                                             MappingCursor* new_cursor) {
-    return x86_mmu_remove_mapping_l0<PageTable<PT_L>>(aspace, table, start_cursor, new_cursor);
+                                             MappingCursor* new_cursor,
+                                             PendingTlbInvalidation* pending) {
+    return x86_mmu_remove_mapping_l0<PageTable<PT_L>>(aspace, table, start_cursor, new_cursor,
+                                                      pending);
 }
 
 template <>
 bool x86_mmu_remove_mapping<ExtendedPageTable<PT_L>>(arch_aspace_t* aspace, pt_entry_t* table,
                                                      const MappingCursor& start_cursor,
-                                                     MappingCursor* new_cursor) {
+                                                     MappingCursor* new_cursor,
+                                                     PendingTlbInvalidation* pending) {
     return x86_mmu_remove_mapping_l0<ExtendedPageTable<PT_L>>(aspace, table, start_cursor,
-                                                              new_cursor);
+                                                              new_cursor, pending);
 }
 
 /**
@@ -827,6 +982,8 @@ bool x86_mmu_remove_mapping<ExtendedPageTable<PT_L>>(arch_aspace_t* aspace, pt_e
  * act on within table
  * @param new_cursor A returned cursor describing how much work was not
  * completed.  Must be non-null.
+ * @param pending TLB invalidations and freed page tables are queued here for
+ * the caller to flush.
  *
  * @return NO_ERROR if successful
  * @return ERR_ALREADY_EXISTS if the range overlaps an existing mapping
@@ -834,7 +991,8 @@ bool x86_mmu_remove_mapping<ExtendedPageTable<PT_L>>(arch_aspace_t* aspace, pt_e
  */
 template <typename PageTable>
 static status_t x86_mmu_add_mapping(arch_aspace_t* aspace, pt_entry_t* table, uint mmu_flags,
-                                    const MappingCursor& start_cursor, MappingCursor* new_cursor) {
+                                    const MappingCursor& start_cursor, MappingCursor* new_cursor,
+                                    PendingTlbInvalidation* pending) {
     DEBUG_ASSERT(table);
     DEBUG_ASSERT(x86_mmu_check_vaddr(start_cursor.vaddr));
     DEBUG_ASSERT(x86_mmu_check_paddr(start_cursor.paddr));
@@ -862,7 +1020,7 @@ static status_t x86_mmu_add_mapping(arch_aspace_t* aspace, pt_entry_t* table, ui
         if (level_supports_large_pages && !IS_PAGE_PRESENT(*e) && level_valigned &&
             level_paligned && new_cursor->size >= ps) {
 
-            update_entry<PageTable>(aspace, new_cursor->vaddr, table + index, new_cursor->paddr,
+            update_entry<PageTable>(pending, new_cursor->vaddr, table + index, new_cursor->paddr,
                                     arch_flags | X86_MMU_PG_PS);
 
             new_cursor->paddr += ps;
@@ -880,13 +1038,13 @@ static status_t x86_mmu_add_mapping(arch_aspace_t* aspace, pt_entry_t* table, ui
 
                 LTRACEF_LEVEL(2, "new table %p at level %d\n", m, PageTable::level);
 
-                update_entry<PageTable>(aspace, new_cursor->vaddr, e, X86_VIRT_TO_PHYS(m),
+                update_entry<PageTable>(pending, new_cursor->vaddr, e, X86_VIRT_TO_PHYS(m),
                                         interm_arch_flags);
             }
 
             MappingCursor cursor;
             ret = x86_mmu_add_mapping<typename PageTable::LowerTable>(
-                aspace, get_next_table_from_entry(*e), mmu_flags, *new_cursor, &cursor);
+                aspace, get_next_table_from_entry(*e), mmu_flags, *new_cursor, &cursor, pending);
             *new_cursor = cursor;
             DEBUG_ASSERT(new_cursor->size <= start_cursor.size);
             if (ret != NO_ERROR) {
@@ -902,7 +1060,7 @@ err:
         // new_cursor->size should be how much is left to be mapped still
         cursor.size -= new_cursor->size;
         if (cursor.size > 0) {
-            x86_mmu_remove_mapping<typename PageTable::TopTable>(aspace, table, cursor, &result);
+            x86_mmu_remove_mapping<typename PageTable::TopTable>(aspace, table, cursor, &result, pending);
             DEBUG_ASSERT(result.size == 0);
         }
     }
@@ -913,7 +1071,8 @@ err:
 template <typename PageTable>
 static status_t x86_mmu_add_mapping_l0(arch_aspace_t* aspace, pt_entry_t* table, uint mmu_flags,
                                        const MappingCursor& start_cursor,
-                                       MappingCursor* new_cursor) {
+                                       MappingCursor* new_cursor,
+                                       PendingTlbInvalidation* pending) {
     static_assert(PageTable::level == PT_L, "x86_mmu_remove_mapping_l0 used with wrong level");
     DEBUG_ASSERT(IS_PAGE_ALIGNED(start_cursor.size));
 
@@ -928,7 +1087,7 @@ static status_t x86_mmu_add_mapping_l0(arch_aspace_t* aspace, pt_entry_t* table,
             return ERR_ALREADY_EXISTS;
         }
 
-        update_entry<PageTable>(aspace, new_cursor->vaddr, table + index, new_cursor->paddr,
+        update_entry<PageTable>(pending, new_cursor->vaddr, table + index, new_cursor->paddr,
                                 arch_flags);
 
         new_cursor->paddr += PAGE_SIZE;
@@ -943,18 +1102,20 @@ static status_t x86_mmu_add_mapping_l0(arch_aspace_t* aspace, pt_entry_t* table,
 template <>
 status_t x86_mmu_add_mapping<PageTable<PT_L>>(arch_aspace_t* aspace, pt_entry_t* table,
                                               uint mmu_flags, const MappingCursor& start_cursor,
-                                              MappingCursor* new_cursor) {
+                                              MappingCursor* new_cursor,
+                                              PendingTlbInvalidation* pending) {
     return x86_mmu_add_mapping_l0<PageTable<PT_L>>(aspace, table, mmu_flags, start_cursor,
-                                                   new_cursor);
+                                                   new_cursor, pending);
 }
 
 template <>
 status_t x86_mmu_add_mapping<ExtendedPageTable<PT_L>>(arch_aspace_t* aspace, pt_entry_t* table,
                                                       uint mmu_flags,
                                                       const MappingCursor& start_cursor,
-                                                      MappingCursor* new_cursor) {
+                                                      MappingCursor* new_cursor,
+                                                      PendingTlbInvalidation* pending) {
     return x86_mmu_add_mapping_l0<ExtendedPageTable<PT_L>>(aspace, table, mmu_flags, start_cursor,
-                                                           new_cursor);
+                                                           new_cursor, pending);
 }
 
 /**
@@ -968,11 +1129,14 @@ status_t x86_mmu_add_mapping<ExtendedPageTable<PT_L>>(arch_aspace_t* aspace, pt_
  * act on within table
  * @param new_cursor A returned cursor describing how much work was not
  * completed.  Must be non-null.
+ * @param pending TLB invalidations and freed page tables are queued here for
+ * the caller to flush.
  */
 template <typename PageTable>
 static status_t x86_mmu_update_mapping(arch_aspace_t* aspace, pt_entry_t* table, uint mmu_flags,
                                        const MappingCursor& start_cursor,
-                                       MappingCursor* new_cursor) {
+                                       MappingCursor* new_cursor,
+                                       PendingTlbInvalidation* pending) {
     DEBUG_ASSERT(table);
     LTRACEF("L: %d, %016" PRIxPTR " %016zx\n", PageTable::level, start_cursor.vaddr,
             start_cursor.size);
@@ -1006,7 +1170,7 @@ static status_t x86_mmu_update_mapping(arch_aspace_t* aspace, pt_entry_t* table,
             // If the request covers the entire large page, just change the
             // permissions
             if (vaddr_level_aligned && new_cursor->size >= ps) {
-                update_entry<PageTable>(aspace, new_cursor->vaddr, e, PageTable::paddr_from_pte(*e),
+                update_entry<PageTable>(pending, new_cursor->vaddr, e, PageTable::paddr_from_pte(*e),
                                         arch_flags | X86_MMU_PG_PS);
 
                 new_cursor->vaddr += ps;
@@ -1016,7 +1180,7 @@ static status_t x86_mmu_update_mapping(arch_aspace_t* aspace, pt_entry_t* table,
             }
             // Otherwise, we need to split it
             vaddr_t page_vaddr = new_cursor->vaddr & ~(ps - 1);
-            ret = x86_mmu_split<PageTable>(aspace, page_vaddr, e);
+            ret = x86_mmu_split<PageTable>(pending, page_vaddr, e);
             if (ret != NO_ERROR) {
                 // If we failed to split the table, just unmap it.  Subsequent
                 // page faults will bring it back in.
@@ -1025,7 +1189,7 @@ static status_t x86_mmu_update_mapping(arch_aspace_t* aspace, pt_entry_t* table,
                 cursor.size = ps;
 
                 MappingCursor tmp_cursor;
-                x86_mmu_remove_mapping<PageTable>(aspace, table, cursor, &tmp_cursor);
+                x86_mmu_remove_mapping<PageTable>(aspace, table, cursor, &tmp_cursor, pending);
 
                 const size_t size = (new_cursor->size > ps) ? ps : new_cursor->size;
                 new_cursor->vaddr += size;
@@ -1036,7 +1200,7 @@ static status_t x86_mmu_update_mapping(arch_aspace_t* aspace, pt_entry_t* table,
         MappingCursor cursor;
         pt_entry_t* next_table = get_next_table_from_entry(*e);
         ret = x86_mmu_update_mapping<typename PageTable::LowerTable>(aspace, next_table, mmu_flags,
-                                                                     *new_cursor, &cursor);
+                                                                     *new_cursor, &cursor, pending);
         *new_cursor = cursor;
         if (ret != NO_ERROR) {
             // Currently this can't happen
@@ -1057,7 +1221,8 @@ err:
 template <typename PageTable>
 static status_t x86_mmu_update_mapping_l0(arch_aspace_t* aspace, pt_entry_t* table, uint mmu_flags,
                                           const MappingCursor& start_cursor,
-                                          MappingCursor* new_cursor) {
+                                          MappingCursor* new_cursor,
+                                          PendingTlbInvalidation* pending) {
     static_assert(PageTable::level == PT_L, "x86_mmu_update_mapping_l0 used with wrong level");
     LTRACEF("%016" PRIxPTR " %016zx\n", start_cursor.vaddr, start_cursor.size);
     DEBUG_ASSERT(IS_PAGE_ALIGNED(start_cursor.size));
@@ -1071,7 +1236,7 @@ static status_t x86_mmu_update_mapping_l0(arch_aspace_t* aspace, pt_entry_t* tab
         pt_entry_t* e = table + index;
         // Skip unmapped pages (we may encounter these due to demand paging)
         if (IS_PAGE_PRESENT(*e)) {
-            update_entry<PageTable>(aspace, new_cursor->vaddr, e, PageTable::paddr_from_pte(*e),
+            update_entry<PageTable>(pending, new_cursor->vaddr, e, PageTable::paddr_from_pte(*e),
                                     arch_flags);
         }
 
@@ -1085,18 +1250,20 @@ static status_t x86_mmu_update_mapping_l0(arch_aspace_t* aspace, pt_entry_t* tab
 template <>
 status_t x86_mmu_update_mapping<PageTable<PT_L>>(arch_aspace_t* aspace, pt_entry_t* table,
                                                  uint mmu_flags, const MappingCursor& start_cursor,
-                                                 MappingCursor* new_cursor) {
+                                                 MappingCursor* new_cursor,
+                                                 PendingTlbInvalidation* pending) {
     return x86_mmu_update_mapping_l0<PageTable<PT_L>>(aspace, table, mmu_flags, start_cursor,
-                                                      new_cursor);
+                                                      new_cursor, pending);
 }
 
 template <>
 status_t x86_mmu_update_mapping<ExtendedPageTable<PT_L>>(arch_aspace_t* aspace, pt_entry_t* table,
                                                          uint mmu_flags,
                                                          const MappingCursor& start_cursor,
-                                                         MappingCursor* new_cursor) {
+                                                         MappingCursor* new_cursor,
+                                                         PendingTlbInvalidation* pending) {
     return x86_mmu_update_mapping_l0<ExtendedPageTable<PT_L>>(aspace, table, mmu_flags,
-                                                              start_cursor, new_cursor);
+                                                              start_cursor, new_cursor, pending);
 }
 
 template <template <int> class PageTable>
@@ -1121,7 +1288,10 @@ static status_t mmu_unmap(arch_aspace_t* aspace, vaddr_t vaddr, const size_t cou
     };
 
     MappingCursor result;
-    x86_mmu_remove_mapping<PageTable<MAX_PAGING_LEVEL>>(aspace, aspace->pt_virt, start, &result);
+    PendingTlbInvalidation pending;
+    x86_mmu_remove_mapping<PageTable<MAX_PAGING_LEVEL>>(aspace, aspace->pt_virt, start, &result,
+                                                        &pending);
+    x86_tlb_invalidate(aspace, &pending);
     DEBUG_ASSERT(result.size == 0);
 
     if (unmapped)
@@ -1167,8 +1337,10 @@ static status_t mmu_map(arch_aspace_t* aspace, vaddr_t vaddr, paddr_t paddr, con
         .paddr = paddr, .vaddr = vaddr, .size = count * PAGE_SIZE,
     };
     MappingCursor result;
-    status_t status = x86_mmu_add_mapping<PageTable<MAX_PAGING_LEVEL>>(aspace, aspace->pt_virt,
-                                                                       mmu_flags, start, &result);
+    PendingTlbInvalidation pending;
+    status_t status = x86_mmu_add_mapping<PageTable<MAX_PAGING_LEVEL>>(
+        aspace, aspace->pt_virt, mmu_flags, start, &result, &pending);
+    x86_tlb_invalidate(aspace, &pending);
     if (status != NO_ERROR) {
         dprintf(SPEW, "Add mapping failed with err=%d\n", status);
         return status;
@@ -1215,8 +1387,10 @@ static status_t mmu_protect(arch_aspace_t* aspace, vaddr_t vaddr, size_t count,
         .paddr = 0, .vaddr = vaddr, .size = count * PAGE_SIZE,
     };
     MappingCursor result;
+    PendingTlbInvalidation pending;
     status_t status = x86_mmu_update_mapping<PageTable<MAX_PAGING_LEVEL>>(
-        aspace, aspace->pt_virt, mmu_flags, start, &result);
+        aspace, aspace->pt_virt, mmu_flags, start, &result, &pending);
+    x86_tlb_invalidate(aspace, &pending);
     if (status != NO_ERROR) {
         return status;
     }
@@ -1258,7 +1432,12 @@ void x86_mmu_early_init() {
     LTRACEF("paddr_width %u vaddr_width %u\n", g_paddr_width, g_vaddr_width);
 }
 
-void x86_mmu_init(void) {}
+void x86_mmu_init(void) {
+    pcid_enabled = x86_feature_test(X86_FEATURE_PCID) &&
+                   cmdline_get_bool("kernel.x86.pcid", true);
+    dprintf(INFO, "x86: pcid %s, invpcid %s\n", pcid_enabled ? "enabled" : "disabled",
+            x86_feature_test(X86_FEATURE_INVPCID) ? "supported" : "not supported");
+}
 
 /*
  * Fill in the high level x86 arch aspace structure and allocating a top level page table.
@@ -1303,6 +1482,11 @@ status_t arch_mmu_init_aspace(arch_aspace_t* aspace, vaddr_t base, size_t size,
     }
     aspace->io_bitmap = nullptr;
     aspace->active_cpus = 0;
+
+    /* the pcid may have been used by an aspace that's since been destroyed,
+     * so every cpu has to flush it the first time it switches in */
+    aspace->pcid = (mmu_flags & ARCH_ASPACE_FLAG_KERNEL) ? 0 : x86_pcid_alloc();
+    aspace->pcid_stale_cpus = -1;
     spin_lock_init(&aspace->io_bitmap_lock);
 
     return NO_ERROR;
@@ -1328,6 +1512,8 @@ status_t guest_mmu_init_paspace(guest_paspace_t* paspace, size_t size) {
     paspace->base = 0;
     paspace->size = size;
     paspace->active_cpus = 0;
+    paspace->pcid = 0;
+    paspace->pcid_stale_cpus = 0;
     paspace->io_bitmap = nullptr;
     spin_lock_init(&paspace->io_bitmap_lock);
 
@@ -1363,6 +1549,7 @@ status_t mmu_destroy_aspace(arch_aspace_t* aspace) {
     }
 
     pmm_free_page(paddr_to_vm_page(aspace->pt_phys));
+    x86_pcid_free(aspace->pcid);
 
     aspace->magic = 0;
 
@@ -1381,8 +1568,21 @@ void arch_mmu_context_switch(arch_aspace_t* old_aspace, arch_aspace_t* aspace) {
     mp_cpu_mask_t cpu_bit = 1U << arch_curr_cpu_num();
     if (aspace != nullptr) {
         DEBUG_ASSERT(aspace->magic == ARCH_ASPACE_MAGIC);
-        LTRACEF_LEVEL(3, "switching to aspace %p, pt %#" PRIXPTR "\n", aspace, aspace->pt_phys);
-        x86_set_cr3(aspace->pt_phys);
+        LTRACEF_LEVEL(3, "switching to aspace %p, pt %#" PRIXPTR ", pcid %u\n", aspace,
+                      aspace->pt_phys, aspace->pcid);
+
+        ulong cr3 = aspace->pt_phys;
+        if (aspace->pcid != 0) {
+            /* Become visible to shootdowns before checking for stale entries,
+             * see x86_tlb_invalidate.  Whatever this cpu cached under the
+             * pcid last time around is still good unless something was
+             * invalidated since, in which case the load flushes it. */
+            atomic_or(&aspace->active_cpus, cpu_bit);
+            cr3 |= aspace->pcid;
+            if (!(atomic_and(&aspace->pcid_stale_cpus, ~cpu_bit) & cpu_bit))
+                cr3 |= X86_CR3_NOFLUSH;
+        }
+        x86_set_cr3(cr3);
 
         if (old_aspace != nullptr) {
             atomic_and(&old_aspace->active_cpus, ~cpu_bit);
@@ -1488,6 +1688,10 @@ void x86_mmu_percpu_init(void) {
         cr4 |= X86_CR4_SMEP;
     if (x86_feature_test(X86_FEATURE_SMAP))
         cr4 |= X86_CR4_SMAP;
+    /* CR4.PCIDE needs CR3[11:0] clear, which holds since we're still on the
+     * kernel's page tables with pcid 0 here */
+    if (x86_feature_test(X86_FEATURE_PCID))
+        cr4 |= X86_CR4_PCIDE;
     x86_set_cr4(cr4);
 
     /* Set NXE bit in X86_MSR_IA32_EFER*/
@@ -19,18 +19,23 @@ __BEGIN_CDECLS;
 
 #define MUTEX_MAGIC (0x6D757478)  // 'mutx'
 
+/* The owner word holds the thread_t of the current holder, or 0 if the mutex is
+ * free. The uncontended acquire and release paths are a single compare-and-swap
+ * on it. The low bit is set while threads are queued in the wait queue, which
+ * forces the holder through the slow release path to hand the mutex off.
+ */
+#define MUTEX_FLAG_QUEUED ((uintptr_t)1)
+
 typedef struct TA_CAP("mutex") mutex {
     uint32_t magic;
-    thread_t *holder;
-    int count;
+    uintptr_t val;
     wait_queue_t wait;
 } mutex_t;
 
 #define MUTEX_INITIAL_VALUE(m) \
 { \
     .magic = MUTEX_MAGIC, \
-    .holder = NULL, \
-    .count = 0, \
+    .val = 0, \
     .wait = WAIT_QUEUE_INITIAL_VALUE((m).wait), \
 }
 
@@ -43,13 +48,19 @@ void mutex_destroy(mutex_t *m);
 void mutex_acquire(mutex_t *m) TA_ACQ(m);
 void mutex_release(mutex_t *m) TA_REL(m);
 
-/* special version of the above with the thread lock held */
-void mutex_release_thread_locked(mutex_t *m, bool resched) TA_REL(m);
+/* special version of the above for callers holding a spinlock; never reschedules */
+void mutex_release_no_resched(mutex_t *m) TA_REL(m);
+
+/* the thread currently holding the mutex, if any */
+static inline thread_t *mutex_holder(const mutex_t *m)
+{
+    return (thread_t *)(__atomic_load_n(&m->val, __ATOMIC_RELAXED) & ~MUTEX_FLAG_QUEUED);
+}
 
 /* does the current thread hold the mutex? */
 static inline bool is_mutex_held(const mutex_t *m)
 {
-    return m->holder == get_current_thread();
+    return mutex_holder(m) == get_current_thread();
 }
 
 __END_CDECLS;
@@ -20,4 +20,11 @@ void sched_unblock(thread_t *t, bool resched);
 void sched_unblock_list(struct list_node *list, bool resched);
 
 void sched_yield(void);
+void sched_reschedule(void);
+
+/* change a thread's effective priority, requeueing it if it's ready */
+void sched_set_priority(thread_t *t, int priority);
 void sched_preempt(void);
+
+/* move all unpinned threads queued on old_cpu to other cpus */
+void sched_transition_off_cpu(uint old_cpu);
@@ -74,14 +74,16 @@ typedef struct thread {
 
     /* active bits */
     struct list_node queue_node;
-    int priority;
+    int priority; /* effective priority, including any inherited from waiters */
+    int base_priority;
     enum thread_state state;
     lk_time_t last_started_running;
     lk_time_t remaining_time_slice;
+    lk_time_t timer_slack; /* how late the timers of our sleeps and timed waits may fire */
     unsigned int flags;
     unsigned int signals;
 #if WITH_SMP
-    uint last_cpu; /* last/current cpu the thread is running on */
+    uint last_cpu; /* last/current cpu the thread is running on, or queued on if ready */
     int pinned_cpu; /* only run on pinned_cpu if >= 0 */
 #endif
 
@@ -104,12 +106,19 @@ typedef struct thread {
     /* if blocked, a pointer to the wait queue */
     struct wait_queue *blocking_wait_queue;
 
+    /* wait queues whose waiters are lending us their priority */
+    struct list_node owned_wait_queues;
+
     /* return code if woken up abnormally from suspend, sleep, or block */
     status_t blocked_status;
 
     /* are we allowed to be interrupted on the current thing we're blocked/sleeping on */
     bool interruptable;
 
+    /* about to block on whoever we wake next, which should take our place on this cpu.
+     * only touched by the thread itself */
+    bool handoff;
+
     /* non-NULL if stopped in an exception */
     const struct arch_exception_context *exception_context;
 
@@ -244,6 +253,7 @@ void dump_all_threads(bool full);
 /* scheduler routines */
 void thread_yield(void);             /* give up the cpu and time slice voluntarily */
 void thread_preempt(bool interrupt); /* get preempted (return to head of queue and reschedule) */
+void thread_reschedule(void);        /* let threads readied by a wait queue wakeup run, if they should */
 void thread_resched(void);
 
 static inline bool thread_is_realtime(thread_t *t)
@@ -269,6 +279,14 @@ enum handler_return thread_timer_tick(void);
 thread_t *get_current_thread(void);
 void set_current_thread(thread_t *);
 
+/* mark the current thread as about to block until the next thread it wakes up gets back to
+ * it, so that thread is readied on this cpu to run in its place rather than sent to another
+ * one. the next wakeup clears it, as should the caller once it's done waking */
+static inline void thread_set_handoff(bool handoff)
+{
+    get_current_thread()->handoff = handoff;
+}
+
 /* the idle thread(s) (statically allocated) */
 extern thread_t idle_threads[SMP_MAX_CPUS];
 
@@ -300,10 +318,20 @@ struct thread_stats {
     ulong exceptions; /* exceptions such as page fault or undefined opcode */
     ulong syscalls;
 
+    /* contended mutex acquires, by whether spinning paid off or the thread had to block */
+    ulong mutex_spins;
+    ulong mutex_blocks;
+
 #if WITH_SMP
     /* inter-processor interrupts */
     ulong reschedule_ipis;
     ulong generic_ipis;
+
+    /* threads pulled from another cpu's run queue */
+    ulong steals;
+
+    /* wakeups kept on the waking cpu by thread_set_handoff() */
+    ulong handoffs;
 #endif
 };
 
@@ -24,14 +24,20 @@ typedef enum handler_return (*timer_callback)(struct timer *, lk_time_t now, voi
 
 typedef struct timer {
     int magic;
-    struct list_node node;
+
+    /* links in the per cpu pairing heap of pending timers */
+    struct timer *heap_child;
+    struct timer *heap_next;
+    struct timer *heap_prev; /* previous sibling, or parent if the first child */
 
     lk_time_t scheduled_time;
+    lk_time_t slack; /* the timer may fire up to this long after scheduled_time */
     lk_time_t period;
 
     timer_callback callback;
     void *arg;
 
+    volatile int queue_cpu;  // cpu whose queue the timer is pending in, <0 if none
     volatile int active_cpu; // <0 if inactive
     volatile bool cancel;    // true if cancel is pending
 } timer_t;
@@ -39,11 +45,15 @@ typedef struct timer {
 #define TIMER_INITIAL_VALUE(t) \
 { \
     .magic = TIMER_MAGIC, \
-    .node = LIST_INITIAL_CLEARED_VALUE, \
+    .heap_child = NULL, \
+    .heap_next = NULL, \
+    .heap_prev = NULL, \
     .scheduled_time = 0, \
+    .slack = 0, \
     .period = 0, \
     .callback = NULL, \
     .arg = NULL, \
+    .queue_cpu = -1, \
     .active_cpu = -1, \
     .cancel = false, \
 }
@@ -57,6 +67,7 @@ typedef struct timer {
 */
 void timer_initialize(timer_t *);
 void timer_set_oneshot(timer_t *, lk_time_t deadline, timer_callback, void *arg);
+void timer_set_oneshot_etc(timer_t *, lk_time_t deadline, lk_time_t slack, timer_callback, void *arg);
 void timer_set_periodic(timer_t *, lk_time_t period, timer_callback, void *arg);
 void timer_cancel(timer_t *);
 
@@ -38,6 +38,11 @@ __BEGIN_CDECLS
 #define ROUNDUP_PAGE_SIZE(x) ROUNDUP((x), PAGE_SIZE)
 #define IS_PAGE_ALIGNED(x) IS_ALIGNED((x), PAGE_SIZE)
 
+// size of the smallest block the mmu can map with a single entry one level
+// above the last level page tables (2MB with 4K pages)
+#define VM_LARGE_PAGE_SIZE_SHIFT (PAGE_SIZE_SHIFT + (PAGE_SIZE_SHIFT - 3))
+#define VM_LARGE_PAGE_SIZE (1UL << VM_LARGE_PAGE_SIZE_SHIFT)
+
 struct mmu_initial_mapping {
     paddr_t phys;
     vaddr_t virt;
@@ -112,6 +117,7 @@ status_t pmm_add_arena(const pmm_arena_info_t* arena) __NONNULL((1));
 /* flags for allocation routines below */
 #define PMM_ALLOC_FLAG_ANY (0x0)  /* no restrictions on which arena to allocate from */
 #define PMM_ALLOC_FLAG_KMAP (0x1) /* allocate only from arenas marked KMAP */
+#define PMM_ALLOC_FLAG_ZEROED (0x2) /* return zero filled pages, preferring ones zeroed in the background */
 
 /* Allocate count pages of physical memory, adding to the tail of the passed list.
  * The list must be initialized.
@@ -42,6 +42,9 @@ typedef struct vm_page {
     };
 } vm_page_t;
 
+// page flags
+#define VM_PAGE_FLAG_ZEROED (0x1) // free page that is known to be filled with zeros
+
 // pmm will maintain pages of this size
 #define VM_PAGE_STRUCT_SIZE (sizeof(vm_page_t))
 static_assert(sizeof(vm_page_t) == 32, "");
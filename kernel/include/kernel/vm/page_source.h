@@ -0,0 +1,103 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <err.h>
+#include <kernel/event.h>
+#include <kernel/mutex.h>
+#include <magenta/thread_annotations.h>
+#include <mxtl/atomic.h>
+#include <mxtl/canary.h>
+#include <mxtl/intrusive_double_list.h>
+#include <mxtl/macros.h>
+#include <mxtl/ref_counted.h>
+#include <mxtl/ref_ptr.h>
+#include <stdint.h>
+
+class VmObjectPaged;
+
+// Supplies the contents of a VmObjectPaged's pages on demand. When something
+// needs a page the object doesn't have, the object records a PageRequest for
+// it and whoever needs the page waits on the request until it has been
+// supplied or failed.
+class PageSource : public mxtl::RefCounted<PageSource> {
+public:
+    virtual ~PageSource() = default;
+
+    // Asks for the pages in [offset, offset + len) of the object. Called by the
+    // first waiter on a request, with no vm locks held, so it may block.
+    virtual status_t RequestPages(uint64_t offset, uint64_t len) = 0;
+
+    // Called by the object when it's created with and destroyed ahead of us.
+    // Once detached, FailRequests() has nothing left to fail.
+    void Attach(VmObjectPaged* object);
+    void Detach();
+
+protected:
+    PageSource() = default;
+
+    // Fails every outstanding request of the object with |status|, for when
+    // whoever supplies the pages has gone away.
+    void FailRequests(status_t status);
+
+    // Called once the object is attached and once it is gone.
+    virtual void OnAttach() {}
+    virtual void OnDetach() {}
+
+private:
+    Mutex lock_;
+    VmObjectPaged* object_ TA_GUARDED(lock_) = nullptr;
+};
+
+// A range of pages that has been asked of a PageSource and not supplied yet.
+class PageRequest final : public mxtl::RefCounted<PageRequest>,
+                          public mxtl::DoublyLinkedListable<mxtl::RefPtr<PageRequest>> {
+public:
+    PageRequest(mxtl::RefPtr<PageSource> source, uint64_t offset, uint64_t len);
+    ~PageRequest();
+
+    DISALLOW_COPY_ASSIGN_AND_MOVE(PageRequest);
+
+    uint64_t offset() const { return offset_; }
+    uint64_t len() const { return len_; }
+    bool Overlaps(uint64_t offset, uint64_t len) const {
+        return offset < offset_ + len_ && offset_ < offset + len;
+    }
+
+    // Passes the request on to the page source, unless that's already been
+    // done or the request has completed. Fails the request if the source
+    // can't take it. The caller must not hold any vm locks.
+    void Send();
+
+    // Sends the request and blocks until it completes, after which the caller
+    // should look for the page again. The caller must not hold any vm locks.
+    // Returns the status the request was completed with, or ERR_INTERRUPTED
+    // if the thread is being killed.
+    status_t Wait();
+
+    // Wakes up everyone waiting on the request, now and in the future, and
+    // has them return |status|. Called when any of the pages are supplied or
+    // failed, or the object goes away. Only the first call has any effect.
+    void Complete(status_t status = NO_ERROR);
+
+    // true once completed with an error, after which asking again is the
+    // only way to get the pages
+    bool failed() const { return status_.load() < 0; }
+
+private:
+    // status_ until the request completes
+    static constexpr status_t kPending = 1;
+
+    mxtl::Canary<mxtl::magic("PREQ")> canary_;
+
+    const mxtl::RefPtr<PageSource> source_;
+    const uint64_t offset_;
+    const uint64_t len_;
+    mxtl::atomic<int> sent_;
+    mxtl::atomic<status_t> status_;
+    event_t event_;
+};
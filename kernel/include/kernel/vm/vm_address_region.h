@@ -41,6 +41,10 @@
 // with execute permissions.  When on a VmMapping, controls whether or not the
 // mapping can gain this permission.
 #define VMAR_FLAG_CAN_MAP_EXECUTE (1 << 6)
+// When on a VmMapping, a read fault also maps the neighbouring pages that are
+// already present in the vm object, so that sequential access takes fewer
+// faults.
+#define VMAR_FLAG_FAULT_AROUND (1 << 7)
 
 #define VMAR_CAN_RWX_FLAGS (VMAR_FLAG_CAN_MAP_READ |  \
                             VMAR_FLAG_CAN_MAP_WRITE | \
@@ -114,8 +118,11 @@ public:
     mxtl::RefPtr<VmMapping> as_vm_mapping();
 
     // Page fault in an address within the region.  Recursively traverses
-    // the regions to find the target mapping, if it exists.
-    virtual status_t PageFault(vaddr_t va, uint pf_flags) = 0;
+    // the regions to find the target mapping, if it exists.  If the page has
+    // to come from a page source first, returns ERR_SHOULD_WAIT and sets
+    // |*page_request| to what to wait on before faulting again.
+    virtual status_t PageFault(vaddr_t va, uint pf_flags,
+                               mxtl::RefPtr<PageRequest>* page_request) = 0;
 
     // WAVL tree key function
     vaddr_t GetKey() const { return base(); }
@@ -236,7 +243,8 @@ public:
     bool is_mapping() const override { return false; }
 
     void Dump(uint depth, bool verbose) const override;
-    status_t PageFault(vaddr_t va, uint pf_flags) override;
+    status_t PageFault(vaddr_t va, uint pf_flags,
+                       mxtl::RefPtr<PageRequest>* page_request) override;
 
 protected:
     // constructor for use in creating a VmAddressRegionDummy
@@ -367,7 +375,8 @@ public:
         return;
     }
 
-    status_t PageFault(vaddr_t va, uint pf_flags) override {
+    status_t PageFault(vaddr_t va, uint pf_flags,
+                       mxtl::RefPtr<PageRequest>* page_request) override {
         // We should never be trying to page fault on this...
         ASSERT(false);
         return ERR_BAD_STATE;
@@ -409,10 +418,18 @@ public:
     uint64_t object_offset() const { return object_offset_; }
     mxtl::RefPtr<VmObject> vmo() const { return object_; };
 
+    // The number of pages of the mapped range of the vm object that it has
+    // committed itself. Kept up to date by the object as pages come and go.
+    size_t committed_pages() const;
+
     // Convenience wrapper for vmo()->DecommitRange() with the necessary
     // offset modification and locking.
     status_t DecommitRange(size_t offset, size_t len, size_t* decommitted);
 
+    // Swaps the object's pages mapped at [va, va + len) with the ones on
+    // |pages|, if that whole range is still mapped with user write access.
+    status_t ExchangeUserPages(vaddr_t va, size_t len, list_node* pages);
+
     // Map in pages from the underlying vm object, optionally committing pages as it goes
     status_t MapRange(size_t offset, size_t len, bool commit);
 
@@ -431,7 +448,8 @@ public:
     bool is_mapping() const override { return true; }
 
     void Dump(uint depth, bool verbose) const override;
-    status_t PageFault(vaddr_t va, uint pf_flags) override;
+    status_t PageFault(vaddr_t va, uint pf_flags,
+                       mxtl::RefPtr<PageRequest>* page_request) override;
 
 protected:
     ~VmMapping() override;
@@ -467,9 +485,27 @@ private:
     // Implementation for Protect().  This does not acquire the aspace lock.
     status_t ProtectLocked(vaddr_t base, size_t size, uint new_arch_mmu_flags);
 
+    // If |va| (backed by |pa|) falls in a large page aligned run of pages the
+    // vm object has committed contiguously, map the whole run with one call so
+    // the arch layer can use a large page.  Returns false if it didn't.
+    bool MapLargePageLocked(vaddr_t va, paddr_t pa) TA_REQ(object_->lock());
+
+    // Map the pages already present in the vm object around |va| with
+    // |mmu_flags|, skipping anything that is already mapped.  Called from
+    // PageFault() on mappings with VMAR_FLAG_FAULT_AROUND set.
+    void FaultAroundLocked(vaddr_t va, uint mmu_flags) TA_REQ(object_->lock());
+
     // Version of AllocatedPages() that does not acquire the aspace lock
     size_t AllocatedPagesLocked() const override;
 
+    // Set committed_pages_, keeping the address space's total in step.  Must
+    // be called with object_'s lock held, which clang can't tell is the one
+    // VmObject holds when it calls these.
+    void SetCommittedPagesLocked(size_t count);
+
+    // Count the committed pages of the mapped range afresh, after it changed.
+    void RecountCommittedPagesLocked();
+
     void Activate() override;
 
     // Version of Activate that does not take the object_ lock.
@@ -486,4 +522,7 @@ private:
 
     // used to detect recursions through the vmo fault path
     bool currently_faulting_ = false;
+
+    // pages of the mapped range the object has committed, guarded by object_'s lock
+    size_t committed_pages_ = 0;
 };
@@ -12,6 +12,7 @@
 #include <kernel/vm.h>
 #include <kernel/vm/vm_address_region.h>
 #include <lib/crypto/prng.h>
+#include <mxtl/atomic.h>
 #include <mxtl/canary.h>
 #include <mxtl/intrusive_double_list.h>
 #include <mxtl/intrusive_wavl_tree.h>
@@ -80,11 +81,25 @@ public:
         // VmMapping covers a range of a VmObject that contains that page, and
         // that page has physical memory allocated to it.
         size_t committed_pages;
+
+        // The committed pages split by whether the VmObject behind the
+        // VmMapping is mapped only once (private) or several times (shared),
+        // and the shared ones divided among the mappings that share them.
+        size_t private_pages;
+        size_t shared_pages;
+        size_t scaled_shared_bytes;
+
+        // A count of pages the zero page scanner has given back from the
+        // VmObjects that VmMappings cover, because they were entirely zero.
+        // Each VmObject is counted once, however many times it is mapped.
+        size_t zero_reclaimed_pages;
     };
 
     // Counts memory usage under the VmAspace.
     status_t GetMemoryUsage(vm_usage_t* usage);
 
+    // The pages committed under every mapping in the address space, kept up to
+    // date by the mappings so that it doesn't need the aspace lock.
     size_t AllocatedPages() const;
 
     // Convenience method for traversing the tree of VMARs to find the deepest
@@ -162,6 +177,9 @@ private:
     // Access to this reference is guarded by lock_.
     mxtl::RefPtr<VmAddressRegion> root_vmar_;
 
+    // sum of the committed_pages_ of every mapping, updated by VmMapping
+    mxtl::atomic<size_t> committed_pages_;
+
     // PRNG used by VMARs for address choices.  We record the seed to enable
     // reproducible debugging.
     crypto::PRNG aslr_prng_;
@@ -183,6 +201,11 @@ private:
 
 void DumpAllAspaces(bool verbose);
 
+// Runs |ve| over the |index|th user address space, holding the list of address
+// spaces locked so that it can't go away in the meantime. Returns false if
+// there are not that many user address spaces.
+bool EnumerateUserAspace(size_t index, VmEnumerator* ve);
+
 // hack to convert from vmm_aspace_t to VmAspace
 static VmAspace* vmm_aspace_to_obj(vmm_aspace_t* aspace) {
     return reinterpret_cast<VmAspace*>(aspace);
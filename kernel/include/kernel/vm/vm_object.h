@@ -9,6 +9,7 @@
 #include <assert.h>
 #include <kernel/mutex.h>
 #include <kernel/vm.h>
+#include <kernel/vm/page_source.h>
 #include <kernel/vm/vm_page_list.h>
 #include <lib/user_copy/user_ptr.h>
 #include <list.h>
@@ -44,6 +45,10 @@ public:
     virtual size_t AllocatedPagesInRange(uint64_t offset, uint64_t len) const {
         return 0;
     }
+    virtual size_t AllocatedPagesInRangeLocked(uint64_t offset, uint64_t len) const
+        TA_REQ(lock_) {
+        return 0;
+    }
     // Returns the number of physical pages currently allocated to the object.
     size_t AllocatedPages() const {
         return AllocatedPagesInRange(0, size());
@@ -65,6 +70,43 @@ public:
         return ERR_NOT_SUPPORTED;
     }
 
+    // look at up to |max_pages| pages committed in [*offset, end) and give back the ones
+    // that are entirely zero, so that they read as the shared zero page again. advances
+    // |*offset| past what was looked at and returns the number of pages given back
+    virtual size_t ReclaimZeroPages(uint64_t* offset, uint64_t end, size_t max_pages) {
+        *offset = end;
+        return 0;
+    }
+
+    // the number of pages ReclaimZeroPages has given back over the life of the object
+    virtual size_t ZeroPagesReclaimed() const { return 0; }
+
+    // move the committed pages in [src_offset, src_offset + len) of |src| into the range
+    // starting at |offset|, for objects whose pages come from a PageSource
+    virtual status_t SupplyPages(uint64_t offset, uint64_t len, VmObject* src,
+                                 uint64_t src_offset) {
+        return ERR_NOT_SUPPORTED;
+    }
+
+    // complete the outstanding page requests overlapping [offset, offset + len) with the
+    // error |status|, for objects whose pages come from a PageSource
+    virtual status_t FailPages(uint64_t offset, uint64_t len, status_t status) {
+        return ERR_NOT_SUPPORTED;
+    }
+
+    // take every page in [offset, offset + len) out of the object, in order, onto |pages|.
+    // fails without taking any if not all of them are committed in the object itself
+    virtual status_t TakePages(uint64_t offset, uint64_t len, list_node* pages) {
+        return ERR_NOT_SUPPORTED;
+    }
+
+    // swap every page in [offset, offset + len) of the object, in order, with the ones on
+    // |pages|, which then holds the object's old pages. fails without swapping any if not
+    // all of them are committed in the object itself
+    virtual status_t ExchangePages(uint64_t offset, uint64_t len, list_node* pages) {
+        return ERR_NOT_SUPPORTED;
+    }
+
     // read/write operators against kernel pointers only
     virtual status_t Read(void* ptr, uint64_t offset, size_t len, size_t* bytes_read) {
         return ERR_NOT_SUPPORTED;
@@ -123,12 +165,36 @@ public:
         return ERR_NOT_SUPPORTED;
     }
 
+    // if every page in the page-aligned range is committed in this object
+    // itself (not a parent) and they are physically contiguous, return the
+    // physical address of the first one. never faults pages in.
+    virtual status_t GetPageRunLocked(uint64_t offset, uint64_t len, paddr_t* pa) TA_REQ(lock_) {
+        return ERR_NOT_SUPPORTED;
+    }
+
+    // after GetPageLocked() returned ERR_SHOULD_WAIT for |offset|, the request to wait on
+    // (without holding any locks) before trying again. null if there's nothing to wait for
+    virtual mxtl::RefPtr<PageRequest> GetPageRequestLocked(uint64_t offset) TA_REQ(lock_) {
+        return nullptr;
+    }
+
+    // called when the dispatcher that handed the object out to user space is
+    // destroyed, after which only its mappings and clones can reach it
+    virtual void OnDispatcherClosed() {}
+
     Mutex* lock() TA_RET_CAP(lock_) { return &lock_; }
     Mutex& lock_ref() TA_RET_CAP(lock_) { return lock_; }
 
     void AddMappingLocked(VmMapping* r) TA_REQ(lock_);
     void RemoveMappingLocked(VmMapping* r) TA_REQ(lock_);
 
+    // the number of mappings of the object, which share its committed pages
+    uint32_t share_count() const;
+
+    // whether |map| is the one mapping of the object picked to stand for all of
+    // its mappings in |map|'s address space, for counting the object only once
+    bool IsFirstMappingInAspace(const VmMapping* map) const;
+
     void AddChildLocked(VmObject* r) TA_REQ(lock_);
     void RemoveChildLocked(VmObject* r) TA_REQ(lock_);
 
@@ -147,11 +213,22 @@ protected:
     // inform all mappings and children that a range of this vmo's pages were added or removed.
     void RangeChangeUpdateLocked(uint64_t offset, uint64_t len) TA_REQ(lock_);
 
+    // keep the committed page counts of the mappings covering |offset| in step with
+    // |delta| pages having been added to (or taken from) the object itself there
+    void UpdateMappingPagesLocked(uint64_t offset, ssize_t delta) TA_REQ(lock_);
+
+    // count the committed pages of the mappings overlapping the range afresh, after
+    // pages were freed from it wholesale
+    void RecountMappingPagesLocked(uint64_t offset, uint64_t len) TA_REQ(lock_);
+
     // above call but called from a parent
     virtual void RangeChangeUpdateFromParentLocked(uint64_t offset, uint64_t len)
         // Called under the parent's lock, which confuses analysis.
         TA_NO_THREAD_SAFETY_ANALYSIS { RangeChangeUpdateLocked(offset, len); }
 
+    // called after a mapping or child of the object has been removed
+    virtual void OnReferenceRemovedLocked() TA_REQ(lock_) {}
+
     // magic value
     mxtl::Canary<mxtl::magic("VMO_")> canary_;
 
@@ -167,6 +244,7 @@ protected:
 
     // list of every mapping
     mxtl::DoublyLinkedList<VmMapping*> mapping_list_ TA_GUARDED(lock_);
+    uint32_t mapping_list_len_ TA_GUARDED(lock_) = 0;
 
     // list of every child
     mxtl::DoublyLinkedList<VmObject*> children_list_ TA_GUARDED(lock_);
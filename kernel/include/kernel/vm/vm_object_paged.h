@@ -29,6 +29,10 @@ public:
 
     static mxtl::RefPtr<VmObject> CreateFromROData(const void* data, size_t size);
 
+    // an object whose pages are asked of |src| rather than zero filled
+    static mxtl::RefPtr<VmObject> CreateWithSource(uint32_t pmm_alloc_flags, uint64_t size,
+                                                   mxtl::RefPtr<PageSource> src);
+
     status_t Resize(uint64_t size) override;
     status_t ResizeLocked(uint64_t size) override TA_REQ(lock_);
     uint64_t size() const override
@@ -37,12 +41,25 @@ public:
         TA_NO_THREAD_SAFETY_ANALYSIS { return size_; }
 
     size_t AllocatedPagesInRange(uint64_t offset, uint64_t len) const override;
+    size_t AllocatedPagesInRangeLocked(uint64_t offset, uint64_t len) const override
+        TA_REQ(lock_);
 
     status_t CommitRange(uint64_t offset, uint64_t len, uint64_t* committed) override;
     status_t CommitRangeContiguous(uint64_t offset, uint64_t len, uint64_t* committed,
                                    uint8_t alignment_log2) override;
     status_t DecommitRange(uint64_t offset, uint64_t len, uint64_t* decommitted) override;
 
+    size_t ReclaimZeroPages(uint64_t* offset, uint64_t end, size_t max_pages) override;
+    size_t ZeroPagesReclaimed() const override
+        // Only a statistic, a stale value is fine.
+        TA_NO_THREAD_SAFETY_ANALYSIS { return zero_pages_reclaimed_; }
+
+    status_t SupplyPages(uint64_t offset, uint64_t len, VmObject* src,
+                         uint64_t src_offset) override;
+    status_t FailPages(uint64_t offset, uint64_t len, status_t status) override;
+    status_t TakePages(uint64_t offset, uint64_t len, list_node* pages) override;
+    status_t ExchangePages(uint64_t offset, uint64_t len, list_node* pages) override;
+
     status_t Read(void* ptr, uint64_t offset, size_t len, size_t* bytes_read) override;
     status_t Write(const void* ptr, uint64_t offset, size_t len, size_t* bytes_written) override;
     status_t Lookup(uint64_t offset, uint64_t len, uint pf_flags,
@@ -63,9 +80,16 @@ public:
     status_t CleanInvalidateCache(const uint64_t offset, const uint64_t len) override;
     status_t SyncCache(const uint64_t offset, const uint64_t len) override;
 
+    status_t GetPageRunLocked(uint64_t offset, uint64_t len, paddr_t* pa) override TA_REQ(lock_);
     status_t GetPageLocked(uint64_t offset, uint pf_flags, vm_page_t**, paddr_t*) override
         // Calls a Locked method of the parent, which confuses analysis.
         TA_NO_THREAD_SAFETY_ANALYSIS;
+    mxtl::RefPtr<PageRequest> GetPageRequestLocked(uint64_t offset) override
+        // Calls a Locked method of the parent, which confuses analysis.
+        TA_NO_THREAD_SAFETY_ANALYSIS;
+
+    // called by the page source once whoever supplies the pages is gone
+    void FailPageRequests(uint64_t offset, uint64_t len, status_t status);
 
     status_t CloneCOW(uint64_t offset, uint64_t size,
                       mxtl::RefPtr<VmObject>* clone_vmo) override
@@ -76,6 +100,8 @@ public:
         // Called under the parent's lock, which confuses analysis.
         TA_NO_THREAD_SAFETY_ANALYSIS;
 
+    void OnDispatcherClosed() override;
+
 private:
     // private constructor (use Create())
     explicit VmObjectPaged(uint32_t pmm_alloc_flags, mxtl::RefPtr<VmObject> parent);
@@ -97,6 +123,10 @@ private:
     status_t AddPage(vm_page_t* p, uint64_t offset);
     status_t AddPageLocked(vm_page_t* p, uint64_t offset) TA_REQ(lock_);
 
+    // true if |offset| starts a large page aligned chunk that fits below |end|
+    // and has no pages committed in it
+    bool IsLargeChunkUncommittedLocked(uint64_t offset, uint64_t end) TA_REQ(lock_);
+
     // internal page list routine
     void AddPageToArray(size_t index, vm_page_t* p);
 
@@ -108,6 +138,42 @@ private:
     // set our offset within our parent
     status_t SetParentOffsetLocked(uint64_t o) TA_REQ(lock_);
 
+    // Once user space has no handles left to us and nothing maps us, our only
+    // child is the one thing that can still see our pages. Clone chains are
+    // cut short by folding such an object into its child, and the child takes
+    // pages it is about to write to rather than copying them.
+    bool OnlyReachableFromChildLocked() const TA_REQ(lock_);
+    void OnReferenceRemovedLocked() override TA_REQ(lock_);
+    void CollapseIntoChildLocked() TA_REQ(lock_);
+
+    // hand our own page |p| at |offset| over to |child| at |child_offset|
+    // instead of letting it make a copy, if the child is all that can see it
+    bool GivePageToChildLocked(uint64_t offset, vm_page_t* p, VmObjectPaged* child,
+                               uint64_t child_offset) TA_REQ(lock_);
+
+    // record a request to the page source, ours or the nearest parent's, for the
+    // missing page at |offset| and the missing ones after it, unless there's one
+    // already. the request is only sent to the source by whoever waits on it, once
+    // the lock is dropped. returns ERR_SHOULD_WAIT once recorded and ERR_NOT_FOUND
+    // if there's no source
+    status_t RequestPageLocked(uint64_t offset)
+        // Calls a Locked method of the parent, which confuses analysis.
+        TA_NO_THREAD_SAFETY_ANALYSIS;
+
+    // whether the contents of missing pages come from a page source, ours or a parent's
+    bool HasPageSourceLocked() const
+        // Calls a Locked method of the parent, which confuses analysis.
+        TA_NO_THREAD_SAFETY_ANALYSIS;
+
+    // after GetPageLocked() returned ERR_SHOULD_WAIT for |offset|, drop the lock, wait
+    // for the page request and take the lock again. returns what the request completed
+    // with, after which the caller has to look for the page again
+    status_t WaitForPageLocked(uint64_t offset) TA_REQ(lock_);
+
+    // complete and forget the outstanding page requests overlapping the range
+    void CompleteRequestsLocked(uint64_t offset, uint64_t len, status_t status = NO_ERROR)
+        TA_REQ(lock_);
+
     // maximum size of a VMO is one page less than the full 64bit range
     static const uint64_t MAX_SIZE = ROUNDDOWN(UINT64_MAX, PAGE_SIZE);
 
@@ -115,7 +181,19 @@ private:
     uint64_t size_ TA_GUARDED(lock_) = 0;
     uint64_t parent_offset_ TA_GUARDED(lock_) = 0;
     uint32_t pmm_alloc_flags_ TA_GUARDED(lock_) = PMM_ALLOC_FLAG_ANY;
+    bool dispatcher_closed_ TA_GUARDED(lock_) = false;
+
+    // set once the physical addresses of our pages have been handed out, after
+    // which the pages have to stay where they are
+    bool phys_exposed_ TA_GUARDED(lock_) = false;
+    size_t zero_pages_reclaimed_ TA_GUARDED(lock_) = 0;
 
     // a tree of pages
     VmPageList page_list_ TA_GUARDED(lock_);
+
+    // where missing pages come from, if not zero filled. set at creation
+    mxtl::RefPtr<PageSource> page_source_;
+
+    // ranges asked of the page source that haven't been supplied yet
+    mxtl::DoublyLinkedList<mxtl::RefPtr<PageRequest>> page_requests_ TA_GUARDED(lock_);
 };
@@ -20,7 +20,7 @@ public:
 
     DISALLOW_COPY_ASSIGN_AND_MOVE(VmPageListNode);
 
-    static const size_t kPageFanOut = 16;
+    static const size_t kPageFanOut = 64;
 
     // accessors
     uint64_t offset() const { return obj_offset_; }
@@ -46,6 +46,30 @@ public:
         }
     }
 
+    // for every valid page in the node that falls within [start_offset, end_offset)
+    // call the passed in function
+    template <typename T>
+    void ForEveryPageInRange(T func, uint64_t start_offset, uint64_t end_offset) {
+        size_t start, end;
+        ClipRange(start_offset, end_offset, &start, &end);
+        for (size_t i = start; i < end; i++) {
+            if (pages_[i]) {
+                func(pages_[i], obj_offset_ + i * PAGE_SIZE);
+            }
+        }
+    }
+
+    template <typename T>
+    void ForEveryPageInRange(T func, uint64_t start_offset, uint64_t end_offset) const {
+        size_t start, end;
+        ClipRange(start_offset, end_offset, &start, &end);
+        for (size_t i = start; i < end; i++) {
+            if (pages_[i]) {
+                func(pages_[i], obj_offset_ + i * PAGE_SIZE);
+            }
+        }
+    }
+
     vm_page* GetPage(size_t index);
     vm_page* RemovePage(size_t index);
     status_t AddPage(vm_page* p, size_t index);
@@ -59,6 +83,14 @@ public:
     }
 
 private:
+    // compute the range of page indices in this node that overlap [start_offset, end_offset)
+    void ClipRange(uint64_t start_offset, uint64_t end_offset, size_t* start, size_t* end) const {
+        uint64_t node_end = obj_offset_ + kPageFanOut * PAGE_SIZE;
+        *start = (start_offset > obj_offset_) ? (start_offset - obj_offset_) / PAGE_SIZE : 0;
+        *end = (end_offset < node_end) ? (end_offset - obj_offset_ + PAGE_SIZE - 1) / PAGE_SIZE
+                                       : kPageFanOut;
+    }
+
     mxtl::Canary<mxtl::magic("PLST")> canary_;
 
     uint64_t obj_offset_ = 0;
@@ -88,11 +120,59 @@ public:
         }
     }
 
+    // walk the tree nodes overlapping [start_offset, end_offset) in order, calling the
+    // passed in function on every page in the range
+    template <typename T>
+    void ForEveryPageInRange(T per_page_func, uint64_t start_offset, uint64_t end_offset) {
+        for (auto pl = list_.lower_bound(NodeOffset(start_offset));
+             pl.IsValid() && pl->offset() < end_offset; ++pl) {
+            pl->ForEveryPageInRange(per_page_func, start_offset, end_offset);
+        }
+    }
+
+    template <typename T>
+    void ForEveryPageInRange(T per_page_func, uint64_t start_offset, uint64_t end_offset) const {
+        for (auto pl = list_.lower_bound(NodeOffset(start_offset));
+             pl.IsValid() && pl->offset() < end_offset; ++pl) {
+            pl->ForEveryPageInRange(per_page_func, start_offset, end_offset);
+        }
+    }
+
+    // Single page operations. The list remembers which tree node the last one
+    // ended up at and steps forward from there, so walking a range of offsets in
+    // increasing order costs a tree descent per node rather than one per page.
     status_t AddPage(vm_page*, uint64_t offset);
     vm_page* GetPage(uint64_t offset);
+    vm_page* RemovePage(uint64_t offset);
     status_t FreePage(uint64_t offset);
+
+    // range operations, walking the tree nodes in order
+    bool AnyPagesInRange(uint64_t start_offset, uint64_t end_offset) const;
+    // offset of the first page in [start_offset, end_offset), or end_offset if there is none
+    uint64_t NextPageOffset(uint64_t start_offset, uint64_t end_offset) const;
+    size_t FreePagesInRange(uint64_t start_offset, uint64_t end_offset);
     size_t FreeAllPages();
 
+    // the number of pages in the list, kept as pages are added and removed.
+    // pages nulled out through the ForEveryPage* functions stay counted until
+    // the next FreeAllPages()
+    size_t count() const { return count_; }
+
 private:
-    mxtl::WAVLTree<uint64_t, mxtl::unique_ptr<VmPageListNode>> list_;
+    using NodeTree = mxtl::WAVLTree<uint64_t, mxtl::unique_ptr<VmPageListNode>>;
+
+    static uint64_t NodeOffset(uint64_t offset) {
+        return offset - offset % (PAGE_SIZE * VmPageListNode::kPageFanOut);
+    }
+
+    VmPageListNode* FindNode(uint64_t node_offset);
+
+    NodeTree list_;
+    size_t count_ = 0;
+
+    // the first node at or after hint_offset_, or end() if there is none,
+    // valid only while hint_valid_ is set
+    NodeTree::iterator hint_;
+    uint64_t hint_offset_ = 0;
+    bool hint_valid_ = false;
 };
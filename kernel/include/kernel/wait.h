@@ -14,6 +14,7 @@
 #include <arch/defines.h>
 #include <arch/ops.h>
 #include <arch/thread.h>
+#include <kernel/spinlock.h>
 
 __BEGIN_CDECLS;
 
@@ -22,19 +23,38 @@ __BEGIN_CDECLS;
 
 typedef struct wait_queue {
     int magic;
+    spin_lock_t lock;
     struct list_node list;
     int count;
+
+    /* for priority inheritance, the thread the waiters are waiting on, if any.
+     * protected by thread_lock. */
+    struct thread *owner;
+    struct list_node owner_node;
 } wait_queue_t;
 
 #define WAIT_QUEUE_INITIAL_VALUE(q) \
 { \
     .magic = WAIT_QUEUE_MAGIC, \
+    .lock = SPIN_LOCK_INITIAL_VALUE, \
     .list = LIST_INITIAL_VALUE((q).list), \
-    .count = 0 \
+    .count = 0, \
+    .owner = NULL, \
+    .owner_node = LIST_INITIAL_CLEARED_VALUE, \
 }
 
+/* each wait queue is protected by its own spinlock, which also serves as the
+ * lock for whatever state the queue's owner checks before blocking (event
+ * signaled state, mutex count, etc). lock ordering is wait queue lock, then
+ * thread_lock; thread_lock is only taken internally to move threads on and off
+ * of the run queues. the list of waiters is only modified with both locks held,
+ * so it may be walked with either one.
+ */
+#define WAIT_QUEUE_LOCK(wait, state) spin_lock_saved_state_t state; spin_lock_irqsave(&(wait)->lock, state)
+#define WAIT_QUEUE_UNLOCK(wait, state) spin_unlock_irqrestore(&(wait)->lock, state)
+
 /* wait queue primitive */
-/* NOTE: must be inside critical section when using these */
+/* NOTE: must hold the wait queue's lock when using these */
 void wait_queue_init(wait_queue_t *wait);
 
 void wait_queue_destroy(wait_queue_t *);
@@ -49,15 +69,27 @@ status_t wait_queue_block(wait_queue_t *, lk_time_t deadline);
 
 /*
  * release one or more threads from the wait queue.
- * reschedule = should the system reschedule if any is released.
  * wait_queue_error = what wait_queue_block() should return for the blocking thread.
+ * the released threads are placed on a run queue but the current thread keeps
+ * running; callers that want to give up the cpu to them should call
+ * thread_reschedule() once the wait queue lock has been dropped.
+ */
+int wait_queue_wake_one(wait_queue_t *, status_t wait_queue_error);
+int wait_queue_wake_all(wait_queue_t *, status_t wait_queue_error);
+
+/*
+ * set the thread that threads blocked on this queue are waiting for, or NULL.
+ * the owner runs at no less than the priority of its highest priority waiter,
+ * and passes the boost along to the owner of any queue it blocks on in turn.
+ * may be called with or without the wait queue lock held.
  */
-int wait_queue_wake_one(wait_queue_t *, bool reschedule, status_t wait_queue_error);
-int wait_queue_wake_all(wait_queue_t *, bool reschedule, status_t wait_queue_error);
+void wait_queue_set_owner(wait_queue_t *, struct thread *owner);
 
 /*
  * remove the thread from whatever wait queue it's in.
  * return an error if the thread is not currently blocked (or is the current thread)
+ * must be called with the thread_lock held instead of the wait queue lock, which
+ * may be briefly dropped while acquiring the wait queue lock.
  */
 status_t thread_unblock_from_wait_queue(struct thread *t, status_t wait_queue_error);
 
@@ -82,6 +82,8 @@ static int cmd_threadstats(int argc, const cmd_args *argv, uint32_t flags)
         printf("\treschedules: %lu\n", thread_stats[i].reschedules);
 #if WITH_SMP
         printf("\treschedule_ipis: %lu\n", thread_stats[i].reschedule_ipis);
+        printf("\tsteals: %lu\n", thread_stats[i].steals);
+        printf("\thandoffs: %lu\n", thread_stats[i].handoffs);
 #endif
         printf("\tcontext_switches: %lu\n", thread_stats[i].context_switches);
         printf("\tpreempts: %lu\n", thread_stats[i].preempts);
@@ -89,6 +91,8 @@ static int cmd_threadstats(int argc, const cmd_args *argv, uint32_t flags)
         printf("\tinterrupts: %lu\n", thread_stats[i].interrupts);
         printf("\ttimer interrupts: %lu\n", thread_stats[i].timer_ints);
         printf("\ttimers: %lu\n", thread_stats[i].timers);
+        printf("\tmutex spins: %lu\n", thread_stats[i].mutex_spins);
+        printf("\tmutex blocks: %lu\n", thread_stats[i].mutex_blocks);
     }
 
     return 0;
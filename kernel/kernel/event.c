@@ -56,14 +56,14 @@ void event_destroy(event_t *e)
 {
     DEBUG_ASSERT(e->magic == EVENT_MAGIC);
 
-    THREAD_LOCK(state);
+    WAIT_QUEUE_LOCK(&e->wait, state);
 
     e->magic = 0;
     e->signaled = false;
     e->flags = 0;
     wait_queue_destroy(&e->wait);
 
-    THREAD_UNLOCK(state);
+    WAIT_QUEUE_UNLOCK(&e->wait, state);
 }
 
 /**
@@ -91,7 +91,7 @@ status_t event_wait_deadline(event_t *e, lk_time_t deadline, bool interruptable)
     DEBUG_ASSERT(e->magic == EVENT_MAGIC);
     DEBUG_ASSERT(!arch_in_int_handler());
 
-    THREAD_LOCK(state);
+    WAIT_QUEUE_LOCK(&e->wait, state);
 
     current_thread->interruptable = interruptable;
 
@@ -109,7 +109,7 @@ status_t event_wait_deadline(event_t *e, lk_time_t deadline, bool interruptable)
     current_thread->interruptable = false;
 
 out:
-    THREAD_UNLOCK(state);
+    WAIT_QUEUE_UNLOCK(&e->wait, state);
 
     return ret;
 }
@@ -138,14 +138,14 @@ int event_signal_etc(event_t *e, bool reschedule, status_t wait_result)
     DEBUG_ASSERT(e->magic == EVENT_MAGIC);
     DEBUG_ASSERT(!reschedule || !arch_in_int_handler());
 
-    THREAD_LOCK(state);
+    WAIT_QUEUE_LOCK(&e->wait, state);
 
     int wake_count = 0;
 
     if (!e->signaled) {
         if (e->flags & EVENT_FLAG_AUTOUNSIGNAL) {
             /* try to release one thread and leave unsignaled if successful */
-            if ((wake_count = wait_queue_wake_one(&e->wait, reschedule, wait_result)) <= 0) {
+            if ((wake_count = wait_queue_wake_one(&e->wait, wait_result)) <= 0) {
                 /*
                  * if we didn't actually find a thread to wake up, go to
                  * signaled state and let the next call to event_wait
@@ -156,11 +156,15 @@ int event_signal_etc(event_t *e, bool reschedule, status_t wait_result)
         } else {
             /* release all threads and remain signaled */
             e->signaled = true;
-            wake_count = wait_queue_wake_all(&e->wait, reschedule, wait_result);
+            wake_count = wait_queue_wake_all(&e->wait, wait_result);
         }
     }
 
-    THREAD_UNLOCK(state);
+    WAIT_QUEUE_UNLOCK(&e->wait, state);
+
+    /* the wakeups above only readied the threads, give them the cpu if asked to */
+    if (reschedule && wake_count > 0)
+        thread_reschedule();
 
     return wake_count;
 }
@@ -18,8 +18,10 @@
 #include <kernel/event.h>
 #include <kernel/mp.h>
 #include <kernel/mutex.h>
+#include <kernel/sched.h>
 #include <kernel/spinlock.h>
 #include <kernel/timer.h>
+#include <lib/dpc.h>
 
 #define LOCAL_TRACE 0
 
@@ -242,6 +244,10 @@ status_t mp_hotplug_cpu(uint cpu_id) {
     }
 
     status = platform_mp_cpu_hotplug(cpu_id);
+    if (status == NO_ERROR) {
+        /* bring back the dpc worker we stopped when the cpu was unplugged */
+        status = dpc_init_for_cpu(cpu_id);
+    }
 cleanup_mutex:
     mutex_release(&mp.hotplug_lock);
     return status;
@@ -294,6 +300,13 @@ status_t mp_unplug_cpu(uint cpu_id) {
         goto cleanup_thread;
     }
 
+    /* Stop the target's dpc worker while it can still run, so it isn't left
+     * stranded in the middle of a dpc */
+    status = dpc_shutdown(cpu_id);
+    if (status != NO_ERROR) {
+        goto cleanup_thread;
+    }
+
     /* Pin to the target CPU */
     thread_set_pinned_cpu(t, cpu_id);
     /* Set real time to cancel the pre-emption timer */
@@ -301,6 +314,8 @@ status_t mp_unplug_cpu(uint cpu_id) {
 
     status = thread_detach_and_resume(t);
     if (status != NO_ERROR) {
+        if (dpc_init_for_cpu(cpu_id) != NO_ERROR)
+            printf("failed to restart dpc thread for cpu %u\n", cpu_id);
         goto cleanup_thread;
     }
 
@@ -309,14 +324,20 @@ status_t mp_unplug_cpu(uint cpu_id) {
         status = event_wait(&unplug_done);
     } while (status < 0);
 
-    /* Now that the CPU is no longer processing tasks, move all of its timers */
+    /* Now that the CPU is no longer processing tasks, move all of its timers,
+     * any threads still sitting in its run queue and any queued dpcs */
     timer_transition_off_cpu(cpu_id);
+    sched_transition_off_cpu(cpu_id);
+    dpc_transition_off_cpu(cpu_id);
 
     status = platform_mp_cpu_unplug(cpu_id);
     if (status != NO_ERROR) {
         /* Do not cleanup the unplug thread in this case.  We have successfully
          * unplugged the CPU from the scheduler's perspective, but the platform
-         * may have failed to shut down the CPU */
+         * may have failed to shut down the CPU.  Give the CPU its dpc worker
+         * back, so it has one whenever it is scheduling again */
+        if (dpc_init_for_cpu(cpu_id) != NO_ERROR)
+            printf("failed to restart dpc thread for cpu %u\n", cpu_id);
         goto cleanup_mutex;
     }
 
@@ -20,6 +20,10 @@
 #include <assert.h>
 #include <err.h>
 #include <kernel/thread.h>
+#include <platform.h>
+
+/* how long to spin waiting for a running holder before going to sleep */
+#define MUTEX_SPIN_MAX_TIME LK_USEC(10)
 
 /**
  * @brief  Initialize a mutex_t
@@ -40,19 +44,115 @@ void mutex_destroy(mutex_t *m)
     DEBUG_ASSERT(m->magic == MUTEX_MAGIC);
     DEBUG_ASSERT(!arch_in_int_handler());
 
-    THREAD_LOCK(state);
+    WAIT_QUEUE_LOCK(&m->wait, state);
 #if LK_DEBUGLEVEL > 0
-    if (unlikely(m->count > 0)) {
+    thread_t *holder = mutex_holder(m);
+    if (unlikely(holder != NULL)) {
         panic("mutex_destroy: thread %p (%s) tried to destroy locked mutex %p,"
               " locked by %p (%s)\n",
               get_current_thread(), get_current_thread()->name, m,
-              m->holder, m->holder->name);
+              holder, holder->name);
     }
 #endif
     m->magic = 0;
-    m->count = 0;
+    m->val = 0;
     wait_queue_destroy(&m->wait);
-    THREAD_UNLOCK(state);
+    WAIT_QUEUE_UNLOCK(&m->wait, state);
+}
+
+/* try to move the owner word from |oldval| to |newval|, updating |oldval| on failure */
+static inline bool mutex_cmpxchg(mutex_t *m, uintptr_t *oldval, uintptr_t newval, int success_order)
+{
+    return __atomic_compare_exchange_n(&m->val, oldval, newval, false,
+                                       success_order, __ATOMIC_RELAXED);
+}
+
+/* Spin on a held mutex for a bounded time, as long as the holder is running
+ * on another cpu and nobody is already queued. Returns true if the mutex was
+ * acquired.
+ */
+static bool mutex_spin(mutex_t *m, thread_t *current_thread)
+{
+#if WITH_SMP
+    lk_time_t deadline = current_time() + MUTEX_SPIN_MAX_TIME;
+
+    for (;;) {
+        uintptr_t oldval = __atomic_load_n(&m->val, __ATOMIC_RELAXED);
+        if (oldval == 0) {
+            if (mutex_cmpxchg(m, &oldval, (uintptr_t)current_thread, __ATOMIC_ACQUIRE))
+                return true;
+            continue;
+        }
+
+        /* don't jump the queue of threads that are already waiting */
+        if (oldval & MUTEX_FLAG_QUEUED)
+            return false;
+
+        /* the holder isn't going to release it any time soon if it's not running.
+         * the holder may drop the mutex and exit while we look at it, but thread
+         * structures are only ever freed back to the heap, so the worst a stale
+         * read can do is end the spin early or late. */
+        thread_t *holder = (thread_t *)oldval;
+        if (__atomic_load_n(&holder->state, __ATOMIC_RELAXED) != THREAD_RUNNING)
+            return false;
+
+        if (current_time() >= deadline)
+            return false;
+
+        arch_spinloop_pause();
+    }
+#else
+    return false;
+#endif
+}
+
+static void mutex_acquire_contended(mutex_t *m, thread_t *current_thread)
+{
+    if (mutex_spin(m, current_thread)) {
+        THREAD_STATS_INC(mutex_spins);
+        return;
+    }
+
+    WAIT_QUEUE_LOCK(&m->wait, state);
+
+    for (;;) {
+        uintptr_t oldval = __atomic_load_n(&m->val, __ATOMIC_RELAXED);
+        if (oldval == 0) {
+            /* released while we were getting here. the queued flag is only
+             * cleared with the wait queue lock held, so nobody is waiting */
+            if (mutex_cmpxchg(m, &oldval, (uintptr_t)current_thread, __ATOMIC_ACQUIRE))
+                break;
+            continue;
+        }
+
+        /* make sure the holder takes the slow path on release. it needs the
+         * wait queue lock to do so, which we hold until we're queued */
+        if (!(oldval & MUTEX_FLAG_QUEUED) &&
+            !mutex_cmpxchg(m, &oldval, oldval | MUTEX_FLAG_QUEUED, __ATOMIC_RELAXED))
+            continue;
+
+        THREAD_STATS_INC(mutex_blocks);
+
+        /* lend the holder our priority while we wait. it can't hand the mutex
+         * off or change the owner without the wait queue lock */
+        wait_queue_set_owner(&m->wait, (thread_t *)(oldval & ~MUTEX_FLAG_QUEUED));
+
+        status_t ret = wait_queue_block(&m->wait, INFINITE_TIME);
+        if (unlikely(ret < NO_ERROR)) {
+            /* mutexes are not interruptable and cannot time out, so it
+             * is illegal to return with any error state.
+             */
+            panic("mutex_acquire: wait_queue_block returns with error %d m %p, thr %p, sp %p\n",
+                   ret, m, current_thread, __GET_FRAME());
+        }
+
+        /* the releasing thread handed the mutex directly to us */
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        DEBUG_ASSERT(mutex_holder(m) == current_thread);
+        break;
+    }
+
+    WAIT_QUEUE_UNLOCK(&m->wait, state);
 }
 
 /**
@@ -65,71 +165,98 @@ void mutex_acquire(mutex_t *m) TA_NO_THREAD_SAFETY_ANALYSIS
     DEBUG_ASSERT(m->magic == MUTEX_MAGIC);
     DEBUG_ASSERT(!arch_in_int_handler());
 
+    thread_t *current_thread = get_current_thread();
+
 #if LK_DEBUGLEVEL > 0
-    if (unlikely(get_current_thread() == m->holder))
+    if (unlikely(current_thread == mutex_holder(m)))
         panic("mutex_acquire: thread %p (%s) tried to acquire mutex %p it already owns.\n",
-              get_current_thread(), get_current_thread()->name, m);
+              current_thread, current_thread->name, m);
 #endif
 
-    THREAD_LOCK(state);
-    if (unlikely(++m->count > 1)) {
-        status_t ret = wait_queue_block(&m->wait, INFINITE_TIME);
-        if (unlikely(ret < NO_ERROR)) {
-            /* mutexes are not interruptable and cannot time out, so it
-             * is illegal to return with any error state.
-             */
-            panic("mutex_acquire: wait_queue_block returns with error %d m %p, thr %p, sp %p\n",
-                   ret, m, get_current_thread(), __GET_FRAME());
-        }
+    /* fast path: the mutex is free */
+    uintptr_t oldval = 0;
+    if (likely(mutex_cmpxchg(m, &oldval, (uintptr_t)current_thread, __ATOMIC_ACQUIRE)))
+        return;
+
+    mutex_acquire_contended(m, current_thread);
+}
+
+/* hand the mutex to the first waiter, returning the number of threads woken */
+static int mutex_release_contended(mutex_t *m)
+{
+    DEBUG_ASSERT(arch_ints_disabled());
+    DEBUG_ASSERT(spin_lock_held(&m->wait.lock));
+
+    thread_t *t = list_peek_head_type(&m->wait.list, thread_t, queue_node);
+    if (!t) {
+        wait_queue_set_owner(&m->wait, NULL);
+        __atomic_store_n(&m->val, 0, __ATOMIC_RELEASE);
+        return 0;
     }
 
-    m->holder = get_current_thread();
-    THREAD_UNLOCK(state);
+    /* the new holder inherits from the threads left waiting, and we go back
+     * to our own priority */
+    uintptr_t newval = (uintptr_t)t;
+    if (m->wait.count > 1) {
+        newval |= MUTEX_FLAG_QUEUED;
+        wait_queue_set_owner(&m->wait, t);
+    } else {
+        wait_queue_set_owner(&m->wait, NULL);
+    }
+    __atomic_store_n(&m->val, newval, __ATOMIC_RELEASE);
+
+    /* release a thread */
+    return wait_queue_wake_one(&m->wait, NO_ERROR);
 }
 
+static inline void mutex_check_release(mutex_t *m, const char *func)
+{
+#if LK_DEBUGLEVEL > 0
+    thread_t *holder = mutex_holder(m);
+    if (unlikely(get_current_thread() != holder)) {
+        panic("%s: thread %p (%s) tried to release mutex %p it doesn't own. owned by %p (%s)\n",
+              func, get_current_thread(), get_current_thread()->name, m, holder,
+              holder ? holder->name : "none");
+    }
+#endif
+}
 
 void mutex_release(mutex_t *m) TA_NO_THREAD_SAFETY_ANALYSIS
 {
     DEBUG_ASSERT(m->magic == MUTEX_MAGIC);
     DEBUG_ASSERT(!arch_in_int_handler());
 
-#if LK_DEBUGLEVEL > 0
-    if (unlikely(get_current_thread() != m->holder)) {
-        panic("mutex_release: thread %p (%s) tried to release mutex %p it doesn't own. owned by %p (%s)\n",
-              get_current_thread(), get_current_thread()->name, m, m->holder, m->holder ? m->holder->name : "none");
-    }
-#endif
+    mutex_check_release(m, __func__);
 
-    THREAD_LOCK(state);
-    m->holder = 0;
+    /* fast path: nobody is waiting */
+    uintptr_t oldval = (uintptr_t)get_current_thread();
+    if (likely(mutex_cmpxchg(m, &oldval, 0, __ATOMIC_RELEASE)))
+        return;
 
-    if (unlikely(--m->count >= 1)) {
-        /* release a thread */
-        wait_queue_wake_one(&m->wait, true, NO_ERROR);
-    }
-    THREAD_UNLOCK(state);
+    WAIT_QUEUE_LOCK(&m->wait, state);
+    int woken = mutex_release_contended(m);
+    WAIT_QUEUE_UNLOCK(&m->wait, state);
+
+    /* let the new holder run now if it outranks us */
+    if (woken > 0)
+        thread_reschedule();
 }
 
-void mutex_release_thread_locked(mutex_t *m, bool reschedule) TA_NO_THREAD_SAFETY_ANALYSIS
+/* release the mutex from a context that holds another spinlock, and so can't be
+ * rescheduled. the caller is expected to block or reschedule shortly after. */
+void mutex_release_no_resched(mutex_t *m) TA_NO_THREAD_SAFETY_ANALYSIS
 {
     DEBUG_ASSERT(m->magic == MUTEX_MAGIC);
     DEBUG_ASSERT(!arch_in_int_handler());
     DEBUG_ASSERT(arch_ints_disabled());
-    DEBUG_ASSERT(spin_lock_held(&thread_lock));
 
-#if LK_DEBUGLEVEL > 0
-    if (unlikely(get_current_thread() != m->holder)) {
-        panic("mutex_release_thread_locked: thread %p (%s) tried to release mutex %p it doesn't own. "
-              "owned by %p (%s)\n",
-              get_current_thread(), get_current_thread()->name, m, m->holder,
-              m->holder ? m->holder->name : "none");
-    }
-#endif
+    mutex_check_release(m, __func__);
 
-    m->holder = 0;
+    uintptr_t oldval = (uintptr_t)get_current_thread();
+    if (likely(mutex_cmpxchg(m, &oldval, 0, __ATOMIC_RELEASE)))
+        return;
 
-    if (unlikely(--m->count >= 1)) {
-        /* release a thread */
-        wait_queue_wake_one(&m->wait, reschedule, NO_ERROR);
-    }
+    spin_lock(&m->wait.lock);
+    mutex_release_contended(m);
+    spin_unlock(&m->wait.lock);
 }
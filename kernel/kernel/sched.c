@@ -19,26 +19,46 @@
 /* legacy implementation that just broadcast ipis for every reschedule */
 #define BROADCAST_RESCHEDULE 0
 
-/* the run queue */
-static struct list_node run_queue[NUM_PRIORITIES];
-static uint32_t run_queue_bitmap;
+/* per cpu run queues. each queue's lists and bitmap are protected by its own lock,
+ * so readying, picking or stealing a thread only contends with users of that one cpu's
+ * queue. the queue locks nest inside thread_lock, which still covers the thread state,
+ * and are never held more than one at a time. the bitmap is also read without the lock
+ * as a hint of which cpus have anything worth stealing.
+ */
+struct run_queue {
+    spin_lock_t lock;
+    struct list_node list[NUM_PRIORITIES];
+    uint32_t bitmap;
+} __CPU_ALIGN;
+
+static struct run_queue run_queue[SMP_MAX_CPUS];
 
 /* make sure the bitmap is large enough to cover our number of priorities */
-static_assert(NUM_PRIORITIES <= sizeof(run_queue_bitmap) * CHAR_BIT, "");
+static_assert(NUM_PRIORITIES <= sizeof(run_queue[0].bitmap) * CHAR_BIT, "");
 
-/* pick a 'random' cpu */
-static mp_cpu_mask_t rand_cpu(const mp_cpu_mask_t mask)
+/* compute the highest priority queue with a thread in it from a run queue bitmap */
+static inline uint highest_run_queue(uint32_t bitmap)
+{
+    DEBUG_ASSERT(bitmap != 0);
+
+    return HIGHEST_PRIORITY - __builtin_clz(bitmap)
+           - (sizeof(bitmap) * CHAR_BIT - NUM_PRIORITIES);
+}
+
+#if WITH_SMP
+/* pick a 'random' cpu out of the passed in mask, returns -1 if none are usable */
+static int rand_cpu(const mp_cpu_mask_t mask)
 {
     if (unlikely(mask == 0))
-        return 0;
+        return -1;
 
-    /* check that the mask passed in has at least one bit set in the online mask */
-    mp_cpu_mask_t online = mp_get_online_mask();
-    if (unlikely((mask & online) == 0))
-        return 0;
+    /* check that the mask passed in has at least one bit set in the active mask */
+    mp_cpu_mask_t active = mp_get_active_mask();
+    if (unlikely((mask & active) == 0))
+        return -1;
 
-    /* compute the highest online cpu */
-    uint highest_cpu = (sizeof(mp_cpu_mask_t) * CHAR_BIT - 1) - __builtin_clz(online);
+    /* compute the highest active cpu */
+    uint highest_cpu = (sizeof(mp_cpu_mask_t) * CHAR_BIT - 1) - __builtin_clz(active);
 
     /* not very random, round robins a bit through the mask until it gets a hit */
     for (;;) {
@@ -48,106 +68,215 @@ static mp_cpu_mask_t rand_cpu(const mp_cpu_mask_t mask)
         if (++rot > highest_cpu)
             rot = 0;
 
-        if ((1u << rot) & mask)
-            return (1u << rot);
+        if ((1u << rot) & mask & active)
+            return rot;
     }
 }
+#endif
 
-/* find a cpu to wake up */
-static mp_cpu_mask_t find_cpu(thread_t *t)
+/* find a cpu to run the thread on, the thread will be inserted into that cpu's run queue */
+static uint find_cpu(thread_t *t)
 {
-#if BROADCAST_RESCHEDULE
-    return MP_CPU_ALL_BUT_LOCAL;
-#elif WITH_SMP
-    /* get the last cpu the thread ran on */
-    mp_cpu_mask_t last_ran_cpu_mask = (1u << thread_last_cpu(t));
+    uint curr_cpu = arch_curr_cpu_num();
+
+#if BROADCAST_RESCHEDULE || !WITH_SMP
+    return curr_cpu;
+#else
+    /* the waker is about to block on this thread, so have it run here in the waker's place
+     * instead of kicking another cpu. only the first wakeup gets the handoff */
+    thread_t *current_thread = get_current_thread();
+    if (unlikely(current_thread->handoff) && !arch_in_int_handler()) {
+        current_thread->handoff = false;
+        if (thread_pinned_cpu(t) < 0 || (uint)thread_pinned_cpu(t) == curr_cpu) {
+            THREAD_STATS_INC(handoffs);
+            return curr_cpu;
+        }
+    }
+
+    /* pinned threads only ever run on a single cpu */
+    if (unlikely(thread_pinned_cpu(t) >= 0))
+        return thread_pinned_cpu(t);
 
-    /* the current cpu */
-    mp_cpu_mask_t curr_cpu_mask = (1u << arch_curr_cpu_num());
+    mp_cpu_mask_t active_cpu_mask = mp_get_active_mask();
+
+    /* get the last cpu the thread ran on, ignoring it if it's gone away */
+    uint last_cpu = thread_last_cpu(t);
+    if (unlikely(!(active_cpu_mask & (1u << last_cpu))))
+        last_cpu = curr_cpu;
 
     /* get a list of idle cpus */
-    mp_cpu_mask_t idle_cpu_mask = mp_get_idle_mask();
+    mp_cpu_mask_t idle_cpu_mask = mp_get_idle_mask() & active_cpu_mask;
     if (idle_cpu_mask != 0) {
-        if (idle_cpu_mask & curr_cpu_mask) {
+        if (idle_cpu_mask & (1u << curr_cpu)) {
             /* the current cpu is idle, so run it here */
-            return 0;
+            return curr_cpu;
         }
 
-        if (last_ran_cpu_mask & idle_cpu_mask) {
+        if (idle_cpu_mask & (1u << last_cpu)) {
             /* the last core it ran on is idle and isn't the current cpu */
-            return last_ran_cpu_mask;
+            return last_cpu;
         }
 
         /* pick an idle_cpu */
-        return rand_cpu(idle_cpu_mask);
+        int cpu = rand_cpu(idle_cpu_mask);
+        return (cpu >= 0) ? (uint)cpu : curr_cpu;
     }
 
     /* no idle cpus */
-    if (last_ran_cpu_mask == curr_cpu_mask) {
+    if (last_cpu == curr_cpu) {
         /* the last cpu it ran on is us */
         /* pick a random cpu that isn't the current one */
-        return rand_cpu(mp_get_online_mask() & ~(curr_cpu_mask));
+        int cpu = rand_cpu(active_cpu_mask & ~(1u << curr_cpu));
+        return (cpu >= 0) ? (uint)cpu : curr_cpu;
     } else {
         /* pick the last cpu it ran on */
-        return last_ran_cpu_mask;
+        return last_cpu;
     }
-#else /* !WITH_SMP */
-    /* no smp, dont send an IPI */
-    return 0;
 #endif
 }
 
-/* run queue manipulation */
-static void insert_in_run_queue_head(thread_t *t)
+/* run queue manipulation, with the cpu's run queue lock held */
+static void run_queue_insert_locked(uint cpu, thread_t *t, bool head)
 {
     DEBUG_ASSERT(t->magic == THREAD_MAGIC);
     DEBUG_ASSERT(t->state == THREAD_READY);
     DEBUG_ASSERT(!list_in_list(&t->queue_node));
     DEBUG_ASSERT(arch_ints_disabled());
-    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    DEBUG_ASSERT(cpu < SMP_MAX_CPUS);
 
-    list_add_head(&run_queue[t->priority], &t->queue_node);
-    run_queue_bitmap |= (1<<t->priority);
+    struct run_queue *rq = &run_queue[cpu];
+    DEBUG_ASSERT(spin_lock_held(&rq->lock));
+
+    thread_set_last_cpu(t, cpu);
+    if (head)
+        list_add_head(&rq->list[t->priority], &t->queue_node);
+    else
+        list_add_tail(&rq->list[t->priority], &t->queue_node);
+    __atomic_store_n(&rq->bitmap, rq->bitmap | (1u << t->priority), __ATOMIC_RELAXED);
 }
 
-static void insert_in_run_queue_tail(thread_t *t)
+static void run_queue_remove_locked(uint cpu, thread_t *t)
 {
-    DEBUG_ASSERT(t->magic == THREAD_MAGIC);
-    DEBUG_ASSERT(t->state == THREAD_READY);
-    DEBUG_ASSERT(!list_in_list(&t->queue_node));
-    DEBUG_ASSERT(arch_ints_disabled());
-    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    DEBUG_ASSERT(list_in_list(&t->queue_node));
+
+    struct run_queue *rq = &run_queue[cpu];
+    DEBUG_ASSERT(spin_lock_held(&rq->lock));
+
+    list_delete(&t->queue_node);
 
-    list_add_tail(&run_queue[t->priority], &t->queue_node);
-    run_queue_bitmap |= (1<<t->priority);
+    if (list_is_empty(&rq->list[t->priority]))
+        __atomic_store_n(&rq->bitmap, rq->bitmap & ~(1u << t->priority), __ATOMIC_RELAXED);
 }
 
-thread_t *sched_get_top_thread(uint cpu)
+static void insert_in_run_queue_head(uint cpu, thread_t *t)
 {
-    thread_t *newthread;
-    uint32_t local_run_queue_bitmap = run_queue_bitmap;
+    spin_lock(&run_queue[cpu].lock);
+    run_queue_insert_locked(cpu, t, true);
+    spin_unlock(&run_queue[cpu].lock);
+}
 
-    while (local_run_queue_bitmap) {
-        /* find the first (remaining) queue with a thread in it */
-        uint next_queue = HIGHEST_PRIORITY - __builtin_clz(local_run_queue_bitmap)
-                          - (sizeof(run_queue_bitmap) * CHAR_BIT - NUM_PRIORITIES);
+static void insert_in_run_queue_tail(uint cpu, thread_t *t)
+{
+    spin_lock(&run_queue[cpu].lock);
+    run_queue_insert_locked(cpu, t, false);
+    spin_unlock(&run_queue[cpu].lock);
+}
 
-        list_for_every_entry(&run_queue[next_queue], newthread, thread_t, queue_node) {
 #if WITH_SMP
-            if (likely(newthread->pinned_cpu < 0) || (uint)newthread->pinned_cpu == cpu)
-#endif
-            {
-                list_delete(&newthread->queue_node);
+/* find the highest priority unpinned thread on a cpu's run queue that beats min_priority */
+static thread_t *run_queue_find_unpinned_locked(uint cpu, int min_priority)
+{
+    struct run_queue *rq = &run_queue[cpu];
+    DEBUG_ASSERT(spin_lock_held(&rq->lock));
+
+    uint32_t bitmap = rq->bitmap;
+    while (bitmap) {
+        uint next_queue = highest_run_queue(bitmap);
+        if ((int)next_queue <= min_priority)
+            break;
+
+        thread_t *t;
+        list_for_every_entry(&rq->list[next_queue], t, thread_t, queue_node) {
+            if (likely(thread_pinned_cpu(t) < 0))
+                return t;
+        }
 
-                if (list_is_empty(&run_queue[next_queue]))
-                    run_queue_bitmap &= ~(1<<next_queue);
+        bitmap &= ~(1u << next_queue);
+    }
+
+    return NULL;
+}
 
-                return newthread;
-            }
+/* steal the highest priority unpinned thread queued on any other cpu */
+static thread_t *steal_thread(uint cpu)
+{
+    int best_priority = -1;
+    uint best_cpu = 0;
+
+    /* look for the best victim, skipping cpus whose bitmap says they can't beat it
+     * without touching their locks */
+    for (uint i = 0; i < SMP_MAX_CPUS; i++) {
+        if (i == cpu)
+            continue;
+
+        uint32_t bitmap = __atomic_load_n(&run_queue[i].bitmap, __ATOMIC_RELAXED);
+        if (bitmap == 0 || (int)highest_run_queue(bitmap) <= best_priority)
+            continue;
+
+        spin_lock(&run_queue[i].lock);
+        thread_t *t = run_queue_find_unpinned_locked(i, best_priority);
+        if (t) {
+            best_priority = t->priority;
+            best_cpu = i;
         }
+        spin_unlock(&run_queue[i].lock);
+    }
+
+    if (best_priority < 0)
+        return NULL;
+
+    /* the victim's queue may have changed since we looked, so take whatever is
+     * best there now */
+    spin_lock(&run_queue[best_cpu].lock);
+    thread_t *t = run_queue_find_unpinned_locked(best_cpu, -1);
+    if (t) {
+        run_queue_remove_locked(best_cpu, t);
+        THREAD_STATS_INC(steals);
+    }
+    spin_unlock(&run_queue[best_cpu].lock);
+
+    return t;
+}
+#endif
+
+thread_t *sched_get_top_thread(uint cpu)
+{
+    DEBUG_ASSERT(arch_ints_disabled());
+
+    struct run_queue *rq = &run_queue[cpu];
 
-        local_run_queue_bitmap &= ~(1<<next_queue);
+    /* pull the head of the highest priority queue on this cpu */
+    spin_lock(&rq->lock);
+    if (likely(rq->bitmap)) {
+        uint next_queue = highest_run_queue(rq->bitmap);
+
+        thread_t *newthread = list_peek_head_type(&rq->list[next_queue], thread_t, queue_node);
+        DEBUG_ASSERT(newthread);
+        DEBUG_ASSERT(thread_pinned_cpu(newthread) < 0 || (uint)thread_pinned_cpu(newthread) == cpu);
+
+        run_queue_remove_locked(cpu, newthread);
+        spin_unlock(&rq->lock);
+        return newthread;
     }
+    spin_unlock(&rq->lock);
+
+#if WITH_SMP
+    /* nothing queued locally, see if there's any work we can take from another cpu */
+    thread_t *newthread = steal_thread(cpu);
+    if (newthread)
+        return newthread;
+#endif
+
     /* no threads to run, select the idle thread for this cpu */
     return &idle_threads[cpu];
 }
@@ -166,6 +295,24 @@ void sched_block(void)
     thread_resched();
 }
 
+/* insert a newly readied thread into a run queue, returning the mask of cpus that
+ * need to be kicked to pick it up */
+static mp_cpu_mask_t sched_make_ready(thread_t *t)
+{
+    DEBUG_ASSERT(t->magic == THREAD_MAGIC);
+
+    t->state = THREAD_READY;
+
+    uint cpu = find_cpu(t);
+    insert_in_run_queue_head(cpu, t);
+
+#if BROADCAST_RESCHEDULE
+    return MP_CPU_ALL_BUT_LOCAL;
+#else
+    return (cpu != arch_curr_cpu_num()) ? (1u << cpu) : 0;
+#endif
+}
+
 void sched_unblock(thread_t *t, bool resched)
 {
     DEBUG_ASSERT(t->magic == THREAD_MAGIC);
@@ -179,14 +326,11 @@ void sched_unblock(thread_t *t, bool resched)
         thread_t *current_thread = get_current_thread();
 
         current_thread->state = THREAD_READY;
-        insert_in_run_queue_head(current_thread);
+        insert_in_run_queue_head(arch_curr_cpu_num(), current_thread);
     }
 
     /* stuff the new thread in the run queue */
-    t->state = THREAD_READY;
-    insert_in_run_queue_head(t);
-
-    mp_reschedule(find_cpu(t), 0);
+    mp_reschedule(sched_make_ready(t), 0);
 
     if (resched)
         thread_resched();
@@ -205,26 +349,59 @@ void sched_unblock_list(struct list_node *list, bool resched)
         thread_t *current_thread = get_current_thread();
 
         current_thread->state = THREAD_READY;
-        insert_in_run_queue_head(current_thread);
+        insert_in_run_queue_head(arch_curr_cpu_num(), current_thread);
     }
 
-    /* pop the list of threads and shove into the scheduler */
+    /* pop the list of threads and shove into the scheduler, accumulating the
+     * set of cpus to kick so each one only gets a single ipi */
+    mp_cpu_mask_t kick_mask = 0;
     thread_t *t;
     while ((t = list_remove_tail_type(list, thread_t, queue_node))) {
-        DEBUG_ASSERT(t->magic == THREAD_MAGIC);
-        DEBUG_ASSERT(!thread_is_idle(t));
-
-        /* stuff the new thread in the run queue */
-        t->state = THREAD_READY;
-        insert_in_run_queue_head(t);
-
-        mp_reschedule(find_cpu(t), 0);
+        kick_mask |= sched_make_ready(t);
     }
 
+    mp_reschedule(kick_mask, 0);
+
     if (resched)
         thread_resched();
 }
 
+void sched_reschedule(void)
+{
+    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+
+    thread_t *current_thread = get_current_thread();
+    uint curr_cpu = arch_curr_cpu_num();
+
+    struct run_queue *rq = &run_queue[curr_cpu];
+    spin_lock(&rq->lock);
+
+    /* nothing queued locally that would preempt us, keep running */
+    uint32_t bitmap = rq->bitmap;
+    if (bitmap == 0 || highest_run_queue(bitmap) < (uint)current_thread->priority) {
+        spin_unlock(&rq->lock);
+        return;
+    }
+
+    /* go back in just behind the thread that was readied at the head of our
+     * priority queue, so that it gets a chance to run before the current one,
+     * but the current one doesn't get unnecessarilly punished.
+     */
+    current_thread->state = THREAD_READY;
+    if (likely(!thread_is_idle(current_thread))) { /* idle thread doesn't go in the run queue */
+        struct list_node *head = list_peek_head(&rq->list[current_thread->priority]);
+        if (head) {
+            thread_set_last_cpu(current_thread, curr_cpu);
+            list_add_head(head, &current_thread->queue_node);
+        } else {
+            run_queue_insert_locked(curr_cpu, current_thread, true);
+        }
+    }
+    spin_unlock(&rq->lock);
+
+    thread_resched();
+}
+
 void sched_yield(void)
 {
     DEBUG_ASSERT(spin_lock_held(&thread_lock));
@@ -234,7 +411,7 @@ void sched_yield(void)
     current_thread->state = THREAD_READY;
     current_thread->remaining_time_slice = 0;
     if (likely(!thread_is_idle(current_thread))) { /* idle thread doesn't go in the run queue */
-        insert_in_run_queue_tail(current_thread);
+        insert_in_run_queue_tail(arch_curr_cpu_num(), current_thread);
     }
     thread_resched();
 }
@@ -242,22 +419,91 @@ void sched_yield(void)
 void sched_preempt(void)
 {
     thread_t *current_thread = get_current_thread();
+    uint curr_cpu = arch_curr_cpu_num();
 
     /* we are being preempted, so we get to go back into the front of the run queue if we have quantum left */
     current_thread->state = THREAD_READY;
     if (likely(!thread_is_idle(current_thread))) { /* idle thread doesn't go in the run queue */
         if (current_thread->remaining_time_slice > 0)
-            insert_in_run_queue_head(current_thread);
+            insert_in_run_queue_head(curr_cpu, current_thread);
         else
-            insert_in_run_queue_tail(current_thread); /* if we're out of quantum, go to the tail of the queue */
+            insert_in_run_queue_tail(curr_cpu, current_thread); /* if we're out of quantum, go to the tail of the queue */
     }
     sched_block();
 }
 
+void sched_set_priority(thread_t *t, int priority)
+{
+    DEBUG_ASSERT(t->magic == THREAD_MAGIC);
+    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    DEBUG_ASSERT(priority >= LOWEST_PRIORITY && priority <= HIGHEST_PRIORITY);
+
+    switch (t->state) {
+        case THREAD_READY: {
+            /* move it to the right queue on the cpu it's waiting on */
+            uint cpu = thread_last_cpu(t);
+            spin_lock(&run_queue[cpu].lock);
+            run_queue_remove_locked(cpu, t);
+            t->priority = priority;
+            run_queue_insert_locked(cpu, t, true);
+            spin_unlock(&run_queue[cpu].lock);
+            if (cpu != arch_curr_cpu_num())
+                mp_reschedule(1u << cpu, 0);
+            break;
+        }
+        case THREAD_RUNNING:
+            t->priority = priority;
+            /* let a cpu running a lowered thread reconsider it */
+            if (t != get_current_thread())
+                mp_reschedule(1u << thread_last_cpu(t), 0);
+            break;
+        default:
+            t->priority = priority;
+            break;
+    }
+}
+
+void sched_transition_off_cpu(uint old_cpu)
+{
+    DEBUG_ASSERT(old_cpu != arch_curr_cpu_num());
+
+    THREAD_LOCK(state);
+
+    /* pull everything that isn't pinned off the departing cpu, then redistribute it once
+     * its queue lock is dropped, since readying takes the lock of the new cpu's queue */
+    struct list_node migrating = LIST_INITIAL_VALUE(migrating);
+    struct run_queue *rq = &run_queue[old_cpu];
+    spin_lock(&rq->lock);
+    for (uint i = 0; i < NUM_PRIORITIES; i++) {
+        thread_t *t, *temp;
+        list_for_every_entry_safe(&rq->list[i], t, temp, thread_t, queue_node) {
+            if (thread_pinned_cpu(t) >= 0)
+                continue;
+
+            run_queue_remove_locked(old_cpu, t);
+            list_add_tail(&migrating, &t->queue_node);
+        }
+    }
+    spin_unlock(&rq->lock);
+
+    mp_cpu_mask_t kick_mask = 0;
+    thread_t *t;
+    while ((t = list_remove_head_type(&migrating, thread_t, queue_node))) {
+        kick_mask |= sched_make_ready(t);
+    }
+
+    mp_reschedule(kick_mask, 0);
+
+    THREAD_UNLOCK(state);
+}
+
 void sched_init_early(void)
 {
     /* initialize the run queues */
-    for (int i=0; i < NUM_PRIORITIES; i++)
-        list_initialize(&run_queue[i]);
+    for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        spin_lock_init(&run_queue[cpu].lock);
+        for (uint i = 0; i < NUM_PRIORITIES; i++)
+            list_initialize(&run_queue[cpu].list[i]);
+        run_queue[cpu].bitmap = 0;
+    }
 }
-
@@ -63,6 +63,7 @@ thread_t idle_threads[SMP_MAX_CPUS];
 void thread_resched(void);
 static int idle_thread_routine(void *) __NO_RETURN;
 static void thread_exit_locked(thread_t *current_thread, int retcode) __NO_RETURN;
+static void thread_update_priority_locked(thread_t *t);
 static void thread_do_suspend(void);
 
 /* scheduler */
@@ -79,6 +80,7 @@ static void init_thread_struct(thread_t *t, const char *name)
     thread_set_pinned_cpu(t, -1);
     strlcpy(t->name, name, sizeof(t->name));
     wait_queue_init(&t->retcode_wait_queue);
+    list_initialize(&t->owned_wait_queues);
 }
 
 static void initial_thread_func(void) __NO_RETURN;
@@ -147,6 +149,7 @@ thread_t *thread_create_etc(
     t->entry = entry;
     t->arg = arg;
     t->priority = priority;
+    t->base_priority = priority;
     t->state = THREAD_INITIAL;
     t->signals = 0;
     t->blocking_wait_queue = NULL;
@@ -332,9 +335,14 @@ status_t thread_suspend(thread_t *t)
             /* thread is suspended already */
             break;
         case THREAD_BLOCKED:
-            /* thread is blocked on something and marked interruptable */
-            if (t->interruptable)
+            /* thread is blocked on something and marked interruptable.
+             * the signal has to be posted before the thread lock can be
+             * dropped to get at the wait queue, or the thread could block
+             * again without noticing it. */
+            if (t->interruptable) {
+                t->signals |= THREAD_SIGNAL_SUSPEND;
                 thread_unblock_from_wait_queue(t, ERR_INTERRUPTED_RETRY);
+            }
             break;
         case THREAD_SLEEPING:
             /* thread is sleeping */
@@ -357,11 +365,13 @@ status_t thread_join(thread_t *t, int *retcode, lk_time_t deadline)
 {
     DEBUG_ASSERT(t->magic == THREAD_MAGIC);
 
-    THREAD_LOCK(state);
+    /* the retcode wait queue lock covers the thread's transition to THREAD_DEATH
+     * and its detached flag */
+    WAIT_QUEUE_LOCK(&t->retcode_wait_queue, state);
 
     if (t->flags & THREAD_FLAG_DETACHED) {
         /* the thread is detached, go ahead and exit */
-        THREAD_UNLOCK(state);
+        WAIT_QUEUE_UNLOCK(&t->retcode_wait_queue, state);
         return ERR_BAD_STATE;
     }
 
@@ -369,7 +379,7 @@ status_t thread_join(thread_t *t, int *retcode, lk_time_t deadline)
     if (t->state != THREAD_DEATH) {
         status_t err = wait_queue_block(&t->retcode_wait_queue, deadline);
         if (err < 0) {
-            THREAD_UNLOCK(state);
+            WAIT_QUEUE_UNLOCK(&t->retcode_wait_queue, state);
             return err;
         }
     }
@@ -383,13 +393,18 @@ status_t thread_join(thread_t *t, int *retcode, lk_time_t deadline)
     if (retcode)
         *retcode = t->retcode;
 
+    /* the dying thread drops the thread lock once it has switched away for the
+     * last time, after which it's safe to tear it down */
+    spin_lock(&thread_lock);
+
     /* remove it from the master thread list */
     list_delete(&t->thread_list_node);
 
     /* clear the structure's magic */
     t->magic = 0;
 
-    THREAD_UNLOCK(state);
+    spin_unlock(&thread_lock);
+    WAIT_QUEUE_UNLOCK(&t->retcode_wait_queue, state);
 
     /* free its stack and the thread structure itself */
     if (t->flags & THREAD_FLAG_FREE_STACK && t->stack) {
@@ -409,29 +424,53 @@ status_t thread_detach(thread_t *t)
 {
     DEBUG_ASSERT(t->magic == THREAD_MAGIC);
 
-    THREAD_LOCK(state);
+    WAIT_QUEUE_LOCK(&t->retcode_wait_queue, state);
 
     /* if another thread is blocked inside thread_join() on this thread,
      * wake them up with a specific return code */
-    wait_queue_wake_all(&t->retcode_wait_queue, false, ERR_BAD_STATE);
+    wait_queue_wake_all(&t->retcode_wait_queue, ERR_BAD_STATE);
 
     /* if it's already dead, then just do what join would have and exit */
+    spin_lock(&thread_lock);
     if (t->state == THREAD_DEATH) {
         t->flags &= ~THREAD_FLAG_DETACHED; /* makes sure thread_join continues */
-        THREAD_UNLOCK(state);
+        spin_unlock(&thread_lock);
+        WAIT_QUEUE_UNLOCK(&t->retcode_wait_queue, state);
         return thread_join(t, NULL, 0);
     } else {
         t->flags |= THREAD_FLAG_DETACHED;
-        THREAD_UNLOCK(state);
+        spin_unlock(&thread_lock);
+        WAIT_QUEUE_UNLOCK(&t->retcode_wait_queue, state);
         return NO_ERROR;
     }
 }
 
+/* called with the current thread's retcode wait queue lock held */
 __NO_RETURN static void thread_exit_locked(thread_t *current_thread, int retcode)
 {
-    /* enter the dead state */
+    /* enter the dead state before anyone can look at us again through the
+     * retcode wait queue, so that joiners neither block after the wakeup below
+     * nor find a stale return code */
+    spin_lock(&thread_lock);
     current_thread->state = THREAD_DEATH;
     current_thread->retcode = retcode;
+    spin_unlock(&thread_lock);
+
+    /* signal if anyone is waiting */
+    if (!(current_thread->flags & THREAD_FLAG_DETACHED))
+        wait_queue_wake_all(&current_thread->retcode_wait_queue, 0);
+
+    /* hold on to the thread lock across the final reschedule. joiners need it to
+     * tear us down, so it's safe to let them at the retcode wait queue now. */
+    spin_lock(&thread_lock);
+    spin_unlock(&current_thread->retcode_wait_queue.lock);
+
+    /* nobody can usefully lend us priority anymore */
+    wait_queue_t *owned;
+    while ((owned = list_remove_head_type(&current_thread->owned_wait_queues,
+                                          wait_queue_t, owner_node))) {
+        owned->owner = NULL;
+    }
 
     /* if we're detached, then do our teardown here */
     if (current_thread->flags & THREAD_FLAG_DETACHED) {
@@ -454,9 +493,6 @@ __NO_RETURN static void thread_exit_locked(thread_t *current_thread, int retcode
 
         if (current_thread->flags & THREAD_FLAG_FREE_STRUCT)
             heap_delayed_free(current_thread);
-    } else {
-        /* signal if anyone is waiting */
-        wait_queue_wake_all(&current_thread->retcode_wait_queue, false, 0);
     }
 
     /* reschedule */
@@ -517,7 +553,7 @@ void thread_exit(int retcode)
         current_thread->user_callback(THREAD_USER_STATE_EXIT, current_thread->user_thread);
     }
 
-    THREAD_LOCK(state);
+    WAIT_QUEUE_LOCK(&current_thread->retcode_wait_queue, state);
 
     thread_exit_locked(current_thread, retcode);
 }
@@ -527,6 +563,8 @@ void thread_kill(thread_t *t, bool block)
 {
     DEBUG_ASSERT(t->magic == THREAD_MAGIC);
 
+    bool wait = false;
+
     THREAD_LOCK(state);
 
     /* deliver a signal to the thread */
@@ -582,13 +620,18 @@ void thread_kill(thread_t *t, bool block)
             goto done;
     }
 
-    /* wait for the thread to exit */
-    if (block && !(t->flags & THREAD_FLAG_DETACHED)) {
-        wait_queue_block(&t->retcode_wait_queue, INFINITE_TIME);
-    }
+    wait = block && !(t->flags & THREAD_FLAG_DETACHED);
 
 done:
     THREAD_UNLOCK(state);
+
+    /* wait for the thread to exit */
+    if (wait) {
+        WAIT_QUEUE_LOCK(&t->retcode_wait_queue, wait_state);
+        if (t->state != THREAD_DEATH)
+            wait_queue_block(&t->retcode_wait_queue, INFINITE_TIME);
+        WAIT_QUEUE_UNLOCK(&t->retcode_wait_queue, wait_state);
+    }
 }
 
 /* finish suspending the current thread */
@@ -944,7 +987,8 @@ status_t thread_sleep_etc(lk_time_t deadline, bool interruptable)
 
     if (deadline != INFINITE_TIME) {
         /* set a one shot timer to wake us up and reschedule */
-        timer_set_oneshot(&timer, deadline, thread_sleep_handler, (void *)current_thread);
+        timer_set_oneshot_etc(&timer, deadline, current_thread->timer_slack,
+                              thread_sleep_handler, (void *)current_thread);
     }
     current_thread->state = THREAD_SLEEPING;
     current_thread->blocked_status = NO_ERROR;
@@ -1009,6 +1053,7 @@ void thread_construct_first(thread_t *t, const char *name)
 
     init_thread_struct(t, name);
     t->priority = HIGHEST_PRIORITY;
+    t->base_priority = HIGHEST_PRIORITY;
     t->state = THREAD_RUNNING;
     t->flags = THREAD_FLAG_DETACHED;
     t->signals = 0;
@@ -1087,7 +1132,10 @@ void thread_set_priority(int priority)
         priority = IDLE_PRIORITY + 1;
     if (priority > HIGHEST_PRIORITY)
         priority = HIGHEST_PRIORITY;
-    current_thread->priority = priority;
+    current_thread->base_priority = priority;
+
+    /* an inherited priority may keep us higher than this for now */
+    thread_update_priority_locked(current_thread);
 
     sched_preempt();
 
@@ -1113,6 +1161,7 @@ void thread_become_idle(void)
 
     /* mark ourself as idle */
     t->priority = IDLE_PRIORITY;
+    t->base_priority = IDLE_PRIORITY;
     t->flags |= THREAD_FLAG_IDLE;
     thread_set_pinned_cpu(t, arch_curr_cpu_num());
 
@@ -1311,25 +1360,136 @@ void wait_queue_init(wait_queue_t *wait)
     *wait = (wait_queue_t)WAIT_QUEUE_INITIAL_VALUE(*wait);
 }
 
+/* remove a thread from the wait queue it is blocked on and put it in a run queue.
+ * must be called with the wait queue lock held, but not the thread lock. */
+static void wait_queue_unblock_thread(wait_queue_t *wait, thread_t *t, status_t wait_queue_error)
+{
+    DEBUG_ASSERT(t->magic == THREAD_MAGIC);
+    DEBUG_ASSERT(t->blocking_wait_queue == wait);
+    DEBUG_ASSERT(spin_lock_held(&wait->lock));
+
+    spin_lock(&thread_lock);
+
+    list_delete(&t->queue_node);
+    wait->count--;
+    t->blocking_wait_queue = NULL;
+    t->blocked_status = wait_queue_error;
+
+    /* the owner may have been running on our priority */
+    if (wait->owner)
+        thread_update_priority_locked(wait->owner);
+
+    DEBUG_ASSERT(t->state == THREAD_BLOCKED);
+    sched_unblock(t, false);
+    spin_unlock(&thread_lock);
+}
+
+/* highest priority of any thread blocked on the wait queue, or -1 if there are none */
+static int wait_queue_highest_priority(wait_queue_t *wait)
+{
+    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+
+    int priority = -1;
+    thread_t *t;
+    list_for_every_entry(&wait->list, t, thread_t, queue_node) {
+        if (t->priority > priority)
+            priority = t->priority;
+    }
+    return priority;
+}
+
+/* recompute a thread's effective priority from its base priority and the waiters
+ * on the wait queues it owns, and carry any change down the chain of owners of the
+ * queues it's blocked on. */
+static void thread_update_priority_locked(thread_t *t)
+{
+    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+
+    while (t) {
+        DEBUG_ASSERT(t->magic == THREAD_MAGIC);
+
+        int priority = t->base_priority;
+        wait_queue_t *owned;
+        list_for_every_entry(&t->owned_wait_queues, owned, wait_queue_t, owner_node) {
+            int waiter_priority = wait_queue_highest_priority(owned);
+            if (waiter_priority > priority)
+                priority = waiter_priority;
+        }
+
+        if (priority == t->priority)
+            return;
+
+        sched_set_priority(t, priority);
+
+        /* a blocked thread's queue can't go away while we hold the thread lock,
+         * the waker needs it to finish unblocking the thread */
+        if (t->state != THREAD_BLOCKED || !t->blocking_wait_queue)
+            return;
+        t = t->blocking_wait_queue->owner;
+    }
+}
+
+static void wait_queue_set_owner_locked(wait_queue_t *wait, thread_t *owner)
+{
+    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+
+    thread_t *old_owner = wait->owner;
+    if (old_owner == owner)
+        return;
+
+    if (old_owner) {
+        list_delete(&wait->owner_node);
+        wait->owner = NULL;
+        thread_update_priority_locked(old_owner);
+    }
+
+    /* a thread that has exited has no use for the boost and won't be around
+     * to give it back */
+    if (owner && owner->state != THREAD_DEATH) {
+        DEBUG_ASSERT(owner->magic == THREAD_MAGIC);
+        list_add_tail(&owner->owned_wait_queues, &wait->owner_node);
+        wait->owner = owner;
+        thread_update_priority_locked(owner);
+    }
+}
+
+void wait_queue_set_owner(wait_queue_t *wait, thread_t *owner)
+{
+    DEBUG_ASSERT(wait->magic == WAIT_QUEUE_MAGIC);
+
+    THREAD_LOCK(state);
+    wait_queue_set_owner_locked(wait, owner);
+    THREAD_UNLOCK(state);
+}
+
 static enum handler_return wait_queue_timeout_handler(timer_t *timer, lk_time_t now, void *arg)
 {
     thread_t *thread = (thread_t *)arg;
 
     DEBUG_ASSERT(thread->magic == THREAD_MAGIC);
 
-    /* spin trylocking on the thread lock since the routine that set up the callback,
+    /* if the thread has already been pulled off of the wait queue there's nothing to do.
+     * otherwise the queue can't go away underneath us, since wait_queue_block() will
+     * not return until it has cancelled this timer.
+     */
+    wait_queue_t *wait = thread->blocking_wait_queue;
+    if (!wait)
+        return INT_NO_RESCHEDULE;
+
+    /* spin trylocking on the wait queue lock since the routine that set up the callback,
      * wait_queue_block, may be trying to simultaneously cancel this timer while holding the
-     * thread_lock.
+     * wait queue lock.
      */
-    if (timer_trylock_or_cancel(timer, &thread_lock))
+    if (timer_trylock_or_cancel(timer, &wait->lock))
         return INT_NO_RESCHEDULE;
 
     enum handler_return ret = INT_NO_RESCHEDULE;
-    if (thread_unblock_from_wait_queue(thread, ERR_TIMED_OUT) >= NO_ERROR) {
+    if (thread->blocking_wait_queue == wait) {
+        wait_queue_unblock_thread(wait, thread, ERR_TIMED_OUT);
         ret = INT_RESCHEDULE;
     }
 
-    spin_unlock(&thread_lock);
+    spin_unlock(&wait->lock);
 
     return ret;
 }
@@ -1341,6 +1501,9 @@ static enum handler_return wait_queue_timeout_handler(timer_t *timer, lk_time_t
  * queue and then blocks until some other thread wakes the queue
  * up again.
  *
+ * The wait queue lock must be held on entry. It is dropped while the thread
+ * is blocked and reacquired before returning.
+ *
  * @param  wait     The wait queue to enter
  * @param  deadline The time at which to abort the wait
  *
@@ -1361,17 +1524,25 @@ status_t wait_queue_block(wait_queue_t *wait, lk_time_t deadline)
     DEBUG_ASSERT(wait->magic == WAIT_QUEUE_MAGIC);
     DEBUG_ASSERT(current_thread->state == THREAD_RUNNING);
     DEBUG_ASSERT(arch_ints_disabled());
-    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    DEBUG_ASSERT(spin_lock_held(&wait->lock));
+    DEBUG_ASSERT(!spin_lock_held(&thread_lock));
 
     if (deadline <= current_time())
         return ERR_TIMED_OUT;
 
+    /* signals are delivered under the thread lock, so check for them and go to
+     * sleep with it held to avoid missing a kill or suspend */
+    spin_lock(&thread_lock);
+
     if (current_thread->interruptable && unlikely(current_thread->signals)) {
+        status_t status = ERR_INTERRUPTED;
         if (current_thread->signals & THREAD_SIGNAL_KILL) {
-            return ERR_INTERRUPTED;
+            status = ERR_INTERRUPTED;
         } else if (current_thread->signals & THREAD_SIGNAL_SUSPEND) {
-            return ERR_INTERRUPTED_RETRY;
+            status = ERR_INTERRUPTED_RETRY;
         }
+        spin_unlock(&thread_lock);
+        return status;
     }
 
     list_add_tail(&wait->list, &current_thread->queue_node);
@@ -1380,14 +1551,27 @@ status_t wait_queue_block(wait_queue_t *wait, lk_time_t deadline)
     current_thread->blocking_wait_queue = wait;
     current_thread->blocked_status = NO_ERROR;
 
+    /* lend our priority to whoever we're waiting on */
+    if (wait->owner)
+        thread_update_priority_locked(wait->owner);
+
     /* if the deadline is nonzero or noninfinite, set a callback to yank us out of the queue */
     if (deadline != INFINITE_TIME) {
         timer_initialize(&timer);
-        timer_set_oneshot(&timer, deadline, wait_queue_timeout_handler, (void *)current_thread);
+        timer_set_oneshot_etc(&timer, deadline, current_thread->timer_slack,
+                              wait_queue_timeout_handler, (void *)current_thread);
     }
 
+    /* wakers need the thread lock to put us on a run queue, so they will not be able to
+     * touch us until we're off the cpu. let them at the wait queue in the meantime. */
+    spin_unlock(&wait->lock);
+
     sched_block();
 
+    /* we come back holding the thread lock, swap it for the wait queue lock */
+    spin_unlock(&thread_lock);
+    spin_lock(&wait->lock);
+
     /* we don't really know if the timer fired or not, so it's better safe to try to cancel it */
     if (deadline != INFINITE_TIME) {
         timer_cancel(&timer);
@@ -1404,29 +1588,23 @@ status_t wait_queue_block(wait_queue_t *wait, lk_time_t deadline)
  * run queue.
  *
  * @param wait  The wait queue to wake
- * @param reschedule  If true, the newly-woken thread will run immediately.
  * @param wait_queue_error  The return value which the new thread will receive
  * from wait_queue_block().
  *
  * @return  The number of threads woken (zero or one)
  */
-int wait_queue_wake_one(wait_queue_t *wait, bool reschedule, status_t wait_queue_error)
+int wait_queue_wake_one(wait_queue_t *wait, status_t wait_queue_error)
 {
     thread_t *t;
     int ret = 0;
 
     DEBUG_ASSERT(wait->magic == WAIT_QUEUE_MAGIC);
     DEBUG_ASSERT(arch_ints_disabled());
-    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    DEBUG_ASSERT(spin_lock_held(&wait->lock));
 
-    t = list_remove_head_type(&wait->list, thread_t, queue_node);
+    t = list_peek_head_type(&wait->list, thread_t, queue_node);
     if (t) {
-        wait->count--;
-        DEBUG_ASSERT(t->state == THREAD_BLOCKED);
-        t->blocked_status = wait_queue_error;
-        t->blocking_wait_queue = NULL;
-
-        sched_unblock(t, reschedule);
+        wait_queue_unblock_thread(wait, t, wait_queue_error);
 
         ret = 1;
     }
@@ -1443,31 +1621,31 @@ int wait_queue_wake_one(wait_queue_t *wait, bool reschedule, status_t wait_queue
  * run queue.
  *
  * @param wait  The wait queue to wake
- * @param reschedule  If true, the newly-woken threads will run immediately.
  * @param wait_queue_error  The return value which the new thread will receive
  * from wait_queue_block().
  *
  * @return  The number of threads woken
  */
-int wait_queue_wake_all(wait_queue_t *wait, bool reschedule, status_t wait_queue_error)
+int wait_queue_wake_all(wait_queue_t *wait, status_t wait_queue_error)
 {
     thread_t *t;
     int ret = 0;
 
     DEBUG_ASSERT(wait->magic == WAIT_QUEUE_MAGIC);
     DEBUG_ASSERT(arch_ints_disabled());
-    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    DEBUG_ASSERT(spin_lock_held(&wait->lock));
 
     if (wait->count == 0)
         return 0;
 
     struct list_node list = LIST_INITIAL_VALUE(list);
 
+    spin_lock(&thread_lock);
+
     /* pop all the threads off the wait queue into the run queue */
     while ((t = list_remove_head_type(&wait->list, thread_t, queue_node))) {
         wait->count--;
 
-        DEBUG_ASSERT(t->state == THREAD_BLOCKED);
         t->blocked_status = wait_queue_error;
         t->blocking_wait_queue = NULL;
 
@@ -1479,7 +1657,12 @@ int wait_queue_wake_all(wait_queue_t *wait, bool reschedule, status_t wait_queue
     DEBUG_ASSERT(ret > 0);
     DEBUG_ASSERT(wait->count == 0);
 
-    sched_unblock_list(&list, reschedule);
+    if (wait->owner)
+        thread_update_priority_locked(wait->owner);
+
+    /* move them all over to the run queues in one shot */
+    sched_unblock_list(&list, false);
+    spin_unlock(&thread_lock);
 
     return ret;
 }
@@ -1497,12 +1680,17 @@ void wait_queue_destroy(wait_queue_t *wait)
 {
     DEBUG_ASSERT(wait->magic == WAIT_QUEUE_MAGIC);
     DEBUG_ASSERT(arch_ints_disabled());
-    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    DEBUG_ASSERT(spin_lock_held(&wait->lock));
 
     if (!list_is_empty(&wait->list)) {
         panic("wait_queue_destroy() called on non-empty wait_queue_t\n");
     }
 
+    /* only an exiting owner can clear this behind our back, and that's handled
+     * by wait_queue_set_owner() rechecking under the thread lock */
+    if (wait->owner)
+        wait_queue_set_owner(wait, NULL);
+
     wait->magic = 0;
 }
 
@@ -1512,6 +1700,11 @@ void wait_queue_destroy(wait_queue_t *wait)
  * This function extracts a specific thread from a wait queue, wakes it, and
  * puts it at the head of the run queue.
  *
+ * Must be called with the thread lock held. Since the wait queue lock ranks
+ * above the thread lock, the thread lock may be dropped and reacquired while
+ * waiting for the wait queue lock; the thread's state must be rechecked by the
+ * caller if it matters.
+ *
  * @param t  The thread to wake
  * @param wait_queue_error  The return value which the new thread will receive
  *   from wait_queue_block().
@@ -1524,21 +1717,68 @@ status_t thread_unblock_from_wait_queue(thread_t *t, status_t wait_queue_error)
     DEBUG_ASSERT(arch_ints_disabled());
     DEBUG_ASSERT(spin_lock_held(&thread_lock));
 
-    if (t->state != THREAD_BLOCKED)
-        return ERR_BAD_STATE;
+    for (;;) {
+        if (t->state != THREAD_BLOCKED)
+            return ERR_BAD_STATE;
 
-    DEBUG_ASSERT(t->blocking_wait_queue != NULL);
-    DEBUG_ASSERT(t->blocking_wait_queue->magic == WAIT_QUEUE_MAGIC);
-    DEBUG_ASSERT(list_in_list(&t->queue_node));
+        /* a NULL wait queue on a blocked thread means a waker already pulled it off
+         * the queue and is waiting on the thread lock to finish the job. While the
+         * thread is on the queue, the queue can't be destroyed, so it's safe to poke
+         * at its lock. */
+        wait_queue_t *wait = t->blocking_wait_queue;
+        if (!wait)
+            return ERR_BAD_STATE;
 
-    list_delete(&t->queue_node);
-    t->blocking_wait_queue->count--;
-    t->blocking_wait_queue = NULL;
-    t->blocked_status = wait_queue_error;
+        DEBUG_ASSERT(wait->magic == WAIT_QUEUE_MAGIC);
 
-    sched_unblock(t, false);
+        if (spin_trylock(&wait->lock) == 0) {
+            status_t status = ERR_BAD_STATE;
+            if (t->blocking_wait_queue == wait) {
+                DEBUG_ASSERT(list_in_list(&t->queue_node));
 
-    return NO_ERROR;
+                list_delete(&t->queue_node);
+                wait->count--;
+                t->blocking_wait_queue = NULL;
+                t->blocked_status = wait_queue_error;
+
+                if (wait->owner)
+                    thread_update_priority_locked(wait->owner);
+
+                sched_unblock(t, false);
+                status = NO_ERROR;
+            }
+            spin_unlock(&wait->lock);
+            return status;
+        }
+
+        /* whoever holds the wait queue lock may need the thread lock to make
+         * progress, so back off and try again */
+        spin_unlock(&thread_lock);
+        arch_spinloop_pause();
+        spin_lock(&thread_lock);
+    }
+}
+
+/**
+ * @brief  Give up the cpu to any threads readied by a recent wakeup
+ *
+ * Wait queue wakeups never switch threads themselves, since they are done with
+ * the wait queue lock held. Callers that want the woken thread to run right
+ * away call this after dropping the lock.
+ */
+void thread_reschedule(void)
+{
+    __UNUSED thread_t *current_thread = get_current_thread();
+
+    DEBUG_ASSERT(current_thread->magic == THREAD_MAGIC);
+    DEBUG_ASSERT(current_thread->state == THREAD_RUNNING);
+    DEBUG_ASSERT(!arch_in_int_handler());
+
+    THREAD_LOCK(state);
+
+    sched_reschedule();
+
+    THREAD_UNLOCK(state);
 }
 
 #if WITH_PANIC_BACKTRACE
@@ -33,10 +33,15 @@
 
 #define LOCAL_TRACE 0
 
-spin_lock_t timer_lock;
-
+/* Pending timers are kept in a pairing heap per cpu, ordered by the latest time
+ * each one may fire (its deadline plus slack). The hardware timer is programmed
+ * for the root's latest time, and when it goes off every timer whose deadline
+ * has passed fires, in order, so timers with overlapping windows share a single
+ * interrupt.
+ */
 struct timer_state {
-    struct list_node timer_queue;
+    spin_lock_t lock;
+    timer_t *heap;
 } __CPU_ALIGN;
 
 static struct timer_state timers[SMP_MAX_CPUS];
@@ -51,39 +56,153 @@ void timer_initialize(timer_t *timer)
     *timer = (timer_t)TIMER_INITIAL_VALUE(*timer);
 }
 
-static void insert_timer_in_queue(uint cpu, timer_t *timer)
+/* the latest time the timer may fire */
+static inline lk_time_t timer_latest(const timer_t *timer)
 {
-    timer_t *entry;
+    return timer->scheduled_time + timer->slack;
+}
+
+/* merge two heap roots, returning the new root */
+static timer_t *heap_meld(timer_t *a, timer_t *b)
+{
+    if (!a)
+        return b;
+    if (!b)
+        return a;
+
+    if (TIME_LT(timer_latest(b), timer_latest(a))) {
+        timer_t *tmp = a;
+        a = b;
+        b = tmp;
+    }
+
+    /* b becomes the first child of a */
+    b->heap_prev = a;
+    b->heap_next = a->heap_child;
+    if (a->heap_child)
+        a->heap_child->heap_prev = b;
+    a->heap_child = b;
+
+    a->heap_next = NULL;
+    a->heap_prev = NULL;
+    return a;
+}
+
+/* standard two pass merge of a list of siblings into a single heap */
+static timer_t *heap_merge_pairs(timer_t *first)
+{
+    timer_t *merged = NULL;
+
+    /* meld pairs left to right, stacking up the results */
+    while (first) {
+        timer_t *a = first;
+        timer_t *b = a->heap_next;
+        first = b ? b->heap_next : NULL;
 
+        a->heap_next = a->heap_prev = NULL;
+        if (b)
+            b->heap_next = b->heap_prev = NULL;
+
+        timer_t *pair = heap_meld(a, b);
+        pair->heap_next = merged;
+        merged = pair;
+    }
+
+    /* then meld the stack right to left into one */
+    timer_t *root = NULL;
+    while (merged) {
+        timer_t *next = merged->heap_next;
+        merged->heap_next = NULL;
+        root = heap_meld(root, merged);
+        merged = next;
+    }
+
+    return root;
+}
+
+static void insert_timer_in_queue(uint cpu, timer_t *timer)
+{
     DEBUG_ASSERT(arch_ints_disabled());
+    DEBUG_ASSERT(spin_lock_held(&timers[cpu].lock));
+    DEBUG_ASSERT(timer->queue_cpu < 0);
 
-    LTRACEF("timer %p, cpu %u, scheduled %" PRIu64 ", periodic %" PRIu64 "\n", timer, cpu, timer->scheduled_time, timer->period);
+    LTRACEF("timer %p, cpu %u, scheduled %" PRIu64 ", slack %" PRIu64 ", periodic %" PRIu64 "\n",
+            timer, cpu, timer->scheduled_time, timer->slack, timer->period);
 
-    list_for_every_entry(&timers[cpu].timer_queue, entry, timer_t, node) {
-        if (TIME_GT(entry->scheduled_time, timer->scheduled_time)) {
-            list_add_before(&entry->node, &timer->node);
-            return;
-        }
+    timer->heap_child = timer->heap_next = timer->heap_prev = NULL;
+    timers[cpu].heap = heap_meld(timers[cpu].heap, timer);
+    timer->queue_cpu = cpu;
+}
+
+static void remove_timer_from_queue(uint cpu, timer_t *timer)
+{
+    DEBUG_ASSERT(spin_lock_held(&timers[cpu].lock));
+    DEBUG_ASSERT(timer->queue_cpu == (int)cpu);
+
+    if (timers[cpu].heap == timer) {
+        timers[cpu].heap = heap_merge_pairs(timer->heap_child);
+    } else {
+        /* unlink from the parent or previous sibling */
+        timer_t *prev = timer->heap_prev;
+        if (prev->heap_child == timer)
+            prev->heap_child = timer->heap_next;
+        else
+            prev->heap_next = timer->heap_next;
+        if (timer->heap_next)
+            timer->heap_next->heap_prev = prev;
+
+        /* and put its children back in the heap */
+        timers[cpu].heap = heap_meld(timers[cpu].heap, heap_merge_pairs(timer->heap_child));
     }
 
-    /* walked off the end of the list */
-    list_add_tail(&timers[cpu].timer_queue, &timer->node);
+    timer->heap_child = timer->heap_next = timer->heap_prev = NULL;
+    timer->queue_cpu = -1;
 }
 
-static void timer_set(timer_t *timer, lk_time_t deadline, lk_time_t period, timer_callback callback, void *arg)
+/* lock the cpu whose queue the timer is pending in or whose tick is running its
+ * callback, or the current cpu if neither. returns the cpu that was locked */
+static uint timer_lock_cpu(timer_t *timer)
 {
-    LTRACEF("timer %p, deadline %" PRIu64 ", period %" PRIu64 ", callback %p, arg %p\n", timer, deadline, period, callback, arg);
+    DEBUG_ASSERT(arch_ints_disabled());
+
+    for (;;) {
+        int cpu = timer->queue_cpu;
+        if (cpu < 0)
+            cpu = timer->active_cpu;
+        if (cpu < 0)
+            cpu = arch_curr_cpu_num();
+
+        spin_lock(&timers[cpu].lock);
+
+        /* both fields only change with that cpu's lock held, so make sure we
+         * didn't race with the timer moving */
+        int owner = timer->queue_cpu;
+        if (owner < 0)
+            owner = timer->active_cpu;
+        if (owner < 0 || owner == cpu)
+            return cpu;
+
+        spin_unlock(&timers[cpu].lock);
+    }
+}
+
+static void timer_set(timer_t *timer, lk_time_t deadline, lk_time_t slack, lk_time_t period,
+                      timer_callback callback, void *arg)
+{
+    LTRACEF("timer %p, deadline %" PRIu64 ", slack %" PRIu64 ", period %" PRIu64 ", callback %p, arg %p\n",
+            timer, deadline, slack, period, callback, arg);
 
     DEBUG_ASSERT(timer->magic == TIMER_MAGIC);
 
-    if (list_in_list(&timer->node)) {
-        panic("timer %p already in list\n", timer);
+    if (timer->queue_cpu >= 0) {
+        panic("timer %p already in queue\n", timer);
     }
 
     spin_lock_saved_state_t state;
-    spin_lock_irqsave(&timer_lock, state);
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
 
     uint cpu = arch_curr_cpu_num();
+    spin_lock(&timers[cpu].lock);
 
     if (unlikely(timer->active_cpu == (int)cpu)) {
         /* the timer is active on our own cpu, we must be inside the callback */
@@ -95,10 +214,10 @@ static void timer_set(timer_t *timer, lk_time_t deadline, lk_time_t period, time
 
     /* set up the structure */
     timer->scheduled_time = deadline;
+    timer->slack = slack;
     timer->period = period;
     timer->callback = callback;
     timer->arg = arg;
-    timer->active_cpu = -1;
     timer->cancel = false;
 
     LTRACEF("scheduled time %" PRIu64 "\n", timer->scheduled_time);
@@ -106,15 +225,17 @@ static void timer_set(timer_t *timer, lk_time_t deadline, lk_time_t period, time
     insert_timer_in_queue(cpu, timer);
 
 #if PLATFORM_HAS_DYNAMIC_TIMER
-    if (list_peek_head_type(&timers[cpu].timer_queue, timer_t, node) == timer) {
-        /* we just modified the head of the timer queue */
-        LTRACEF("setting new timer for %" PRIu64 " nsecs\n", deadline);
-        platform_set_oneshot_timer(timer_tick, NULL, deadline);
+    if (timers[cpu].heap == timer) {
+        /* we just modified the head of the timer queue. anything that was due before
+         * the new one will be picked up when it fires */
+        LTRACEF("setting new timer for %" PRIu64 " nsecs\n", timer_latest(timer));
+        platform_set_oneshot_timer(timer_tick, NULL, timer_latest(timer));
     }
 #endif
 
 out:
-    spin_unlock_irqrestore(&timer_lock, state);
+    spin_unlock(&timers[cpu].lock);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
 }
 
 /**
@@ -133,7 +254,26 @@ out:
  */
 void timer_set_oneshot(timer_t *timer, lk_time_t deadline, timer_callback callback, void *arg)
 {
-    timer_set(timer, deadline, 0, callback, arg);
+    timer_set(timer, deadline, 0, 0, callback, arg);
+}
+
+/**
+ * @brief  Set up a timer that executes once, within a window
+ *
+ * Like timer_set_oneshot(), but the callback may be run as late as
+ * deadline + slack. This lets the timer share a hardware interrupt with
+ * other timers that expire around the same time.
+ *
+ * @param  timer The timer to use
+ * @param  deadline The deadline, in ns, after which the timer is executed
+ * @param  slack  How long, in ns, past the deadline the timer may be delayed
+ * @param  callback  The function to call when the timer expires
+ * @param  arg  The argument to pass to the callback
+ */
+void timer_set_oneshot_etc(timer_t *timer, lk_time_t deadline, lk_time_t slack,
+                           timer_callback callback, void *arg)
+{
+    timer_set(timer, deadline, slack, 0, callback, arg);
 }
 
 /**
@@ -154,7 +294,7 @@ void timer_set_periodic(timer_t *timer, lk_time_t period, timer_callback callbac
 {
     if (period == 0)
         period = 1;
-    timer_set(timer, current_time() + period, period, callback, arg);
+    timer_set(timer, current_time() + period, 0, period, callback, arg);
 }
 
 /**
@@ -165,9 +305,10 @@ void timer_cancel(timer_t *timer)
     DEBUG_ASSERT(timer->magic == TIMER_MAGIC);
 
     spin_lock_saved_state_t state;
-    spin_lock_irqsave(&timer_lock, state);
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
 
-    uint cpu = arch_curr_cpu_num();
+    uint curr_cpu = arch_curr_cpu_num();
+    uint cpu = timer_lock_cpu(timer);
 
     /* mark the timer as cancelled */
     timer->cancel = true;
@@ -177,41 +318,47 @@ void timer_cancel(timer_t *timer)
     arch_spinloop_signal();
 
     /* see if we're trying to cancel the timer we're currently in the middle of handling */
-    if (unlikely(timer->active_cpu == (int)cpu)) {
+    if (unlikely(timer->active_cpu == (int)curr_cpu)) {
         /* zero it out */
         timer->callback = NULL;
         timer->arg = NULL;
         timer->period = 0;
 
         /* we're done, so return back to the callback */
-        spin_unlock_irqrestore(&timer_lock, state);
+        spin_unlock(&timers[cpu].lock);
+        arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
         return;
     }
 
     /* if the timer is in a queue, remove it and adjust hardware timers if needed */
-    if (list_in_list(&timer->node)) {
+    if (timer->queue_cpu >= 0) {
+        DEBUG_ASSERT(timer->queue_cpu == (int)cpu);
+
 #if PLATFORM_HAS_DYNAMIC_TIMER
-        timer_t *oldhead = list_peek_head_type(&timers[cpu].timer_queue, timer_t, node);
+        timer_t *oldhead = timers[cpu].heap;
 #endif
 
         /* remove it from the queue */
-        list_delete(&timer->node);
+        remove_timer_from_queue(cpu, timer);
 
 #if PLATFORM_HAS_DYNAMIC_TIMER
         /* see if we've just modified the head of this cpu's timer queue */
         /* if we modified another cpu's queue, we'll just let it fire and sort itself out */
-        timer_t *newhead = list_peek_head_type(&timers[cpu].timer_queue, timer_t, node);
-        if (newhead == NULL) {
-            LTRACEF("clearing old hw timer, nothing in the queue\n");
-            platform_stop_timer();
-        } else if (newhead != oldhead) {
-            LTRACEF("setting new timer to %" PRIu64 "\n", newhead->scheduled_time);
-            platform_set_oneshot_timer(timer_tick, NULL, newhead->scheduled_time);
+        if (cpu == curr_cpu) {
+            timer_t *newhead = timers[cpu].heap;
+            if (newhead == NULL) {
+                LTRACEF("clearing old hw timer, nothing in the queue\n");
+                platform_stop_timer();
+            } else if (newhead != oldhead) {
+                LTRACEF("setting new timer to %" PRIu64 "\n", timer_latest(newhead));
+                platform_set_oneshot_timer(timer_tick, NULL, timer_latest(newhead));
+            }
         }
 #endif
     }
 
-    spin_unlock_irqrestore(&timer_lock, state);
+    spin_unlock(&timers[cpu].lock);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
 
     /* wait for the timer to become un-busy in case a callback is currently active on another cpu */
     while (timer->active_cpu >= 0) {
@@ -238,11 +385,13 @@ static enum handler_return timer_tick(void *arg, lk_time_t now)
 
     LTRACEF("cpu %u now %" PRIu64 ", sp %p\n", cpu, now, __GET_FRAME());
 
-    spin_lock(&timer_lock);
+    spin_lock(&timers[cpu].lock);
 
     for (;;) {
-        /* see if there's an event to process */
-        timer = list_peek_head_type(&timers[cpu].timer_queue, timer_t, node);
+        /* see if there's an event to process. the root is the timer that has to fire
+         * soonest; keep going while its window has opened so that timers with
+         * overlapping windows are handled in this one interrupt */
+        timer = timers[cpu].heap;
         if (likely(timer == 0))
             break;
         LTRACEF("next item on timer queue %p at %" PRIu64 " now %" PRIu64 " (%p, arg %p)\n", timer, timer->scheduled_time, now, timer->callback, timer->arg);
@@ -254,14 +403,14 @@ static enum handler_return timer_tick(void *arg, lk_time_t now)
         DEBUG_ASSERT_MSG(timer && timer->magic == TIMER_MAGIC,
                 "ASSERT: timer failed magic check: timer %p, magic 0x%x\n",
                 timer, (uint)timer->magic);
-        list_delete(&timer->node);
+        remove_timer_from_queue(cpu, timer);
 
         /* mark the timer busy */
         timer->active_cpu = cpu;
         /* spinlock below acts as a memory barrier */
 
-        /* we pulled it off the list, release the list lock to handle it */
-        spin_unlock(&timer_lock);
+        /* we pulled it off the queue, release the queue lock to handle it */
+        spin_unlock(&timers[cpu].lock);
 
         LTRACEF("dequeued timer %p, scheduled %" PRIu64 " periodic %" PRIu64 "\n", timer, timer->scheduled_time, timer->period);
 
@@ -273,7 +422,7 @@ static enum handler_return timer_tick(void *arg, lk_time_t now)
 
         DEBUG_ASSERT(arch_ints_disabled());
         /* it may have been requeued or periodic, grab the lock so we can safely inspect it */
-        spin_lock(&timer_lock);
+        spin_lock(&timers[cpu].lock);
 
         /* record whether or not we've been cancelled in the meantime */
         bool cancelled = timer->cancel;
@@ -288,9 +437,9 @@ static enum handler_return timer_tick(void *arg, lk_time_t now)
         /* if we've been cancelled, it's not okay to touch the timer structure from now on out */
         if (!cancelled) {
             /* if it is a periodic timer and it hasn't been requeued
-             * by the callback put it back in the list
+             * by the callback put it back in the queue
              */
-            if (timer->period > 0 && !list_in_list(&timer->node)) {
+            if (timer->period > 0 && timer->queue_cpu < 0) {
                 LTRACEF("periodic timer, period %" PRIu64 "\n", timer->period);
                 timer->scheduled_time = now + timer->period;
                 insert_timer_in_queue(cpu, timer);
@@ -300,21 +449,21 @@ static enum handler_return timer_tick(void *arg, lk_time_t now)
 
 #if PLATFORM_HAS_DYNAMIC_TIMER
     /* reset the timer to the next event */
-    timer = list_peek_head_type(&timers[cpu].timer_queue, timer_t, node);
+    timer = timers[cpu].heap;
     if (timer) {
         /* has to be the case or it would have fired already */
         DEBUG_ASSERT(TIME_GT(timer->scheduled_time, now));
 
-        LTRACEF("setting new timer for %" PRIu64 " nsecs for event %p\n", timer->scheduled_time,
+        LTRACEF("setting new timer for %" PRIu64 " nsecs for event %p\n", timer_latest(timer),
                 timer);
-        platform_set_oneshot_timer(timer_tick, NULL, timer->scheduled_time);
+        platform_set_oneshot_timer(timer_tick, NULL, timer_latest(timer));
     }
 
     /* we're done manipulating the timer queue */
-    spin_unlock(&timer_lock);
+    spin_unlock(&timers[cpu].lock);
 #else
     /* release the timer lock before calling the tick handler */
-    spin_unlock(&timer_lock);
+    spin_unlock(&timers[cpu].lock);
 
     /* let the scheduler have a shot to do quantum expiration, etc */
     /* in case of dynamic timer, the scheduler will set up a periodic timer */
@@ -346,28 +495,36 @@ status_t timer_trylock_or_cancel(timer_t *t, spin_lock_t *lock)
 void timer_transition_off_cpu(uint old_cpu)
 {
     spin_lock_saved_state_t state;
-    spin_lock_irqsave(&timer_lock, state);
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
     uint cpu = arch_curr_cpu_num();
 
-    timer_t *old_head = list_peek_head_type(&timers[old_cpu].timer_queue, timer_t, node);
+    DEBUG_ASSERT(cpu != old_cpu);
+
+    /* take the two queue locks in cpu order */
+    spin_lock(&timers[MIN(cpu, old_cpu)].lock);
+    spin_lock(&timers[MAX(cpu, old_cpu)].lock);
+
+    timer_t *old_head = timers[cpu].heap;
 
-    timer_t *entry = NULL, *tmp_entry = NULL;
     /* Move all timers from old_cpu to this cpu */
-    list_for_every_entry_safe(&timers[old_cpu].timer_queue, entry, tmp_entry, timer_t, node) {
-        list_delete(&entry->node);
+    timer_t *entry;
+    while ((entry = timers[old_cpu].heap) != NULL) {
+        remove_timer_from_queue(old_cpu, entry);
         insert_timer_in_queue(cpu, entry);
     }
 
 #if PLATFORM_HAS_DYNAMIC_TIMER
-    timer_t *new_head = list_peek_head_type(&timers[cpu].timer_queue, timer_t, node);
+    timer_t *new_head = timers[cpu].heap;
     if (new_head != NULL && new_head != old_head) {
         /* we just modified the head of the timer queue */
-        LTRACEF("setting new timer for %" PRIu64 " nsecs\n", new_head->scheduled_time);
-        platform_set_oneshot_timer(timer_tick, NULL, new_head->scheduled_time);
+        LTRACEF("setting new timer for %" PRIu64 " nsecs\n", timer_latest(new_head));
+        platform_set_oneshot_timer(timer_tick, NULL, timer_latest(new_head));
     }
 #endif
 
-    spin_unlock_irqrestore(&timer_lock, state);
+    spin_unlock(&timers[MAX(cpu, old_cpu)].lock);
+    spin_unlock(&timers[MIN(cpu, old_cpu)].lock);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
 }
 
 /* This function is to be invoked after resume on each CPU that may have
@@ -376,25 +533,25 @@ void timer_thaw_percpu(void)
 {
 #if PLATFORM_HAS_DYNAMIC_TIMER
     DEBUG_ASSERT(arch_ints_disabled());
-    spin_lock(&timer_lock);
 
     uint cpu = arch_curr_cpu_num();
+    spin_lock(&timers[cpu].lock);
 
-    timer_t *t = list_peek_head_type(&timers[cpu].timer_queue, timer_t, node);
+    timer_t *t = timers[cpu].heap;
     if (t) {
-        LTRACEF("rescheduling timer for %" PRIu64 " nsecs\n", t->scheduled_time);
-        platform_set_oneshot_timer(timer_tick, NULL, t->scheduled_time);
+        LTRACEF("rescheduling timer for %" PRIu64 " nsecs\n", timer_latest(t));
+        platform_set_oneshot_timer(timer_tick, NULL, timer_latest(t));
     }
 
-    spin_unlock(&timer_lock);
+    spin_unlock(&timers[cpu].lock);
 #endif
 }
 
 void timer_init(void)
 {
-    timer_lock = SPIN_LOCK_INITIAL_VALUE;
     for (uint i = 0; i < SMP_MAX_CPUS; i++) {
-        list_initialize(&timers[i].timer_queue);
+        timers[i].lock = SPIN_LOCK_INITIAL_VALUE;
+        timers[i].heap = NULL;
     }
 #if !PLATFORM_HAS_DYNAMIC_TIMER
     /* register for a periodic timer tick */
@@ -0,0 +1,92 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include "kernel/vm/page_source.h"
+
+#include "vm_priv.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <kernel/vm/vm_object_paged.h>
+#include <trace.h>
+
+#define LOCAL_TRACE MAX(VM_GLOBAL_TRACE, 0)
+
+void PageSource::Attach(VmObjectPaged* object) {
+    {
+        AutoLock a(&lock_);
+        DEBUG_ASSERT(!object_);
+        object_ = object;
+    }
+    OnAttach();
+}
+
+void PageSource::Detach() {
+    {
+        AutoLock a(&lock_);
+        object_ = nullptr;
+    }
+    OnDetach();
+}
+
+void PageSource::FailRequests(status_t status) {
+    // holding our lock keeps the object from going away underneath us
+    AutoLock a(&lock_);
+    if (object_)
+        object_->FailPageRequests(0, UINT64_MAX, status);
+}
+
+PageRequest::PageRequest(mxtl::RefPtr<PageSource> source, uint64_t offset, uint64_t len)
+    : source_(mxtl::move(source)), offset_(offset), len_(len), sent_(0), status_(kPending) {
+    LTRACEF("%p offset %#" PRIx64 " len %#" PRIx64 "\n", this, offset, len);
+    event_init(&event_, false, 0);
+}
+
+PageRequest::~PageRequest() {
+    canary_.Assert();
+    LTRACEF("%p\n", this);
+    event_destroy(&event_);
+}
+
+void PageRequest::Send() {
+    canary_.Assert();
+
+    if (status_.load() != kPending || sent_.exchange(1))
+        return;
+
+    status_t status = source_->RequestPages(offset_, len_);
+    LTRACEF("%p sent, status %d\n", this, status);
+
+    // nobody is going to answer it
+    if (status != NO_ERROR)
+        Complete(status < 0 ? status : ERR_INTERNAL);
+}
+
+status_t PageRequest::Wait() {
+    canary_.Assert();
+
+    Send();
+
+    status_t status = event_wait_deadline(&event_, INFINITE_TIME, true);
+    LTRACEF("%p status %d\n", this, status);
+    if (status != NO_ERROR)
+        return status;
+    return status_.load();
+}
+
+void PageRequest::Complete(status_t status) {
+    canary_.Assert();
+    DEBUG_ASSERT(status <= NO_ERROR);
+    LTRACEF("%p status %d\n", this, status);
+
+    status_t expected = kPending;
+    if (!status_.compare_exchange_strong(&expected, status, mxtl::memory_order_seq_cst,
+                                         mxtl::memory_order_seq_cst))
+        return;
+
+    // usually called with the object's lock held, which the waiters need next
+    event_signal(&event_, false);
+}
@@ -10,8 +10,11 @@
 #include <err.h>
 #include <inttypes.h>
 #include <kernel/auto_lock.h>
+#include <kernel/event.h>
 #include <kernel/mp.h>
 #include <kernel/mutex.h>
+#include <kernel/spinlock.h>
+#include <kernel/thread.h>
 #include <kernel/timer.h>
 #include <kernel/vm.h>
 #include <lib/console.h>
@@ -35,6 +38,43 @@ static Mutex arena_lock;
 static mxtl::DoublyLinkedList<PmmArena*> arena_list TA_GUARDED(arena_lock);
 static size_t arena_cumulative_size TA_GUARDED(arena_lock);
 
+// Per cpu magazines of free pages sitting in front of the arenas. Single page
+// allocations and frees are served from the local magazine under a cheap
+// uncontended spinlock, and only go to the arenas to refill or drain a batch
+// of pages at a time. Only pages from KMAP arenas are cached, so a cached page
+// is good for any allocation flags.
+//
+// Pages in a magazine are still marked allocated as far as the arenas are
+// concerned.
+#define PMM_CACHE_MAX 64
+#define PMM_CACHE_BATCH 16
+
+struct pmm_cache {
+    spin_lock_t lock;
+    list_node pages;
+    size_t count;
+
+    // statistics
+    uint64_t alloc_hits;
+    uint64_t alloc_misses;
+    uint64_t free_hits;
+    uint64_t refills;
+    uint64_t drains;
+} __CPU_ALIGN;
+
+static pmm_cache pmm_caches[SMP_MAX_CPUS];
+
+static void pmm_cache_init(uint level) {
+    for (auto& c : pmm_caches) {
+        c.lock = SPIN_LOCK_INITIAL_VALUE;
+        list_initialize(&c.pages);
+    }
+}
+LK_INIT_HOOK(pmm_cache, &pmm_cache_init, LK_INIT_LEVEL_VM);
+
+static size_t pmm_alloc_pages_locked(size_t count, uint alloc_flags, list_node* list) TA_REQ(arena_lock);
+static size_t pmm_free_locked(list_node* list) TA_REQ(arena_lock);
+
 #if PMM_ENABLE_FREE_FILL
 static void pmm_enforce_fill(uint level) {
     for (auto& a : arena_list) {
@@ -105,9 +145,142 @@ done_add:
     return NO_ERROR;
 }
 
-vm_page_t* pmm_alloc_page(uint alloc_flags, paddr_t* pa) {
-    AutoLock al(&arena_lock);
+// We don't need to hold the arena lock while executing this, since it is
+// only accesses values that are set once during system initialization.
+static bool pmm_page_is_cacheable(const vm_page_t* page) TA_NO_THREAD_SAFETY_ANALYSIS {
+    for (const auto& a : arena_list) {
+        if (a.page_belongs_to_arena(page))
+            return (a.flags() & PMM_ARENA_FLAG_KMAP) != 0;
+    }
+    return false;
+}
+
+// Finish handing a page out of the pmm: zero it if the caller asked for that
+// and it wasn't already zeroed in the background, and drop the free page flags.
+static void pmm_finish_alloc(vm_page_t* page, uint alloc_flags) {
+    if ((alloc_flags & PMM_ALLOC_FLAG_ZEROED) && !(page->flags & VM_PAGE_FLAG_ZEROED)) {
+        void* ptr = paddr_to_kvaddr(vm_page_to_paddr(page));
+        DEBUG_ASSERT(ptr);
+        arch_zero_page(ptr);
+    }
+    page->flags &= ~VM_PAGE_FLAG_ZEROED;
+}
+
+// Try to pull a page out of the current cpu's magazine. Like the arena free
+// lists, magazines keep dirty pages at the head and zeroed ones at the tail.
+static vm_page_t* pmm_cache_alloc(bool zeroed) {
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    pmm_cache* cache = &pmm_caches[arch_curr_cpu_num()];
+    spin_lock(&cache->lock);
+
+    vm_page_t* page = zeroed ? list_remove_tail_type(&cache->pages, vm_page_t, free.node)
+                             : list_remove_head_type(&cache->pages, vm_page_t, free.node);
+    if (page) {
+        cache->count--;
+        cache->alloc_hits++;
+    } else {
+        cache->alloc_misses++;
+    }
+
+    spin_unlock(&cache->lock);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    return page;
+}
+
+// Add as many pages from |list| to the current cpu's magazine as will fit,
+// returning how many were taken. If the magazine is full, a batch is moved
+// out to |drain| for the caller to give back to the arenas.
+static size_t pmm_cache_free(list_node* list, list_node* drain) {
+    size_t count = 0;
+
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    pmm_cache* cache = &pmm_caches[arch_curr_cpu_num()];
+    spin_lock(&cache->lock);
+
+    if (cache->count >= PMM_CACHE_MAX) {
+        for (size_t i = 0; i < PMM_CACHE_BATCH; i++) {
+            vm_page_t* page = list_remove_tail_type(&cache->pages, vm_page_t, free.node);
+            list_add_tail(drain, &page->free.node);
+        }
+        cache->count -= PMM_CACHE_BATCH;
+        cache->drains++;
+    }
+
+    while (cache->count < PMM_CACHE_MAX) {
+        vm_page_t* page = list_remove_head_type(list, vm_page_t, free.node);
+        if (!page)
+            break;
+
+        DEBUG_ASSERT(!page_is_free(page));
+        DEBUG_ASSERT(!(page->flags & VM_PAGE_FLAG_ZEROED));
+        page->state = VM_PAGE_STATE_ALLOC;
+
+        list_add_head(&cache->pages, &page->free.node);
+        cache->count++;
+        cache->free_hits++;
+        count++;
+    }
+
+    spin_unlock(&cache->lock);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
 
+    return count;
+}
+
+// Put freshly allocated pages in the current cpu's magazine, returning any
+// that don't fit back to |list|.
+static void pmm_cache_refill(list_node* list) {
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    pmm_cache* cache = &pmm_caches[arch_curr_cpu_num()];
+    spin_lock(&cache->lock);
+
+    while (cache->count < PMM_CACHE_MAX) {
+        vm_page_t* page = list_remove_head_type(list, vm_page_t, free.node);
+        if (!page)
+            break;
+        if (page->flags & VM_PAGE_FLAG_ZEROED)
+            list_add_tail(&cache->pages, &page->free.node);
+        else
+            list_add_head(&cache->pages, &page->free.node);
+        cache->count++;
+    }
+    cache->refills++;
+
+    spin_unlock(&cache->lock);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+}
+
+// Empty every cpu's magazine back into the arenas, returning how many pages
+// were released.
+static size_t pmm_cache_drain_all() TA_REQ(arena_lock) {
+    list_node list = LIST_INITIAL_VALUE(list);
+
+    for (auto& c : pmm_caches) {
+        spin_lock_saved_state_t state;
+        spin_lock_irqsave(&c.lock, state);
+
+        if (c.count > 0) {
+            list_node* node;
+            while ((node = list_remove_head(&c.pages)))
+                list_add_tail(&list, node);
+            c.count = 0;
+            c.drains++;
+        }
+
+        spin_unlock_irqrestore(&c.lock, state);
+    }
+
+    return pmm_free_locked(&list);
+}
+
+static vm_page_t* pmm_alloc_page_locked(uint alloc_flags, paddr_t* pa) TA_REQ(arena_lock) {
     /* walk the arenas in order until we find one with a free page */
     for (auto& a : arena_list) {
         /* skip the arena if it's not KMAP and the KMAP only allocation flag was passed */
@@ -122,21 +295,48 @@ vm_page_t* pmm_alloc_page(uint alloc_flags, paddr_t* pa) {
             return page;
     }
 
-    LTRACEF("failed to allocate page\n");
     return nullptr;
 }
 
-size_t pmm_alloc_pages(size_t count, uint alloc_flags, struct list_node* list) {
-    LTRACEF("count %zu\n", count);
+vm_page_t* pmm_alloc_page(uint alloc_flags, paddr_t* pa) {
+    vm_page_t* page = pmm_cache_alloc(alloc_flags & PMM_ALLOC_FLAG_ZEROED);
+    if (!page) {
+        AutoLock al(&arena_lock);
+
+        // pull a batch out of the KMAP arenas for the magazine while we're here
+        list_node list = LIST_INITIAL_VALUE(list);
+        size_t allocated = pmm_alloc_pages_locked(PMM_CACHE_BATCH,
+                                                  PMM_ALLOC_FLAG_KMAP | (alloc_flags & PMM_ALLOC_FLAG_ZEROED),
+                                                  &list);
+        if (allocated == 0) {
+            // the KMAP arenas may be empty, or all of the free pages may be
+            // sitting in other cpus' magazines
+            pmm_cache_drain_all();
+
+            page = pmm_alloc_page_locked(alloc_flags, nullptr);
+            if (!page) {
+                LTRACEF("failed to allocate page\n");
+                return nullptr;
+            }
+        } else {
+            page = list_remove_head_type(&list, vm_page_t, free.node);
+            if (!list_is_empty(&list)) {
+                pmm_cache_refill(&list);
 
-    /* list must be initialized prior to calling this */
-    DEBUG_ASSERT(list);
+                // someone else refilled the magazine first, hand back the extras
+                pmm_free_locked(&list);
+            }
+        }
+    }
 
-    if (count == 0)
-        return 0;
+    pmm_finish_alloc(page, alloc_flags);
 
-    AutoLock al(&arena_lock);
+    if (pa)
+        *pa = vm_page_to_paddr(page);
+    return page;
+}
 
+static size_t pmm_alloc_pages_locked(size_t count, uint alloc_flags, struct list_node* list) TA_REQ(arena_lock) {
     /* walk the arenas in order, allocating as many pages as we can from each */
     size_t allocated = 0;
     for (auto& a : arena_list) {
@@ -149,7 +349,7 @@ size_t pmm_alloc_pages(size_t count, uint alloc_flags, struct list_node* list) {
         }
 
         // ask the arena to allocate some pages
-        allocated += a.AllocPages(count - allocated, list);
+        allocated += a.AllocPages(count - allocated, list, alloc_flags & PMM_ALLOC_FLAG_ZEROED);
         DEBUG_ASSERT(allocated <= count);
         if (allocated == count)
             break;
@@ -158,6 +358,37 @@ size_t pmm_alloc_pages(size_t count, uint alloc_flags, struct list_node* list) {
     return allocated;
 }
 
+size_t pmm_alloc_pages(size_t count, uint alloc_flags, struct list_node* list) {
+    LTRACEF("count %zu\n", count);
+
+    /* list must be initialized prior to calling this */
+    DEBUG_ASSERT(list);
+
+    if (count == 0)
+        return 0;
+
+    list_node pages = LIST_INITIAL_VALUE(pages);
+    size_t allocated;
+    {
+        AutoLock al(&arena_lock);
+
+        allocated = pmm_alloc_pages_locked(count, alloc_flags, &pages);
+        if (allocated < count && pmm_cache_drain_all() > 0) {
+            /* try again with the pages that were sitting in the magazines */
+            allocated += pmm_alloc_pages_locked(count - allocated, alloc_flags, &pages);
+        }
+    }
+
+    /* zero whatever wasn't zeroed already outside of the lock */
+    vm_page_t* page;
+    while ((page = list_remove_head_type(&pages, vm_page_t, free.node))) {
+        pmm_finish_alloc(page, alloc_flags);
+        list_add_tail(list, &page->free.node);
+    }
+
+    return allocated;
+}
+
 size_t pmm_alloc_range(paddr_t address, size_t count, struct list_node* list) {
     LTRACEF("address %#" PRIxPTR ", count %zu\n", address, count);
 
@@ -169,12 +400,16 @@ size_t pmm_alloc_range(paddr_t address, size_t count, struct list_node* list) {
 
     AutoLock al(&arena_lock);
 
+    /* any of the pages could be sitting in a magazine */
+    pmm_cache_drain_all();
+
     /* walk through the arenas, looking to see if the physical page belongs to it */
     for (auto& a : arena_list) {
         while (allocated < count && a.address_in_arena(address)) {
             vm_page_t* page = a.AllocSpecific(address);
             if (!page)
                 break;
+            pmm_finish_alloc(page, 0);
 
             if (list)
                 list_add_tail(list, &page->free.node);
@@ -201,18 +436,34 @@ size_t pmm_alloc_contiguous(size_t count, uint alloc_flags, uint8_t alignment_lo
 
     AutoLock al(&arena_lock);
 
-    for (auto& a : arena_list) {
-        /* skip the arena if it's not KMAP and the KMAP only allocation flag was passed */
-        if (alloc_flags & PMM_ALLOC_FLAG_KMAP) {
-            if ((a.flags() & PMM_ARENA_FLAG_KMAP) == 0)
-                continue;
-        }
+    /* if we don't find a run the first time, give back the pages in the
+     * magazines, which may be breaking one up, and look again */
+    for (int pass = 0; pass < 2; pass++) {
+        for (auto& a : arena_list) {
+            /* skip the arena if it's not KMAP and the KMAP only allocation flag was passed */
+            if (alloc_flags & PMM_ALLOC_FLAG_KMAP) {
+                if ((a.flags() & PMM_ARENA_FLAG_KMAP) == 0)
+                    continue;
+            }
+
+            paddr_t run_pa;
+            size_t allocated = a.AllocContiguous(count, alignment_log2, &run_pa, list);
+            if (allocated > 0) {
+                DEBUG_ASSERT(allocated == count);
 
-        size_t allocated = a.AllocContiguous(count, alignment_log2, pa, list);
-        if (allocated > 0) {
-            DEBUG_ASSERT(allocated == count);
-            return allocated;
+                size_t index = (run_pa - a.base()) / PAGE_SIZE;
+                for (size_t i = 0; i < count; i++) {
+                    pmm_finish_alloc(a.get_page(index + i), alloc_flags);
+                }
+
+                if (pa)
+                    *pa = run_pa;
+                return allocated;
+            }
         }
+
+        if (pmm_cache_drain_all() == 0)
+            break;
     }
 
     LTRACEF("couldn't find run\n");
@@ -288,13 +539,80 @@ size_t pmm_free_kpages(void* _ptr, size_t count) {
     return pmm_free(&list);
 }
 
-size_t pmm_free(struct list_node* list) {
-    LTRACEF("list %p\n", list);
+#if !PMM_ENABLE_FREE_FILL
+// Free pages are zeroed ahead of time by a low priority thread, so that
+// PMM_ALLOC_FLAG_ZEROED allocations can usually skip doing it themselves.
+#define PMM_ZERO_BATCH 16
+
+static event_t zero_event = EVENT_INITIAL_VALUE(zero_event, false, EVENT_FLAG_AUTOUNSIGNAL);
+static bool zero_thread_idle TA_GUARDED(arena_lock);
+static uint64_t zero_thread_pages TA_GUARDED(arena_lock);
+
+static int pmm_zero_thread(void* arg) {
+    for (;;) {
+        PmmArena* arenas[PMM_ZERO_BATCH];
+        vm_page_t* pages[PMM_ZERO_BATCH];
+        size_t count = 0;
+
+        // grab a batch of dirty pages from the KMAP arenas
+        {
+            AutoLock al(&arena_lock);
+
+            for (auto& a : arena_list) {
+                if ((a.flags() & PMM_ARENA_FLAG_KMAP) == 0)
+                    continue;
+
+                while (count < PMM_ZERO_BATCH) {
+                    vm_page_t* page = a.TakeDirtyPage();
+                    if (!page)
+                        break;
+                    arenas[count] = &a;
+                    pages[count] = page;
+                    count++;
+                }
+                if (count == PMM_ZERO_BATCH)
+                    break;
+            }
 
-    DEBUG_ASSERT(list);
+            // nothing left to do, wait for something to be freed
+            if (count == 0)
+                zero_thread_idle = true;
+        }
 
-    AutoLock al(&arena_lock);
+        if (count == 0) {
+            event_wait(&zero_event);
+            continue;
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            void* ptr = paddr_to_kvaddr(arenas[i]->page_address_from_arena(pages[i]));
+            DEBUG_ASSERT(ptr);
+            arch_zero_page(ptr);
+        }
 
+        {
+            AutoLock al(&arena_lock);
+
+            for (size_t i = 0; i < count; i++) {
+                arenas[i]->ReturnZeroedPage(pages[i]);
+            }
+            zero_thread_pages += count;
+        }
+    }
+
+    return 0;
+}
+
+static void pmm_zero_thread_init(uint level) {
+    // run just above the idle threads, so zeroing only happens when a cpu has nothing else to do
+    thread_t* t = thread_create("pmm zero", &pmm_zero_thread, nullptr, LOWEST_PRIORITY + 1,
+                                DEFAULT_STACK_SIZE);
+    thread_detach_and_resume(t);
+}
+LK_INIT_HOOK(pmm_zero, &pmm_zero_thread_init, LK_INIT_LEVEL_THREADING);
+#endif // !PMM_ENABLE_FREE_FILL
+
+static size_t pmm_free_locked(struct list_node* list) TA_REQ(arena_lock) {
     uint count = 0;
     while (!list_is_empty(list)) {
         vm_page_t* page = list_remove_head_type(list, vm_page_t, free.node);
@@ -310,18 +628,52 @@ size_t pmm_free(struct list_node* list) {
         }
     }
 
-    LTRACEF("returning count %u\n", count);
+#if !PMM_ENABLE_FREE_FILL
+    // give the zeroing thread something to do
+    if (count > 0 && zero_thread_idle) {
+        zero_thread_idle = false;
+        event_signal(&zero_event, false);
+    }
+#endif
+
+    return count;
+}
+
+size_t pmm_free(struct list_node* list) {
+    LTRACEF("list %p\n", list);
+
+    DEBUG_ASSERT(list);
+
+    AutoLock al(&arena_lock);
+
+    size_t count = pmm_free_locked(list);
+
+    LTRACEF("returning count %zu\n", count);
 
     return count;
 }
 
 size_t pmm_free_page(vm_page_t* page) {
+    DEBUG_ASSERT(!page_is_free(page));
+
     struct list_node list;
     list_initialize(&list);
 
     list_add_head(&list, &page->free.node);
 
-    return pmm_free(&list);
+    if (!pmm_page_is_cacheable(page))
+        return pmm_free(&list);
+
+    list_node drain = LIST_INITIAL_VALUE(drain);
+    size_t count = pmm_cache_free(&list, &drain);
+    DEBUG_ASSERT(count == 1);
+
+    if (!list_is_empty(&drain)) {
+        AutoLock al(&arena_lock);
+        pmm_free_locked(&drain);
+    }
+
+    return count;
 }
 
 static size_t pmm_count_free_pages_locked() TA_REQ(arena_lock) {
@@ -329,6 +681,10 @@ static size_t pmm_count_free_pages_locked() TA_REQ(arena_lock) {
     for (const auto& a : arena_list) {
         free += a.free_count();
     }
+    // pages in the magazines are free too, a racy read is fine here
+    for (const auto& c : pmm_caches) {
+        free += c.count;
+    }
     return free;
 }
 
@@ -356,6 +712,20 @@ extern "C" enum handler_return pmm_dump_timer(struct timer* t, lk_time_t, void*)
     return INT_NO_RESCHEDULE;
 }
 
+// Statistics are read without any locks, so they may be slightly stale.
+static void pmm_cache_dump() TA_NO_THREAD_SAFETY_ANALYSIS {
+    printf("per cpu page magazines (max %d, batch %d):\n", PMM_CACHE_MAX, PMM_CACHE_BATCH);
+    for (uint i = 0; i < arch_max_num_cpus(); i++) {
+        const pmm_cache& c = pmm_caches[i];
+        printf("\tcpu %u: pages %zu alloc hits %" PRIu64 " misses %" PRIu64
+               " free hits %" PRIu64 " refills %" PRIu64 " drains %" PRIu64 "\n",
+               i, c.count, c.alloc_hits, c.alloc_misses, c.free_hits, c.refills, c.drains);
+    }
+#if !PMM_ENABLE_FREE_FILL
+    printf("pages zeroed in the background %" PRIu64 "\n", zero_thread_pages);
+#endif
+}
+
 // No lock analysis here, as we want to just go for it in the panic case without the lock.
 static void arena_dump(bool is_panic) TA_NO_THREAD_SAFETY_ANALYSIS {
     if (!is_panic) {
@@ -378,6 +748,7 @@ static int cmd_pmm(int argc, const cmd_args* argv, uint32_t flags) {
     usage:
         printf("usage:\n");
         printf("%s arenas\n", argv[0].str);
+        printf("%s cache\n", argv[0].str);
         if (!is_panic) {
             printf("%s alloc <count>\n", argv[0].str);
             printf("%s alloc_range <address> <count>\n", argv[0].str);
@@ -386,6 +757,7 @@ static int cmd_pmm(int argc, const cmd_args* argv, uint32_t flags) {
             printf("%s dump_alloced\n", argv[0].str);
             printf("%s free_alloced\n", argv[0].str);
             printf("%s free\n", argv[0].str);
+            printf("%s drain_cache\n", argv[0].str);
         }
         return ERR_INTERNAL;
     }
@@ -394,6 +766,8 @@ static int cmd_pmm(int argc, const cmd_args* argv, uint32_t flags) {
 
     if (!strcmp(argv[1].str, "arenas")) {
         arena_dump(is_panic);
+    } else if (!strcmp(argv[1].str, "cache")) {
+        pmm_cache_dump();
     } else if (is_panic) {
         // No other operations will work during a panic.
         printf("Only the \"arenas\" command is available during a panic.\n");
@@ -491,6 +865,10 @@ static int cmd_pmm(int argc, const cmd_args* argv, uint32_t flags) {
         while ((node = list_remove_head(&list))) {
             list_add_tail(&allocated, node);
         }
+    } else if (!strcmp(argv[1].str, "drain_cache")) {
+        AutoLock al(&arena_lock);
+        size_t count = pmm_cache_drain_all();
+        printf("drained %zu pages\n", count);
     } else if (!strcmp(argv[1].str, "free_alloced")) {
         size_t err = pmm_free(&allocated);
         printf("pmm_free returns %zu\n", err);
@@ -9,6 +9,7 @@
 
 #include <err.h>
 #include <inttypes.h>
+#include <pow2.h>
 #include <string.h>
 #include <trace.h>
 
@@ -47,10 +48,27 @@ void PmmArena::CheckFreeFill(vm_page_t* page) {
 #endif // PMM_ENABLE_FREE_FILL
 
 void PmmArena::BootAllocArray() {
-    /* allocate an array of pages to back this one */
+    /* allocate an array of pages to back this one, and its free extent index */
+    void* raw_page_array = boot_alloc_mem(PageArraySize());
+    void* raw_buddy_tree = boot_alloc_mem(BuddyTreeSize());
+
+    InitArrays(raw_page_array, raw_buddy_tree);
+}
+
+size_t PmmArena::PageArraySize() const {
+    return size() / PAGE_SIZE * VM_PAGE_STRUCT_SIZE;
+}
+
+size_t PmmArena::BuddyTreeSize() const {
+    uint levels;
+    size_t offset;
+    BuddyWindow(&levels, &offset);
+    return (1UL << levels) * 2;
+}
+
+void PmmArena::InitArrays(void* raw_page_array, void* raw_buddy_tree) {
     size_t page_count = size() / PAGE_SIZE;
-    size_t size = page_count * VM_PAGE_STRUCT_SIZE;
-    void* raw_page_array = boot_alloc_mem(size);
+    size_t size = PageArraySize();
 
     LTRACEF("arena for base 0%#" PRIxPTR " size %#zx page array at %p size %zu\n", info_.base, info_.size,
             raw_page_array, size);
@@ -67,18 +85,117 @@ void PmmArena::BootAllocArray() {
     }
 
     free_count_ += page_count;
+
+    BuddyInit(page_count, static_cast<uint8_t*>(raw_buddy_tree));
 }
 
-vm_page_t* PmmArena::AllocPage(paddr_t* pa) {
-    vm_page_t* page = list_remove_head_type(&free_list_, vm_page_t, free.node);
-    if (!page)
-        return nullptr;
+// value of a buddy tree node at |level| given the values of its children: if
+// both halves are entirely free so is the node, otherwise it inherits the
+// larger free block below it
+static inline uint8_t buddy_combine(uint8_t left, uint8_t right, uint level) {
+    if (left == level && right == level)
+        return static_cast<uint8_t>(level + 1);
+    return MAX(left, right);
+}
+
+void PmmArena::BuddyWindow(uint* levels, size_t* offset) const {
+    /* pick a window of physical page numbers, aligned to its own size, that
+     * covers the whole arena. the arena may start anywhere within it, which
+     * keeps tree blocks aligned in physical memory and not just relative to
+     * the arena base. */
+    size_t page_count = size() / PAGE_SIZE;
+    size_t base_pn = base() / PAGE_SIZE;
+    *levels = log2_ulong_ceil(page_count);
+    for (;;) {
+        *offset = base_pn & ((1UL << *levels) - 1);
+        if (*offset + page_count <= (1UL << *levels))
+            break;
+        (*levels)++;
+    }
+}
 
+void PmmArena::BuddyInit(size_t page_count, uint8_t* tree) {
+    BuddyWindow(&buddy_levels_, &buddy_offset_);
+
+    size_t leaves = 1UL << buddy_levels_;
+    buddy_tree_ = tree;
+    memset(buddy_tree_, 0, leaves * 2);
+
+    LTRACEF("arena base %#" PRIxPTR " buddy tree %p levels %u offset %zu\n", base(), buddy_tree_,
+            buddy_levels_, buddy_offset_);
+
+    for (size_t i = 0; i < page_count; i++) {
+        if (page_is_free(&page_array_[i]))
+            buddy_tree_[leaves + buddy_offset_ + i] = 1;
+    }
+    for (uint level = 1; level <= buddy_levels_; level++) {
+        for (size_t j = leaves >> level; j < (leaves >> (level - 1)); j++) {
+            buddy_tree_[j] = buddy_combine(buddy_tree_[2 * j], buddy_tree_[2 * j + 1], level);
+        }
+    }
+}
+
+// mark the page at |index| free or allocated, fixing up its ancestors
+void PmmArena::BuddyUpdate(size_t index, bool free) {
+    size_t j = (1UL << buddy_levels_) + buddy_offset_ + index;
+    buddy_tree_[j] = free ? 1 : 0;
+
+    for (uint level = 1; j > 1; level++) {
+        j >>= 1;
+        uint8_t val = buddy_combine(buddy_tree_[2 * j], buddy_tree_[2 * j + 1], level);
+        if (buddy_tree_[j] == val)
+            break;
+        buddy_tree_[j] = val;
+    }
+}
+
+// find an entirely free, naturally aligned block of 2^|order| pages, returning
+// the index of its first page
+bool PmmArena::BuddyFind(uint order, size_t* index) {
+    buddy_search_steps_++;
+    if (order > buddy_levels_ || buddy_tree_[1] <= order)
+        return false;
+
+    size_t j = 1;
+    for (uint level = buddy_levels_; level > order; level--) {
+        buddy_search_steps_++;
+        uint8_t left = buddy_tree_[2 * j];
+        uint8_t right = buddy_tree_[2 * j + 1];
+
+        /* when both halves will do, descend into the one with the smaller
+         * largest block so that big free blocks are broken up last */
+        if (left > order && (right <= order || left <= right)) {
+            j = 2 * j;
+        } else {
+            j = 2 * j + 1;
+        }
+    }
+
+    *index = (j << order) - (1UL << buddy_levels_) - buddy_offset_;
+    return true;
+}
+
+// pull a page that was on the free list out of it, keeping the counts straight
+void PmmArena::RemoveFreePage(vm_page_t* page) {
+    DEBUG_ASSERT(page_is_free(page));
     DEBUG_ASSERT(free_count_ > 0);
 
+    list_delete(&page->free.node);
     free_count_--;
+    BuddyUpdate(page - page_array_, false);
 
-    DEBUG_ASSERT(page_is_free(page));
+    if (page->flags & VM_PAGE_FLAG_ZEROED) {
+        DEBUG_ASSERT(zeroed_count_ > 0);
+        zeroed_count_--;
+    }
+}
+
+vm_page_t* PmmArena::AllocPage(paddr_t* pa) {
+    vm_page_t* page = list_peek_head_type(&free_list_, vm_page_t, free.node);
+    if (!page)
+        return nullptr;
+
+    RemoveFreePage(page);
 
     page->state = VM_PAGE_STATE_ALLOC;
 #if PMM_ENABLE_FREE_FILL
@@ -110,32 +227,27 @@ vm_page_t* PmmArena::AllocSpecific(paddr_t pa) {
         return nullptr;
     }
 
-    list_delete(&page->free.node);
+    RemoveFreePage(page);
 
     page->state = VM_PAGE_STATE_ALLOC;
 
-    DEBUG_ASSERT(free_count_ > 0);
-
-    free_count_--;
-
     return page;
 }
 
-size_t PmmArena::AllocPages(size_t count, list_node* list) {
+size_t PmmArena::AllocPages(size_t count, list_node* list, bool zeroed) {
     size_t allocated = 0;
 
     while (allocated < count) {
-        vm_page_t* page = list_remove_head_type(&free_list_, vm_page_t, free.node);
+        /* zeroed pages are kept at the tail of the list */
+        vm_page_t* page = zeroed ? list_peek_tail_type(&free_list_, vm_page_t, free.node)
+                                 : list_peek_head_type(&free_list_, vm_page_t, free.node);
         if (!page)
             return allocated;
 
         LTRACEF("allocating page %p, pa %#" PRIxPTR "\n", page, page_address_from_arena(page));
 
-        DEBUG_ASSERT(free_count_ > 0);
-
-        free_count_--;
+        RemoveFreePage(page);
 
-        DEBUG_ASSERT(page_is_free(page));
 #if PMM_ENABLE_FREE_FILL
         CheckFreeFill(page);
 #endif
@@ -149,69 +261,126 @@ size_t PmmArena::AllocPages(size_t count, list_node* list) {
     return allocated;
 }
 
-size_t PmmArena::AllocContiguous(size_t count, uint8_t alignment_log2, paddr_t* pa, struct list_node* list) {
-    /* walk the list starting at alignment boundaries.
-     * calculate the starting offset into this arena, based on the
-     * base address of the arena to handle the case where the arena
-     * is not aligned on the same boundary requested.
-     */
-    paddr_t rounded_base = ROUNDUP(base(), 1UL << alignment_log2);
-    if (rounded_base < base() || rounded_base > base() + size() - 1)
-        return 0;
-
-    paddr_t aligned_offset = (rounded_base - base()) / PAGE_SIZE;
-    paddr_t start = aligned_offset;
-    LTRACEF("starting search at aligned offset %#" PRIxPTR "\n", start);
-    LTRACEF("arena base %#" PRIxPTR " size %zu\n", base(), size());
-
-retry:
-    /* search while we're still within the arena and have a chance of finding a slot
-       (start + count < end of arena) */
-    while ((start < size() / PAGE_SIZE) && ((start + count) <= size() / PAGE_SIZE)) {
-        vm_page_t* p = &page_array_[start];
-        for (uint i = 0; i < count; i++) {
-            if (!page_is_free(p)) {
-                /* this run is broken, break out of the inner loop.
-                 * start over at the next alignment boundary
-                 */
-                start = ROUNDUP(start - aligned_offset + i + 1, 1UL << (alignment_log2 - PAGE_SIZE_SHIFT)) +
-                        aligned_offset;
-                goto retry;
+// whether the |len| pages at window position |pos| are all free, where |pos|
+// is aligned to the largest power of two in |len|
+bool PmmArena::BuddyRangeFree(size_t pos, size_t len) const {
+    size_t leaves = 1UL << buddy_levels_;
+    if (pos + len > leaves)
+        return false;
+
+    /* cover the range with aligned blocks, largest first */
+    for (int k = static_cast<int>(buddy_levels_); k >= 0 && len > 0; k--) {
+        if (!(len & (1UL << k)))
+            continue;
+        DEBUG_ASSERT(IS_ALIGNED(pos, 1UL << k));
+        if (buddy_tree_[(leaves + pos) >> k] != k + 1)
+            return false;
+        pos += 1UL << k;
+        len -= 1UL << k;
+    }
+    return true;
+}
+
+// find an entirely free block of 2^|order| pages that starts on a physical
+// 2^|align_order| boundary and is followed by |tail| more free pages,
+// returning the index of its first page. |align_order| is at least |order|
+// and |tail| is less than 2^|order|. only subtrees holding a free block of
+// |order| are visited, down to the blocks the alignment allows a run to start
+// in, so a search costs at most a node per such block rather than a page.
+bool PmmArena::BuddyFindRun(uint order, uint align_order, size_t tail, size_t* index) {
+    DEBUG_ASSERT(align_order >= order);
+    DEBUG_ASSERT(tail < (1UL << order));
+
+    if (order > buddy_levels_)
+        return false;
+
+    /* runs can only start at the start of a block of this level. alignments
+     * coarser than the whole window leave just its start, if even that */
+    const uint start_level = MIN(align_order, buddy_levels_);
+    const size_t window_pn = base() / PAGE_SIZE - buddy_offset_;
+
+    size_t j = 1;
+    uint level = buddy_levels_;
+    for (;;) {
+        buddy_search_steps_++;
+        if (buddy_tree_[j] > order) {
+            if (level > start_level) {
+                j = 2 * j;
+                level--;
+                continue;
             }
-            p++;
+
+            size_t pos = (j << level) - (1UL << buddy_levels_);
+            if (buddy_tree_[j << (level - order)] == order + 1 &&
+                IS_ALIGNED(window_pn + pos, 1UL << align_order) &&
+                BuddyRangeFree(pos + (1UL << order), tail)) {
+                *index = pos - buddy_offset_;
+                return true;
+            }
+        }
+
+        /* on to the next block: climb out of right children, then step over
+         * to the right sibling */
+        while (j & 1) {
+            if (j == 1)
+                return false;
+            j >>= 1;
+            level++;
         }
+        j++;
+    }
+}
 
-        /* we found a run */
-        LTRACEF("found run from pn %" PRIuPTR " to %" PRIuPTR "\n", start, start + count);
+size_t PmmArena::AllocContiguous(size_t count, uint8_t alignment_log2, paddr_t* pa, struct list_node* list) {
+    /* the quick way is to round the run up to a power of two block that also
+     * satisfies the alignment, and carve it out of the first suitable free
+     * block in the buddy tree. any pages of the block past |count| stay free. */
+    DEBUG_ASSERT(alignment_log2 >= PAGE_SIZE_SHIFT);
+    const uint order = log2_ulong_ceil(count);
+    const uint align_order = alignment_log2 - PAGE_SIZE_SHIFT;
+    const bool exact = (1UL << order) == count;
+
+    size_t start;
+    if (!BuddyFind(MAX(order, align_order), &start)) {
+        /* a power of two run aligned to at least its size is such a block,
+         * so there is nothing else to look for */
+        if (exact && align_order <= order)
+            return 0;
+
+        /* otherwise the run can be a smaller block on the alignment: the
+         * largest power of two that fits in it, followed by free pages for
+         * the rest. that finds every run aligned to at least that block, and
+         * otherwise only the runs that start on one of its boundaries. */
+        uint head = exact ? order : order - 1;
+        if (!BuddyFindRun(head, MAX(head, align_order), count - (1UL << head), &start))
+            return 0;
+    }
 
-        /* remove the pages from the run out of the free list */
-        for (paddr_t i = start; i < start + count; i++) {
-            p = &page_array_[i];
-            DEBUG_ASSERT(page_is_free(p));
-            DEBUG_ASSERT(list_in_list(&p->free.node));
+    DEBUG_ASSERT(start + count <= size() / PAGE_SIZE);
 
-            list_delete(&p->free.node);
-            p->state = VM_PAGE_STATE_ALLOC;
+    /* we found a run */
+    LTRACEF("found run from pn %zu to %zu\n", start, start + count);
 
-            DEBUG_ASSERT(free_count_ > 0);
+    /* remove the pages from the run out of the free list */
+    for (size_t i = start; i < start + count; i++) {
+        vm_page_t* p = &page_array_[i];
+        DEBUG_ASSERT(list_in_list(&p->free.node));
 
-            free_count_--;
+        RemoveFreePage(p);
+        p->state = VM_PAGE_STATE_ALLOC;
 
 #if PMM_ENABLE_FREE_FILL
-            CheckFreeFill(p);
+        CheckFreeFill(p);
 #endif
 
-            if (list)
-                list_add_tail(list, &p->free.node);
-        }
-
-        if (pa)
-            *pa = base() + start * PAGE_SIZE;
-
-        return count;
+        if (list)
+            list_add_tail(list, &p->free.node);
     }
 
-    return 0;
+    if (pa)
+        *pa = base() + start * PAGE_SIZE;
+
+    return count;
 }
 
 status_t PmmArena::FreePage(vm_page_t* page) {
@@ -224,16 +393,50 @@ status_t PmmArena::FreePage(vm_page_t* page) {
 #endif
 
     page->state = VM_PAGE_STATE_FREE;
-
-    list_add_head(&free_list_, &page->free.node);
+    BuddyUpdate(page - page_array_, true);
+
+    /* pages coming back with the zeroed flag never left the pmm's hands */
+    if (page->flags & VM_PAGE_FLAG_ZEROED) {
+        list_add_tail(&free_list_, &page->free.node);
+        zeroed_count_++;
+    } else {
+        list_add_head(&free_list_, &page->free.node);
+    }
     free_count_++;
     return NO_ERROR;
 }
 
+vm_page_t* PmmArena::TakeDirtyPage() {
+    vm_page_t* page = list_peek_head_type(&free_list_, vm_page_t, free.node);
+    if (!page || (page->flags & VM_PAGE_FLAG_ZEROED))
+        return nullptr;
+
+    RemoveFreePage(page);
+    page->state = VM_PAGE_STATE_ALLOC;
+
+    return page;
+}
+
+void PmmArena::ReturnZeroedPage(vm_page_t* page) {
+    DEBUG_ASSERT(page_belongs_to_arena(page));
+    DEBUG_ASSERT(page->state == VM_PAGE_STATE_ALLOC);
+
+    page->state = VM_PAGE_STATE_FREE;
+    page->flags |= VM_PAGE_FLAG_ZEROED;
+    BuddyUpdate(page - page_array_, true);
+
+    list_add_tail(&free_list_, &page->free.node);
+    free_count_++;
+    zeroed_count_++;
+}
+
 void PmmArena::Dump(bool dump_pages, bool dump_free_ranges) {
     printf("arena %p: name '%s' base %#" PRIxPTR " size 0x%zx priority %u flags 0x%x\n", this, name(), base(),
            size(), priority(), flags());
-    printf("\tpage_array %p, free_count %zu\n", page_array_, free_count_);
+    printf("\tpage_array %p, free_count %zu, zeroed_count %zu\n", page_array_, free_count_, zeroed_count_);
+    if (buddy_tree_[1] > 0) {
+        printf("\tlargest free aligned run %zu pages\n", 1UL << (buddy_tree_[1] - 1));
+    }
 
     /* dump all of the pages */
     if (dump_pages) {
@@ -24,6 +24,12 @@ public:
     // set up the per page structures, allocated out of the boot time allocator
     void BootAllocArray();
 
+    // the same, out of memory the caller provides: PageArraySize() bytes for
+    // the pages and BuddyTreeSize() for the free extent index
+    void InitArrays(void* page_array, void* buddy_tree);
+    size_t PageArraySize() const;
+    size_t BuddyTreeSize() const;
+
 #if PMM_ENABLE_FREE_FILL
     void EnforceFill();
 #endif
@@ -38,16 +44,30 @@ public:
     unsigned int flags() const { return info_.flags; }
     unsigned int priority() const { return info_.priority; }
     size_t free_count() const { return free_count_; };
+    size_t zeroed_count() const { return zeroed_count_; };
+
+    // how many buddy tree nodes contiguous allocations have looked at, for tests
+    size_t buddy_search_steps() const { return buddy_search_steps_; }
 
     vm_page_t* get_page(size_t index) { return &page_array_[index]; }
 
     // main allocation routines
+    //
+    // The free list keeps dirty pages at the head and pages that have been
+    // zeroed in the background, marked VM_PAGE_FLAG_ZEROED, at the tail.
+    // Allocated pages keep the flag so the caller can tell whether it still
+    // needs to zero them; it is up to the caller to clear it.
     vm_page_t* AllocPage(paddr_t* pa);
     vm_page_t* AllocSpecific(paddr_t pa);
-    size_t AllocPages(size_t count, list_node* list);
+    size_t AllocPages(size_t count, list_node* list, bool zeroed = false);
     size_t AllocContiguous(size_t count, uint8_t alignment_log2, paddr_t* pa, struct list_node* list);
     status_t FreePage(vm_page_t* page);
 
+    // background zeroing: take a dirty free page out of the arena, and give it
+    // back once it has been zeroed
+    vm_page_t* TakeDirtyPage();
+    void ReturnZeroedPage(vm_page_t* page);
+
     // helpers
     bool page_belongs_to_arena(const vm_page* page) const {
         uintptr_t page_addr = reinterpret_cast<uintptr_t>(page);
@@ -69,6 +89,16 @@ public:
     }
 
 private:
+    void RemoveFreePage(vm_page_t* page);
+
+    // free extent index, used to find aligned runs for AllocContiguous
+    void BuddyWindow(uint* levels, size_t* offset) const;
+    void BuddyInit(size_t page_count, uint8_t* tree);
+    void BuddyUpdate(size_t index, bool free);
+    bool BuddyFind(uint order, size_t* index);
+    bool BuddyRangeFree(size_t pos, size_t len) const;
+    bool BuddyFindRun(uint order, uint align_order, size_t tail, size_t* index);
+
 #if PMM_ENABLE_FREE_FILL
     void FreeFill(vm_page_t* page);
     void CheckFreeFill(vm_page_t* page);
@@ -78,8 +108,19 @@ private:
     vm_page_t* page_array_ = nullptr;
 
     size_t free_count_ = 0;
+    size_t zeroed_count_ = 0;
     list_node free_list_ = LIST_INITIAL_VALUE(free_list_);
 
+    // A complete binary tree laid out like a heap over a power of two
+    // window of physical page numbers that covers the arena, so every node
+    // spans a naturally aligned block of pages. Each node holds one plus the
+    // order of the largest entirely free aligned block below it, or zero if
+    // it covers no free pages at all. Leaves outside the arena stay zero.
+    uint8_t* buddy_tree_ = nullptr;
+    uint buddy_levels_ = 0;
+    size_t buddy_offset_ = 0; // leaf position of the arena's first page
+    size_t buddy_search_steps_ = 0;
+
 #if PMM_ENABLE_FREE_FILL
     bool enforce_fill_ = false;
 #endif
@@ -17,6 +17,7 @@ MODULE_DEPS += \
 MODULE_SRCS += \
     $(LOCAL_DIR)/bootalloc.cpp \
     $(LOCAL_DIR)/page.cpp \
+    $(LOCAL_DIR)/page_source.cpp \
     $(LOCAL_DIR)/pmm.cpp \
     $(LOCAL_DIR)/pmm_arena.cpp \
     $(LOCAL_DIR)/vm.cpp \
@@ -29,6 +30,7 @@ MODULE_SRCS += \
     $(LOCAL_DIR)/vm_object_physical.cpp \
     $(LOCAL_DIR)/vm_page_list.cpp \
     $(LOCAL_DIR)/vm_unittest.cpp \
+    $(LOCAL_DIR)/vm_zero_scanner.cpp \
     $(LOCAL_DIR)/vmm.cpp \
 
 include make/module.mk
@@ -207,7 +207,8 @@ status_t VmAddressRegion::CreateVmMapping(size_t mapping_offset, size_t size, ui
     LTRACEF("%p %#zx %#zx %x\n", this, mapping_offset, size, vmar_flags);
 
     // Check that only allowed flags have been set
-    if (vmar_flags & ~(VMAR_FLAG_SPECIFIC | VMAR_FLAG_SPECIFIC_OVERWRITE | VMAR_CAN_RWX_FLAGS)) {
+    if (vmar_flags & ~(VMAR_FLAG_SPECIFIC | VMAR_FLAG_SPECIFIC_OVERWRITE | VMAR_CAN_RWX_FLAGS |
+                       VMAR_FLAG_FAULT_AROUND)) {
         return ERR_INVALID_ARGS;
     }
 
@@ -237,9 +238,21 @@ status_t VmAddressRegion::CreateVmMapping(size_t mapping_offset, size_t size, ui
     }
 
     mxtl::RefPtr<VmAddressRegionOrMapping> res;
-    status_t status =
-        CreateSubVmarInternal(mapping_offset, size, align_pow2, vmar_flags, mxtl::move(vmo),
-                              vmo_offset, arch_mmu_flags, name, &res);
+    status_t status = ERR_NO_MEMORY;
+
+    // Place mappings of at least a large page whose object offset is large page
+    // aligned on a large page boundary if there's room, so that contiguous runs
+    // committed in the object can be mapped with large pages.
+    if (!(vmar_flags & (VMAR_FLAG_SPECIFIC | VMAR_FLAG_SPECIFIC_OVERWRITE)) &&
+        size >= VM_LARGE_PAGE_SIZE && IS_ALIGNED(vmo_offset, VM_LARGE_PAGE_SIZE) &&
+        align_pow2 < VM_LARGE_PAGE_SIZE_SHIFT) {
+        status = CreateSubVmarInternal(mapping_offset, size, VM_LARGE_PAGE_SIZE_SHIFT, vmar_flags,
+                                       vmo, vmo_offset, arch_mmu_flags, name, &res);
+    }
+    if (status == ERR_NO_MEMORY) {
+        status = CreateSubVmarInternal(mapping_offset, size, align_pow2, vmar_flags,
+                                       mxtl::move(vmo), vmo_offset, arch_mmu_flags, name, &res);
+    }
     if (status != NO_ERROR) {
         return status;
     }
@@ -348,7 +361,8 @@ size_t VmAddressRegion::AllocatedPagesLocked() const {
     return sum;
 }
 
-status_t VmAddressRegion::PageFault(vaddr_t va, uint pf_flags) {
+status_t VmAddressRegion::PageFault(vaddr_t va, uint pf_flags,
+                                    mxtl::RefPtr<PageRequest>* page_request) {
     canary_.Assert();
     DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
 
@@ -356,7 +370,7 @@ status_t VmAddressRegion::PageFault(vaddr_t va, uint pf_flags) {
          auto next = vmar->FindRegionLocked(va);
          vmar = next->as_vm_address_region()) {
         if (next->is_mapping())
-            return next->PageFault(va, pf_flags);
+            return next->PageFault(va, pf_flags, page_request);
     }
 
     return ERR_NOT_FOUND;
@@ -121,7 +121,8 @@ static inline size_t trim_to_aspace(VmAspace& aspace, vaddr_t vaddr, size_t size
 }
 
 VmAspace::VmAspace(vaddr_t base, size_t size, uint32_t flags, const char* name)
-    : base_(base), size_(size), flags_(flags), root_vmar_(nullptr), aslr_prng_(nullptr, 0) {
+    : base_(base), size_(size), flags_(flags), root_vmar_(nullptr), committed_pages_(0),
+      aslr_prng_(nullptr, 0) {
 
     DEBUG_ASSERT(size != 0);
     DEBUG_ASSERT(base + size - 1 >= base);
@@ -518,12 +519,28 @@ status_t VmAspace::PageFault(vaddr_t va, uint flags) {
     DEBUG_ASSERT(!aspace_destroyed_);
     LTRACEF("va %#" PRIxPTR ", flags %#x\n", va, flags);
 
-    // for now, hold the aspace lock across the page fault operation,
-    // which stops any other operations on the address space from moving
-    // the region out from underneath it
-    AutoLock a(&lock_);
+    for (;;) {
+        mxtl::RefPtr<PageRequest> request;
+        status_t status;
+        {
+            // for now, hold the aspace lock across the page fault operation,
+            // which stops any other operations on the address space from moving
+            // the region out from underneath it
+            AutoLock a(&lock_);
+
+            status = root_vmar_->PageFault(va, flags, &request);
+        }
+        if (status != ERR_SHOULD_WAIT)
+            return status;
 
-    return root_vmar_->PageFault(va, flags);
+        // the page has to be supplied by a page source first. wait for it with
+        // no locks held and fault again, since anything may have changed
+        if (request) {
+            status = request->Wait();
+            if (status != NO_ERROR)
+                return status;
+        }
+    }
 }
 
 void VmAspace::Dump(bool verbose) const {
@@ -559,12 +576,25 @@ void DumpAllAspaces(bool verbose) {
         a.Dump(verbose);
 }
 
+bool EnumerateUserAspace(size_t index, VmEnumerator* ve) {
+    AutoLock a(&aspace_list_lock);
+
+    for (auto& a : aspaces) {
+        if (!a.is_user())
+            continue;
+        if (index-- == 0) {
+            a.EnumerateChildren(ve);
+            return true;
+        }
+    }
+    return false;
+}
+
 // TODO(dbort): Use GetMemoryUsage()
 size_t VmAspace::AllocatedPages() const {
     canary_.Assert();
 
-    AutoLock a(&lock_);
-    return root_vmar_->AllocatedPagesLocked();
+    return committed_pages_.load();
 }
 
 void VmAspace::InitializeAslr() {
@@ -21,6 +21,9 @@
 
 #define LOCAL_TRACE MAX(VM_GLOBAL_TRACE, 0)
 
+// size of the window around a read fault that FaultAroundLocked() populates
+static const size_t kFaultAroundPages = 16;
+
 VmMapping::VmMapping(VmAddressRegion& parent, vaddr_t base, size_t size, uint32_t vmar_flags,
                      mxtl::RefPtr<VmObject> vmo, uint64_t vmo_offset, uint arch_mmu_flags,
                      const char* name)
@@ -44,7 +47,30 @@ size_t VmMapping::AllocatedPagesLocked() const {
     if (state_ != LifeCycleState::ALIVE) {
         return 0;
     }
-    return object_->AllocatedPagesInRange(object_offset_, size_);
+    return committed_pages();
+}
+
+size_t VmMapping::committed_pages() const {
+    canary_.Assert();
+
+    AutoLock al(object_->lock());
+    return committed_pages_;
+}
+
+// See the comment above ActivateLocked() for why these can't be analyzed.
+void VmMapping::SetCommittedPagesLocked(size_t count) TA_NO_THREAD_SAFETY_ANALYSIS {
+    DEBUG_ASSERT(object_->lock()->IsHeld());
+
+    if (count > committed_pages_) {
+        aspace_->committed_pages_.fetch_add(count - committed_pages_);
+    } else {
+        aspace_->committed_pages_.fetch_sub(committed_pages_ - count);
+    }
+    committed_pages_ = count;
+}
+
+void VmMapping::RecountCommittedPagesLocked() TA_NO_THREAD_SAFETY_ANALYSIS {
+    SetCommittedPagesLocked(object_->AllocatedPagesInRangeLocked(object_offset_, size_));
 }
 
 void VmMapping::Dump(uint depth, bool verbose) const {
@@ -57,10 +83,9 @@ void VmMapping::Dump(uint depth, bool verbose) const {
            " pages %zu ref %d '%s'\n",
            this, base_, base_ + size_ - 1, size_, arch_mmu_flags_,
            object_.get(), object_offset_,
-           // TODO: Use AllocatePagesLocked() when Dump() is locked
-           // consistently. Currently, Dump() may be called without the aspace
-           // lock.
-           object_->AllocatedPagesInRange(object_offset_, size_),
+           // Dump() may be called with or without the object's lock held, so
+           // this is only a snapshot.
+           committed_pages_,
            ref_count_debug(), name_);
     if (verbose)
         object_->Dump(depth + 1, false);
@@ -141,6 +166,7 @@ status_t VmMapping::ProtectLocked(vaddr_t base, size_t size, uint new_arch_mmu_f
         arch_mmu_flags_ = new_arch_mmu_flags;
 
         size_ = size;
+        RecountCommittedPagesLocked();
         mapping->ActivateLocked();
         return NO_ERROR;
     }
@@ -163,6 +189,7 @@ status_t VmMapping::ProtectLocked(vaddr_t base, size_t size, uint new_arch_mmu_f
         LTRACEF("arch_mmu_protect returns %d\n", status);
 
         size_ -= size;
+        RecountCommittedPagesLocked();
         mapping->ActivateLocked();
         return NO_ERROR;
     }
@@ -193,6 +220,7 @@ status_t VmMapping::ProtectLocked(vaddr_t base, size_t size, uint new_arch_mmu_f
 
     // Turn us into the left half
     size_ = left_size;
+    RecountCommittedPagesLocked();
 
     center_mapping->ActivateLocked();
     right_mapping->ActivateLocked();
@@ -268,6 +296,7 @@ status_t VmMapping::UnmapLocked(vaddr_t base, size_t size) {
             parent_->subregions_.insert(mxtl::move(ref));
         }
         size_ -= size;
+        RecountCommittedPagesLocked();
 
         return NO_ERROR;
     }
@@ -296,6 +325,7 @@ status_t VmMapping::UnmapLocked(vaddr_t base, size_t size) {
 
     // Turn us into the left half
     size_ = base - base_;
+    RecountCommittedPagesLocked();
     mapping->ActivateLocked();
     return NO_ERROR;
 }
@@ -396,7 +426,30 @@ status_t VmMapping::MapRange(size_t offset, size_t len, bool commit) {
     auto ac = mxtl::MakeAutoCall([&]() { currently_faulting_ = false; });
 
     // iterate through the range, grabbing a page from the underlying object and
-    // mapping it in
+    // mapping in each physically contiguous run with a single call, which lets
+    // the arch layer use large pages where the run is suitably aligned
+    vaddr_t run_va = 0;
+    paddr_t run_pa = 0;
+    size_t run_count = 0;
+    auto flush_run = [&]() {
+        if (run_count == 0)
+            return;
+
+        LTRACEF_LEVEL(2, "mapping pa %#" PRIxPTR " to va %#" PRIxPTR ", %zu pages\n",
+                      run_pa, run_va, run_count);
+
+        size_t mapped;
+        auto ret = arch_mmu_map(&aspace_->arch_aspace(), run_va, run_pa, run_count,
+                                arch_mmu_flags_, &mapped);
+        if (ret < 0) {
+            TRACEF("error %d mapping %zu pages at va %#" PRIxPTR " pa %#" PRIxPTR "\n",
+                   ret, run_count, run_va, run_pa);
+        }
+
+        DEBUG_ASSERT(mapped == run_count);
+        run_count = 0;
+    };
+
     size_t o;
     for (o = offset; o < offset + len; o += PAGE_SIZE) {
         uint64_t vmo_offset = object_offset_ + o;
@@ -404,28 +457,37 @@ status_t VmMapping::MapRange(size_t offset, size_t len, bool commit) {
         status_t status;
         paddr_t pa;
         status = object_->GetPageLocked(vmo_offset, pf_flags, nullptr, &pa);
+        if (status == ERR_SHOULD_WAIT) {
+            // the page source hasn't supplied it yet. it gets faulted in later
+            // instead, since we can't wait for it with the aspace lock held
+            flush_run();
+            continue;
+        }
         if (status < 0) {
             // no page to map
             if (commit) {
                 // fail when we can't commit every requested page
+                flush_run();
                 return status;
             } else {
                 // skip ahead
+                flush_run();
                 continue;
             }
         }
 
         vaddr_t va = base_ + o;
-        LTRACEF_LEVEL(2, "mapping pa %#" PRIxPTR " to va %#" PRIxPTR "\n", pa, va);
-
-        size_t mapped;
-        auto ret = arch_mmu_map(&aspace_->arch_aspace(), va, pa, 1, arch_mmu_flags_, &mapped);
-        if (ret < 0) {
-            TRACEF("error %d mapping page at va %#" PRIxPTR " pa %#" PRIxPTR "\n", ret, va, pa);
+        if (run_count > 0 && run_pa + run_count * PAGE_SIZE == pa) {
+            run_count++;
+            continue;
         }
 
-        DEBUG_ASSERT(mapped == 1);
+        flush_run();
+        run_va = va;
+        run_pa = pa;
+        run_count = 1;
     }
+    flush_run();
 
     return NO_ERROR;
 }
@@ -448,6 +510,27 @@ status_t VmMapping::DecommitRange(size_t offset, size_t len,
     return object_->DecommitRange(object_offset_ + offset, len, decommitted);
 }
 
+status_t VmMapping::ExchangeUserPages(vaddr_t va, size_t len, list_node* pages) {
+    canary_.Assert();
+    LTRACEF("%p '%s' [%#zx+%#zx], va %#" PRIxPTR ", len %#zx\n",
+            this, name_, base_, size_, va, len);
+
+    AutoLock guard(aspace_->lock());
+    if (state_ != LifeCycleState::ALIVE) {
+        return ERR_BAD_STATE;
+    }
+    const uint perms = ARCH_MMU_FLAG_PERM_USER | ARCH_MMU_FLAG_PERM_WRITE;
+    if ((arch_mmu_flags_ & perms) != perms) {
+        return ERR_ACCESS_DENIED;
+    }
+    if (va < base_ || va + len < va || va + len > base_ + size_) {
+        return ERR_OUT_OF_RANGE;
+    }
+    // VmObject::ExchangePages will typically call back into our instance's
+    // VmMapping::UnmapVmoRangeLocked.
+    return object_->ExchangePages(va - base_ + object_offset_, len, pages);
+}
+
 status_t VmMapping::DestroyLocked() {
     canary_.Assert();
     DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
@@ -498,7 +581,8 @@ status_t VmMapping::DestroyLocked() {
     return NO_ERROR;
 }
 
-status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
+status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags,
+                             mxtl::RefPtr<PageRequest>* page_request) {
     canary_.Assert();
     DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
 
@@ -544,6 +628,11 @@ status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
     paddr_t new_pa;
     vm_page_t* page;
     status_t status = object_->GetPageLocked(vmo_offset, pf_flags, &page, &new_pa);
+    if (status == ERR_SHOULD_WAIT) {
+        // the page is on its way from a page source, the caller waits for it
+        *page_request = object_->GetPageRequestLocked(vmo_offset);
+        return status;
+    }
     if (status < 0) {
         TRACEF("ERROR: failed to fault in or grab existing page\n");
         TRACEF("%p '%s', vmo_offset %#" PRIx64 ", pf_flags %#x\n", this, name_, vmo_offset, pf_flags);
@@ -559,6 +648,11 @@ status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
         mmu_flags &= ~ARCH_MMU_FLAG_PERM_WRITE;
     }
 
+    // if the page is part of a large page sized run the object has committed
+    // contiguously, map the whole run at once so it can use a large page
+    if (MapLargePageLocked(va, new_pa))
+        return NO_ERROR;
+
     // see if something is mapped here now
     // this may happen if we are one of multiple threads racing on a single address
     uint page_flags;
@@ -624,6 +718,10 @@ status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
             return ERR_NO_MEMORY;
         }
         DEBUG_ASSERT(mapped == 1);
+
+        if ((flags_ & VMAR_FLAG_FAULT_AROUND) && !(pf_flags & VMM_PF_FLAG_WRITE)) {
+            FaultAroundLocked(va, mmu_flags);
+        }
     }
 
 // TODO: figure out what to do with this
@@ -634,6 +732,109 @@ status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
     return NO_ERROR;
 }
 
+bool VmMapping::MapLargePageLocked(vaddr_t va, paddr_t pa) {
+    DEBUG_ASSERT(IS_PAGE_ALIGNED(va));
+
+    // the aligned large page around va has to fit in the mapping and the page
+    // has to sit at the same offset into an aligned physical run
+    const vaddr_t large_va = ROUNDDOWN(va, VM_LARGE_PAGE_SIZE);
+    if (large_va < base_ || size_ < VM_LARGE_PAGE_SIZE ||
+        large_va - base_ > size_ - VM_LARGE_PAGE_SIZE) {
+        return false;
+    }
+    const paddr_t large_pa = pa - (va - large_va);
+    if (!IS_ALIGNED(large_pa, VM_LARGE_PAGE_SIZE))
+        return false;
+
+    // the object has to own every page of the run; parent pages may not be
+    // mapped with our permissions. since it does, there's no copy-on-write to
+    // preserve and the run can go in with the mapping's full permissions.
+    paddr_t run_pa;
+    uint64_t vmo_offset = large_va - base_ + object_offset_;
+    if (object_->GetPageRunLocked(vmo_offset, VM_LARGE_PAGE_SIZE, &run_pa) != NO_ERROR ||
+        run_pa != large_pa) {
+        return false;
+    }
+
+    // leave it alone if any part of it is already mapped
+    for (vaddr_t cur = large_va; cur < large_va + VM_LARGE_PAGE_SIZE; cur += PAGE_SIZE) {
+        if (arch_mmu_query(&aspace_->arch_aspace(), cur, nullptr, nullptr) == NO_ERROR)
+            return false;
+    }
+
+    LTRACEF("mapping large page pa %#" PRIxPTR " to va %#" PRIxPTR "\n", large_pa, large_va);
+
+    size_t mapped;
+    status_t status = arch_mmu_map(&aspace_->arch_aspace(), large_va, large_pa,
+                                   VM_LARGE_PAGE_SIZE / PAGE_SIZE, arch_mmu_flags_, &mapped);
+    if (status < 0) {
+        LTRACEF("failed to map large page, status %d\n", status);
+        return false;
+    }
+
+#if ARCH_ARM64
+    if (arch_mmu_flags_ & ARCH_MMU_FLAG_PERM_EXECUTE)
+        arch_sync_cache_range(large_va, VM_LARGE_PAGE_SIZE);
+#endif
+    return true;
+}
+
+void VmMapping::FaultAroundLocked(vaddr_t va, uint mmu_flags) {
+    DEBUG_ASSERT(IS_PAGE_ALIGNED(va));
+    DEBUG_ASSERT(!(mmu_flags & ARCH_MMU_FLAG_PERM_WRITE));
+
+    // map the aligned window around the faulting page, clipped to the mapping
+    const size_t window = kFaultAroundPages * PAGE_SIZE;
+    const vaddr_t window_base = ROUNDDOWN(va, window);
+    const vaddr_t start = MAX(window_base, base_);
+    const vaddr_t end = window_base + MIN(window, base_ + size_ - window_base);
+
+    // physically contiguous runs of pages go in with a single arch_mmu_map call
+    vaddr_t run_va = 0;
+    paddr_t run_pa = 0;
+    size_t run_count = 0;
+    auto flush_run = [&]() {
+        if (run_count == 0)
+            return;
+        size_t mapped;
+        status_t status = arch_mmu_map(&aspace_->arch_aspace(), run_va, run_pa, run_count,
+                                       mmu_flags, &mapped);
+        if (status < 0) {
+            LTRACEF("failed to map %zu pages at va %#" PRIxPTR ", status %d\n",
+                    run_count, run_va, status);
+        }
+#if ARCH_ARM64
+        if (status == NO_ERROR && (mmu_flags & ARCH_MMU_FLAG_PERM_EXECUTE))
+            arch_sync_cache_range(run_va, run_count * PAGE_SIZE);
+#endif
+        run_count = 0;
+    };
+
+    for (vaddr_t cur = start; cur < end; cur += PAGE_SIZE) {
+        // only take pages the object (or its parent) already has, never fault
+        // new ones in, and leave anything that is already mapped alone
+        paddr_t pa;
+        uint64_t vmo_offset = cur - base_ + object_offset_;
+        bool present = object_->GetPageLocked(vmo_offset, 0, nullptr, &pa) == NO_ERROR &&
+                       arch_mmu_query(&aspace_->arch_aspace(), cur, nullptr, nullptr) < 0;
+        if (!present) {
+            flush_run();
+            continue;
+        }
+
+        if (run_count > 0 && run_pa + run_count * PAGE_SIZE == pa) {
+            run_count++;
+            continue;
+        }
+
+        flush_run();
+        run_va = cur;
+        run_pa = pa;
+        run_count = 1;
+    }
+    flush_run();
+}
+
 // We disable thread safety analysis here because one of the common uses of this
 // function is for splitting one mapping object into several that will be backed
 // by the same VmObject.  In that case, object_->lock() gets aliased across all
@@ -57,12 +57,33 @@ void VmObject::AddMappingLocked(VmMapping* r) {
     canary_.Assert();
     DEBUG_ASSERT(lock_.IsHeld());
     mapping_list_.push_front(r);
+    mapping_list_len_++;
+    r->RecountCommittedPagesLocked();
 }
 
 void VmObject::RemoveMappingLocked(VmMapping* r) {
     canary_.Assert();
     DEBUG_ASSERT(lock_.IsHeld());
+    r->SetCommittedPagesLocked(0);
     mapping_list_.erase(*r);
+    mapping_list_len_--;
+    OnReferenceRemovedLocked();
+}
+
+uint32_t VmObject::share_count() const {
+    canary_.Assert();
+    AutoLock a(&lock_);
+    return mapping_list_len_;
+}
+
+bool VmObject::IsFirstMappingInAspace(const VmMapping* map) const {
+    canary_.Assert();
+    AutoLock a(&lock_);
+    for (const auto& m : mapping_list_) {
+        if (m.aspace() == map->aspace())
+            return &m == map;
+    }
+    return false;
 }
 
 void VmObject::AddChildLocked(VmObject* o) {
@@ -75,6 +96,7 @@ void VmObject::RemoveChildLocked(VmObject* o) {
     canary_.Assert();
     DEBUG_ASSERT(lock_.IsHeld());
     children_list_.erase(*o);
+    OnReferenceRemovedLocked();
 }
 
 void VmObject::RangeChangeUpdateLocked(uint64_t offset, uint64_t len) {
@@ -96,6 +118,28 @@ void VmObject::RangeChangeUpdateLocked(uint64_t offset, uint64_t len) {
     }
 }
 
+void VmObject::UpdateMappingPagesLocked(uint64_t offset, ssize_t delta) {
+    canary_.Assert();
+    DEBUG_ASSERT(lock_.IsHeld());
+
+    for (auto& m : mapping_list_) {
+        if (offset >= m.object_offset() && offset - m.object_offset() < m.size()) {
+            m.SetCommittedPagesLocked(m.committed_pages_ + delta);
+        }
+    }
+}
+
+void VmObject::RecountMappingPagesLocked(uint64_t offset, uint64_t len) {
+    canary_.Assert();
+    DEBUG_ASSERT(lock_.IsHeld());
+
+    for (auto& m : mapping_list_) {
+        if (offset < m.object_offset() + m.size() && m.object_offset() < offset + len) {
+            m.RecountCommittedPagesLocked();
+        }
+    }
+}
+
 static int cmd_vm_object(int argc, const cmd_args* argv, uint32_t flags) {
     if (argc < 2) {
     notenoughargs:
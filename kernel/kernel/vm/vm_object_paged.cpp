@@ -27,17 +27,24 @@
 
 namespace {
 
-void ZeroPage(paddr_t pa) {
-    void* ptr = paddr_to_kvaddr(pa);
-    DEBUG_ASSERT(ptr);
-
-    arch_zero_page(ptr);
+// true if every byte of the page is zero. ors together a cache line's worth of
+// words per step so the loop unrolls into straight line loads.
+bool PageIsZero(const vm_page_t* p) {
+    const uint64_t* words = static_cast<const uint64_t*>(paddr_to_kvaddr(vm_page_to_paddr(p)));
+    for (size_t i = 0; i < PAGE_SIZE / sizeof(uint64_t); i += 8) {
+        uint64_t bits = words[i] | words[i + 1] | words[i + 2] | words[i + 3] |
+                        words[i + 4] | words[i + 5] | words[i + 6] | words[i + 7];
+        if (bits)
+            return false;
+    }
+    return true;
 }
 
-void ZeroPage(vm_page_t* p) {
-    paddr_t pa = vm_page_to_paddr(p);
-    ZeroPage(pa);
-}
+// the most pages ReclaimZeroPages looks at per call
+const size_t kMaxZeroScanPages = 64;
+
+// the most pages asked of a page source at once, starting with the one that's needed
+const size_t kPageRequestPages = 16;
 
 } // namespace
 
@@ -51,8 +58,17 @@ VmObjectPaged::~VmObjectPaged() {
 
     LTRACEF("%p\n", this);
 
+    // after this the page source can't reach us to fail requests
+    if (page_source_)
+        page_source_->Detach();
+
     // free all of the pages attached to us
     page_list_.FreeAllPages();
+
+    // nothing is going to supply pages any more, let the waiters find out
+    while (!page_requests_.is_empty()) {
+        page_requests_.pop_front()->Complete();
+    }
 }
 
 mxtl::RefPtr<VmObject> VmObjectPaged::Create(uint32_t pmm_alloc_flags, uint64_t size) {
@@ -76,6 +92,22 @@ mxtl::RefPtr<VmObject> VmObjectPaged::Create(uint32_t pmm_alloc_flags, uint64_t
     return vmo;
 }
 
+mxtl::RefPtr<VmObject> VmObjectPaged::CreateWithSource(uint32_t pmm_alloc_flags, uint64_t size,
+                                                       mxtl::RefPtr<PageSource> src) {
+    DEBUG_ASSERT(src);
+
+    auto vmo = Create(pmm_alloc_flags, size);
+    if (!vmo)
+        return nullptr;
+
+    // nothing else can see the object yet
+    auto paged = static_cast<VmObjectPaged*>(vmo.get());
+    src->Attach(paged);
+    paged->page_source_ = mxtl::move(src);
+
+    return vmo;
+}
+
 status_t VmObjectPaged::CloneCOW(uint64_t offset, uint64_t size, mxtl::RefPtr<VmObject>* clone_vmo) {
     LTRACEF("vmo %p offset %#" PRIx64 " size %#" PRIx64 "\n", this, offset, size);
 
@@ -133,17 +165,26 @@ void VmObjectPaged::Dump(uint depth, bool verbose) {
 size_t VmObjectPaged::AllocatedPagesInRange(uint64_t offset, uint64_t len) const {
     canary_.Assert();
     AutoLock a(&lock_);
+    return AllocatedPagesInRangeLocked(offset, len);
+}
+
+size_t VmObjectPaged::AllocatedPagesInRangeLocked(uint64_t offset, uint64_t len) const {
+    canary_.Assert();
+    DEBUG_ASSERT(lock_.IsHeld());
+
     uint64_t new_len;
     if (!TrimRange(offset, len, size_, &new_len)) {
         return 0;
     }
+
+    // the page list keeps count of the whole lot
+    if (offset == 0 && new_len == size_) {
+        return page_list_.count();
+    }
+
     size_t count = 0;
-    page_list_.ForEveryPage(
-        [&count, offset, new_len](const auto p, uint64_t off) {
-            if (off >= offset && off < offset + new_len) {
-                count++;
-            }
-        });
+    page_list_.ForEveryPageInRange([&count](const auto p, uint64_t off) { count++; },
+                                   offset, offset + new_len);
     return count;
 }
 
@@ -167,6 +208,7 @@ status_t VmObjectPaged::AddPageLocked(vm_page_t* p, uint64_t offset) {
     status_t err = page_list_.AddPage(p, offset);
     if (err != NO_ERROR)
         return err;
+    UpdateMappingPagesLocked(offset, 1);
 
     // other mappings may have covered this offset into the vmo, so unmap those ranges
     RangeChangeUpdateLocked(offset, PAGE_SIZE);
@@ -223,6 +265,32 @@ mxtl::RefPtr<VmObject> VmObjectPaged::CreateFromROData(const void* data, size_t
     return vmo;
 }
 
+status_t VmObjectPaged::GetPageRunLocked(uint64_t offset, uint64_t len, paddr_t* pa_out) {
+    canary_.Assert();
+    DEBUG_ASSERT(lock_.IsHeld());
+    DEBUG_ASSERT(IS_PAGE_ALIGNED(offset) && IS_PAGE_ALIGNED(len));
+
+    if (len == 0 || offset >= size_ || len > size_ - offset)
+        return ERR_OUT_OF_RANGE;
+
+    paddr_t base = 0;
+    for (uint64_t o = 0; o < len; o += PAGE_SIZE) {
+        vm_page_t* p = page_list_.GetPage(offset + o);
+        if (!p)
+            return ERR_NOT_FOUND;
+
+        paddr_t pa = vm_page_to_paddr(p);
+        if (o == 0) {
+            base = pa;
+        } else if (pa != base + o) {
+            return ERR_NOT_FOUND;
+        }
+    }
+
+    *pa_out = base;
+    return NO_ERROR;
+}
+
 status_t VmObjectPaged::GetPageLocked(uint64_t offset, uint pf_flags, vm_page_t** const page_out, paddr_t* const pa_out) {
     canary_.Assert();
     DEBUG_ASSERT(lock_.IsHeld());
@@ -271,7 +339,21 @@ status_t VmObjectPaged::GetPageLocked(uint64_t offset, uint pf_flags, vm_page_t*
                 return NO_ERROR;
             }
 
-            // if we're write faulting, we need to clone it and return the new page
+            // if we're write faulting and nothing but us can see the parent's page, take it
+            // from them. parents of paged objects are always paged objects themselves.
+            auto parent = static_cast<VmObjectPaged*>(parent_.get());
+            if (parent->GivePageToChildLocked(parent_offset.ValueOrDie(), p, this, offset)) {
+                LTRACEF("write faulting took page %p, pa %#" PRIxPTR " from parent\n", p, pa);
+
+                if (page_out)
+                    *page_out = p;
+                if (pa_out)
+                    *pa_out = pa;
+
+                return NO_ERROR;
+            }
+
+            // otherwise we need to clone it and return the new page
             paddr_t pa_clone;
             vm_page_t* p_clone = pmm_alloc_page(pmm_alloc_flags_, &pa_clone);
             if (!p_clone)
@@ -307,6 +389,11 @@ status_t VmObjectPaged::GetPageLocked(uint64_t offset, uint pf_flags, vm_page_t*
     if ((pf_flags & VMM_PF_FLAG_FAULT_MASK) == 0)
         return ERR_NOT_FOUND;
 
+    // if the contents come from a page source, ours or a parent's, it has to supply them first
+    status_t status = RequestPageLocked(offset);
+    if (status != ERR_NOT_FOUND)
+        return status;
+
     // if we're read faulting, we don't already have a page, and the parent doesn't have it,
     // return the single global zero page
     if ((pf_flags & VMM_PF_FLAG_WRITE) == 0) {
@@ -318,17 +405,14 @@ status_t VmObjectPaged::GetPageLocked(uint64_t offset, uint pf_flags, vm_page_t*
         return NO_ERROR;
     }
 
-    // allocate a page
-    p = pmm_alloc_page(pmm_alloc_flags_, &pa);
+    // allocate a zeroed page
+    p = pmm_alloc_page(pmm_alloc_flags_ | PMM_ALLOC_FLAG_ZEROED, &pa);
     if (!p)
         return ERR_NO_MEMORY;
 
     p->state = VM_PAGE_STATE_OBJECT;
 
-    // TODO: remove once pmm returns zeroed pages
-    ZeroPage(pa);
-
-    status_t status = AddPageLocked(p, offset);
+    status = AddPageLocked(p, offset);
     DEBUG_ASSERT(status == NO_ERROR);
 
     // other mappings may have covered this offset into the vmo, so unmap those ranges
@@ -344,6 +428,126 @@ status_t VmObjectPaged::GetPageLocked(uint64_t offset, uint pf_flags, vm_page_t*
     return NO_ERROR;
 }
 
+status_t VmObjectPaged::RequestPageLocked(uint64_t offset) {
+    DEBUG_ASSERT(lock_.IsHeld());
+
+    // the page is missing here and in every object between the faulting one and us
+    if (offset >= size_)
+        return ERR_NOT_FOUND;
+
+    if (!page_source_) {
+        if (!parent_)
+            return ERR_NOT_FOUND;
+        auto parent = static_cast<VmObjectPaged*>(parent_.get());
+        return parent->RequestPageLocked(parent_offset_ + offset);
+    }
+
+    // someone may have asked for it already. a failed request is forgotten so the
+    // next one to look asks again
+    for (auto iter = page_requests_.begin(); iter != page_requests_.end();) {
+        auto cur = iter++;
+        if (!cur->Overlaps(offset, PAGE_SIZE))
+            continue;
+        if (!cur->failed())
+            return ERR_SHOULD_WAIT;
+        page_requests_.erase(cur);
+    }
+
+    // read ahead over the missing pages that follow, stopping short of the next page we
+    // have or range that's already been asked for
+    uint64_t end = ROUNDUP_PAGE_SIZE(size_);
+    if (end - offset > kPageRequestPages * PAGE_SIZE)
+        end = offset + kPageRequestPages * PAGE_SIZE;
+    end = page_list_.NextPageOffset(offset, end);
+    for (const auto& r : page_requests_) {
+        if (r.offset() > offset && r.offset() < end)
+            end = r.offset();
+    }
+
+    AllocChecker ac;
+    auto request = mxtl::AdoptRef(new (&ac) PageRequest(page_source_, offset, end - offset));
+    if (!ac.check())
+        return ERR_NO_MEMORY;
+
+    LTRACEF("vmo %p requesting offset %#" PRIx64 " len %#" PRIx64 "\n", this, offset, end - offset);
+
+    page_requests_.push_back(mxtl::move(request));
+    return ERR_SHOULD_WAIT;
+}
+
+bool VmObjectPaged::HasPageSourceLocked() const {
+    DEBUG_ASSERT(lock_.IsHeld());
+
+    if (page_source_)
+        return true;
+    if (!parent_)
+        return false;
+    return static_cast<VmObjectPaged*>(parent_.get())->HasPageSourceLocked();
+}
+
+status_t VmObjectPaged::WaitForPageLocked(uint64_t offset) {
+    DEBUG_ASSERT(lock_.IsHeld());
+
+    auto request = GetPageRequestLocked(offset);
+    if (!request)
+        return NO_ERROR;
+
+    lock_.Release();
+    status_t status = request->Wait();
+    lock_.Acquire();
+    return status;
+}
+
+void VmObjectPaged::CompleteRequestsLocked(uint64_t offset, uint64_t len, status_t status) {
+    DEBUG_ASSERT(lock_.IsHeld());
+
+    for (auto iter = page_requests_.begin(); iter != page_requests_.end();) {
+        auto cur = iter++;
+        if (cur->Overlaps(offset, len)) {
+            auto request = page_requests_.erase(cur);
+            request->Complete(status);
+        }
+    }
+}
+
+void VmObjectPaged::FailPageRequests(uint64_t offset, uint64_t len, status_t status) {
+    canary_.Assert();
+    DEBUG_ASSERT(status < 0);
+
+    AutoLock a(&lock_);
+    CompleteRequestsLocked(offset, len, status);
+}
+
+mxtl::RefPtr<PageRequest> VmObjectPaged::GetPageRequestLocked(uint64_t offset) {
+    canary_.Assert();
+    DEBUG_ASSERT(lock_.IsHeld());
+
+    if (offset >= size_ || page_list_.GetPage(offset))
+        return nullptr;
+
+    if (page_source_) {
+        for (auto& r : page_requests_) {
+            if (r.Overlaps(offset, PAGE_SIZE))
+                return mxtl::WrapRefPtr(&r);
+        }
+        return nullptr;
+    }
+
+    if (parent_)
+        return parent_->GetPageRequestLocked(parent_offset_ + offset);
+
+    return nullptr;
+}
+
+bool VmObjectPaged::IsLargeChunkUncommittedLocked(uint64_t offset, uint64_t end) {
+    DEBUG_ASSERT(lock_.IsHeld());
+
+    if (!IS_ALIGNED(offset, VM_LARGE_PAGE_SIZE) || end - offset < VM_LARGE_PAGE_SIZE)
+        return false;
+
+    return !page_list_.AnyPagesInRange(offset, offset + VM_LARGE_PAGE_SIZE);
+}
+
 status_t VmObjectPaged::CommitRange(uint64_t offset, uint64_t len, uint64_t* committed) {
     canary_.Assert();
     LTRACEF("offset %#" PRIx64 ", len %#" PRIx64 "\n", offset, len);
@@ -353,6 +557,10 @@ status_t VmObjectPaged::CommitRange(uint64_t offset, uint64_t len, uint64_t* com
 
     AutoLock a(&lock_);
 
+    // the page source decides what goes in the pages, not us, even in a clone
+    if (HasPageSourceLocked())
+        return ERR_NOT_SUPPORTED;
+
     // trim the size
     uint64_t new_len;
     if (!TrimRange(offset, len, size_, &new_len))
@@ -367,21 +575,50 @@ status_t VmObjectPaged::CommitRange(uint64_t offset, uint64_t len, uint64_t* com
     DEBUG_ASSERT(end > offset);
 
     // make a pass through the list, counting the number of pages we need to allocate
+    // and how many large page sized, aligned chunks are entirely uncommitted
     size_t count = 0;
+    size_t large_chunks = 0;
     for (uint64_t o = offset; o < end; o += PAGE_SIZE) {
+        if (IsLargeChunkUncommittedLocked(o, end)) {
+            count += VM_LARGE_PAGE_SIZE / PAGE_SIZE;
+            large_chunks++;
+            o += VM_LARGE_PAGE_SIZE - PAGE_SIZE;
+            continue;
+        }
         if (!page_list_.GetPage(o))
             count++;
     }
     if (count == 0)
         return NO_ERROR;
 
-    // allocate count number of pages
+    // back as many of the uncommitted chunks as we can with physically
+    // contiguous, aligned runs so mappings of them can use large pages.
+    // stop at the first failure, it's not going to get less fragmented.
+    list_node large_page_list;
+    list_initialize(&large_page_list);
+
+    size_t large_count = 0;
+    for (size_t i = 0; i < large_chunks; i++) {
+        paddr_t pa;
+        size_t allocated = pmm_alloc_contiguous(VM_LARGE_PAGE_SIZE / PAGE_SIZE,
+                                                pmm_alloc_flags_ | PMM_ALLOC_FLAG_ZEROED,
+                                                VM_LARGE_PAGE_SIZE_SHIFT, &pa, &large_page_list);
+        if (allocated == 0)
+            break;
+        DEBUG_ASSERT(allocated == VM_LARGE_PAGE_SIZE / PAGE_SIZE);
+        large_count += allocated;
+    }
+
+    // allocate the rest as individual pages
     list_node page_list;
     list_initialize(&page_list);
 
-    size_t allocated = pmm_alloc_pages(count, pmm_alloc_flags_, &page_list);
-    if (allocated < count) {
-        LTRACEF("failed to allocate enough pages (asked for %zu, got %zu)\n", count, allocated);
+    size_t allocated = pmm_alloc_pages(count - large_count, pmm_alloc_flags_ | PMM_ALLOC_FLAG_ZEROED,
+                                       &page_list);
+    if (allocated < count - large_count) {
+        LTRACEF("failed to allocate enough pages (asked for %zu, got %zu)\n",
+                count - large_count, allocated);
+        pmm_free(&large_page_list);
         pmm_free(&page_list);
         return ERR_NO_MEMORY;
     }
@@ -389,28 +626,39 @@ status_t VmObjectPaged::CommitRange(uint64_t offset, uint64_t len, uint64_t* com
     // unmap all of the pages in this range on all the mapping regions
     RangeChangeUpdateLocked(offset, end - offset);
 
-    // add them to the appropriate range of the object
+    // add them to the appropriate range of the object, handing the contiguous
+    // runs out to the first uncommitted chunks. the runs come back from the
+    // pmm in address order, so each chunk ends up physically contiguous.
+    list_node* chunk_list = &page_list;
+    uint64_t chunk_end = 0;
     for (uint64_t o = offset; o < end; o += PAGE_SIZE) {
+        if (o >= chunk_end) {
+            chunk_list = &page_list;
+            if (!list_is_empty(&large_page_list) && IsLargeChunkUncommittedLocked(o, end)) {
+                chunk_list = &large_page_list;
+                chunk_end = o + VM_LARGE_PAGE_SIZE;
+            }
+        }
+
         vm_page_t* p = page_list_.GetPage(o);
         if (p)
             continue;
 
-        p = list_remove_head_type(&page_list, vm_page_t, free.node);
+        p = list_remove_head_type(chunk_list, vm_page_t, free.node);
         ASSERT(p);
 
         p->state = VM_PAGE_STATE_OBJECT;
 
-        // TODO: remove once pmm returns zeroed pages
-        ZeroPage(p);
-
         status_t status = page_list_.AddPage(p, o);
         DEBUG_ASSERT(status == NO_ERROR);
+        UpdateMappingPagesLocked(o, 1);
 
         if (committed)
             *committed += PAGE_SIZE;
     }
 
     DEBUG_ASSERT(list_is_empty(&page_list));
+    DEBUG_ASSERT(list_is_empty(&large_page_list));
 
     // for now we only support committing as much as we were asked for
     DEBUG_ASSERT(!committed || *committed == count * PAGE_SIZE);
@@ -428,6 +676,10 @@ status_t VmObjectPaged::CommitRangeContiguous(uint64_t offset, uint64_t len, uin
 
     AutoLock a(&lock_);
 
+    // the page source decides what goes in the pages, not us, even in a clone
+    if (HasPageSourceLocked())
+        return ERR_NOT_SUPPORTED;
+
     // trim the size
     uint64_t new_len;
     if (!TrimRange(offset, len, size_, &new_len))
@@ -454,7 +706,8 @@ status_t VmObjectPaged::CommitRangeContiguous(uint64_t offset, uint64_t len, uin
     list_node page_list;
     list_initialize(&page_list);
 
-    size_t allocated = pmm_alloc_contiguous(count, pmm_alloc_flags_, alignment_log2, nullptr, &page_list);
+    size_t allocated = pmm_alloc_contiguous(count, pmm_alloc_flags_ | PMM_ALLOC_FLAG_ZEROED,
+                                            alignment_log2, nullptr, &page_list);
     if (allocated < count) {
         LTRACEF("failed to allocate enough pages (asked for %zu, got %zu)\n", count, allocated);
         pmm_free(&page_list);
@@ -463,6 +716,9 @@ status_t VmObjectPaged::CommitRangeContiguous(uint64_t offset, uint64_t len, uin
 
     DEBUG_ASSERT(list_length(&page_list) == allocated);
 
+    // the caller is after the physical layout, so leave it alone from here on
+    phys_exposed_ = true;
+
     // unmap all of the pages in this range on all the mapping regions
     RangeChangeUpdateLocked(offset, end - offset);
 
@@ -473,11 +729,9 @@ status_t VmObjectPaged::CommitRangeContiguous(uint64_t offset, uint64_t len, uin
 
         p->state = VM_PAGE_STATE_OBJECT;
 
-        // TODO: remove once pmm returns zeroed pages
-        ZeroPage(p);
-
         auto status = page_list_.AddPage(p, o);
         DEBUG_ASSERT(status == NO_ERROR);
+        UpdateMappingPagesLocked(o, 1);
 
         if (committed)
             *committed += PAGE_SIZE;
@@ -520,18 +774,221 @@ status_t VmObjectPaged::DecommitRange(uint64_t offset, uint64_t len, uint64_t* d
     // unmap all of the pages in this range on all the mapping regions
     RangeChangeUpdateLocked(start, page_aligned_len);
 
-    // iterate through the pages, freeing them
-    while (start < end) {
-        auto status = page_list_.FreePage(start);
-        if (status == NO_ERROR && decommitted) {
-            *decommitted += PAGE_SIZE;
+    // free all of the pages in the range
+    size_t freed = page_list_.FreePagesInRange(start, end);
+    RecountMappingPagesLocked(start, page_aligned_len);
+    if (decommitted)
+        *decommitted = freed * PAGE_SIZE;
+
+    return NO_ERROR;
+}
+
+status_t VmObjectPaged::SupplyPages(uint64_t offset, uint64_t len, VmObject* src,
+                                   uint64_t src_offset) {
+    canary_.Assert();
+    LTRACEF("offset %#" PRIx64 ", len %#" PRIx64 ", src %p offset %#" PRIx64 "\n",
+            offset, len, src, src_offset);
+
+    if (!IS_PAGE_ALIGNED(offset) || !IS_PAGE_ALIGNED(len) || !IS_PAGE_ALIGNED(src_offset))
+        return ERR_INVALID_ARGS;
+
+    if (!page_source_)
+        return ERR_NOT_SUPPORTED;
+
+    // taking pages out of our own clone chain would need our lock twice
+    if (src->lock() == lock())
+        return ERR_INVALID_ARGS;
+
+    {
+        AutoLock a(&lock_);
+        if (!InRange(offset, len, ROUNDUP_PAGE_SIZE(size_)))
+            return ERR_OUT_OF_RANGE;
+    }
+
+    list_node pages = LIST_INITIAL_VALUE(pages);
+    status_t status = src->TakePages(src_offset, len, &pages);
+    if (status != NO_ERROR)
+        return status;
+
+    AutoLock a(&lock_);
+
+    // where a page has turned up in the meantime, or the object has shrunk past
+    // it, the one being supplied is dropped
+    for (uint64_t o = offset; o < offset + len; o += PAGE_SIZE) {
+        vm_page_t* p = list_remove_head_type(&pages, vm_page_t, free.node);
+        DEBUG_ASSERT(p);
+        if (o >= size_ || page_list_.GetPage(o)) {
+            pmm_free_page(p);
+            continue;
         }
-        start += PAGE_SIZE;
+        status = AddPageLocked(p, o);
+        DEBUG_ASSERT(status == NO_ERROR);
+    }
+    DEBUG_ASSERT(list_is_empty(&pages));
+
+    CompleteRequestsLocked(offset, len);
+
+    return NO_ERROR;
+}
+
+status_t VmObjectPaged::FailPages(uint64_t offset, uint64_t len, status_t status) {
+    canary_.Assert();
+    LTRACEF("offset %#" PRIx64 ", len %#" PRIx64 ", status %d\n", offset, len, status);
+
+    if (!IS_PAGE_ALIGNED(offset) || !IS_PAGE_ALIGNED(len) || status >= 0)
+        return ERR_INVALID_ARGS;
+
+    if (!page_source_)
+        return ERR_NOT_SUPPORTED;
+
+    AutoLock a(&lock_);
+    if (!InRange(offset, len, ROUNDUP_PAGE_SIZE(size_)))
+        return ERR_OUT_OF_RANGE;
+
+    // the waiters see |status|, and the next fault on the range asks again
+    CompleteRequestsLocked(offset, len, status);
+
+    return NO_ERROR;
+}
+
+status_t VmObjectPaged::TakePages(uint64_t offset, uint64_t len, list_node* pages) {
+    canary_.Assert();
+    LTRACEF("offset %#" PRIx64 ", len %#" PRIx64 "\n", offset, len);
+
+    if (!IS_PAGE_ALIGNED(offset) || !IS_PAGE_ALIGNED(len))
+        return ERR_INVALID_ARGS;
+
+    AutoLock a(&lock_);
+
+    if (!InRange(offset, len, ROUNDUP_PAGE_SIZE(size_)))
+        return ERR_OUT_OF_RANGE;
+
+    // the pages have to be ours alone, not seen through by clones and not
+    // pinned down by having had their physical addresses handed out
+    if (!children_list_.is_empty() || phys_exposed_)
+        return ERR_BAD_STATE;
+
+    uint64_t end = offset + len;
+    for (uint64_t o = offset; o < end; o += PAGE_SIZE) {
+        vm_page_t* p = page_list_.GetPage(o);
+        if (!p || p->state != VM_PAGE_STATE_OBJECT)
+            return ERR_BAD_STATE;
+    }
+
+    // pull them out of every mapping before they go
+    RangeChangeUpdateLocked(offset, len);
+
+    for (uint64_t o = offset; o < end; o += PAGE_SIZE) {
+        vm_page_t* p = page_list_.RemovePage(o);
+        UpdateMappingPagesLocked(o, -1);
+        list_add_tail(pages, &p->free.node);
+    }
+
+    return NO_ERROR;
+}
+
+status_t VmObjectPaged::ExchangePages(uint64_t offset, uint64_t len, list_node* pages) {
+    canary_.Assert();
+    LTRACEF("offset %#" PRIx64 ", len %#" PRIx64 "\n", offset, len);
+
+    if (!IS_PAGE_ALIGNED(offset) || !IS_PAGE_ALIGNED(len))
+        return ERR_INVALID_ARGS;
+
+    AutoLock a(&lock_);
+
+    if (!InRange(offset, len, ROUNDUP_PAGE_SIZE(size_)))
+        return ERR_OUT_OF_RANGE;
+
+    // same as for TakePages, and the page source decides what our pages hold
+    if (!children_list_.is_empty() || phys_exposed_ || page_source_)
+        return ERR_BAD_STATE;
+
+    uint64_t end = offset + len;
+    for (uint64_t o = offset; o < end; o += PAGE_SIZE) {
+        vm_page_t* p = page_list_.GetPage(o);
+        if (!p || p->state != VM_PAGE_STATE_OBJECT)
+            return ERR_BAD_STATE;
     }
 
+    // pull the old ones out of every mapping before they go
+    RangeChangeUpdateLocked(offset, len);
+
+    // every offset has a page, so they can be swapped in place without touching the tree
+    list_node old_pages = LIST_INITIAL_VALUE(old_pages);
+    page_list_.ForEveryPageInRange([pages, &old_pages](vm_page*& p, uint64_t) {
+        vm_page_t* n = list_remove_head_type(pages, vm_page_t, free.node);
+        DEBUG_ASSERT(n);
+        n->state = VM_PAGE_STATE_OBJECT;
+        list_add_tail(&old_pages, &p->free.node);
+        p = n;
+    }, offset, end);
+    DEBUG_ASSERT(list_is_empty(pages));
+
+    list_move(&old_pages, pages);
+
     return NO_ERROR;
 }
 
+size_t VmObjectPaged::ReclaimZeroPages(uint64_t* offset, uint64_t end, size_t max_pages) {
+    canary_.Assert();
+    LTRACEF("offset %#" PRIx64 ", end %#" PRIx64 "\n", *offset, end);
+    DEBUG_ASSERT(max_pages > 0);
+
+    AutoLock a(&lock_);
+
+    // unless the page budget cuts the window short, this call covers the rest of the range
+    uint64_t start = ROUNDDOWN(*offset, PAGE_SIZE);
+    *offset = end;
+    end = MIN(ROUNDUP_PAGE_SIZE(end), size_);
+
+    // a clone reads through to its parent where it has no page, and a hole in
+    // an object with a page source reads whatever the source supplies, so a
+    // hole is not the same as zero. pages whose physical address went out, or
+    // that a kernel mapping can touch at any time, have to stay put.
+    if (parent_ || page_source_ || phys_exposed_ || start >= end)
+        return 0;
+    for (const auto& m : mapping_list_) {
+        if (!m.aspace()->is_user())
+            return 0;
+    }
+
+    // skip straight to the first committed page and bound the window by the page budget
+    start = page_list_.NextPageOffset(start, end);
+    max_pages = MIN(max_pages, kMaxZeroScanPages);
+    if (end - start > max_pages * PAGE_SIZE) {
+        end = start + max_pages * PAGE_SIZE;
+        *offset = end;
+    }
+
+    // find the zero pages without disturbing anything first
+    uint64_t candidates[kMaxZeroScanPages];
+    size_t count = 0;
+    page_list_.ForEveryPageInRange([&candidates, &count](const auto p, uint64_t off) {
+        if (p->state == VM_PAGE_STATE_OBJECT && PageIsZero(p))
+            candidates[count++] = off;
+    }, start, end);
+
+    size_t reclaimed = 0;
+    for (size_t i = 0; i < count; i++) {
+        // pull the page out of every mapping and look again, now that nothing
+        // can write to it behind our back
+        RangeChangeUpdateLocked(candidates[i], PAGE_SIZE);
+
+        vm_page_t* p = page_list_.GetPage(candidates[i]);
+        DEBUG_ASSERT(p);
+        if (!PageIsZero(p))
+            continue;
+
+        page_list_.RemovePage(candidates[i]);
+        UpdateMappingPagesLocked(candidates[i], -1);
+        pmm_free_page(p);
+        reclaimed++;
+    }
+
+    zero_pages_reclaimed_ += reclaimed;
+    return reclaimed;
+}
+
 status_t VmObjectPaged::ResizeLocked(uint64_t s) {
     canary_.Assert();
     DEBUG_ASSERT(lock_.IsHeld());
@@ -555,11 +1012,12 @@ status_t VmObjectPaged::ResizeLocked(uint64_t s) {
             // unmap all of the pages in this range on all the mapping regions
             RangeChangeUpdateLocked(start, page_aligned_len);
 
-            // iterate through the pages, freeing them
-            while (start < end) {
-                page_list_.FreePage(start);
-                start += PAGE_SIZE;
-            }
+            // free all of the pages in the range
+            page_list_.FreePagesInRange(start, end);
+            RecountMappingPagesLocked(start, page_aligned_len);
+
+            // nobody will be waiting for pages past the end any more
+            CompleteRequestsLocked(start, page_aligned_len);
         }
     } else if (s > size_) {
         // expanding
@@ -607,6 +1065,113 @@ status_t VmObjectPaged::SetParentOffsetLocked(uint64_t offset) {
     return NO_ERROR;
 }
 
+void VmObjectPaged::OnDispatcherClosed() {
+    canary_.Assert();
+
+    AutoLock a(&lock_);
+
+    dispatcher_closed_ = true;
+    CollapseIntoChildLocked();
+}
+
+void VmObjectPaged::OnReferenceRemovedLocked() {
+    CollapseIntoChildLocked();
+}
+
+bool VmObjectPaged::OnlyReachableFromChildLocked() const {
+    DEBUG_ASSERT(lock_.IsHeld());
+
+    return dispatcher_closed_ && mapping_list_.is_empty() && !children_list_.is_empty() &&
+           &children_list_.front() == &children_list_.back();
+}
+
+bool VmObjectPaged::GivePageToChildLocked(uint64_t offset, vm_page_t* p, VmObjectPaged* child,
+                                          uint64_t child_offset) {
+    canary_.Assert();
+    DEBUG_ASSERT(lock_.IsHeld());
+
+    if (!OnlyReachableFromChildLocked() || page_list_.GetPage(offset) != p)
+        return false;
+
+    DEBUG_ASSERT(&children_list_.front() == child);
+
+    // add it to the child before taking it from us, so a failure leaves it where it was
+    if (child->AddPageLocked(p, child_offset) != NO_ERROR)
+        return false;
+
+    __UNUSED auto removed = page_list_.RemovePage(offset);
+    DEBUG_ASSERT(removed == p);
+
+    return true;
+}
+
+void VmObjectPaged::CollapseIntoChildLocked() {
+    canary_.Assert();
+    DEBUG_ASSERT(lock_.IsHeld());
+
+    // only intermediate objects go away, the child keeps using the lock of the
+    // object at the root of the chain
+    if (!parent_ || !OnlyReachableFromChildLocked())
+        return;
+
+    // children of paged objects are always paged objects themselves
+    auto child = static_cast<VmObjectPaged*>(&children_list_.front());
+
+    // if the child can see past our end, those offsets read as zeros through us
+    // but would show our parent's pages once we're gone
+    uint64_t start = child->parent_offset_;
+    uint64_t end = ROUNDUP_PAGE_SIZE(start + child->size_);
+    if (end > size_)
+        return;
+
+    LTRACEF("vmo %p collapsing into child %p\n", this, child);
+
+    // hand every page the child can see through us over to it. if the child can't
+    // take them all, take back the ones it did and stay, with our pages as they were.
+    bool stay = false;
+    page_list_.ForEveryPage([&](vm_page*& p, uint64_t off) {
+        if (stay || off < start || off >= end || child->page_list_.GetPage(off - start))
+            return;
+        if (child->page_list_.AddPage(p, off - start) != NO_ERROR)
+            stay = true;
+    });
+    if (stay) {
+        page_list_.ForEveryPage([&](vm_page*& p, uint64_t off) {
+            if (off >= start && off < end && child->page_list_.GetPage(off - start) == p)
+                child->page_list_.RemovePage(off - start);
+        });
+        return;
+    }
+
+    // now that they're all in the child, free the ones it can't see
+    list_node free_list;
+    list_initialize(&free_list);
+    page_list_.ForEveryPage([&](vm_page*& p, uint64_t off) {
+        if (off < start || off >= end || child->page_list_.GetPage(off - start) != p)
+            list_add_tail(&free_list, &p->free.node);
+        p = nullptr;
+    });
+    pmm_free(&free_list);
+
+    // the child's mappings may see some of them
+    child->RecountMappingPagesLocked(0, ROUNDUP_PAGE_SIZE(child->size_));
+
+    // drop the emptied out nodes
+    __UNUSED auto freed = page_list_.FreeAllPages();
+    DEBUG_ASSERT(freed == 0);
+
+    // take our place under our parent. the caller is holding a reference to us,
+    // so we stay around until it is done with us. the child is added to our
+    // parent before we leave it, so that our leaving doesn't make the parent
+    // look like it has no other children and collapse into a sibling of ours.
+    children_list_.erase(*child);
+    auto parent = parent_;
+    parent->AddChildLocked(child);
+    child->parent_offset_ += parent_offset_;
+    child->parent_ = mxtl::move(parent_);
+    parent->RemoveChildLocked(this);
+}
+
 // perform some sort of copy in/out on a range of the object using a passed in lambda
 // for the copy routine
 template <typename T>
@@ -637,6 +1202,13 @@ status_t VmObjectPaged::ReadWriteInternal(uint64_t offset, size_t len, size_t* b
         // fault in the page
         paddr_t pa;
         auto status = GetPageLocked(src_offset, VMM_PF_FLAG_SW_FAULT | (write ? VMM_PF_FLAG_WRITE : 0), nullptr, &pa);
+        if (status == ERR_SHOULD_WAIT) {
+            // the page source has to supply it first, wait for it and look again
+            status = WaitForPageLocked(src_offset);
+            if (status < 0)
+                return status;
+            continue;
+        }
         if (status < 0)
             return status;
 
@@ -706,19 +1278,35 @@ status_t VmObjectPaged::Lookup(uint64_t offset, uint64_t len, uint pf_flags,
     if (unlikely(!InRange(offset, len, size_)))
         return ERR_OUT_OF_RANGE;
 
+    // physical addresses are going out, so the pages have to stay where they are
+    phys_exposed_ = true;
+
     uint64_t start_page_offset = ROUNDDOWN(offset, PAGE_SIZE);
     uint64_t end_page_offset = ROUNDUP(offset + len, PAGE_SIZE);
 
     size_t index = 0;
-    for (uint64_t off = start_page_offset; off != end_page_offset; off += PAGE_SIZE, index++) {
+    for (uint64_t off = start_page_offset; off != end_page_offset;) {
         paddr_t pa;
         auto status = GetPageLocked(off, pf_flags, nullptr, &pa);
+        if (status == ERR_SHOULD_WAIT) {
+            // the page source has to supply it first. the object may have shrunk
+            // while the lock was dropped
+            status = WaitForPageLocked(off);
+            if (status < 0)
+                return status;
+            if (unlikely(!InRange(offset, len, size_)))
+                return ERR_OUT_OF_RANGE;
+            continue;
+        }
         if (status < 0)
             return ERR_NO_MEMORY;
 
         status = lookup_fn(context, off, index, pa);
         if (unlikely(status < 0))
             return status;
+
+        off += PAGE_SIZE;
+        index++;
     }
 
     return NO_ERROR;
@@ -67,16 +67,44 @@ VmPageList::~VmPageList() {
     DEBUG_ASSERT(list_.is_empty());
 }
 
+// look up the tree node at node_offset, stepping forward from the node the last
+// lookup ended at when that's cheaper than a fresh descent of the tree. leaves
+// hint_ at the first node at or after node_offset either way.
+VmPageListNode* VmPageList::FindNode(uint64_t node_offset) {
+    if (hint_valid_ && node_offset >= hint_offset_) {
+        // nothing lives between hint_offset_ and hint_, so if the target is
+        // no further on than hint_ it's either there or nowhere
+        if (!hint_.IsValid() || hint_->offset() >= node_offset) {
+            hint_offset_ = node_offset;
+            return (hint_.IsValid() && hint_->offset() == node_offset) ? &*hint_ : nullptr;
+        }
+
+        // otherwise try the very next node
+        auto next = hint_;
+        ++next;
+        if (!next.IsValid() || next->offset() >= node_offset) {
+            hint_ = next;
+            hint_offset_ = node_offset;
+            return (hint_.IsValid() && hint_->offset() == node_offset) ? &*hint_ : nullptr;
+        }
+    }
+
+    hint_ = list_.lower_bound(node_offset);
+    hint_offset_ = node_offset;
+    hint_valid_ = true;
+    return (hint_.IsValid() && hint_->offset() == node_offset) ? &*hint_ : nullptr;
+}
+
 status_t VmPageList::AddPage(vm_page* p, uint64_t offset) {
-    uint64_t node_offset = ROUNDDOWN(offset, PAGE_SIZE * VmPageListNode::kPageFanOut);
+    uint64_t node_offset = NodeOffset(offset);
     size_t index = (offset >> PAGE_SIZE_SHIFT) % VmPageListNode::kPageFanOut;
 
     LTRACEF_LEVEL(2, "%p page %p, offset %#" PRIx64 " node_offset %#" PRIx64 " index %zu\n", this, p, offset,
                   node_offset, index);
 
     // lookup the tree node that holds this page
-    auto pln = list_.find(node_offset);
-    if (!pln.IsValid()) {
+    auto pln = FindNode(node_offset);
+    if (!pln) {
         AllocChecker ac;
         mxtl::unique_ptr<VmPageListNode> pl =
             mxtl::unique_ptr<VmPageListNode>(new (&ac) VmPageListNode(node_offset));
@@ -87,58 +115,134 @@ status_t VmPageList::AddPage(vm_page* p, uint64_t offset) {
         __UNUSED auto status = pl->AddPage(p, index);
         DEBUG_ASSERT(status == NO_ERROR);
 
+        // the new node is now the first one at or after node_offset
+        hint_ = list_.make_iterator(*pl);
         list_.insert(mxtl::move(pl));
     } else {
-        pln->AddPage(p, index);
+        status_t status = pln->AddPage(p, index);
+        if (status != NO_ERROR)
+            return status;
     }
 
+    count_++;
     return NO_ERROR;
 }
 
 vm_page* VmPageList::GetPage(uint64_t offset) {
-    uint64_t node_offset = ROUNDDOWN(offset, PAGE_SIZE * VmPageListNode::kPageFanOut);
+    uint64_t node_offset = NodeOffset(offset);
     size_t index = (offset >> PAGE_SIZE_SHIFT) % VmPageListNode::kPageFanOut;
 
     LTRACEF_LEVEL(2, "%p offset %#" PRIx64 " node_offset %#" PRIx64 " index %zu\n", this, offset, node_offset,
                   index);
 
     // lookup the tree node that holds this page
-    auto pln = list_.find(node_offset);
-    if (!pln.IsValid()) {
+    auto pln = FindNode(node_offset);
+    if (!pln) {
         return nullptr;
     }
 
     return pln->GetPage(index);
 }
 
-status_t VmPageList::FreePage(uint64_t offset) {
-    uint64_t node_offset = ROUNDDOWN(offset, PAGE_SIZE * VmPageListNode::kPageFanOut);
+// take the page at offset out of the list without freeing it
+vm_page* VmPageList::RemovePage(uint64_t offset) {
+    uint64_t node_offset = NodeOffset(offset);
     size_t index = (offset >> PAGE_SIZE_SHIFT) % VmPageListNode::kPageFanOut;
 
     LTRACEF_LEVEL(2, "%p offset %#" PRIx64 " node_offset %#" PRIx64 " index %zu\n", this, offset, node_offset,
                   index);
 
     // lookup the tree node that holds this page
-    auto pln = list_.find(node_offset);
-    if (!pln.IsValid()) {
-        return ERR_NOT_FOUND;
+    auto pln = FindNode(node_offset);
+    if (!pln) {
+        return nullptr;
     }
 
-    // free this page
     auto page = pln->RemovePage(index);
     if (page) {
-        // if it was the last page in the node, remove the node from the tree
+        count_--;
+
+        // if it was the last page in the node, remove the node from the tree,
+        // moving the hint on to the node after it
         if (pln->IsEmpty()) {
             LTRACEF_LEVEL(2, "%p freeing the list node\n", this);
+            ++hint_;
             list_.erase(*pln);
         }
+    }
 
-        pmm_free_page(page);
+    return page;
+}
+
+status_t VmPageList::FreePage(uint64_t offset) {
+    // free this page
+    auto page = RemovePage(offset);
+    if (!page) {
+        return ERR_NOT_FOUND;
     }
 
+    pmm_free_page(page);
+
     return NO_ERROR;
 }
 
+bool VmPageList::AnyPagesInRange(uint64_t start_offset, uint64_t end_offset) const {
+    bool found = false;
+    for (auto pl = list_.lower_bound(NodeOffset(start_offset));
+         !found && pl.IsValid() && pl->offset() < end_offset; ++pl) {
+        pl->ForEveryPageInRange([&found](const auto p, uint64_t) { found = true; },
+                                start_offset, end_offset);
+    }
+    return found;
+}
+
+uint64_t VmPageList::NextPageOffset(uint64_t start_offset, uint64_t end_offset) const {
+    uint64_t next = end_offset;
+    for (auto pl = list_.lower_bound(NodeOffset(start_offset));
+         next == end_offset && pl.IsValid() && pl->offset() < end_offset; ++pl) {
+        pl->ForEveryPageInRange([&next](const auto p, uint64_t offset) {
+            if (offset < next)
+                next = offset;
+        }, start_offset, end_offset);
+    }
+    return next;
+}
+
+size_t VmPageList::FreePagesInRange(uint64_t start_offset, uint64_t end_offset) {
+    LTRACEF("%p start %#" PRIx64 " end %#" PRIx64 "\n", this, start_offset, end_offset);
+
+    list_node list;
+    list_initialize(&list);
+
+    size_t count = 0;
+
+    // per page get a reference to the page pointer inside the page list node
+    auto per_page_func = [&](vm_page*& p, uint64_t offset) {
+        // add the page to our list and null out the inner node
+        list_add_tail(&list, &p->free.node);
+        p = nullptr;
+        count++;
+    };
+
+    // walk the nodes covering the range in order, dropping any that end up empty
+    auto pl = list_.lower_bound(NodeOffset(start_offset));
+    while (pl.IsValid() && pl->offset() < end_offset) {
+        auto cur = pl++;
+        cur->ForEveryPageInRange(per_page_func, start_offset, end_offset);
+        if (cur->IsEmpty()) {
+            list_.erase(cur);
+        }
+    }
+    hint_valid_ = false;
+    count_ -= count;
+
+    // return all the pages to the pmm at once
+    __UNUSED auto freed = pmm_free(&list);
+    DEBUG_ASSERT(freed == count);
+
+    return count;
+}
+
 size_t VmPageList::FreeAllPages() {
     LTRACEF("%p\n", this);
 
@@ -164,6 +268,8 @@ size_t VmPageList::FreeAllPages() {
 
     // empty the tree
     list_.clear();
+    hint_valid_ = false;
+    count_ = 0;
 
     return count;
 }
@@ -11,10 +11,13 @@
 #include <kernel/vm/vm_aspace.h>
 #include <kernel/vm/vm_object.h>
 #include <kernel/vm/vm_object_paged.h>
+#include <kernel/vm/vm_page_list.h>
 #include <mxtl/array.h>
 #include <new.h>
 #include <unittest.h>
 
+#include "pmm_arena.h"
+
 static const uint kArchRwFlags = ARCH_MMU_FLAG_PERM_READ | ARCH_MMU_FLAG_PERM_WRITE;
 
 // Allocates a single page, translates it to a vm_page_t and frees it.
@@ -70,6 +73,219 @@ static bool pmm_oversized_alloc_test(void* context) {
     END_TEST;
 }
 
+// Allocates and frees enough single pages to cycle them through the per cpu
+// page magazines a few times.
+static bool pmm_single_page_cycle_test(void* context) {
+    BEGIN_TEST;
+    list_node list = LIST_INITIAL_VALUE(list);
+
+    static const size_t alloc_count = 512;
+
+    for (size_t i = 0; i < alloc_count; i++) {
+        paddr_t pa;
+        vm_page_t* page = pmm_alloc_page(0, &pa);
+        EXPECT_NEQ(nullptr, page, "pmm_alloc single page");
+        if (!page)
+            break;
+        EXPECT_EQ(page, paddr_to_vm_page(pa), "paddr_to_vm_page on single page");
+        EXPECT_FALSE(list_in_list(&page->free.node), "page handed out twice");
+        list_add_tail(&list, &page->free.node);
+    }
+    EXPECT_EQ(alloc_count, list_length(&list), "pmm_alloc_page list count");
+
+    vm_page_t* page;
+    while ((page = list_remove_head_type(&list, vm_page_t, free.node))) {
+        auto ret = pmm_free_page(page);
+        EXPECT_EQ(1u, ret, "pmm_free_page on single page");
+    }
+    END_TEST;
+}
+
+// Dirties some pages, frees them and makes sure zeroed allocations come back
+// zero filled whether or not they were zeroed ahead of time.
+static bool pmm_zeroed_alloc_test(void* context) {
+    BEGIN_TEST;
+    list_node list = LIST_INITIAL_VALUE(list);
+
+    static const size_t alloc_count = 64;
+
+    auto count = pmm_alloc_pages(alloc_count, PMM_ALLOC_FLAG_KMAP, &list);
+    EXPECT_EQ(alloc_count, count, "pmm_alloc_pages count");
+
+    vm_page_t* page;
+    list_for_every_entry (&list, page, vm_page_t, free.node) {
+        memset(paddr_to_kvaddr(vm_page_to_paddr(page)), 0xa5, PAGE_SIZE);
+    }
+    while ((page = list_remove_head_type(&list, vm_page_t, free.node))) {
+        pmm_free_page(page);
+    }
+
+    for (size_t i = 0; i < alloc_count; i++) {
+        paddr_t pa;
+        page = pmm_alloc_page(PMM_ALLOC_FLAG_KMAP | PMM_ALLOC_FLAG_ZEROED, &pa);
+        EXPECT_NEQ(nullptr, page, "pmm_alloc zeroed page");
+        if (!page)
+            break;
+        list_add_tail(&list, &page->free.node);
+    }
+
+    count = pmm_alloc_pages(alloc_count, PMM_ALLOC_FLAG_KMAP | PMM_ALLOC_FLAG_ZEROED, &list);
+    EXPECT_EQ(alloc_count, count, "pmm_alloc_pages zeroed count");
+
+    bool all_zero = true;
+    list_for_every_entry (&list, page, vm_page_t, free.node) {
+        const uint8_t* ptr = static_cast<const uint8_t*>(paddr_to_kvaddr(vm_page_to_paddr(page)));
+        for (size_t j = 0; j < PAGE_SIZE; j++) {
+            if (ptr[j] != 0) {
+                all_zero = false;
+                break;
+            }
+        }
+    }
+    EXPECT_TRUE(all_zero, "zeroed pages are zero filled");
+
+    pmm_free(&list);
+    END_TEST;
+}
+
+// Punches holes in a large contiguous run and makes sure contiguous
+// allocations of every size come back aligned, contiguous and clear of the
+// pages still held, then that the run can be had again once it is freed.
+static bool pmm_contiguous_fragmentation_test(void* context) {
+    BEGIN_TEST;
+    list_node held = LIST_INITIAL_VALUE(held);
+    list_node runs = LIST_INITIAL_VALUE(runs);
+
+    static const size_t run_count = 256;
+    static const uint8_t run_align_log2 = PAGE_SIZE_SHIFT + 8;
+
+    paddr_t run_pa;
+    auto count = pmm_alloc_contiguous(run_count, 0, run_align_log2, &run_pa, &held);
+    EXPECT_EQ(run_count, count, "pmm_alloc_contiguous large run");
+    if (count != run_count) {
+        pmm_free(&held);
+        END_TEST;
+    }
+    EXPECT_TRUE(IS_ALIGNED(run_pa, 1UL << run_align_log2), "large run alignment");
+
+    // give back every other page, leaving no two free pages next to each
+    // other anywhere in the run
+    list_node holes = LIST_INITIAL_VALUE(holes);
+    vm_page_t* page;
+    vm_page_t* temp;
+    size_t i = 0;
+    list_for_every_entry_safe (&held, page, temp, vm_page_t, free.node) {
+        if (i++ % 2) {
+            list_delete(&page->free.node);
+            list_add_tail(&holes, &page->free.node);
+        }
+    }
+    pmm_free(&holes);
+
+    for (size_t round = 0; round < 4; round++) {
+        for (size_t run = 1; run <= 64; run += (run < 8) ? 1 : run) {
+            for (uint8_t align = PAGE_SIZE_SHIFT; align <= PAGE_SIZE_SHIFT + 6; align += 3) {
+                list_node list = LIST_INITIAL_VALUE(list);
+                paddr_t pa;
+                count = pmm_alloc_contiguous(run, 0, align, &pa, &list);
+                EXPECT_EQ(run, count, "pmm_alloc_contiguous fragmented");
+                if (count != run)
+                    continue;
+
+                EXPECT_TRUE(IS_ALIGNED(pa, 1UL << align), "run alignment");
+                size_t n = 0;
+                list_for_every_entry (&list, page, vm_page_t, free.node) {
+                    paddr_t page_pa = vm_page_to_paddr(page);
+                    EXPECT_EQ(pa + n * PAGE_SIZE, page_pa, "run is contiguous");
+                    if (page_pa >= run_pa && page_pa < run_pa + run_count * PAGE_SIZE) {
+                        EXPECT_EQ(1u, ((page_pa - run_pa) / PAGE_SIZE) % 2, "run overlaps a held page");
+                    }
+                    n++;
+                }
+                EXPECT_EQ(run, n, "run list count");
+
+                while ((page = list_remove_head_type(&list, vm_page_t, free.node))) {
+                    list_add_tail(&runs, &page->free.node);
+                }
+            }
+        }
+
+        // free half of what has been handed out so far to churn the arenas
+        i = 0;
+        list_for_every_entry_safe (&runs, page, temp, vm_page_t, free.node) {
+            if (i++ % 2) {
+                list_delete(&page->free.node);
+                list_add_tail(&holes, &page->free.node);
+            }
+        }
+        pmm_free(&holes);
+    }
+
+    pmm_free(&runs);
+    pmm_free(&held);
+
+    count = pmm_alloc_contiguous(run_count, 0, run_align_log2, &run_pa, &held);
+    EXPECT_EQ(run_count, count, "pmm_alloc_contiguous large run after freeing");
+    pmm_free(&held);
+    END_TEST;
+}
+
+// Fragments an arena of its own so that no two neighbouring pages are free
+// and checks that contiguous allocations are answered by the buddy tree:
+// exact misses without searching, and over-aligned or odd sized runs found
+// in blocks smaller than the run rounded up to its alignment.
+static bool pmm_arena_buddy_search_test(void* context) {
+    BEGIN_TEST;
+    static const size_t page_count = 4096;
+
+    // the arena is never handed out, so its pages don't have to exist
+    pmm_arena_info_t info = {};
+    strlcpy(info.name, "test", sizeof(info.name));
+    info.base = 1UL << 30;
+    info.size = page_count * PAGE_SIZE;
+    PmmArena arena(&info);
+
+    AllocChecker ac;
+    mxtl::Array<uint8_t> page_array(new (&ac) uint8_t[arena.PageArraySize()],
+                                    arena.PageArraySize());
+    REQUIRE_TRUE(ac.check(), "allocating page array");
+    mxtl::Array<uint8_t> buddy_tree(new (&ac) uint8_t[arena.BuddyTreeSize()],
+                                    arena.BuddyTreeSize());
+    REQUIRE_TRUE(ac.check(), "allocating buddy tree");
+    arena.InitArrays(page_array.get(), buddy_tree.get());
+
+    // hand every even page back, but none on a 2MB boundary, then make
+    // 1025 through 1028 the only run of more than one page
+    list_node list = LIST_INITIAL_VALUE(list);
+    REQUIRE_EQ(page_count, arena.AllocPages(page_count, &list), "taking every page");
+    for (size_t i = 0; i < page_count; i++) {
+        if ((i % 2 == 0 && i % 512 != 0) || i == 1025 || i == 1027)
+            arena.FreePage(arena.get_page(i));
+    }
+
+    // a 2MB aligned large page is an exact block, a miss costs nothing
+    paddr_t pa;
+    size_t steps = arena.buddy_search_steps();
+    EXPECT_EQ(0u, arena.AllocContiguous(512, PAGE_SIZE_SHIFT + 9, &pa, nullptr), "large page");
+    EXPECT_LE(arena.buddy_search_steps() - steps, 1u, "large page search steps");
+
+    // three pages fit in the four free ones without a free block of four
+    EXPECT_EQ(3u, arena.AllocContiguous(3, PAGE_SIZE_SHIFT, &pa, nullptr), "odd sized run");
+    EXPECT_EQ(info.base + 1026 * PAGE_SIZE, pa, "odd sized run address");
+
+    // a single page on a 2MB boundary, without a free 2MB block anywhere
+    EXPECT_EQ(0u, arena.AllocContiguous(1, PAGE_SIZE_SHIFT + 9, &pa, nullptr),
+              "over-aligned page before freeing");
+    arena.FreePage(arena.get_page(2048));
+    steps = arena.buddy_search_steps();
+    EXPECT_EQ(1u, arena.AllocContiguous(1, PAGE_SIZE_SHIFT + 9, &pa, nullptr), "over-aligned page");
+    EXPECT_EQ(info.base + 2048 * PAGE_SIZE, pa, "over-aligned page address");
+    EXPECT_LE(arena.buddy_search_steps() - steps, 2 * page_count / 512 + 1,
+              "over-aligned page search steps");
+
+    END_TEST;
+}
+
 static uint32_t test_rand(uint32_t seed) {
     return (seed = seed * 1664525 + 1013904223);
 }
@@ -522,6 +738,109 @@ static bool vmo_double_remap_test(void* context) {
     END_TEST;
 }
 
+// Creates a committed vm object, maps it with fault-around and checks that a
+// single read fault maps in the neighbouring pages.
+static bool vmo_fault_around_test(void* context) {
+    BEGIN_TEST;
+    static const size_t alloc_size = PAGE_SIZE * 16;
+    auto vmo = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, alloc_size);
+    REQUIRE_NONNULL(vmo, "vmobject creation\n");
+
+    uint64_t committed;
+    auto ret = vmo->CommitRange(0, alloc_size, &committed);
+    EXPECT_EQ(NO_ERROR, ret, "committing vm object\n");
+
+    auto ka = VmAspace::kernel_aspace();
+    mxtl::RefPtr<VmMapping> mapping;
+    // align the mapping so it falls in a single fault-around window
+    ret = ka->RootVmar()->CreateVmMapping(0, alloc_size, PAGE_SIZE_SHIFT + 4,
+                                          VMAR_FLAG_FAULT_AROUND,
+                                          vmo, 0, ARCH_MMU_FLAG_PERM_READ, "test",
+                                          &mapping);
+    REQUIRE_EQ(NO_ERROR, ret, "mapping object");
+
+    // nothing is mapped until the first fault
+    const vaddr_t base = mapping->base();
+    const vaddr_t last = base + alloc_size - PAGE_SIZE;
+    EXPECT_NEQ(NO_ERROR, arch_mmu_query(&ka->arch_aspace(), last, nullptr, nullptr),
+               "page mapped before fault");
+
+    // touch the first page and check the rest of the window came along
+    volatile uint8_t* ptr = reinterpret_cast<volatile uint8_t*>(base);
+    EXPECT_EQ(0, *ptr, "reading first page");
+
+    size_t mapped = 0;
+    for (vaddr_t va = base; va <= last; va += PAGE_SIZE) {
+        if (arch_mmu_query(&ka->arch_aspace(), va, nullptr, nullptr) == NO_ERROR)
+            mapped++;
+    }
+    EXPECT_EQ(alloc_size / PAGE_SIZE, mapped, "pages mapped by one fault");
+
+    ret = mapping->Destroy();
+    EXPECT_EQ(NO_ERROR, ret, "unmapping object");
+    END_TEST;
+}
+
+// Commits a vm object spanning large pages, maps it and checks that the pages
+// came back as aligned contiguous runs and survive a partial protect.
+static bool vmo_large_page_map_test(void* context) {
+    BEGIN_TEST;
+    static const size_t alloc_size = VM_LARGE_PAGE_SIZE * 2;
+    auto vmo = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, alloc_size);
+    REQUIRE_NONNULL(vmo, "vmobject creation\n");
+
+    uint64_t committed;
+    auto ret = vmo->CommitRange(0, alloc_size, &committed);
+    REQUIRE_EQ(NO_ERROR, ret, "committing vm object\n");
+    EXPECT_EQ(alloc_size, committed, "committed size\n");
+
+    paddr_t run_pa;
+    {
+        AutoLock al(vmo->lock());
+        ret = vmo->GetPageRunLocked(0, VM_LARGE_PAGE_SIZE, &run_pa);
+    }
+    EXPECT_EQ(NO_ERROR, ret, "first chunk is a contiguous run");
+    EXPECT_TRUE(IS_ALIGNED(run_pa, VM_LARGE_PAGE_SIZE), "run is large page aligned");
+
+    auto ka = VmAspace::kernel_aspace();
+    mxtl::RefPtr<VmMapping> mapping;
+    ret = ka->RootVmar()->CreateVmMapping(0, alloc_size, 0, 0, vmo, 0, kArchRwFlags, "test",
+                                          &mapping);
+    REQUIRE_EQ(NO_ERROR, ret, "mapping object");
+    EXPECT_TRUE(IS_ALIGNED(mapping->base(), VM_LARGE_PAGE_SIZE), "mapping is large page aligned");
+
+    ret = mapping->MapRange(0, alloc_size, false);
+    EXPECT_EQ(NO_ERROR, ret, "mapping range");
+
+    void* ptr = reinterpret_cast<void*>(mapping->base());
+    if (!fill_and_test(ptr, alloc_size))
+        all_ok = false;
+
+    // make one page in the middle of the first large page read-only, which
+    // has to break the large page up without disturbing its neighbours
+    const vaddr_t ro_va = mapping->base() + PAGE_SIZE;
+    ret = ka->RootVmar()->Protect(ro_va, PAGE_SIZE, ARCH_MMU_FLAG_PERM_READ);
+    EXPECT_EQ(NO_ERROR, ret, "protecting one page");
+
+    paddr_t pa;
+    uint flags;
+    ret = arch_mmu_query(&ka->arch_aspace(), ro_va, &pa, &flags);
+    EXPECT_EQ(NO_ERROR, ret, "protected page still mapped");
+    EXPECT_EQ(run_pa + PAGE_SIZE, pa, "protected page address");
+    EXPECT_FALSE(flags & ARCH_MMU_FLAG_PERM_WRITE, "protected page is read-only");
+
+    ret = arch_mmu_query(&ka->arch_aspace(), ro_va + PAGE_SIZE, &pa, &flags);
+    EXPECT_EQ(NO_ERROR, ret, "neighbouring page still mapped");
+    EXPECT_TRUE(flags & ARCH_MMU_FLAG_PERM_WRITE, "neighbouring page is writable");
+
+    bool result = test_region((uintptr_t)ptr, ptr, alloc_size);
+    EXPECT_TRUE(result, "testing region for corruption");
+
+    ret = ka->FreeRegion(mapping->base());
+    EXPECT_EQ(NO_ERROR, ret, "unmapping object");
+    END_TEST;
+}
+
 static bool vmo_read_write_smoke_test(void* context) {
     BEGIN_TEST;
     static const size_t alloc_size = PAGE_SIZE * 16;
@@ -619,6 +938,369 @@ static bool vmo_read_write_smoke_test(void* context) {
     END_TEST;
 }
 
+// Writes a page sized pattern of |val| at |offset| in |vmo|.
+static bool vmo_write_pattern(const mxtl::RefPtr<VmObject>& vmo, uint64_t offset, uint8_t val) {
+    uint8_t buf[64];
+    memset(buf, val, sizeof(buf));
+    size_t written;
+    return vmo->Write(buf, offset, sizeof(buf), &written) == NO_ERROR && written == sizeof(buf);
+}
+
+// Checks that the start of the page at |offset| in |vmo| holds |val|.
+static bool vmo_check_pattern(const mxtl::RefPtr<VmObject>& vmo, uint64_t offset, uint8_t val) {
+    uint8_t buf[64];
+    size_t read;
+    if (vmo->Read(buf, offset, sizeof(buf), &read) != NO_ERROR || read != sizeof(buf))
+        return false;
+    for (auto b : buf) {
+        if (b != val)
+            return false;
+    }
+    return true;
+}
+
+// Builds a root <- middle <- leaf clone chain, closes off the middle object
+// and checks the leaf takes its pages over and keeps seeing the same data.
+static bool vmo_clone_collapse_test(void* context) {
+    BEGIN_TEST;
+    static const size_t alloc_size = PAGE_SIZE * 4;
+
+    auto root = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, alloc_size);
+    REQUIRE_NONNULL(root, "vmobject creation\n");
+    for (size_t i = 0; i < 4; i++) {
+        EXPECT_TRUE(vmo_write_pattern(root, i * PAGE_SIZE, 0x10), "writing to root");
+    }
+
+    mxtl::RefPtr<VmObject> middle;
+    EXPECT_EQ(NO_ERROR, root->CloneCOW(0, alloc_size, &middle), "cloning root");
+    REQUIRE_NONNULL(middle, "cloning root");
+    EXPECT_TRUE(vmo_write_pattern(middle, PAGE_SIZE, 0x20), "writing to middle");
+    EXPECT_TRUE(vmo_write_pattern(middle, 2 * PAGE_SIZE, 0x20), "writing to middle");
+
+    mxtl::RefPtr<VmObject> leaf;
+    EXPECT_EQ(NO_ERROR, middle->CloneCOW(PAGE_SIZE, 2 * PAGE_SIZE, &leaf), "cloning middle");
+    REQUIRE_NONNULL(leaf, "cloning middle");
+    EXPECT_TRUE(vmo_write_pattern(leaf, PAGE_SIZE, 0x30), "writing to leaf");
+    EXPECT_EQ(1u, leaf->AllocatedPages(), "leaf pages before collapse");
+
+    // with its handles gone, the middle object is folded into the leaf, which
+    // takes the one page it can still see through it
+    middle->OnDispatcherClosed();
+    middle.reset();
+    EXPECT_EQ(2u, leaf->AllocatedPages(), "leaf pages after collapse");
+    EXPECT_TRUE(vmo_check_pattern(leaf, 0, 0x20), "leaf page from middle");
+    EXPECT_TRUE(vmo_check_pattern(leaf, PAGE_SIZE, 0x30), "leaf's own page");
+
+    // the root is still seen through the leaf, and once it is closed off too
+    // the leaf moves pages out of it on write instead of copying them
+    leaf.reset();
+    EXPECT_EQ(NO_ERROR, root->CloneCOW(PAGE_SIZE * 3, PAGE_SIZE, &leaf), "cloning root");
+    REQUIRE_NONNULL(leaf, "cloning root");
+    EXPECT_TRUE(vmo_check_pattern(leaf, 0, 0x10), "leaf page from root");
+
+    root->OnDispatcherClosed();
+    EXPECT_TRUE(vmo_write_pattern(leaf, 0, 0x40), "writing to leaf");
+    EXPECT_EQ(3u, root->AllocatedPages(), "root pages after the leaf wrote");
+    EXPECT_EQ(1u, leaf->AllocatedPages(), "leaf pages after writing");
+    EXPECT_TRUE(vmo_check_pattern(leaf, 0, 0x40), "leaf's own page");
+    END_TEST;
+}
+
+// Builds root <- parent <- {middle <- leaf, sibling} with the parent closed
+// off, then collapses the middle object and checks the leaf still sees the
+// parent's pages instead of the parent collapsing into the sibling.
+static bool vmo_clone_collapse_sibling_test(void* context) {
+    BEGIN_TEST;
+    static const size_t alloc_size = PAGE_SIZE * 2;
+
+    auto root = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, alloc_size);
+    REQUIRE_NONNULL(root, "vmobject creation\n");
+    EXPECT_TRUE(vmo_write_pattern(root, 0, 0x10), "writing to root");
+    EXPECT_TRUE(vmo_write_pattern(root, PAGE_SIZE, 0x10), "writing to root");
+
+    mxtl::RefPtr<VmObject> parent;
+    EXPECT_EQ(NO_ERROR, root->CloneCOW(0, alloc_size, &parent), "cloning root");
+    REQUIRE_NONNULL(parent, "cloning root");
+    EXPECT_TRUE(vmo_write_pattern(parent, PAGE_SIZE, 0x20), "writing to parent");
+
+    mxtl::RefPtr<VmObject> middle, sibling, leaf;
+    EXPECT_EQ(NO_ERROR, parent->CloneCOW(0, alloc_size, &middle), "cloning parent");
+    REQUIRE_NONNULL(middle, "cloning parent");
+    EXPECT_EQ(NO_ERROR, parent->CloneCOW(0, alloc_size, &sibling), "cloning parent");
+    REQUIRE_NONNULL(sibling, "cloning parent");
+    EXPECT_EQ(NO_ERROR, middle->CloneCOW(0, alloc_size, &leaf), "cloning middle");
+    REQUIRE_NONNULL(leaf, "cloning middle");
+
+    // the parent has two children, so closing it off leaves it where it is
+    parent->OnDispatcherClosed();
+    parent.reset();
+
+    middle->OnDispatcherClosed();
+    middle.reset();
+    EXPECT_TRUE(vmo_check_pattern(leaf, 0, 0x10), "leaf page from root");
+    EXPECT_TRUE(vmo_check_pattern(leaf, PAGE_SIZE, 0x20), "leaf page from parent");
+    EXPECT_TRUE(vmo_check_pattern(sibling, 0, 0x10), "sibling page from root");
+    EXPECT_TRUE(vmo_check_pattern(sibling, PAGE_SIZE, 0x20), "sibling page from parent");
+    END_TEST;
+}
+
+// Commits a run of pages, leaves some of them zero and checks the zero page
+// scan gives exactly those back, with every page still reading the same.
+static bool vmo_reclaim_zero_pages_test(void* context) {
+    BEGIN_TEST;
+    static const size_t page_count = 8;
+    static const size_t alloc_size = PAGE_SIZE * page_count;
+
+    auto vmo = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, alloc_size);
+    REQUIRE_NONNULL(vmo, "vmobject creation\n");
+    uint64_t committed;
+    EXPECT_EQ(NO_ERROR, vmo->CommitRange(0, alloc_size, &committed), "committing vm object\n");
+    EXPECT_EQ(page_count, vmo->AllocatedPages(), "committed pages");
+    for (size_t i = 0; i < page_count; i += 2) {
+        EXPECT_TRUE(vmo_write_pattern(vmo, i * PAGE_SIZE, 0x55), "writing to vmo");
+    }
+
+    // a page budget smaller than the range has the scan come back part way through
+    uint64_t offset = 0;
+    EXPECT_EQ(1u, vmo->ReclaimZeroPages(&offset, alloc_size, 2), "reclaiming first pages");
+    EXPECT_EQ(2u * PAGE_SIZE, offset, "offset after first pages");
+    while (offset < alloc_size) {
+        vmo->ReclaimZeroPages(&offset, alloc_size, page_count);
+    }
+    EXPECT_EQ(page_count / 2, vmo->AllocatedPages(), "pages after reclaiming");
+    EXPECT_EQ(page_count / 2, vmo->ZeroPagesReclaimed(), "pages reclaimed");
+    for (size_t i = 0; i < page_count; i++) {
+        EXPECT_TRUE(vmo_check_pattern(vmo, i * PAGE_SIZE, (i % 2) ? 0 : 0x55), "reading back");
+    }
+
+    // once its physical addresses have gone out, nothing is taken from the object
+    offset = 0;
+    EXPECT_EQ(NO_ERROR, vmo->Lookup(0, PAGE_SIZE, 0,
+                                    [](void*, size_t, size_t, paddr_t) { return NO_ERROR; },
+                                    nullptr),
+              "lookup");
+    EXPECT_EQ(NO_ERROR, vmo->CommitRange(0, alloc_size, &committed), "recommitting vm object\n");
+    EXPECT_EQ(0u, vmo->ReclaimZeroPages(&offset, alloc_size, page_count), "reclaiming after lookup");
+    EXPECT_EQ(page_count, vmo->AllocatedPages(), "pages after lookup");
+    END_TEST;
+}
+
+// Maps a vm object twice into an address space and checks that the committed
+// page counts of the mappings and the address space follow the object's pages.
+static bool vmo_committed_pages_test(void* context) {
+    BEGIN_TEST;
+    static const size_t alloc_size = PAGE_SIZE * 8;
+    auto vmo = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, alloc_size);
+    REQUIRE_NONNULL(vmo, "vmobject creation\n");
+
+    auto aspace = VmAspace::Create(0, "test aspace");
+    REQUIRE_NONNULL(aspace, "aspace creation\n");
+    mxtl::RefPtr<VmMapping> full, part;
+    auto ret = aspace->RootVmar()->CreateVmMapping(0, alloc_size, 0, 0, vmo, 0,
+                                                   kArchRwFlags, "full", &full);
+    REQUIRE_EQ(NO_ERROR, ret, "mapping whole object");
+    ret = aspace->RootVmar()->CreateVmMapping(0, PAGE_SIZE * 4, 0, 0, vmo, PAGE_SIZE * 2,
+                                              kArchRwFlags, "part", &part);
+    REQUIRE_EQ(NO_ERROR, ret, "mapping part of object");
+    EXPECT_EQ(2u, vmo->share_count(), "share count");
+
+    uint64_t committed;
+    EXPECT_EQ(NO_ERROR, vmo->CommitRange(0, PAGE_SIZE * 3, &committed), "committing");
+    EXPECT_EQ(3u, full->committed_pages(), "whole mapping after commit");
+    EXPECT_EQ(1u, part->committed_pages(), "partial mapping after commit");
+    EXPECT_EQ(4u, aspace->AllocatedPages(), "aspace after commit");
+
+    EXPECT_EQ(NO_ERROR, vmo->DecommitRange(PAGE_SIZE * 2, PAGE_SIZE, &committed), "decommitting");
+    EXPECT_EQ(2u, full->committed_pages(), "whole mapping after decommit");
+    EXPECT_EQ(0u, part->committed_pages(), "partial mapping after decommit");
+    EXPECT_EQ(2u, aspace->AllocatedPages(), "aspace after decommit");
+
+    EXPECT_EQ(NO_ERROR, part->Destroy(), "unmapping part");
+    EXPECT_EQ(1u, vmo->share_count(), "share count after unmap");
+    EXPECT_EQ(NO_ERROR, vmo->CommitRange(PAGE_SIZE * 6, PAGE_SIZE * 2, &committed), "committing");
+    EXPECT_EQ(4u, aspace->AllocatedPages(), "aspace after second commit");
+
+    // splitting the mapping splits its count
+    ret = full->Protect(full->base(), PAGE_SIZE * 4, ARCH_MMU_FLAG_PERM_READ);
+    EXPECT_EQ(NO_ERROR, ret, "protecting half");
+    EXPECT_EQ(2u, full->committed_pages(), "left half after protect");
+    EXPECT_EQ(4u, aspace->AllocatedPages(), "aspace after protect");
+
+    EXPECT_EQ(NO_ERROR, vmo->Resize(PAGE_SIZE), "shrinking");
+    EXPECT_EQ(1u, full->committed_pages(), "left half after shrinking");
+    EXPECT_EQ(1u, aspace->AllocatedPages(), "aspace after shrinking");
+
+    EXPECT_EQ(NO_ERROR, aspace->Destroy(), "destroying aspace");
+    EXPECT_EQ(0u, aspace->AllocatedPages(), "aspace after destroy");
+    END_TEST;
+}
+
+// a page source that remembers what it was asked for
+class TestPageSource final : public PageSource {
+public:
+    status_t RequestPages(uint64_t offset, uint64_t len) override {
+        requests++;
+        last_offset = offset;
+        last_len = len;
+        return NO_ERROR;
+    }
+
+    size_t requests = 0;
+    uint64_t last_offset = 0;
+    uint64_t last_len = 0;
+};
+
+static bool vmo_page_source_test(void* context) {
+    BEGIN_TEST;
+    static const size_t page_count = 4;
+    static const size_t alloc_size = PAGE_SIZE * page_count;
+
+    AllocChecker ac;
+    auto src = mxtl::AdoptRef(new (&ac) TestPageSource());
+    REQUIRE_TRUE(ac.check(), "page source creation\n");
+    auto vmo = VmObjectPaged::CreateWithSource(PMM_ALLOC_FLAG_ANY, alloc_size, src);
+    REQUIRE_NONNULL(vmo, "vmobject creation\n");
+
+    uint64_t committed;
+    EXPECT_EQ(ERR_NOT_SUPPORTED, vmo->CommitRange(0, alloc_size, &committed), "committing");
+
+    // a fault records a request for the page and the missing ones after it, once
+    mxtl::RefPtr<PageRequest> request;
+    {
+        AutoLock a(vmo->lock());
+        paddr_t pa;
+        EXPECT_EQ(ERR_SHOULD_WAIT, vmo->GetPageLocked(PAGE_SIZE, VMM_PF_FLAG_SW_FAULT, nullptr, &pa),
+                  "first fault");
+        EXPECT_EQ(ERR_SHOULD_WAIT, vmo->GetPageLocked(PAGE_SIZE, VMM_PF_FLAG_SW_FAULT, nullptr, &pa),
+                  "second fault");
+        EXPECT_EQ(ERR_NOT_FOUND, vmo->GetPageLocked(PAGE_SIZE, 0, nullptr, &pa), "lookup");
+        request = vmo->GetPageRequestLocked(PAGE_SIZE);
+    }
+    REQUIRE_NONNULL(request, "page request\n");
+
+    // which only goes to the source once the lock is dropped
+    EXPECT_EQ(0u, src->requests, "requests under the lock");
+    request->Send();
+    request->Send();
+    EXPECT_EQ(1u, src->requests, "requests");
+    EXPECT_EQ(static_cast<uint64_t>(PAGE_SIZE), src->last_offset, "request offset");
+    EXPECT_EQ(alloc_size - PAGE_SIZE, src->last_len, "request length");
+
+    // pages can only be supplied from an object that has them all committed
+    auto aux = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, alloc_size);
+    REQUIRE_NONNULL(aux, "aux vmobject creation\n");
+    EXPECT_EQ(ERR_BAD_STATE, vmo->SupplyPages(PAGE_SIZE, PAGE_SIZE, aux.get(), 0), "uncommitted");
+    EXPECT_EQ(NO_ERROR, aux->CommitRange(0, PAGE_SIZE, &committed), "committing aux\n");
+    EXPECT_TRUE(vmo_write_pattern(aux, 0, 0x55), "writing to aux");
+
+    // supplying moves the page over and completes the request
+    EXPECT_EQ(NO_ERROR, vmo->SupplyPages(PAGE_SIZE, PAGE_SIZE, aux.get(), 0), "supplying");
+    EXPECT_EQ(0u, aux->AllocatedPages(), "aux pages after supplying");
+    EXPECT_EQ(1u, vmo->AllocatedPages(), "pages after supplying");
+    EXPECT_EQ(NO_ERROR, request->Wait(), "waiting on completed request");
+    EXPECT_TRUE(vmo_check_pattern(vmo, PAGE_SIZE, 0x55), "reading back");
+    EXPECT_EQ(1u, src->requests, "requests after reading");
+
+    // a failed request hands its waiters the error, and the next fault asks again
+    {
+        AutoLock a(vmo->lock());
+        paddr_t pa;
+        EXPECT_EQ(ERR_SHOULD_WAIT,
+                  vmo->GetPageLocked(PAGE_SIZE * 2, VMM_PF_FLAG_SW_FAULT, nullptr, &pa),
+                  "fault to fail");
+        request = vmo->GetPageRequestLocked(PAGE_SIZE * 2);
+    }
+    REQUIRE_NONNULL(request, "page request to fail\n");
+    EXPECT_EQ(ERR_INVALID_ARGS, vmo->FailPages(PAGE_SIZE * 2, PAGE_SIZE, NO_ERROR), "no error");
+    EXPECT_EQ(NO_ERROR, vmo->FailPages(PAGE_SIZE * 2, PAGE_SIZE, ERR_IO), "failing");
+    EXPECT_EQ(ERR_IO, request->Wait(), "waiting on failed request");
+    EXPECT_EQ(1u, src->requests, "failed request isn't sent");
+    {
+        AutoLock a(vmo->lock());
+        paddr_t pa;
+        EXPECT_EQ(ERR_SHOULD_WAIT,
+                  vmo->GetPageLocked(PAGE_SIZE * 2, VMM_PF_FLAG_SW_FAULT, nullptr, &pa),
+                  "fault after failing");
+        EXPECT_TRUE(vmo->GetPageRequestLocked(PAGE_SIZE * 2) != request, "new request");
+    }
+    END_TEST;
+}
+
+// Fills a page list sparsely across several nodes, then checks in order and
+// out of order lookups and the range operations against it.
+static bool vmpl_range_test(void* context) {
+    BEGIN_TEST;
+    static const size_t node_pages = VmPageListNode::kPageFanOut;
+    static const size_t page_count = node_pages * 4;
+
+    // what each offset should hold, too big for the stack
+    AllocChecker ac;
+    mxtl::Array<vm_page_t*> pages(new (&ac) vm_page_t*[page_count](), page_count);
+    REQUIRE_TRUE(ac.check(), "allocating page array");
+
+    list_node list = LIST_INITIAL_VALUE(list);
+    auto count = pmm_alloc_pages(page_count / 3 + 1, 0, &list);
+    REQUIRE_EQ(page_count / 3 + 1, count, "pmm_alloc_pages");
+
+    // put a page at every third offset, leaving the last node empty
+    VmPageList pl;
+    for (size_t i = 0; i < page_count - node_pages; i += 3) {
+        pages[i] = list_remove_head_type(&list, vm_page_t, free.node);
+        EXPECT_EQ(NO_ERROR, pl.AddPage(pages[i], i * PAGE_SIZE), "AddPage");
+    }
+    pmm_free(&list);
+
+    for (size_t i = 0; i < page_count; i++) {
+        EXPECT_EQ(pages[i], pl.GetPage(i * PAGE_SIZE), "GetPage in order");
+    }
+    for (size_t i = page_count; i > 0; i--) {
+        EXPECT_EQ(pages[i - 1], pl.GetPage((i - 1) * PAGE_SIZE), "GetPage in reverse");
+    }
+
+    size_t found = 0;
+    pl.ForEveryPageInRange([&](const auto p, uint64_t off) {
+        EXPECT_EQ(pages[off / PAGE_SIZE], p, "ForEveryPageInRange page");
+        found++;
+    }, (node_pages - 2) * PAGE_SIZE, (node_pages * 2 + 2) * PAGE_SIZE);
+    size_t expected = 0;
+    for (size_t i = node_pages - 2; i < node_pages * 2 + 2; i++) {
+        if (pages[i])
+            expected++;
+    }
+    EXPECT_EQ(expected, found, "ForEveryPageInRange count");
+
+    EXPECT_TRUE(pl.AnyPagesInRange(0, PAGE_SIZE), "AnyPagesInRange first page");
+    EXPECT_FALSE(pl.AnyPagesInRange(PAGE_SIZE, 3 * PAGE_SIZE), "AnyPagesInRange gap");
+    EXPECT_FALSE(pl.AnyPagesInRange((page_count - node_pages + 1) * PAGE_SIZE, page_count * PAGE_SIZE),
+                 "AnyPagesInRange empty node");
+
+    // free a range straddling a node boundary and check its neighbors survive
+    uint64_t start = (node_pages - 4) * PAGE_SIZE;
+    uint64_t end = (node_pages + 4) * PAGE_SIZE;
+    expected = 0;
+    for (size_t i = start / PAGE_SIZE; i < end / PAGE_SIZE; i++) {
+        if (pages[i])
+            expected++;
+        pages[i] = nullptr;
+    }
+    EXPECT_EQ(expected, pl.FreePagesInRange(start, end), "FreePagesInRange count");
+    for (size_t i = 0; i < page_count; i++) {
+        EXPECT_EQ(pages[i], pl.GetPage(i * PAGE_SIZE), "GetPage after FreePagesInRange");
+    }
+
+    // free every page one at a time, in order, emptying out the nodes
+    for (size_t i = 0; i < page_count; i++) {
+        if (pages[i]) {
+            EXPECT_EQ(NO_ERROR, pl.FreePage(i * PAGE_SIZE), "FreePage");
+            pages[i] = nullptr;
+        }
+        EXPECT_EQ(nullptr, pl.GetPage(i * PAGE_SIZE), "GetPage after FreePage");
+    }
+    EXPECT_FALSE(pl.AnyPagesInRange(0, page_count * PAGE_SIZE), "AnyPagesInRange after freeing");
+    EXPECT_EQ(0u, pl.FreeAllPages(), "FreeAllPages");
+    END_TEST;
+}
+
 // Use the function name as the test name
 #define VM_UNITTEST(fname) UNITTEST(#fname, fname)
 
@@ -626,6 +1308,10 @@ UNITTEST_START_TESTCASE(vm_tests)
 VM_UNITTEST(pmm_smoke_test)
 VM_UNITTEST(pmm_large_alloc_test)
 VM_UNITTEST(pmm_oversized_alloc_test)
+VM_UNITTEST(pmm_single_page_cycle_test)
+VM_UNITTEST(pmm_zeroed_alloc_test)
+VM_UNITTEST(pmm_contiguous_fragmentation_test)
+VM_UNITTEST(pmm_arena_buddy_search_test)
 VM_UNITTEST(vmm_alloc_smoke_test)
 VM_UNITTEST(vmm_alloc_contiguous_smoke_test)
 VM_UNITTEST(multiple_regions_test)
@@ -644,6 +1330,14 @@ VM_UNITTEST(vmo_demand_paged_map_test)
 VM_UNITTEST(vmo_dropped_ref_test)
 VM_UNITTEST(vmo_remap_test)
 VM_UNITTEST(vmo_double_remap_test)
+VM_UNITTEST(vmo_fault_around_test)
+VM_UNITTEST(vmo_large_page_map_test)
 VM_UNITTEST(vmo_read_write_smoke_test)
+VM_UNITTEST(vmo_clone_collapse_test)
+VM_UNITTEST(vmo_clone_collapse_sibling_test)
+VM_UNITTEST(vmo_reclaim_zero_pages_test)
+VM_UNITTEST(vmo_committed_pages_test)
+VM_UNITTEST(vmo_page_source_test)
+VM_UNITTEST(vmpl_range_test)
 VM_UNITTEST(dump_all_aspaces) // Run last
 UNITTEST_END_TESTCASE(vm_tests, "vmtests", "Virtual memory tests", nullptr, nullptr);
@@ -0,0 +1,125 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include "vm_priv.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <kernel/cmdline.h>
+#include <kernel/thread.h>
+#include <kernel/vm.h>
+#include <kernel/vm/vm_address_region.h>
+#include <kernel/vm/vm_aspace.h>
+#include <kernel/vm/vm_object.h>
+#include <lk/init.h>
+#include <mxtl/ref_ptr.h>
+#include <trace.h>
+
+#define LOCAL_TRACE MAX(VM_GLOBAL_TRACE, 0)
+
+// A low priority thread that works its way through the memory mapped into
+// user address spaces, giving back committed pages that are entirely zero so
+// that they read as the shared zero page again. It looks at a bounded number
+// of pages per second, set by kernel.zero-scan-rate.
+
+namespace {
+
+// mappings picked up from an address space per visit
+const size_t kMappingBatch = 16;
+
+// pages looked at per call into a vmo, between which the scanner sleeps
+const size_t kPagesPerStep = 64;
+
+// pause between complete passes over every address space
+const lk_time_t kPassInterval = LK_SEC(10);
+
+struct ScanTarget {
+    mxtl::RefPtr<VmObject> vmo;
+    uint64_t offset;
+    uint64_t end;
+};
+
+// Takes references to the objects behind up to kMappingBatch mappings of an
+// address space, skipping the ones already visited, so that the scan itself
+// can run without the address space locked.
+class MappingCollector final : public VmEnumerator {
+public:
+    explicit MappingCollector(size_t skip) : skip_(skip) {}
+
+    bool OnVmMapping(const VmMapping* map, const VmAddressRegion* vmar,
+                     uint depth) override {
+        if (skip_ > 0) {
+            skip_--;
+            return true;
+        }
+        targets_[count_].vmo = map->vmo();
+        targets_[count_].offset = map->object_offset();
+        targets_[count_].end = map->object_offset() + map->size();
+        return ++count_ < kMappingBatch;
+    }
+
+    size_t count() const { return count_; }
+    ScanTarget& target(size_t i) { return targets_[i]; }
+
+private:
+    size_t skip_;
+    size_t count_ = 0;
+    ScanTarget targets_[kMappingBatch];
+};
+
+int zero_scanner_thread(void* arg) {
+    const uint32_t pages_per_sec = *static_cast<uint32_t*>(arg);
+    const lk_time_t step_delay = LK_SEC(1) * kPagesPerStep / pages_per_sec;
+
+    size_t aspace_index = 0;
+    size_t mapping_index = 0;
+    size_t reclaimed = 0;
+    for (;;) {
+        MappingCollector collector(mapping_index);
+        if (!EnumerateUserAspace(aspace_index, &collector)) {
+            LTRACEF("pass done, %zu pages reclaimed\n", reclaimed);
+            aspace_index = 0;
+            mapping_index = 0;
+            thread_sleep_relative(kPassInterval);
+            continue;
+        }
+
+        // move on to the next address space once this one runs out of mappings
+        if (collector.count() < kMappingBatch) {
+            aspace_index++;
+            mapping_index = 0;
+        } else {
+            mapping_index += kMappingBatch;
+        }
+
+        for (size_t i = 0; i < collector.count(); i++) {
+            ScanTarget& t = collector.target(i);
+            while (t.offset < t.end) {
+                reclaimed += t.vmo->ReclaimZeroPages(&t.offset, t.end, kPagesPerStep);
+                thread_sleep_relative(step_delay);
+            }
+            t.vmo.reset();
+        }
+    }
+
+    return 0;
+}
+
+uint32_t zero_scan_rate;
+
+void zero_scanner_init(uint level) {
+    zero_scan_rate = cmdline_get_uint32("kernel.zero-scan-rate", 4096);
+    if (zero_scan_rate == 0)
+        return;
+
+    thread_t* t = thread_create("zero scanner", &zero_scanner_thread, &zero_scan_rate,
+                                LOWEST_PRIORITY + 1, DEFAULT_STACK_SIZE);
+    thread_detach_and_resume(t);
+}
+
+} // namespace
+
+LK_INIT_HOOK(zero_scanner, &zero_scanner_init, LK_INIT_LEVEL_THREADING);
@@ -8,32 +8,45 @@
 #include <assert.h>
 #include <err.h>
 #include <list.h>
+#include <stdio.h>
 #include <trace.h>
 
 #include <kernel/event.h>
+#include <kernel/mp.h>
 #include <kernel/spinlock.h>
 #include <lk/init.h>
 
-static spin_lock_t dpc_lock = SPIN_LOCK_INITIAL_VALUE;
-static struct list_node dpc_list = LIST_INITIAL_VALUE(dpc_list);
-static event_t dpc_event = EVENT_INITIAL_VALUE(dpc_event, false, 0);
+// Each cpu has its own queue of dpcs and a worker thread pinned to it, so
+// interrupt handlers on different cpus don't serialize on a single thread.
+struct dpc_state {
+    spin_lock_t lock;
+    struct list_node list;
+    event_t event;
+    thread_t *thread;
+    bool stop;
+} __CPU_ALIGN;
+
+static struct dpc_state dpc_state[SMP_MAX_CPUS];
 
 status_t dpc_queue(dpc_t *dpc, bool reschedule)
 {
     DEBUG_ASSERT(dpc);
     DEBUG_ASSERT(dpc->func);
 
-    if (list_in_list(&dpc->node))
-        return NO_ERROR;
-
     spin_lock_saved_state_t state;
-    spin_lock_irqsave(&dpc_lock, state);
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
 
-    // put the dpc at the tail of the list and signal the worker
-    list_add_tail(&dpc_list, &dpc->node);
-    event_signal(&dpc_event, false);
+    struct dpc_state *dpc_st = &dpc_state[arch_curr_cpu_num()];
+    spin_lock(&dpc_st->lock);
 
-    spin_unlock_irqrestore(&dpc_lock, state);
+    // put the dpc at the tail of this cpu's list and signal the worker
+    if (!list_in_list(&dpc->node)) {
+        list_add_tail(&dpc_st->list, &dpc->node);
+        event_signal(&dpc_st->event, false);
+    }
+
+    spin_unlock(&dpc_st->lock);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
 
     // reschedule here if asked to
     if (reschedule)
@@ -44,36 +57,140 @@ status_t dpc_queue(dpc_t *dpc, bool reschedule)
 
 static int dpc_thread(void *arg)
 {
+    struct dpc_state *dpc_st = (struct dpc_state *)arg;
+
     for (;;) {
         // wait for a dpc to fire
-        __UNUSED status_t err = event_wait(&dpc_event);
+        __UNUSED status_t err = event_wait(&dpc_st->event);
         DEBUG_ASSERT(err == NO_ERROR);
 
         spin_lock_saved_state_t state;
-        spin_lock_irqsave(&dpc_lock, state);
+        spin_lock_irqsave(&dpc_st->lock, state);
+
+        // we're being shut down, leave anything queued for dpc_transition_off_cpu
+        if (dpc_st->stop) {
+            spin_unlock_irqrestore(&dpc_st->lock, state);
+            break;
+        }
 
         // pop a dpc off the list
-        dpc_t *dpc = list_remove_head_type(&dpc_list, dpc_t, node);
+        dpc_t *dpc = list_remove_head_type(&dpc_st->list, dpc_t, node);
 
         // if the list is now empty, unsignal the event so we block until it is
         if (!dpc)
-            event_unsignal(&dpc_event);
+            event_unsignal(&dpc_st->event);
 
-        spin_unlock_irqrestore(&dpc_lock, state);
+        spin_unlock_irqrestore(&dpc_st->lock, state);
 
         // call the dpc
         if (dpc && dpc->func)
             dpc->func(dpc);
     }
 
-
     return 0;
 }
 
+status_t dpc_init_for_cpu(uint cpu)
+{
+    DEBUG_ASSERT(cpu < SMP_MAX_CPUS);
+
+    struct dpc_state *dpc_st = &dpc_state[cpu];
+    if (dpc_st->thread)
+        return NO_ERROR;
+
+    dpc_st->stop = false;
+
+    char name[THREAD_NAME_LENGTH];
+    snprintf(name, sizeof(name), "dpc-%u", cpu);
+
+    thread_t *t = thread_create(name, &dpc_thread, dpc_st, HIGH_PRIORITY, DEFAULT_STACK_SIZE);
+    if (!t)
+        return ERR_NO_MEMORY;
+    thread_set_pinned_cpu(t, cpu);
+
+    dpc_st->thread = t;
+    thread_resume(t);
+
+    return NO_ERROR;
+}
+
+status_t dpc_shutdown(uint cpu)
+{
+    DEBUG_ASSERT(cpu < SMP_MAX_CPUS);
+
+    struct dpc_state *dpc_st = &dpc_state[cpu];
+    thread_t *t = dpc_st->thread;
+    if (!t)
+        return NO_ERROR;
+
+    // ask the worker to exit once it is done with the dpc it is running, if any
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&dpc_st->lock, state);
+
+    dpc_st->stop = true;
+    event_signal(&dpc_st->event, false);
+
+    spin_unlock_irqrestore(&dpc_st->lock, state);
+
+    status_t status = thread_join(t, NULL, INFINITE_TIME);
+    if (status != NO_ERROR)
+        return status;
+
+    dpc_st->thread = NULL;
+    return NO_ERROR;
+}
+
+void dpc_transition_off_cpu(uint old_cpu)
+{
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    uint cpu = arch_curr_cpu_num();
+
+    DEBUG_ASSERT(cpu != old_cpu);
+    DEBUG_ASSERT(dpc_state[old_cpu].thread == NULL);
+
+    struct dpc_state *src = &dpc_state[old_cpu];
+    struct dpc_state *dst = &dpc_state[cpu];
+
+    // take the two queue locks in cpu order
+    spin_lock(&dpc_state[MIN(cpu, old_cpu)].lock);
+    spin_lock(&dpc_state[MAX(cpu, old_cpu)].lock);
+
+    // move anything left behind over to this cpu's worker
+    dpc_t *dpc;
+    while ((dpc = list_remove_head_type(&src->list, dpc_t, node)) != NULL) {
+        list_add_tail(&dst->list, &dpc->node);
+    }
+    if (!list_is_empty(&dst->list))
+        event_signal(&dst->event, false);
+    event_unsignal(&src->event);
+
+    spin_unlock(&dpc_state[MAX(cpu, old_cpu)].lock);
+    spin_unlock(&dpc_state[MIN(cpu, old_cpu)].lock);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+}
+
 static void dpc_init(unsigned int level)
 {
-    thread_t *t = thread_create("dpc", &dpc_thread, NULL, HIGH_PRIORITY, DEFAULT_STACK_SIZE);
-    thread_detach_and_resume(t);
+    for (uint i = 0; i < SMP_MAX_CPUS; i++) {
+        dpc_state[i].lock = SPIN_LOCK_INITIAL_VALUE;
+        list_initialize(&dpc_state[i].list);
+        event_init(&dpc_state[i].event, false, 0);
+    }
+
+    // the boot cpu gets its worker right away, the rest once we know how many cpus there are
+    __UNUSED status_t err = dpc_init_for_cpu(arch_curr_cpu_num());
+    DEBUG_ASSERT(err == NO_ERROR);
+}
+
+static void dpc_init_secondary(unsigned int level)
+{
+    uint max = arch_max_num_cpus();
+    for (uint i = 0; i < max; i++) {
+        if (dpc_init_for_cpu(i) != NO_ERROR)
+            printf("failed to create dpc thread for cpu %u\n", i);
+    }
 }
 
 LK_INIT_HOOK(dpc, dpc_init, LK_INIT_LEVEL_THREADING);
+LK_INIT_HOOK(dpc_secondary, dpc_init_secondary, LK_INIT_LEVEL_TARGET);
@@ -21,7 +21,21 @@ typedef struct dpc {
     void *arg;
 } dpc_t;
 
+// Queue a dpc on the current cpu's worker thread. A dpc that is already
+// queued is left where it is.
 status_t dpc_queue(dpc_t *dpc, bool reschedule);
 
+// Start the dpc worker thread for |cpu|, if it isn't already running.
+status_t dpc_init_for_cpu(uint cpu);
+
+// Stop the dpc worker thread for |cpu|, waiting for any dpc it is running
+// to finish. Dpcs still queued on |cpu| stay there until they are moved
+// with dpc_transition_off_cpu().
+status_t dpc_shutdown(uint cpu);
+
+// Move any dpcs queued on |old_cpu| to the current cpu. |old_cpu| must have
+// been shut down and must not be taking interrupts anymore.
+void dpc_transition_off_cpu(uint old_cpu);
+
 __END_CDECLS
 
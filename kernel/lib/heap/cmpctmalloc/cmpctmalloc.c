@@ -13,6 +13,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <err.h>
+#include <arch/ops.h>
 #include <kernel/thread.h>
 #include <kernel/mutex.h>
 #include <kernel/spinlock.h>
@@ -26,6 +27,9 @@
 // Allocation strategy takes place with a global mutex.  Freelist entries are
 // kept in linked lists with 8 different sizes per binary order of magnitude
 // and the header size is two words with eager coalescing on free.
+//
+// Small allocations are served from per cpu caches in front of the heap, see
+// below, so most of them never take the mutex.
 
 #if defined(DEBUG) || LK_DEBUGLEVEL > 2
 #define CMPCT_DEBUG
@@ -86,7 +90,46 @@ struct heap {
 // Heap static vars.
 static struct heap theheap;
 
+// Per cpu caches of small allocations, one magazine per bucket for the buckets
+// up to CACHE_MAX_SIZE bytes.  A miss takes the heap lock once to carve out a
+// batch of allocations of the bucket's size, and a free into a full magazine
+// gives a batch back to the heap the same way.  Cached allocations are still
+// allocated as far as the heap is concerned, so they don't coalesce with their
+// neighbors until they are drained, which trimming the heap does.
+#define CACHE_MAX_SIZE 512
+#define CACHE_BUCKETS 32
+#define CACHE_MAX 16
+#define CACHE_BATCH 8
+
+// Cached allocations are linked through their first word.
+typedef struct cache_entry {
+    struct cache_entry *next;
+} cache_entry_t;
+
+struct heap_cache_bucket {
+    cache_entry_t *head;
+    uint32_t count;
+
+    // statistics
+    uint64_t alloc_hits;
+    uint64_t alloc_misses;
+    uint64_t free_hits;
+    uint64_t drains;
+};
+
+struct heap_cache {
+    spin_lock_t lock;
+    struct heap_cache_bucket buckets[CACHE_BUCKETS];
+} __CPU_ALIGN;
+
+static struct heap_cache heap_caches[SMP_MAX_CPUS];
+
+// Turned off while the self tests run, since they rely on the exact layout of
+// the heap.  Either path is fine for any allocation at any time.
+static volatile bool heap_cache_enabled = true;
+
 static ssize_t heap_grow(size_t len, free_t **bucket);
+static void heap_free_locked(header_t *header) TA_REQ(theheap.lock);
 
 static void lock(void) TA_ACQ(theheap.lock)
 {
@@ -98,6 +141,163 @@ static void unlock(void) TA_REL(theheap.lock)
     mutex_release(&theheap.lock);
 }
 
+// Give a list of cached allocations back to the heap.
+static void heap_free_cache_entries(cache_entry_t *entry)
+{
+    if (entry == NULL) return;
+
+    lock();
+    while (entry != NULL) {
+        cache_entry_t *next = entry->next;
+        heap_free_locked((header_t *)entry - 1);
+        entry = next;
+    }
+    unlock();
+}
+
+// Take an allocation out of the current cpu's cache for |bucket|.
+static void *cache_alloc(int bucket)
+{
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    struct heap_cache *cache = &heap_caches[arch_curr_cpu_num()];
+    spin_lock(&cache->lock);
+
+    struct heap_cache_bucket *b = &cache->buckets[bucket];
+    cache_entry_t *entry = b->head;
+    if (entry != NULL) {
+        b->head = entry->next;
+        b->count--;
+        b->alloc_hits++;
+    } else {
+        b->alloc_misses++;
+    }
+
+    spin_unlock(&cache->lock);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    return entry;
+}
+
+// Put a freshly carved out batch of allocations in the current cpu's cache for
+// |bucket|, giving back to the heap any that don't fit.
+static void cache_refill(int bucket, cache_entry_t *batch)
+{
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    struct heap_cache *cache = &heap_caches[arch_curr_cpu_num()];
+    spin_lock(&cache->lock);
+
+    struct heap_cache_bucket *b = &cache->buckets[bucket];
+    while (batch != NULL && b->count < CACHE_MAX) {
+        cache_entry_t *next = batch->next;
+        batch->next = b->head;
+        b->head = batch;
+        b->count++;
+        batch = next;
+    }
+
+    spin_unlock(&cache->lock);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    heap_free_cache_entries(batch);
+}
+
+// Put an allocation in the current cpu's cache for |bucket|.  If the cache is
+// full, a batch is taken out of it and returned for the caller to give back to
+// the heap.
+static cache_entry_t *cache_free(int bucket, void *payload)
+{
+    cache_entry_t *drain = NULL;
+
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    struct heap_cache *cache = &heap_caches[arch_curr_cpu_num()];
+    spin_lock(&cache->lock);
+
+    struct heap_cache_bucket *b = &cache->buckets[bucket];
+    if (b->count >= CACHE_MAX) {
+        for (int i = 0; i < CACHE_BATCH; i++) {
+            cache_entry_t *entry = b->head;
+            b->head = entry->next;
+            entry->next = drain;
+            drain = entry;
+        }
+        b->count -= CACHE_BATCH;
+        b->drains++;
+    }
+
+    cache_entry_t *entry = (cache_entry_t *)payload;
+    entry->next = b->head;
+    b->head = entry;
+    b->count++;
+    b->free_hits++;
+
+    spin_unlock(&cache->lock);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    return drain;
+}
+
+// Empty every cpu's cache back into the heap.
+static void cache_drain_all(void)
+{
+    for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        struct heap_cache *cache = &heap_caches[cpu];
+        cache_entry_t *drain = NULL;
+
+        spin_lock_saved_state_t state;
+        spin_lock_irqsave(&cache->lock, state);
+        for (int bucket = 0; bucket < CACHE_BUCKETS; bucket++) {
+            struct heap_cache_bucket *b = &cache->buckets[bucket];
+            while (b->head != NULL) {
+                cache_entry_t *entry = b->head;
+                b->head = entry->next;
+                entry->next = drain;
+                drain = entry;
+            }
+            b->count = 0;
+        }
+        spin_unlock_irqrestore(&cache->lock, state);
+
+        heap_free_cache_entries(drain);
+    }
+}
+
+// The payload size of allocations in |bucket|.
+static size_t bucket_size(int bucket)
+{
+    if (bucket < 15) return (bucket + 1) * 8;
+    int row_column = bucket - 15 + 32;
+    return (8 + (row_column & 7)) << (row_column >> 3);
+}
+
+static void cache_dump(void)
+{
+    dprintf(INFO, "\tper cpu caches (max %d, batch %d):\n", CACHE_MAX, CACHE_BATCH);
+    for (int bucket = 0; bucket < CACHE_BUCKETS; bucket++) {
+        uint64_t cached = 0, alloc_hits = 0, alloc_misses = 0, free_hits = 0, drains = 0;
+
+        // racy reads are fine for statistics
+        for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+            const struct heap_cache_bucket *b = &heap_caches[cpu].buckets[bucket];
+            cached += b->count;
+            alloc_hits += b->alloc_hits;
+            alloc_misses += b->alloc_misses;
+            free_hits += b->free_hits;
+            drains += b->drains;
+        }
+        if (alloc_hits + alloc_misses + free_hits == 0) continue;
+
+        dprintf(INFO, "\t\tbucket %2d (%3zu bytes): cached %" PRIu64 ", alloc hits %" PRIu64
+                ", misses %" PRIu64 ", free hits %" PRIu64 ", drains %" PRIu64 "\n",
+                bucket, bucket_size(bucket), cached, alloc_hits, alloc_misses, free_hits, drains);
+    }
+}
+
 static void dump_free(header_t *header)
 {
     dprintf(INFO, "\t\tbase %p, end %#" PRIxPTR ", len %#zx (%zu)\n",
@@ -130,6 +330,8 @@ void cmpct_dump(bool panic_time) TA_NO_THREAD_SAFETY_ANALYSIS
 
     if (!panic_time)
         unlock();
+
+    cache_dump();
 }
 
 // Operates in sizes that don't include the allocation header.
@@ -454,6 +656,10 @@ static void cmpct_test_buckets(void)
 {
     size_t rounded;
     unsigned bucket;
+    // The per cpu caches cover exactly the buckets up to CACHE_MAX_SIZE.
+    ASSERT(size_to_index_freeing(CACHE_MAX_SIZE) == CACHE_BUCKETS - 1);
+    ASSERT(size_to_index_allocating(CACHE_MAX_SIZE, &rounded) == CACHE_BUCKETS - 1);
+    ASSERT(bucket_size(CACHE_BUCKETS - 1) == CACHE_MAX_SIZE);
     // Check for the 8-spaced buckets up to 128.
     for (unsigned i = 1; i <= 128; i++) {
         // Round up when allocating.
@@ -565,6 +771,9 @@ static void cmpct_test_return_to_os(void)
 
 void cmpct_test(void)
 {
+    heap_cache_enabled = false;
+    cache_drain_all();
+
     cmpct_test_buckets();
     cmpct_test_get_back_newly_freed();
     cmpct_test_return_to_os();
@@ -621,6 +830,8 @@ void cmpct_test(void)
     }
 
     cmpct_dump(false);
+
+    heap_cache_enabled = true;
 }
 
 static void check_free_fill(void *ptr, size_t size)
@@ -670,6 +881,9 @@ static void *large_alloc(size_t size)
 
 void cmpct_trim(void)
 {
+    // Give everything sitting in the caches back first, so it can coalesce.
+    cache_drain_all();
+
     // Look at free list entries that are at least as large as one page plus a
     // header. They might be at the start or the end of a block, so we can trim
     // them and free the page(s).
@@ -740,18 +954,11 @@ void cmpct_trim(void)
     unlock();
 }
 
-void *cmpct_alloc(size_t size)
+// Carve an allocation of |size| bytes, rounded up to the size of
+// |start_bucket| (|rounded_up| including the header), out of the heap.
+static void *heap_alloc_locked(size_t size, int start_bucket, size_t rounded_up)
+    TA_REQ(theheap.lock)
 {
-    if (size == 0u) return NULL;
-
-    if (size + sizeof(header_t) > (1u << HEAP_ALLOC_VIRTUAL_BITS)) return large_alloc(size);
-
-    size_t rounded_up;
-    int start_bucket = size_to_index_allocating(size, &rounded_up);
-
-    rounded_up += sizeof(header_t);
-
-    lock();
     int bucket = find_nonempty_bucket(start_bucket);
     if (bucket == -1) {
         // Grow heap by at least 12% if we can.
@@ -760,7 +967,6 @@ void *cmpct_alloc(size_t size)
                                 MAX(HEAP_GROW_SIZE, rounded_up)));
         while (heap_grow(growby, NULL) < 0) {
             if (growby <= rounded_up) {
-                unlock();
                 return NULL;
             }
             growby = MAX(growby >> 1, rounded_up);
@@ -791,7 +997,50 @@ void *cmpct_alloc(size_t size)
     memset(result, ALLOC_FILL, size);
     memset(((char *)result) + size, PADDING_FILL, rounded_up - size - sizeof(header_t));
 #endif
+    return result;
+}
+
+void *cmpct_alloc(size_t size)
+{
+    if (size == 0u) return NULL;
+
+    if (size + sizeof(header_t) > (1u << HEAP_ALLOC_VIRTUAL_BITS)) return large_alloc(size);
+
+    size_t rounded_up;
+    int start_bucket = size_to_index_allocating(size, &rounded_up);
+
+    bool cacheable = heap_cache_enabled && size <= CACHE_MAX_SIZE;
+    if (cacheable) {
+        DEBUG_ASSERT(start_bucket < CACHE_BUCKETS);
+        void *result = cache_alloc(start_bucket);
+        if (result) {
+#ifdef CMPCT_DEBUG
+            memset(result, ALLOC_FILL, size);
+#endif
+            return result;
+        }
+    }
+
+    size_t bucket_size = rounded_up;
+    rounded_up += sizeof(header_t);
+
+    lock();
+    void *result = heap_alloc_locked(size, start_bucket, rounded_up);
+    cache_entry_t *batch = NULL;
+    if (cacheable && result) {
+        // Carve out a batch more while we hold the lock to refill the cache.
+        for (int i = 0; i < CACHE_BATCH; i++) {
+            cache_entry_t *entry = heap_alloc_locked(bucket_size, start_bucket, rounded_up);
+            if (!entry) break;
+            entry->next = batch;
+            batch = entry;
+        }
+    }
     unlock();
+
+    if (batch) {
+        cache_refill(start_bucket, batch);
+    }
     return result;
 }
 
@@ -824,13 +1073,10 @@ void *cmpct_memalign(size_t size, size_t alignment)
     return payload;
 }
 
-void cmpct_free(void *payload)
+static void heap_free_locked(header_t *header) TA_REQ(theheap.lock)
 {
-    if (payload == NULL) return;
-    header_t *header = (header_t *)payload - 1;
     DEBUG_ASSERT(!is_tagged_as_free(header));  // Double free!
     size_t size = header->size;
-    lock();
     header_t *left = header->left;
     if (left != NULL && is_tagged_as_free(left)) {
         // Coalesce with left free object.
@@ -859,6 +1105,22 @@ void cmpct_free(void *payload)
             free_memory(header, left, size);
         }
     }
+}
+
+void cmpct_free(void *payload)
+{
+    if (payload == NULL) return;
+    header_t *header = (header_t *)payload - 1;
+    DEBUG_ASSERT(!is_tagged_as_free(header));  // Double free!
+
+    size_t size = header->size - sizeof(header_t);
+    if (heap_cache_enabled && size <= CACHE_MAX_SIZE) {
+        heap_free_cache_entries(cache_free(size_to_index_freeing(size), payload));
+        return;
+    }
+
+    lock();
+    heap_free_locked(header);
     unlock();
 }
 
@@ -915,6 +1177,10 @@ void cmpct_init(void)
     // Create a mutex.
     mutex_init(&theheap.lock);
 
+    for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        heap_caches[cpu].lock = SPIN_LOCK_INITIAL_VALUE;
+    }
+
     // Initialize the free list.
     for (int i = 0; i < NUMBER_OF_BUCKETS; i++) {
         theheap.free_lists[i] = NULL;
@@ -14,6 +14,7 @@
 #include <trace.h>
 
 #include <kernel/event.h>
+#include <kernel/thread.h>
 #include <platform.h>
 
 #include <magenta/handle.h>
@@ -168,23 +169,25 @@ status_t ChannelDispatcher::Read(uint32_t* msg_size,
     return rv;
 }
 
-status_t ChannelDispatcher::Write(mxtl::unique_ptr<MessagePacket> msg) {
+status_t ChannelDispatcher::Write(mxtl::unique_ptr<MessagePacket>&& msg) {
     canary_.Assert();
 
     mxtl::RefPtr<ChannelDispatcher> other;
     {
         AutoLock lock(&lock_);
         if (!other_) {
-            // |msg| will be destroyed but we want to keep the handles alive since
-            // the caller should put them back into the process table.
+            // |msg| stays with the caller, but we want to keep the handles alive
+            // when it's destroyed since the caller should put them back into the
+            // process table.
             msg->set_owns_handles(false);
             return ERR_PEER_CLOSED;
         }
         other = other_;
     }
 
-    if (other->WriteSelf(mxtl::move(msg)) > 0)
-        thread_preempt(false);
+    // a waiting caller was readied here for us to step aside for
+    if (other->WriteSelf(mxtl::move(msg), false) > 0)
+        thread_reschedule();
 
     return NO_ERROR;
 }
@@ -220,8 +223,9 @@ status_t ChannelDispatcher::Call(mxtl::unique_ptr<MessagePacket> msg,
         waiters_.push_back(waiter);
     }
 
-    // (1) Write outbound message to opposing endpoint.
-    other->WriteSelf(mxtl::move(msg));
+    // (1) Write outbound message to opposing endpoint, handing our cpu
+    // to the thread waiting to read it since we're about to block.
+    other->WriteSelf(mxtl::move(msg), true);
 
     // Reuse the code from the half-call used for retrying a Call after thread
     // suspend.
@@ -264,7 +268,7 @@ status_t ChannelDispatcher::ResumeInterruptedCall(mx_time_t deadline,
     return status;
 }
 
-int ChannelDispatcher::WriteSelf(mxtl::unique_ptr<MessagePacket> msg) {
+int ChannelDispatcher::WriteSelf(mxtl::unique_ptr<MessagePacket> msg, bool handoff) {
     canary_.Assert();
 
     AutoLock lock(&lock_);
@@ -280,16 +284,23 @@ int ChannelDispatcher::WriteSelf(mxtl::unique_ptr<MessagePacket> msg) {
             // Remove waiter from list.
             if (waiter.get_txid() == txid) {
                 waiters_.erase(waiter);
+                // The waiter is blocked on exactly this reply, so it
+                // gets readied on this cpu to run next.
+                thread_set_handoff(true);
                 // we return how many threads have been woken up, or zero.
-                return waiter.Deliver(mxtl::move(msg));
+                int woken = waiter.Deliver(mxtl::move(msg));
+                thread_set_handoff(false);
+                return woken;
             }
         }
     }
     messages_.push_back(mxtl::move(msg));
 
+    thread_set_handoff(handoff);
     state_tracker_.UpdateState(0u, MX_CHANNEL_READABLE);
     if (iopc_)
         iopc_->Signal(MX_CHANNEL_READABLE, size, &lock_);
+    thread_set_handoff(false);
     return 0;
 }
 
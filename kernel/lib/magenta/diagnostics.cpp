@@ -271,8 +271,20 @@ public:
     bool OnVmMapping(const VmMapping* map, const VmAddressRegion* vmar,
                      uint depth) override {
         usage.mapped_pages += map->size() / PAGE_SIZE;
-        usage.committed_pages += map->vmo()->AllocatedPagesInRange(
-            map->object_offset(), map->size());
+        size_t committed = map->committed_pages();
+        usage.committed_pages += committed;
+        uint32_t share_count = map->vmo()->share_count();
+        if (share_count == 1) {
+            usage.private_pages += committed;
+        } else {
+            usage.shared_pages += committed;
+            usage.scaled_shared_bytes += committed * PAGE_SIZE / share_count;
+        }
+        // The reclaimed count belongs to the VmObject, not the mapping, so
+        // take it from just one of the VmObject's mappings in this aspace.
+        size_t reclaimed = map->vmo()->ZeroPagesReclaimed();
+        if (reclaimed > 0 && map->vmo()->IsFirstMappingInAspace(map))
+            usage.zero_reclaimed_pages += reclaimed;
         return true;
     }
 
@@ -346,8 +358,7 @@ public:
             mx_info_maps_mapping_t* u = &entry.u.mapping;
             u->mmu_flags =
                 arch_mmu_flags_to_vm_flags(map->arch_mmu_flags());
-            u->committed_pages = map->vmo()->AllocatedPagesInRange(
-                map->object_offset(), map->size());
+            u->committed_pages = map->committed_pages();
             if (maps_.copy_array_to_user(&entry, 1, nelem_) != NO_ERROR) {
                 return false;
             }
@@ -459,6 +470,7 @@ static int cmd_diagnostics(int argc, const cmd_args* argv, uint32_t flags) {
         printf("%s asd  <pid>|kernel : dump process/kernel address space\n",
                argv[0].str);
         printf("%s htinfo            : handle table info\n", argv[0].str);
+        printf("%s pkinfo            : message packet info\n", argv[0].str);
         return -1;
     }
 
@@ -499,6 +511,10 @@ static int cmd_diagnostics(int argc, const cmd_args* argv, uint32_t flags) {
         if (argc != 2)
             goto usage;
         internal::DumpHandleTableInfo();
+    } else if (strcmp(argv[1].str, "pkinfo") == 0) {
+        if (argc != 2)
+            goto usage;
+        internal::DumpMessagePacketStats();
     } else {
         printf("unrecognized subcommand '%s'\n", argv[1].str);
         goto usage;
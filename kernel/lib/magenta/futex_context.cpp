@@ -4,17 +4,32 @@
 // license that can be found in the LICENSE file or at
 // https://opensource.org/licenses/MIT
 
+#include <arch/ops.h>
 #include <assert.h>
 #include <kernel/auto_lock.h>
+#include <kernel/cmdline.h>
 #include <lib/user_copy.h>
 #include <lib/user_copy/user_ptr.h>
+#include <lk/init.h>
 #include <magenta/futex_context.h>
 #include <magenta/user_copy.h>
 #include <magenta/user_thread.h>
+#include <mxtl/algorithm.h>
 #include <trace.h>
 
 #define LOCAL_TRACE 0
 
+// How many times FutexWait() looks at the futex value before blocking while
+// the lock's owner is running, set by kernel.futex-spin-count. Zero turns
+// spinning off.
+static uint32_t futex_spin_count;
+
+static void futex_init(uint level) {
+    futex_spin_count = cmdline_get_uint32("kernel.futex-spin-count", 1000);
+}
+
+LK_INIT_HOOK(futex, &futex_init, LK_INIT_LEVEL_THREADING);
+
 FutexContext::FutexContext() {
     LTRACE_ENTRY;
 }
@@ -24,17 +39,37 @@ FutexContext::~FutexContext() {
 
     // All of the threads should have removed themselves from wait queues
     // by the time the process has exited.
-    DEBUG_ASSERT(futex_table_.is_empty());
+    for (auto& bucket : buckets_)
+        DEBUG_ASSERT(bucket.table.is_empty());
 }
 
-status_t FutexContext::FutexWait(user_ptr<int> value_ptr, int current_value, mx_time_t deadline) {
+status_t FutexContext::FutexWait(user_ptr<int> value_ptr, int current_value, mx_time_t deadline,
+                                 thread_t* owner) {
     LTRACE_ENTRY;
 
     uintptr_t futex_key = reinterpret_cast<uintptr_t>(value_ptr.get());
     if (futex_key % sizeof(int))
         return ERR_INVALID_ARGS;
 
+    int value;
+    status_t result;
+
+    // If the owner is running it may well release the lock before we'd have
+    // finished going to sleep, so look for that for a while first. The owner
+    // can't go away under us, as our caller holds a reference to it.
+    if (owner != nullptr) {
+        for (uint32_t i = 0; i < futex_spin_count && owner->state == THREAD_RUNNING; i++) {
+            result = value_ptr.copy_from_user(&value);
+            if (result != NO_ERROR)
+                return result;
+            if (value != current_value)
+                return ERR_BAD_STATE;
+            arch_spinloop_pause();
+        }
+    }
+
     FutexNode* node;
+    Bucket* bucket = GetBucket(futex_key);
 
     // FutexWait() checks that the address value_ptr still contains
     // current_value, and if so it sleeps awaiting a FutexWake() on value_ptr.
@@ -42,16 +77,15 @@ status_t FutexContext::FutexWait(user_ptr<int> value_ptr, int current_value, mx_
     // If a FutexWake() operation could occur between them, a userland mutex
     // operation built on top of futexes would have a race condition that
     // could miss wakeups.
-    lock_.Acquire();
+    bucket->lock.Acquire();
 
-    int value;
-    status_t result = value_ptr.copy_from_user(&value);
+    result = value_ptr.copy_from_user(&value);
     if (result != NO_ERROR) {
-        lock_.Release();
+        bucket->lock.Release();
         return result;
     }
     if (value != current_value) {
-        lock_.Release();
+        bucket->lock.Release();
         return ERR_BAD_STATE;
     }
 
@@ -60,26 +94,30 @@ status_t FutexContext::FutexWait(user_ptr<int> value_ptr, int current_value, mx_
     node->set_hash_key(futex_key);
     node->SetAsSingletonList();
 
-    QueueNodesLocked(node);
+    QueueNodesLocked(bucket, node);
 
-    // Block current thread.  This releases lock_ and does not reacquire it.
-    result = node->BlockThread(&lock_, deadline);
+    // Block current thread.  This releases the bucket's lock and does not
+    // reacquire it.
+    result = node->BlockThread(&bucket->lock, deadline, owner);
     if (result == NO_ERROR) {
         // Fix/workaround for MG-624:
         // We must re-acquire the lock here to force this thread to wait until
         // the WakeThreads() marks this thread as not in the queue anymore.
         // Otherwise, this thread can exit before it does that, causing
         // WakeThreads() to scribble on memory.
-        AutoLock lock(&lock_);
+        bucket = LockNodeBucket(node);
         DEBUG_ASSERT(!node->IsInQueue());
+        bucket->lock.Release();
         // All the work necessary for removing us from the hash table was done by FutexWake()
         return NO_ERROR;
     }
 
-    AutoLock lock(&lock_);
     // If we hit the deadline, we need to remove the thread's node from the
     // wait queue, since FutexWake() didn't do that.
-    if (UnqueueNodeLocked(node)) {
+    bucket = LockNodeBucket(node);
+    bool unqueued = UnqueueNodeLocked(bucket, node);
+    bucket->lock.Release();
+    if (unqueued) {
         return ERR_TIMED_OUT;
     }
     // The current thread was not found on the wait queue.  This means
@@ -114,23 +152,26 @@ status_t FutexContext::FutexWake(user_ptr<const int> value_ptr,
     if (futex_key % sizeof(int))
         return ERR_INVALID_ARGS;
 
+    Bucket* bucket = GetBucket(futex_key);
     {
-        AutoLock lock(&lock_);
+        AutoLock lock(&bucket->lock);
 
-        FutexNode* node = futex_table_.erase(futex_key);
+        FutexNode* node = bucket->table.erase(futex_key);
         if (!node) {
             // nothing blocked on this futex if we can't find it
             return NO_ERROR;
         }
         DEBUG_ASSERT(node->GetKey() == futex_key);
 
+        // The woken nodes keep their key, so that the waiters find this
+        // bucket again in LockNodeBucket().
         FutexNode* wake_head = node;
-        node = FutexNode::RemoveFromHead(node, count, futex_key, 0u);
+        node = FutexNode::RemoveFromHead(node, count, futex_key, futex_key);
         // node is now the new blocked thread list head
 
         if (node != nullptr) {
             DEBUG_ASSERT(node->GetKey() == futex_key);
-            futex_table_.insert(node);
+            bucket->table.insert(node);
         }
 
         // Traversing this list of threads must be done while holding the
@@ -144,29 +185,57 @@ status_t FutexContext::FutexWake(user_ptr<const int> value_ptr,
 }
 
 status_t FutexContext::FutexRequeue(user_ptr<int> wake_ptr, uint32_t wake_count, int current_value,
-                                    user_ptr<int> requeue_ptr, uint32_t requeue_count) {
+                                    user_ptr<int> requeue_ptr, uint32_t requeue_count)
+    // The buckets are locked by address, which analysis can't follow.
+    TA_NO_THREAD_SAFETY_ANALYSIS {
     LTRACE_ENTRY;
 
     if ((requeue_ptr.get() == nullptr) && requeue_count)
         return ERR_INVALID_ARGS;
 
-    AutoLock lock(&lock_);
+    uintptr_t wake_key = reinterpret_cast<uintptr_t>(wake_ptr.get());
+    uintptr_t requeue_key = reinterpret_cast<uintptr_t>(requeue_ptr.get());
+    Bucket* wake_bucket = GetBucket(wake_key);
+    Bucket* requeue_bucket = GetBucket(requeue_key);
+
+    // Always lock the lower bucket first, so that concurrent requeues between
+    // the same two buckets can't deadlock.
+    Bucket* first = mxtl::min(wake_bucket, requeue_bucket);
+    Bucket* second = mxtl::max(wake_bucket, requeue_bucket);
+    first->lock.Acquire();
+    if (second != first)
+        second->lock.Acquire();
+
+    status_t result = FutexRequeueLocked(wake_ptr, current_value,
+                                         wake_bucket, wake_key, wake_count,
+                                         requeue_bucket, requeue_key, requeue_count);
+
+    if (second != first)
+        second->lock.Release();
+    first->lock.Release();
+    return result;
+}
 
+status_t FutexContext::FutexRequeueLocked(user_ptr<int> wake_ptr, int current_value,
+                                          Bucket* wake_bucket, uintptr_t wake_key,
+                                          uint32_t wake_count,
+                                          Bucket* requeue_bucket, uintptr_t requeue_key,
+                                          uint32_t requeue_count)
+    // Called with both buckets locked; see FutexRequeue().
+    TA_NO_THREAD_SAFETY_ANALYSIS {
     int value;
     status_t result = wake_ptr.copy_from_user(&value);
     if (result != NO_ERROR) return result;
     if (value != current_value) return ERR_BAD_STATE;
 
-    uintptr_t wake_key = reinterpret_cast<uintptr_t>(wake_ptr.get());
-    uintptr_t requeue_key = reinterpret_cast<uintptr_t>(requeue_ptr.get());
     if (wake_key == requeue_key) return ERR_INVALID_ARGS;
     if (wake_key % sizeof(int) || requeue_key % sizeof(int))
         return ERR_INVALID_ARGS;
 
     // This must happen before RemoveFromHead() calls set_hash_key() on
-    // nodes below, because operations on futex_table_ look at the GetKey
+    // nodes below, because operations on the hash tables look at the GetKey
     // field of the list head nodes for wake_key and requeue_key.
-    FutexNode* node = futex_table_.erase(wake_key);
+    FutexNode* node = wake_bucket->table.erase(wake_key);
     if (!node) {
         // nothing blocked on this futex if we can't find it
         return NO_ERROR;
@@ -177,7 +246,7 @@ status_t FutexContext::FutexRequeue(user_ptr<int> wake_ptr, uint32_t wake_count,
         wake_head = nullptr;
     } else {
         wake_head = node;
-        node = FutexNode::RemoveFromHead(node, wake_count, wake_key, 0u);
+        node = FutexNode::RemoveFromHead(node, wake_count, wake_key, wake_key);
     }
 
     // node is now the head of wake_ptr futex after possibly removing some threads to wake
@@ -190,22 +259,37 @@ status_t FutexContext::FutexRequeue(user_ptr<int> wake_ptr, uint32_t wake_count,
 
             // now requeue our nodes to requeue_ptr mutex
             DEBUG_ASSERT(requeue_head->GetKey() == requeue_key);
-            QueueNodesLocked(requeue_head);
+            QueueNodesLocked(requeue_bucket, requeue_head);
         }
     }
 
     // add any remaining nodes back to wake_key futex
     if (node != nullptr) {
         DEBUG_ASSERT(node->GetKey() == wake_key);
-        futex_table_.insert(node);
+        wake_bucket->table.insert(node);
     }
 
     FutexNode::WakeThreads(wake_head);
     return NO_ERROR;
 }
 
-void FutexContext::QueueNodesLocked(FutexNode* head) {
-    DEBUG_ASSERT(lock_.IsHeld());
+// A node's key only changes with the bucket it is queued in locked, but
+// FutexRequeue() can move the node to another bucket between our reading the
+// key and getting the lock, in which case try again.
+FutexContext::Bucket* FutexContext::LockNodeBucket(FutexNode* node)
+    // Returns with the bucket's lock held, which analysis can't follow.
+    TA_NO_THREAD_SAFETY_ANALYSIS {
+    for (;;) {
+        Bucket* bucket = GetBucket(node->GetKey());
+        bucket->lock.Acquire();
+        if (GetBucket(node->GetKey()) == bucket)
+            return bucket;
+        bucket->lock.Release();
+    }
+}
+
+void FutexContext::QueueNodesLocked(Bucket* bucket, FutexNode* head) {
+    DEBUG_ASSERT(bucket->lock.IsHeld());
 
     FutexNode::HashTable::iterator iter;
 
@@ -213,15 +297,15 @@ void FutexContext::QueueNodesLocked(FutexNode* head) {
     // succeeds, then the current thread is first to block on this futex and we
     // are finished.  If the insert fails, then there is already a thread
     // waiting on this futex.  Add ourselves to that thread's list.
-    if (!futex_table_.insert_or_find(head, &iter))
+    if (!bucket->table.insert_or_find(head, &iter))
         iter->AppendList(head);
 }
 
 // This attempts to unqueue a thread (which may or may not be waiting on a
 // futex), given its FutexNode.  This returns whether the FutexNode was
 // found and removed from a futex wait queue.
-bool FutexContext::UnqueueNodeLocked(FutexNode* node) {
-    DEBUG_ASSERT(lock_.IsHeld());
+bool FutexContext::UnqueueNodeLocked(Bucket* bucket, FutexNode* node) {
+    DEBUG_ASSERT(bucket->lock.IsHeld());
 
     if (!node->IsInQueue())
         return false;
@@ -232,10 +316,10 @@ bool FutexContext::UnqueueNodeLocked(FutexNode* node) {
     // FutexRequeue(), so we need to re-get the hash table key here.
     uintptr_t futex_key = node->GetKey();
 
-    FutexNode* old_head = futex_table_.erase(futex_key);
+    FutexNode* old_head = bucket->table.erase(futex_key);
     DEBUG_ASSERT(old_head);
     FutexNode* new_head = FutexNode::RemoveNodeFromList(old_head, node);
     if (new_head)
-        futex_table_.insert(new_head);
+        bucket->table.insert(new_head);
     return true;
 }
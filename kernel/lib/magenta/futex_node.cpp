@@ -24,9 +24,9 @@ FutexNode::~FutexNode() {
 
     DEBUG_ASSERT(!IsInQueue());
 
-    THREAD_LOCK(state);
+    WAIT_QUEUE_LOCK(&wait_queue_, state);
     wait_queue_destroy(&wait_queue_);
-    THREAD_UNLOCK(state);
+    WAIT_QUEUE_UNLOCK(&wait_queue_, state);
 }
 
 bool FutexNode::IsInQueue() const {
@@ -71,7 +71,8 @@ FutexNode* FutexNode::RemoveNodeFromList(FutexNode* list_head,
 // This removes up to |count| nodes from |list_head|.  It returns the new
 // list head (i.e. the list of remaining nodes), which may be null (empty).
 // On return, |list_head| is the list of nodes that were removed --
-// |list_head| remains a valid list.
+// |list_head| remains a valid list.  The removed nodes' keys are set to
+// |new_hash_key|.
 //
 // This will always remove at least one node, because it requires that
 // |count| is non-zero and |list_head| is a non-empty list.
@@ -105,24 +106,30 @@ FutexNode* FutexNode::RemoveFromHead(FutexNode* list_head, uint32_t count,
 // This blocks the current thread.  This releases the given mutex (which
 // must be held when BlockThread() is called).  To reduce contention, it
 // does not reclaim the mutex on return.
-status_t FutexNode::BlockThread(Mutex* mutex, mx_time_t deadline) TA_NO_THREAD_SAFETY_ANALYSIS {
-    THREAD_LOCK(state);
-
-    // We specifically want reschedule=false here, otherwise the
-    // combination of releasing the mutex and enqueuing the current thread
-    // would not be atomic, which would mean that we could miss wakeups.
-    mutex_release_thread_locked(mutex->GetInternal(), /* reschedule= */ false);
-
-    // Check whether a kill has been initiated, and block if not.  This
-    // check+wait must be done atomically (with respect to THREAD_LOCK),
-    // otherwise we could miss a thread termination.
+status_t FutexNode::BlockThread(Mutex* mutex, mx_time_t deadline,
+                                thread_t* owner) TA_NO_THREAD_SAFETY_ANALYSIS {
+    WAIT_QUEUE_LOCK(&wait_queue_, state);
+
+    // We specifically want to release the mutex without rescheduling here,
+    // otherwise the combination of releasing the mutex and enqueuing the
+    // current thread would not be atomic, which would mean that we could
+    // miss wakeups.
+    mutex_release_no_resched(mutex->GetInternal());
+
+    // Check whether a kill has been initiated, and block if not.  The
+    // wait queue does this check+wait atomically with respect to the
+    // thread lock, otherwise we could miss a thread termination.
     thread_t* current_thread = get_current_thread();
     status_t result;
     current_thread->interruptable = true;
+    if (owner)
+        wait_queue_set_owner(&wait_queue_, owner);
     result = wait_queue_block(&wait_queue_, deadline);
+    if (owner)
+        wait_queue_set_owner(&wait_queue_, nullptr);
     current_thread->interruptable = false;
 
-    THREAD_UNLOCK(state);
+    WAIT_QUEUE_UNLOCK(&wait_queue_, state);
 
     return result;
 }
@@ -130,15 +137,22 @@ status_t FutexNode::BlockThread(Mutex* mutex, mx_time_t deadline) TA_NO_THREAD_S
 void FutexNode::WakeThreads(FutexNode* head) {
     if (!head)
         return;
+    int woken = 0;
     FutexNode* node = head;
     do {
         FutexNode* next = node->queue_next_;
-        THREAD_LOCK(state);
-        wait_queue_wake_one(&node->wait_queue_, true, NO_ERROR);
-        THREAD_UNLOCK(state);
+        // The node lives on the waiter's stack, and the waiter can't return
+        // from BlockThread() until it gets the wait queue lock back, so
+        // finish with the node before dropping it.
+        WAIT_QUEUE_LOCK(&node->wait_queue_, state);
+        woken += wait_queue_wake_one(&node->wait_queue_, NO_ERROR);
         node->MarkAsNotInQueue();
+        WAIT_QUEUE_UNLOCK(&node->wait_queue_, state);
         node = next;
     } while (node != head);
+
+    if (woken > 0)
+        thread_reschedule();
 }
 
 // Set |node1| and |node2|'s list pointers so that |node1| is immediately
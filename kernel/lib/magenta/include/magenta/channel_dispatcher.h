@@ -46,8 +46,9 @@ public:
                   mxtl::unique_ptr<MessagePacket>* msg,
                   bool may_disard);
 
-    // Write to the opposing endpoint's message queue.
-    status_t Write(mxtl::unique_ptr<MessagePacket> msg);
+    // Write to the opposing endpoint's message queue. On failure |msg| is
+    // left with the caller, no longer owning its handles.
+    status_t Write(mxtl::unique_ptr<MessagePacket>&& msg);
     status_t Call(mxtl::unique_ptr<MessagePacket> msg,
                   mx_time_t deadline, bool* return_handles,
                   mxtl::unique_ptr<MessagePacket>* reply);
@@ -135,7 +136,9 @@ private:
 
     ChannelDispatcher(uint32_t flags);
     void Init(mxtl::RefPtr<ChannelDispatcher> other);
-    int WriteSelf(mxtl::unique_ptr<MessagePacket> msg);
+    // |handoff| is set when the writer is about to block for a reply, and
+    // readies whoever is waiting to read the message on the writer's cpu.
+    int WriteSelf(mxtl::unique_ptr<MessagePacket> msg, bool handoff);
     status_t UserSignalSelf(uint32_t clear_mask, uint32_t set_mask);
     void OnPeerZeroHandles();
 
@@ -23,6 +23,8 @@
 // When the thread at the head of the futex's blocked thread list is resumed,
 // The FutexNode for the new head of the blocked thread list is set as the hash table value
 // for the futex.
+// The hash table is split into kNumBuckets buckets by futex address, each with its own
+// lock, so that operations on unrelated futexes in a process don't serialize.
 class FutexContext {
 public:
     FutexContext();
@@ -33,7 +35,14 @@ public:
     // Otherwise it will block the current thread until the |deadline| passes,
     // or until the thread is woken by a FutexWake or FutexRequeue operation
     // on the same |value_ptr| futex.
-    status_t FutexWait(user_ptr<int> value_ptr, int current_value, mx_time_t deadline);
+    // If |owner| is not null, it is the thread holding the lock the futex
+    // implements, and it runs at no less than the current thread's priority
+    // while the current thread waits. While |owner| is running on another
+    // cpu, the current thread first spins for a while (as set by
+    // kernel.futex-spin-count) in case it releases the lock soon, returning
+    // ERR_BAD_STATE if the value changes meanwhile.
+    status_t FutexWait(user_ptr<int> value_ptr, int current_value, mx_time_t deadline,
+                       thread_t* owner = nullptr);
 
     // FutexWake will wake up to |count| number of threads blocked on the |value_ptr| futex.
     status_t FutexWake(user_ptr<const int> value_ptr, uint32_t count);
@@ -51,14 +60,36 @@ private:
     FutexContext(const FutexContext&) = delete;
     FutexContext& operator=(const FutexContext&) = delete;
 
-    void QueueNodesLocked(FutexNode* head) TA_REQ(lock_);
+    static constexpr size_t kNumBuckets = 32;
 
-    bool UnqueueNodeLocked(FutexNode* node) TA_REQ(lock_);
+    struct Bucket {
+        // protects table
+        Mutex lock;
 
-    // protects futex_table_
-    Mutex lock_;
+        // Key is futex address, value is the FutexNode for the head of futex's
+        // blocked thread list.
+        FutexNode::HashTable table TA_GUARDED(lock);
+    };
 
-    // Hash table for futexes in this context.
-    // Key is futex address, value is the FutexNode for the head of futex's blocked thread list.
-    FutexNode::HashTable futex_table_ TA_GUARDED(lock_);
+    // The bucket holding the futex at |futex_key|. Futexes in the same bucket
+    // are spread over the buckets' own hash tables by the next bits down.
+    Bucket* GetBucket(uintptr_t futex_key) {
+        return &buckets_[FutexNode::GetHash(futex_key) / FutexNode::kNumHashBuckets %
+                         kNumBuckets];
+    }
+
+    // Locks and returns the bucket |node| is (or was last) queued in.
+    Bucket* LockNodeBucket(FutexNode* node);
+
+    // FutexRequeue() with the buckets of both futexes locked.
+    status_t FutexRequeueLocked(user_ptr<int> wake_ptr, int current_value,
+                                Bucket* wake_bucket, uintptr_t wake_key, uint32_t wake_count,
+                                Bucket* requeue_bucket, uintptr_t requeue_key,
+                                uint32_t requeue_count);
+
+    static void QueueNodesLocked(Bucket* bucket, FutexNode* head) TA_REQ(bucket->lock);
+
+    static bool UnqueueNodeLocked(Bucket* bucket, FutexNode* node) TA_REQ(bucket->lock);
+
+    Bucket buckets_[kNumBuckets];
 };
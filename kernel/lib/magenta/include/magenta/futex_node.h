@@ -17,7 +17,10 @@
 // Intended to be embedded within a UserThread Instance
 class FutexNode : public mxtl::SinglyLinkedListable<FutexNode*> {
 public:
-    using HashTable = mxtl::HashTable<uintptr_t, FutexNode*>;
+    // Each FutexContext has many of these, so keep them small.
+    static constexpr size_t kNumHashBuckets = 8;
+    using HashTable = mxtl::HashTable<uintptr_t, FutexNode*, mxtl::SinglyLinkedList<FutexNode*>,
+                                      size_t, kNumHashBuckets>;
 
     FutexNode();
     ~FutexNode();
@@ -39,7 +42,9 @@ public:
                                      uintptr_t new_hash_key);
 
     // This must be called with |mutex| held and returns without |mutex| held.
-    status_t BlockThread(Mutex* mutex, mx_time_t deadline) TA_REL(mutex);
+    // If |owner| is not null, it inherits the current thread's priority
+    // while the current thread is blocked.
+    status_t BlockThread(Mutex* mutex, mx_time_t deadline, thread_t* owner) TA_REL(mutex);
 
     // wakes the list of threads starting with node |head|
     static void WakeThreads(FutexNode* head);
@@ -62,4 +62,8 @@ namespace internal {
     // Dumps internal details of the handle table using printf().
     // Should only be called by diagnostics.cpp.
     void DumpHandleTableInfo();
+
+    // Dumps counts of message packets created using printf().
+    // Should only be called by diagnostics.cpp.
+    void DumpMessagePacketStats();
 } // namespace internal
@@ -6,8 +6,10 @@
 
 #pragma once
 
+#include <list.h>
 #include <stdint.h>
 
+#include <lib/user_copy/user_ptr.h>
 #include <magenta/types.h>
 #include <mxtl/intrusive_double_list.h>
 #include <mxtl/unique_ptr.h>
@@ -20,11 +22,30 @@ public:
     static mx_status_t Create(uint32_t data_size, uint32_t num_handles,
                               mxtl::unique_ptr<MessagePacket>* msg);
 
+    // Creates a message packet holding the |data_size| bytes at |data|. With
+    // |donate|, the whole pages in the middle of a large enough message are
+    // swapped out of the caller's memory instead of being copied, and read as
+    // zeros there afterwards.
+    static mx_status_t CreateFromUser(user_ptr<const void> data, uint32_t data_size,
+                                      uint32_t num_handles, bool donate,
+                                      mxtl::unique_ptr<MessagePacket>* msg);
+
+    // Copies all of the data out to |data|. With |accept|, donated pages that
+    // line up with whole pages of the caller's memory are swapped in there
+    // instead of being copied.
+    mx_status_t CopyDataToUser(user_ptr<void> data, bool accept);
+
+    // Puts the pages that CreateFromUser() took from |data| back, for when the
+    // packet couldn't be written after all.
+    void ReturnDonatedPages(user_ptr<const void> data);
+
     uint32_t data_size() const { return data_size_; }
     uint32_t num_handles() const { return num_handles_; }
 
     void set_owns_handles(bool own_handles) { owns_handles_ = own_handles; }
 
+    // The bytes held in the packet itself, which are all of them unless pages
+    // were donated. Donated pages never cover the transaction id.
     const void* data() const { return static_cast<void*>(handles_ + num_handles_); }
     void* mutable_data() { return static_cast<void*>(handles_ + num_handles_); }
     Handle* const* handles() const { return handles_; }
@@ -44,13 +65,25 @@ private:
     MessagePacket(uint32_t data_size, uint32_t num_handles, Handle** handles);
     ~MessagePacket();
 
-    static void operator delete(void* ptr) {
-        free(ptr);
-    }
+    static mx_status_t CreateInternal(uint32_t data_size, uint32_t num_handles,
+                                      uint32_t pages_len, mxtl::unique_ptr<MessagePacket>* msg);
+
+    // Copies the donated pages out to |data|, which is where they start.
+    mx_status_t CopyPagesToUser(user_ptr<void> data);
+
+    // Packets live in buffers that may be cached for reuse rather than freed.
+    static void operator delete(void* ptr);
     friend class mxtl::unique_ptr<MessagePacket>;
 
     bool owns_handles_;
     uint32_t data_size_;
     uint32_t num_handles_;
     Handle** handles_;
+
+    // Donated pages holding the bytes [pages_offset_, pages_offset_ + pages_len_)
+    // of the message, in order. The bytes after them follow the ones before
+    // them in the packet.
+    uint32_t pages_offset_;
+    uint32_t pages_len_;
+    list_node pages_;
 };
@@ -78,6 +78,7 @@
 
 class PortDispatcherV2;
 class PortObserver;
+class PortPageSource;
 
 struct PortPacket final : public mxtl::DoublyLinkedListable<PortPacket*> {
     mx_port_packet_t packet;
@@ -88,6 +89,12 @@ struct PortPacket final : public mxtl::DoublyLinkedListable<PortPacket*> {
     void operator=(PortPacket) = delete;
 
     uint32_t type() const { return packet.type; }
+
+    // Packets that don't belong to an observer are allocated when queued and
+    // freed when dequeued.
+    bool is_allocated() const {
+        return type() == MX_PKT_TYPE_USER || type() == MX_PKT_TYPE_PAGE_REQUEST;
+    }
 };
 
 // Observers are weakly contained in state trackers until |remove_| member
@@ -136,7 +143,14 @@ public:
 
     mx_status_t Queue(PortPacket* port_packet, mx_signals_t observed, uint64_t count);
     mx_status_t QueueUser(const mx_port_packet_t& packet);
+    // Queues a copy of |packet|, type and all. For packets the kernel
+    // generates that don't come from an observer.
+    mx_status_t QueuePacket(const mx_port_packet_t& packet);
     mx_status_t DeQueue(mx_time_t deadline, mx_port_packet_t* packet);
+    // Dequeues up to |count| packets, in order, waiting until |deadline| for the
+    // first one to arrive but not for the rest. |packets| may be null.
+    mx_status_t DeQueueMany(mx_time_t deadline, mx_port_packet_t* packets,
+                            size_t count, size_t* actual);
 
     // Decides who is going to destroy the observer. If it returns |true| it
     // is the duty of the caller. If it is false it is the duty of the port.
@@ -146,6 +160,11 @@ public:
     mx_status_t MakeObservers(uint32_t options, Handle* handle,
                               uint64_t key, mx_signals_t signals);
 
+    // The page sources queueing page requests on the port, told when the
+    // port has no handles left so they can fail what nobody will supply.
+    void AddPageSource(PortPageSource* source);
+    void RemovePageSource(PortPageSource* source);
+
 private:
     PortDispatcherV2(uint32_t options);
     PortObserver* CopyLocked(PortPacket* port_packet, mx_port_packet_t* packet) TA_REQ(lock_);
@@ -155,4 +174,5 @@ private:
     Semaphore sema_;
     bool zero_handles_ TA_GUARDED(lock_);
     mxtl::DoublyLinkedList<PortPacket*> packets_ TA_GUARDED(lock_);
+    mxtl::DoublyLinkedList<PortPageSource*> page_sources_ TA_GUARDED(lock_);
 };
@@ -0,0 +1,47 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <stdint.h>
+
+#include <kernel/vm/page_source.h>
+
+#include <magenta/types.h>
+
+#include <mxtl/canary.h>
+#include <mxtl/intrusive_double_list.h>
+#include <mxtl/ref_ptr.h>
+
+class PortDispatcherV2;
+
+// The page source behind a vmo created by mx_pager_vmo_create(). Each request
+// for pages is queued on the pager's port as a MX_PKT_TYPE_PAGE_REQUEST packet
+// carrying the pager's key, to be answered with mx_pager_supply_pages() or
+// mx_pager_fail_pages(). Once the port loses its last handle, the outstanding
+// requests fail with ERR_PEER_CLOSED.
+class PortPageSource final : public PageSource,
+                             public mxtl::DoublyLinkedListable<PortPageSource*> {
+public:
+    PortPageSource(mxtl::RefPtr<PortDispatcherV2> port, uint64_t key);
+    ~PortPageSource() final;
+
+    status_t RequestPages(uint64_t offset, uint64_t len) final;
+
+    // Called by the port, under its lock, once it has no handles left.
+    void OnPortClosed();
+
+private:
+    void OnAttach() final;
+    void OnDetach() final;
+
+    PortPageSource(const PortPageSource&) = delete;
+    PortPageSource& operator=(const PortPageSource&) = delete;
+
+    mxtl::Canary<mxtl::magic("PGSR")> canary_;
+    mxtl::RefPtr<PortDispatcherV2> const port_;
+    const uint64_t key_;
+};
@@ -22,6 +22,7 @@
 #include <magenta/user_thread.h>
 
 #include <mxtl/array.h>
+#include <mxtl/atomic.h>
 #include <mxtl/canary.h>
 #include <mxtl/intrusive_double_list.h>
 #include <mxtl/ref_counted.h>
@@ -249,6 +250,17 @@ private:
                                                 mxtl::RefPtr<Dispatcher>* dispatcher_out,
                                                 mx_rights_t* out_rights);
 
+    // Looks up |handle_value| without taking |handle_table_lock_|. The handle
+    // arena is already indexed by handle value and checked against the
+    // generation in the value, so all that's needed is to keep the handle from
+    // being destroyed while it's being read; see WaitForHandleLookupsLocked().
+    mx_status_t LookupHandle(mx_handle_t handle_value, mx_rights_t desired_rights,
+                             mxtl::RefPtr<Dispatcher>* dispatcher, mx_rights_t* rights);
+
+    // Called after handles have been taken out of the table to wait for any
+    // LookupHandle() that might still be looking at them.
+    void WaitForHandleLookupsLocked() TA_REQ(handle_table_lock_);
+
     // Thread lifecycle support
     friend class UserThread;
     status_t AddThread(UserThread* t, bool initial_thread);
@@ -283,6 +295,16 @@ private:
     mutable Mutex handle_table_lock_; // protects |handles_|.
     mxtl::DoublyLinkedList<Handle*> handles_ TA_GUARDED(handle_table_lock_);
 
+    // LookupHandle() calls in flight, counted against the current epoch so
+    // that removers only wait for the ones that started before them. Each cpu
+    // counts its own lookups so that concurrent readers don't share a line;
+    // removers wait for every cpu's count to drain.
+    struct HandleLookupCounts {
+        mxtl::atomic<int> count[2] = {{0}, {0}};
+    } __CPU_ALIGN;
+    mxtl::atomic<uint32_t> handle_lookup_epoch_{0u};
+    HandleLookupCounts handle_lookups_[SMP_MAX_CPUS];
+
     StateTracker state_tracker_;
 
     FutexContext futex_context_;
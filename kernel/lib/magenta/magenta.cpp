@@ -9,9 +9,11 @@
 #include <pow2.h>
 #include <trace.h>
 
+#include <arch/ops.h>
 #include <kernel/auto_lock.h>
 #include <kernel/cmdline.h>
 #include <kernel/mutex.h>
+#include <kernel/spinlock.h>
 
 #include <lk/init.h>
 
@@ -30,6 +32,7 @@
 #include <magenta/io_mapping_dispatcher.h>
 
 #include <mxtl/arena.h>
+#include <mxtl/atomic.h>
 #include <mxtl/intrusive_double_list.h>
 #include <mxtl/type_support.h>
 
@@ -47,7 +50,25 @@ constexpr size_t kHighHandleCount = (kMaxHandleCount * 7) / 8;
 // The handle arena and its mutex.
 static Mutex handle_mutex;
 static mxtl::Arena TA_GUARDED(handle_mutex) handle_arena;
-static size_t outstanding_handles TA_GUARDED(handle_mutex) = 0u;
+static mxtl::atomic<size_t> outstanding_handles(0u);
+
+// Free handle slots are kept in small per cpu stacks in front of
+// |handle_arena|, so that creating and closing handles only goes through
+// |handle_mutex| once per kHandleCacheBatch of them.
+constexpr uint32_t kHandleCacheSize = 32u;
+constexpr uint32_t kHandleCacheBatch = kHandleCacheSize / 2;
+
+namespace {
+
+struct HandleCache {
+    SpinLock lock;
+    uint32_t count = 0u;
+    void* slots[kHandleCacheSize];
+} __CPU_ALIGN;
+
+HandleCache handle_caches[SMP_MAX_CPUS];
+
+} // namespace
 
 // The system exception port.
 static mutex_t system_exception_mutex = MUTEX_INITIAL_VALUE(system_exception_mutex);
@@ -99,7 +120,9 @@ static_assert(((3 << 30) ^ kHandleGenerationMask ^ kHandleIndexMask) ==
 // Returns a new |base_value| based on the value stored in the free
 // |handle_arena| slot pointed to by |addr|. The new value will be different
 // from the last |base_value| used by this slot.
-static uint32_t GetNewHandleBaseValue(void* addr) TA_REQ(handle_mutex) {
+static uint32_t GetNewHandleBaseValue(void* addr)
+    // The arena's start never changes after magenta_init().
+    TA_NO_THREAD_SAFETY_ANALYSIS {
     // Get the index of this slot within handle_arena.
     auto va = reinterpret_cast<Handle*>(addr) -
               reinterpret_cast<Handle*>(handle_arena.start());
@@ -146,41 +169,110 @@ void internal::TearDownHandle(Handle *handle) TA_EXCL(handle_mutex) {
     DEBUG_ASSERT(handle->process_id_ == 0);
 }
 
+// Pops up to |max| free slots off the current cpu's cache into |slots|,
+// returning how many it got.
+static uint32_t PopCachedHandleSlots(void** slots, uint32_t max) {
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    HandleCache* cache = &handle_caches[arch_curr_cpu_num()];
+    cache->lock.Acquire();
+
+    uint32_t n = 0u;
+    while (n < max && cache->count > 0u)
+        slots[n++] = cache->slots[--cache->count];
+
+    cache->lock.Release();
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+    return n;
+}
+
+// Pushes as many of the |count| free |slots| onto the current cpu's cache as
+// fit, returning how many did.
+static uint32_t PushCachedHandleSlots(void* const* slots, uint32_t count) {
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    HandleCache* cache = &handle_caches[arch_curr_cpu_num()];
+    cache->lock.Acquire();
+
+    uint32_t n = 0u;
+    while (n < count && cache->count < kHandleCacheSize)
+        cache->slots[cache->count++] = slots[n++];
+
+    cache->lock.Release();
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+    return n;
+}
+
+static void* AllocHandleSlot() {
+    void* slots[kHandleCacheBatch];
+    if (PopCachedHandleSlots(slots, 1u) == 1u)
+        return slots[0];
+
+    // Take a batch from the arena: one for the caller and the rest for the cache.
+    uint32_t n = 0u;
+    {
+        AutoLock lock(&handle_mutex);
+        while (n < kHandleCacheBatch && (slots[n] = handle_arena.Alloc()) != nullptr)
+            n++;
+    }
+    if (n == 0u)
+        return nullptr;
+
+    uint32_t cached = 1u + PushCachedHandleSlots(&slots[1], n - 1u);
+    if (cached < n) {
+        // Someone else on this cpu filled the cache in the meantime.
+        AutoLock lock(&handle_mutex);
+        for (uint32_t i = cached; i < n; i++)
+            handle_arena.Free(slots[i]);
+    }
+    return slots[0];
+}
+
+static void FreeHandleSlot(void* addr) {
+    if (PushCachedHandleSlots(&addr, 1u) == 1u)
+        return;
+
+    // The cache is full: give half of it back to the arena along with |addr|.
+    void* slots[kHandleCacheBatch];
+    uint32_t n = PopCachedHandleSlots(slots, kHandleCacheBatch - 1u);
+    slots[n++] = addr;
+
+    AutoLock lock(&handle_mutex);
+    for (uint32_t i = 0u; i < n; i++)
+        handle_arena.Free(slots[i]);
+}
+
 static void high_handle_count(size_t count) {
     // TODO: Avoid calling this for every handle after kHighHandleCount;
-    // printfs are slow and |handle_mutex| is held by our caller.
+    // printfs are slow.
     printf("WARNING: High handle count: %zu handles\n", count);
 }
 
 Handle* MakeHandle(mxtl::RefPtr<Dispatcher> dispatcher, mx_rights_t rights) {
-    AutoLock lock(&handle_mutex);
-    void* addr = handle_arena.Alloc();
+    void* addr = AllocHandleSlot();
     if (addr == nullptr) {
-        const auto oh = outstanding_handles;
-        lock.release();
         printf("WARNING: Could not allocate new handle (%zu outstanding)\n",
-               oh);
+               outstanding_handles.load());
         return nullptr;
     }
-    if (++outstanding_handles > kHighHandleCount)
-        high_handle_count(outstanding_handles);
+    const size_t oh = outstanding_handles.fetch_add(1u) + 1u;
+    if (oh > kHighHandleCount)
+        high_handle_count(oh);
     uint32_t base_value = GetNewHandleBaseValue(addr);
     return new (addr) Handle(mxtl::move(dispatcher), rights, base_value);
 }
 
 Handle* DupHandle(Handle* source, mx_rights_t rights) {
-    AutoLock lock(&handle_mutex);
-    void* addr = handle_arena.Alloc();
+    void* addr = AllocHandleSlot();
     if (addr == nullptr) {
-        const auto oh = outstanding_handles;
-        lock.release();
         printf(
             "WARNING: Could not allocate duplicate handle (%zu outstanding)\n",
-            oh);
+            outstanding_handles.load());
         return nullptr;
     }
-    if (++outstanding_handles > kHighHandleCount)
-        high_handle_count(outstanding_handles);
+    const size_t oh = outstanding_handles.fetch_add(1u) + 1u;
+    if (oh > kHighHandleCount)
+        high_handle_count(oh);
     uint32_t base_value = GetNewHandleBaseValue(addr);
     return new (addr) Handle(source, rights, base_value);
 }
@@ -211,13 +303,13 @@ void DeleteHandle(Handle* handle) {
     // base_value for reuse the next time this slot is allocated.
     internal::TearDownHandle(handle);
 
-    AutoLock lock(&handle_mutex);
-    --outstanding_handles;
-    handle_arena.Free(handle);
+    outstanding_handles.fetch_sub(1u);
+    FreeHandleSlot(handle);
 }
 
-bool HandleInRange(void* addr) {
-    AutoLock lock(&handle_mutex);
+// Called without |handle_mutex| by lookups. The arena's data pool only ever
+// grows, so a slot that was once in range stays mapped.
+bool HandleInRange(void* addr) TA_NO_THREAD_SAFETY_ANALYSIS {
     return handle_arena.in_range(addr);
 }
 
@@ -231,6 +323,13 @@ Handle* MapU32ToHandle(uint32_t value) TA_NO_THREAD_SAFETY_ANALYSIS {
 }
 
 void internal::DumpHandleTableInfo() {
+    // racy reads are fine for statistics
+    uint32_t cached = 0u;
+    for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++)
+        cached += handle_caches[cpu].count;
+    printf("%zu handles outstanding, %u free slots in per-cpu caches\n",
+           outstanding_handles.load(), cached);
+
     AutoLock lock(&handle_mutex);
     handle_arena.Dump();
 }
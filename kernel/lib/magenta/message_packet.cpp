@@ -5,28 +5,195 @@
 // https://opensource.org/licenses/MIT
 
 #include <err.h>
+#include <inttypes.h>
 #include <new.h>
+#include <stdio.h>
+
+#include <arch/ops.h>
+#include <kernel/cmdline.h>
+#include <kernel/spinlock.h>
+#include <kernel/vm.h>
+#include <kernel/vm/vm_address_region.h>
+#include <kernel/vm/vm_aspace.h>
+#include <kernel/vm/vm_object.h>
+#include <lk/init.h>
 
 #include <magenta/handle_reaper.h>
 #include <magenta/magenta.h>
 #include <magenta/message_packet.h>
+#include <magenta/process_dispatcher.h>
 
 constexpr uint32_t kMaxMessageSize = 65536u;
 constexpr uint32_t kMaxMessageHandles = 1024u;
 
+// The fewest bytes of whole pages worth donating rather than copying, set by
+// kernel.channel-donate-min. Zero turns donation off.
+static uint32_t donate_min_bytes;
+
+static void message_packet_init(uint level) {
+    donate_min_bytes = cmdline_get_uint32("kernel.channel-donate-min", 4 * PAGE_SIZE);
+}
+
+LK_INIT_HOOK(message_packet, &message_packet_init, LK_INIT_LEVEL_THREADING);
+
+namespace {
+
+// The buffers of packets up to a few sizes are kept in per cpu caches when the
+// packets are destroyed, for the next packets of about the same size to reuse.
+// Small messages and the replies to channel calls written in response to them
+// then never have to go to the heap. Bigger packets come from the heap and go
+// straight back to it.
+struct SizeClass {
+    size_t payload;      // bytes of handle pointers and data a buffer has room for
+    uint32_t max_cached; // buffers each cpu holds on to
+};
+
+const SizeClass kSizeClasses[] = {
+    {256u + 4u * sizeof(Handle*), 64u},
+    {4096u + 16u * sizeof(Handle*), 8u},
+};
+constexpr uint32_t kNumSizeClasses = countof(kSizeClasses);
+
+// Every packet buffer starts with one of these, ahead of the MessagePacket.
+struct BufferHeader {
+    BufferHeader* next;  // while cached
+    uint32_t size_class; // kNumSizeClasses for buffers sized to their packet
+};
+static_assert(sizeof(BufferHeader) % alignof(MessagePacket) == 0, "");
+
+struct PacketCache {
+    SpinLock lock;
+    BufferHeader* head[kNumSizeClasses] = {};
+    uint32_t count[kNumSizeClasses] = {};
+
+    // statistics, the last allocs entry counting packets too big for any class
+    uint64_t allocs[kNumSizeClasses + 1] = {};
+    uint64_t hits[kNumSizeClasses] = {};
+} __CPU_ALIGN;
+
+PacketCache packet_caches[SMP_MAX_CPUS];
+
+// Returns room for a MessagePacket followed by |payload| bytes.
+void* AllocPacketBuffer(size_t payload) {
+    uint32_t size_class = 0;
+    while (size_class < kNumSizeClasses && payload > kSizeClasses[size_class].payload)
+        size_class++;
+
+    BufferHeader* header = nullptr;
+
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    PacketCache* cache = &packet_caches[arch_curr_cpu_num()];
+    cache->lock.Acquire();
+
+    cache->allocs[size_class]++;
+    if (size_class < kNumSizeClasses && cache->head[size_class] != nullptr) {
+        header = cache->head[size_class];
+        cache->head[size_class] = header->next;
+        cache->count[size_class]--;
+        cache->hits[size_class]++;
+    }
+
+    cache->lock.Release();
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    if (header == nullptr) {
+        if (size_class < kNumSizeClasses)
+            payload = kSizeClasses[size_class].payload;
+        header = static_cast<BufferHeader*>(
+            malloc(sizeof(BufferHeader) + sizeof(MessagePacket) + payload));
+        if (header == nullptr)
+            return nullptr;
+        header->size_class = size_class;
+    }
+    return header + 1;
+}
+
+void FreePacketBuffer(void* ptr) {
+    BufferHeader* header = static_cast<BufferHeader*>(ptr) - 1;
+    const uint32_t size_class = header->size_class;
+
+    if (size_class < kNumSizeClasses) {
+        bool cached = false;
+
+        spin_lock_saved_state_t state;
+        arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+        PacketCache* cache = &packet_caches[arch_curr_cpu_num()];
+        cache->lock.Acquire();
+
+        if (cache->count[size_class] < kSizeClasses[size_class].max_cached) {
+            header->next = cache->head[size_class];
+            cache->head[size_class] = header;
+            cache->count[size_class]++;
+            cached = true;
+        }
+
+        cache->lock.Release();
+        arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+        if (cached)
+            return;
+    }
+
+    free(header);
+}
+
+} // namespace
+
+void internal::DumpMessagePacketStats() {
+    for (uint32_t size_class = 0; size_class <= kNumSizeClasses; size_class++) {
+        uint64_t cached = 0, allocs = 0, hits = 0;
+
+        // racy reads are fine for statistics
+        for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+            const PacketCache& cache = packet_caches[cpu];
+            allocs += cache.allocs[size_class];
+            if (size_class < kNumSizeClasses) {
+                cached += cache.count[size_class];
+                hits += cache.hits[size_class];
+            }
+        }
+
+        if (size_class < kNumSizeClasses) {
+            printf("up to %4zu bytes: %" PRIu64 " packets, %" PRIu64 " from the cache, "
+                   "%" PRIu64 " buffers cached\n",
+                   kSizeClasses[size_class].payload, allocs, hits, cached);
+        } else {
+            printf("bigger:          %" PRIu64 " packets\n", allocs);
+        }
+    }
+}
+
+// Swaps the pages of the caller's memory at [va, va + len) with the ones on
+// |pages|, if they all belong to one mapping the caller could write them
+// through anyway.
+static mx_status_t ExchangeUserPages(vaddr_t va, size_t len, list_node* pages) {
+    auto region = ProcessDispatcher::GetCurrent()->aspace()->FindRegion(va);
+    if (!region || !region->is_mapping())
+        return ERR_NOT_FOUND;
+
+    return region->as_vm_mapping()->ExchangeUserPages(va, len, pages);
+}
+
 // static
 mx_status_t MessagePacket::Create(uint32_t data_size, uint32_t num_handles,
                                   mxtl::unique_ptr<MessagePacket>* msg) {
+    return CreateInternal(data_size, num_handles, 0u, msg);
+}
+
+// static
+mx_status_t MessagePacket::CreateInternal(uint32_t data_size, uint32_t num_handles,
+                                          uint32_t pages_len,
+                                          mxtl::unique_ptr<MessagePacket>* msg) {
     if (data_size > kMaxMessageSize)
         return ERR_OUT_OF_RANGE;
     if (num_handles > kMaxMessageHandles)
         return ERR_OUT_OF_RANGE;
 
     // Allocate space for the MessagePacket object followed by num_handles
-    // Handle*s followed by data_size bytes.
-    char* ptr = static_cast<char*>(malloc(sizeof(MessagePacket) +
-                                          num_handles * sizeof(Handle*) +
-                                          data_size));
+    // Handle*s followed by the data_size bytes not held in donated pages.
+    char* ptr = static_cast<char*>(AllocPacketBuffer(num_handles * sizeof(Handle*) +
+                                                     data_size - pages_len));
     if (ptr == nullptr)
         return ERR_NO_MEMORY;
 
@@ -35,17 +202,120 @@ mx_status_t MessagePacket::Create(uint32_t data_size, uint32_t num_handles,
     // fill these arrays immediately after creation of the object.
     msg->reset(new (ptr) MessagePacket(data_size, num_handles,
                                        reinterpret_cast<Handle**>(ptr + sizeof(MessagePacket))));
+    (*msg)->pages_len_ = pages_len;
+    return NO_ERROR;
+}
+
+// static
+mx_status_t MessagePacket::CreateFromUser(user_ptr<const void> data, uint32_t data_size,
+                                          uint32_t num_handles, bool donate,
+                                          mxtl::unique_ptr<MessagePacket>* msg) {
+    // The whole pages past the transaction id, if there are enough of them.
+    vaddr_t va = reinterpret_cast<vaddr_t>(data.get());
+    vaddr_t pages_start = ROUNDUP(va + sizeof(mx_txid_t), PAGE_SIZE);
+    vaddr_t pages_end = ROUNDDOWN(va + data_size, PAGE_SIZE);
+    if (donate && donate_min_bytes > 0 &&
+        pages_end > pages_start && pages_end - pages_start >= donate_min_bytes) {
+        uint32_t pages_offset = static_cast<uint32_t>(pages_start - va);
+        uint32_t pages_len = static_cast<uint32_t>(pages_end - pages_start);
+        uint32_t tail_len = data_size - pages_offset - pages_len;
+
+        mx_status_t status = CreateInternal(data_size, num_handles, pages_len, msg);
+        if (status != NO_ERROR)
+            return status;
+        MessagePacket* packet = msg->get();
+        packet->pages_offset_ = pages_offset;
+
+        // copy the bytes around the pages first, so that nothing is taken from
+        // the caller when those can't be read
+        uint8_t* bytes = static_cast<uint8_t*>(packet->mutable_data());
+        if (data.copy_array_from_user(bytes, pages_offset) != NO_ERROR)
+            return ERR_INVALID_ARGS;
+        if (tail_len > 0u &&
+            data.byte_offset(pages_offset + pages_len)
+                    .copy_array_from_user(bytes + pages_offset, tail_len) != NO_ERROR)
+            return ERR_INVALID_ARGS;
+
+        // the caller gets zeroed pages in place of the ones it gives up
+        size_t count = pages_len / PAGE_SIZE;
+        if (pmm_alloc_pages(count, PMM_ALLOC_FLAG_ZEROED, &packet->pages_) == count &&
+            ExchangeUserPages(pages_start, pages_len, &packet->pages_) == NO_ERROR)
+            return NO_ERROR;
+
+        // something about the memory doesn't allow it, copy the whole lot instead
+        msg->reset();
+    }
+
+    mx_status_t status = Create(data_size, num_handles, msg);
+    if (status != NO_ERROR)
+        return status;
+
+    if (data_size > 0u) {
+        if (data.copy_array_from_user((*msg)->mutable_data(), data_size) != NO_ERROR)
+            return ERR_INVALID_ARGS;
+    }
     return NO_ERROR;
 }
 
+mx_status_t MessagePacket::CopyDataToUser(user_ptr<void> data, bool accept) {
+    if (pages_len_ == 0u)
+        return data.copy_array_to_user(this->data(), data_size_);
+
+    const uint8_t* bytes = static_cast<const uint8_t*>(this->data());
+    uint32_t tail_len = data_size_ - pages_offset_ - pages_len_;
+    if (data.copy_array_to_user(bytes, pages_offset_) != NO_ERROR)
+        return ERR_INVALID_ARGS;
+    if (tail_len > 0u &&
+        data.byte_offset(pages_offset_ + pages_len_)
+                .copy_array_to_user(bytes + pages_offset_, tail_len) != NO_ERROR)
+        return ERR_INVALID_ARGS;
+
+    // the caller's old pages are freed along with the packet
+    vaddr_t va = reinterpret_cast<vaddr_t>(data.get()) + pages_offset_;
+    if (accept && IS_PAGE_ALIGNED(va) && ExchangeUserPages(va, pages_len_, &pages_) == NO_ERROR)
+        return NO_ERROR;
+
+    return CopyPagesToUser(data.byte_offset(pages_offset_));
+}
+
+void MessagePacket::ReturnDonatedPages(user_ptr<const void> data) {
+    if (pages_len_ == 0u)
+        return;
+
+    // the zeroed pages the caller got in their place are freed along with the
+    // packet. if the memory has changed since, put back what we can.
+    vaddr_t va = reinterpret_cast<vaddr_t>(data.get()) + pages_offset_;
+    if (ExchangeUserPages(va, pages_len_, &pages_) != NO_ERROR)
+        CopyPagesToUser(user_ptr<void>(reinterpret_cast<void*>(va)));
+}
+
+mx_status_t MessagePacket::CopyPagesToUser(user_ptr<void> data) {
+    size_t offset = 0;
+    vm_page_t* p;
+    list_for_every_entry (&pages_, p, vm_page_t, free.node) {
+        const void* src = paddr_to_kvaddr(vm_page_to_paddr(p));
+        if (data.byte_offset(offset).copy_array_to_user(src, PAGE_SIZE) != NO_ERROR)
+            return ERR_INVALID_ARGS;
+        offset += PAGE_SIZE;
+    }
+    return NO_ERROR;
+}
+
+void MessagePacket::operator delete(void* ptr) {
+    FreePacketBuffer(ptr);
+}
+
 MessagePacket::~MessagePacket() {
     if (owns_handles_) {
         // Delete handles out-of-band to avoid the worst case recursive
         // destruction behavior.
         ReapHandles(handles_, num_handles_);
     }
+    if (!list_is_empty(&pages_))
+        pmm_free(&pages_);
 }
 
 MessagePacket::MessagePacket(uint32_t data_size, uint32_t num_handles, Handle** handles)
-    : owns_handles_(false), data_size_(data_size), num_handles_(num_handles), handles_(handles) {
+    : owns_handles_(false), data_size_(data_size), num_handles_(num_handles), handles_(handles),
+      pages_offset_(0u), pages_len_(0u), pages_(LIST_INITIAL_VALUE(pages_)) {
 }
@@ -13,6 +13,7 @@
 #include <pow2.h>
 
 #include <magenta/compiler.h>
+#include <magenta/port_page_source.h>
 #include <magenta/state_tracker.h>
 #include <magenta/syscalls/port.h>
 
@@ -120,12 +121,37 @@ void PortDispatcherV2::on_zero_handles() {
     {
         AutoLock al(&lock_);
         zero_handles_ = true;
+
+        // nobody is left to answer the page requests
+        for (auto& source : page_sources_)
+            source.OnPortClosed();
     }
     while (DeQueue(0ull, nullptr) == NO_ERROR) {}
 }
 
+void PortDispatcherV2::AddPageSource(PortPageSource* source) {
+    canary_.Assert();
+
+    AutoLock al(&lock_);
+    page_sources_.push_back(source);
+}
+
+void PortDispatcherV2::RemovePageSource(PortPageSource* source) {
+    canary_.Assert();
+
+    AutoLock al(&lock_);
+    page_sources_.erase(*source);
+}
+
 mx_status_t PortDispatcherV2::QueueUser(const mx_port_packet_t& packet) {
+    mx_port_packet_t user_packet = packet;
+    user_packet.type = MX_PKT_TYPE_USER;
+    return QueuePacket(user_packet);
+}
+
+mx_status_t PortDispatcherV2::QueuePacket(const mx_port_packet_t& packet) {
     canary_.Assert();
+    DEBUG_ASSERT(packet.type == MX_PKT_TYPE_USER || packet.type == MX_PKT_TYPE_PAGE_REQUEST);
 
     AllocChecker ac;
     auto port_packet = new (&ac) PortPacket();
@@ -133,7 +159,6 @@ mx_status_t PortDispatcherV2::QueueUser(const mx_port_packet_t& packet) {
         return ERR_NO_MEMORY;
 
     port_packet->packet = packet;
-    port_packet->packet.type = MX_PKT_TYPE_USER;
 
     auto status = Queue(port_packet, 0u, 0u);
     if (status < 0)
@@ -170,39 +195,56 @@ mx_status_t PortDispatcherV2::Queue(PortPacket* port_packet,
 }
 
 mx_status_t PortDispatcherV2::DeQueue(mx_time_t deadline, mx_port_packet_t* packet) {
+    size_t actual;
+    return DeQueueMany(deadline, packet, 1u, &actual);
+}
+
+mx_status_t PortDispatcherV2::DeQueueMany(mx_time_t deadline, mx_port_packet_t* packets,
+                                          size_t count, size_t* actual) {
     canary_.Assert();
+    DEBUG_ASSERT(count > 0u);
 
-    PortPacket* port_packet = nullptr;
-    PortObserver* observer = nullptr;
+    // Packets whose memory goes away once dequeued, freed without the lock held.
+    mxtl::DoublyLinkedList<PortPacket*> reap;
+    size_t n = 0u;
 
     while (true) {
         {
             AutoLock al(&lock_);
-            if (packets_.is_empty())
-                goto wait;
-
-            port_packet = packets_.pop_front();
-            observer = CopyLocked(port_packet, packet);
+            while (n < count && !packets_.is_empty()) {
+                auto port_packet = packets_.pop_front();
+                auto observer = CopyLocked(port_packet, packets ? &packets[n] : nullptr);
+                if (observer || port_packet->is_allocated())
+                    reap.push_back(port_packet);
+                n++;
+            }
         }
 
-        if (observer)
-            delete observer;
-        else if (packet && packet->type == MX_PKT_TYPE_USER)
-            delete port_packet;
-        return NO_ERROR;
+        if (n > 0u)
+            break;
 
-wait:
         status_t st = sema_.Wait(deadline);
         if (st != NO_ERROR)
             return st;
     }
+
+    PortPacket* port_packet;
+    while ((port_packet = reap.pop_front()) != nullptr) {
+        if (port_packet->is_allocated())
+            delete port_packet;
+        else
+            delete port_packet->observer;
+    }
+
+    *actual = n;
+    return NO_ERROR;
 }
 
 PortObserver* PortDispatcherV2::CopyLocked(PortPacket* port_packet, mx_port_packet_t* packet) {
     if (packet)
         *packet = port_packet->packet;
 
-    return (port_packet->type() == MX_PKT_TYPE_USER) ? nullptr : port_packet->observer;
+    return port_packet->is_allocated() ? nullptr : port_packet->observer;
 }
 
 bool PortDispatcherV2::CanReap(PortObserver* observer, PortPacket* port_packet) {
@@ -0,0 +1,48 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <magenta/port_page_source.h>
+
+#include <err.h>
+
+#include <magenta/port_dispatcher_v2.h>
+#include <magenta/syscalls/port.h>
+
+PortPageSource::PortPageSource(mxtl::RefPtr<PortDispatcherV2> port, uint64_t key)
+    : port_(mxtl::move(port)), key_(key) {
+}
+
+PortPageSource::~PortPageSource() {}
+
+status_t PortPageSource::RequestPages(uint64_t offset, uint64_t len) {
+    canary_.Assert();
+
+    mx_port_packet_t packet = {};
+    packet.key = key_;
+    packet.type = MX_PKT_TYPE_PAGE_REQUEST;
+    packet.page_request.offset = offset;
+    packet.page_request.length = len;
+
+    // fails once the pager has closed its port, after which nobody is left
+    // to supply the pages
+    status_t status = port_->QueuePacket(packet);
+    return status == ERR_BAD_STATE ? ERR_PEER_CLOSED : status;
+}
+
+void PortPageSource::OnPortClosed() {
+    canary_.Assert();
+    FailRequests(ERR_PEER_CLOSED);
+}
+
+void PortPageSource::OnAttach() {
+    canary_.Assert();
+    port_->AddPageSource(this);
+}
+
+void PortPageSource::OnDetach() {
+    canary_.Assert();
+    port_->RemovePageSource(this);
+}
@@ -15,8 +15,10 @@
 #include <trace.h>
 
 #include <arch/defines.h>
+#include <arch/ops.h>
 
 #include <kernel/auto_lock.h>
+#include <kernel/spinlock.h>
 #include <kernel/thread.h>
 #include <kernel/vm.h>
 #include <kernel/vm/vm_aspace.h>
@@ -332,6 +334,7 @@ void ProcessDispatcher::SetStateLocked(State s) {
             for (auto& handle : handles_) {
                 handle.set_process_id(0u);
             }
+            WaitForHandleLookupsLocked();
             // Delete handles out-of-band to avoid the worst case recursive
             // destruction behavior.
             ReapHandles(&handles_);
@@ -423,10 +426,64 @@ HandleOwner ProcessDispatcher::RemoveHandleLocked(mx_handle_t handle_value) {
 
     handle->set_process_id(0u);
     handles_.erase(*handle);
+    WaitForHandleLookupsLocked();
 
     return HandleOwner(handle);
 }
 
+void ProcessDispatcher::WaitForHandleLookupsLocked() {
+    // Lookups that start from here on count against the new epoch and will
+    // see the process ids cleared by our caller, so only the old one matters.
+    uint32_t old_epoch = handle_lookup_epoch_.load();
+    handle_lookup_epoch_.store(old_epoch ^ 1u);
+    for (uint cpu = 0; cpu < arch_max_num_cpus(); cpu++) {
+        while (handle_lookups_[cpu].count[old_epoch].load() != 0)
+            arch_spinloop_pause();
+    }
+}
+
+mx_status_t ProcessDispatcher::LookupHandle(mx_handle_t handle_value,
+                                            mx_rights_t desired_rights,
+                                            mxtl::RefPtr<Dispatcher>* dispatcher,
+                                            mx_rights_t* rights)
+    // |handle_table_lock_| is replaced by the lookup counts here.
+    TA_NO_THREAD_SAFETY_ANALYSIS {
+    // Removers spin waiting for us, so don't get preempted in here. That also
+    // keeps us on this cpu, so its count is only ever touched from here.
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    auto& lookups = handle_lookups_[arch_curr_cpu_num()];
+    uint32_t epoch;
+    for (;;) {
+        epoch = handle_lookup_epoch_.load();
+        lookups.count[epoch].fetch_add(1);
+        if (handle_lookup_epoch_.load() == epoch)
+            break;
+        lookups.count[epoch].fetch_sub(1);
+    }
+
+    mx_status_t status = NO_ERROR;
+    mxtl::RefPtr<Dispatcher> found;
+    Handle* handle = GetHandleLocked(handle_value);
+    if (!handle) {
+        status = ERR_BAD_HANDLE;
+    } else if (!magenta_rights_check(handle, desired_rights)) {
+        status = ERR_ACCESS_DENIED;
+    } else {
+        found = handle->dispatcher();
+        if (rights)
+            *rights = handle->rights();
+    }
+
+    lookups.count[epoch].fetch_sub(1);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    if (status == NO_ERROR)
+        *dispatcher = mxtl::move(found);
+    return status;
+}
+
 void ProcessDispatcher::UndoRemoveHandleLocked(mx_handle_t handle_value) {
     auto handle = map_value_to_handle(handle_value, handle_rand_);
     AddHandleLocked(HandleOwner(handle));
@@ -443,33 +500,14 @@ mx_koid_t ProcessDispatcher::GetKoidForHandle(mx_handle_t handle_value) {
 mx_status_t ProcessDispatcher::GetDispatcherInternal(mx_handle_t handle_value,
                                                      mxtl::RefPtr<Dispatcher>* dispatcher,
                                                      mx_rights_t* rights) {
-    AutoLock lock(&handle_table_lock_);
-    Handle* handle = GetHandleLocked(handle_value);
-    if (!handle)
-        return ERR_BAD_HANDLE;
-
-    *dispatcher = handle->dispatcher();
-    if (rights)
-        *rights = handle->rights();
-    return NO_ERROR;
+    return LookupHandle(handle_value, 0u, dispatcher, rights);
 }
 
 mx_status_t ProcessDispatcher::GetDispatcherWithRightsInternal(mx_handle_t handle_value,
                                                                mx_rights_t desired_rights,
                                                                mxtl::RefPtr<Dispatcher>* dispatcher_out,
                                                                mx_rights_t* out_rights) {
-    AutoLock lock(&handle_table_lock_);
-    Handle* handle = GetHandleLocked(handle_value);
-    if (!handle)
-        return ERR_BAD_HANDLE;
-
-    if (!magenta_rights_check(handle, desired_rights))
-        return ERR_ACCESS_DENIED;
-
-    *dispatcher_out = handle->dispatcher();
-    if (out_rights)
-        *out_rights = handle->rights();
-    return NO_ERROR;
+    return LookupHandle(handle_value, desired_rights, dispatcher_out, out_rights);
 }
 
 status_t ProcessDispatcher::GetInfo(mx_info_process_t* info) {
@@ -515,6 +553,10 @@ status_t ProcessDispatcher::GetStats(mx_info_task_stats_t* stats) {
     }
     stats->mem_mapped_bytes = usage.mapped_pages * PAGE_SIZE;
     stats->mem_committed_bytes = usage.committed_pages * PAGE_SIZE;
+    stats->mem_zero_reclaimed_bytes = usage.zero_reclaimed_pages * PAGE_SIZE;
+    stats->mem_private_bytes = usage.private_pages * PAGE_SIZE;
+    stats->mem_shared_bytes = usage.shared_pages * PAGE_SIZE;
+    stats->mem_scaled_shared_bytes = usage.scaled_shared_bytes;
     return NO_ERROR;
 }
 
@@ -14,19 +14,19 @@ Semaphore::Semaphore(int64_t initial_count) : count_(initial_count) {
 }
 
 Semaphore::~Semaphore() {
-    THREAD_LOCK(state);
+    WAIT_QUEUE_LOCK(&waitq_, state);
     wait_queue_destroy(&waitq_);
-    THREAD_UNLOCK(state);
+    WAIT_QUEUE_UNLOCK(&waitq_, state);
 }
 
 int Semaphore::Post() {
     // If the count is or was negative then a thread is waiting for a resource,
     // otherwise it's safe to just increase the count available with no downsides.
     int ret = 0;
-    THREAD_LOCK(state);
+    WAIT_QUEUE_LOCK(&waitq_, state);
     if (unlikely(++count_ <= 0))
-        ret = wait_queue_wake_one(&waitq_, false, NO_ERROR);
-    THREAD_UNLOCK(state);
+        ret = wait_queue_wake_one(&waitq_, NO_ERROR);
+    WAIT_QUEUE_UNLOCK(&waitq_, state);
     return ret;
 }
 
@@ -36,7 +36,7 @@ status_t Semaphore::Wait(lk_time_t deadline) {
      // If there are no resources available then we need to
      // sit in the wait queue until sem_post adds some.
     status_t ret = NO_ERROR;
-    THREAD_LOCK(state);
+    WAIT_QUEUE_LOCK(&waitq_, state);
     current_thread->interruptable = true;
 
     if (unlikely(--count_ < 0)) {
@@ -48,6 +48,6 @@ status_t Semaphore::Wait(lk_time_t deadline) {
     }
 
     current_thread->interruptable = false;
-    THREAD_UNLOCK(state);
+    WAIT_QUEUE_UNLOCK(&waitq_, state);
     return ret;
 }
@@ -15,10 +15,12 @@
 #include <trace.h>
 
 #include <lib/dpc.h>
+#include <lk/init.h>
 
 #include <arch/debugger.h>
 
 #include <kernel/auto_lock.h>
+#include <kernel/cmdline.h>
 #include <kernel/thread.h>
 #include <kernel/vm.h>
 #include <kernel/vm/vm_aspace.h>
@@ -38,6 +40,16 @@
 
 #define LOCAL_TRACE 0
 
+// How late, in ns, the sleeps and timed waits of user threads may end, set by
+// kernel.user-timer-slack-us.
+static lk_time_t user_timer_slack;
+
+static void user_thread_init(uint level) {
+    user_timer_slack = LK_USEC(cmdline_get_uint32("kernel.user-timer-slack-us", 50));
+}
+
+LK_INIT_HOOK(user_thread, &user_thread_init, LK_INIT_LEVEL_THREADING);
+
 UserThread::UserThread(mxtl::RefPtr<ProcessDispatcher> process,
                        uint32_t flags)
     : koid_(MX_KOID_INVALID),
@@ -221,6 +233,9 @@ status_t UserThread::Initialize(const char* name, size_t len) {
     // set the per-thread pointer
     lkthread->user_thread = reinterpret_cast<void*>(this);
 
+    // user deadlines are met a little late if that lets their timers share an interrupt
+    lkthread->timer_slack = user_timer_slack;
+
     // associate the proc's address space with this thread
     process_->aspace()->AttachToThread(lkthread);
 
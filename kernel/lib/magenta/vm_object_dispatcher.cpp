@@ -36,7 +36,10 @@ status_t VmObjectDispatcher::Create(mxtl::RefPtr<VmObject> vmo,
 VmObjectDispatcher::VmObjectDispatcher(mxtl::RefPtr<VmObject> vmo)
     : vmo_(vmo), state_tracker_(0u) {}
 
-VmObjectDispatcher::~VmObjectDispatcher() {}
+VmObjectDispatcher::~VmObjectDispatcher() {
+    // let the vmo know user space can no longer get at it directly
+    vmo_->OnDispatcherClosed();
+}
 
 mx_status_t VmObjectDispatcher::Read(user_ptr<void> user_data,
                                      size_t length,
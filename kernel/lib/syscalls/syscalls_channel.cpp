@@ -113,8 +113,7 @@ mx_status_t sys_channel_read(mx_handle_t handle_value, uint32_t options,
     if (result != NO_ERROR)
         return result;
 
-    // Currently MAY_DISCARD is the only allowable option.
-    if (options & ~MX_CHANNEL_READ_MAY_DISCARD)
+    if (options & ~(MX_CHANNEL_READ_MAY_DISCARD | MX_CHANNEL_READ_ACCEPT_PAGES))
         return ERR_NOT_SUPPORTED;
 
     mxtl::unique_ptr<MessagePacket> msg;
@@ -137,7 +136,7 @@ mx_status_t sys_channel_read(mx_handle_t handle_value, uint32_t options,
         return result;
 
     if (num_bytes > 0u) {
-        if (_bytes.copy_array_to_user(msg->data(), num_bytes) != NO_ERROR)
+        if (msg->CopyDataToUser(_bytes, options & MX_CHANNEL_READ_ACCEPT_PAGES) != NO_ERROR)
             return ERR_INVALID_ARGS;
     }
 
@@ -204,7 +203,7 @@ mx_status_t sys_channel_write(mx_handle_t handle_value, uint32_t options,
     LTRACEF("handle %d bytes %p num_bytes %u handles %p num_handles %u options 0x%x\n",
             handle_value, _bytes.get(), num_bytes, _handles.get(), num_handles, options);
 
-    if (options)
+    if (options & ~MX_CHANNEL_WRITE_DONATE_PAGES)
         return ERR_INVALID_ARGS;
 
     auto up = ProcessDispatcher::GetCurrent();
@@ -216,15 +215,11 @@ mx_status_t sys_channel_write(mx_handle_t handle_value, uint32_t options,
 
 
     mxtl::unique_ptr<MessagePacket> msg;
-    result = MessagePacket::Create(num_bytes, num_handles, &msg);
+    result = MessagePacket::CreateFromUser(_bytes, num_bytes, num_handles,
+                                           options & MX_CHANNEL_WRITE_DONATE_PAGES, &msg);
     if (result != NO_ERROR)
         return result;
 
-    if (num_bytes > 0u) {
-        if (_bytes.copy_array_from_user(msg->mutable_data(), num_bytes) != NO_ERROR)
-            return ERR_INVALID_ARGS;
-    }
-
     AllocChecker ac;
     mxtl::InlineArray<mx_handle_t, kChannelWriteHandlesInlineCount> handles(&ac, num_handles);
     if (!ac.check())
@@ -232,13 +227,16 @@ mx_status_t sys_channel_write(mx_handle_t handle_value, uint32_t options,
     if (num_handles > 0u) {
         result = msg_put_handles(up, msg.get(), handles.get(), _handles, num_handles,
                                  static_cast<Dispatcher*>(channel.get()));
-        if (result)
+        if (result) {
+            msg->ReturnDonatedPages(_bytes);
             return result;
+        }
     }
 
     result = channel->Write(mxtl::move(msg));
     if (result != NO_ERROR) {
-        // Write failed, put back the handles into this process.
+        // Write failed, put back the pages and handles into this process.
+        msg->ReturnDonatedPages(_bytes);
         AutoLock lock(up->handle_table_lock());
         for (size_t ix = 0; ix != num_handles; ++ix) {
             up->UndoRemoveHandleLocked(handles[ix]);
@@ -351,7 +349,7 @@ mx_status_t sys_channel_call(mx_handle_t handle_value, uint32_t options,
     }
 
     if (num_bytes > 0u) {
-        if (make_user_ptr(args.rd_bytes).copy_array_to_user(reply->data(), num_bytes) != NO_ERROR) {
+        if (reply->CopyDataToUser(make_user_ptr(args.rd_bytes), false) != NO_ERROR) {
             result = ERR_INVALID_ARGS;
             goto read_failed;
         }
@@ -7,6 +7,8 @@
 #include <trace.h>
 
 #include <magenta/process_dispatcher.h>
+#include <magenta/thread_dispatcher.h>
+#include <magenta/user_thread.h>
 
 #include "syscalls_priv.h"
 
@@ -20,6 +22,33 @@ mx_status_t sys_futex_wait(user_ptr<mx_futex_t> value_ptr, int current_value, mx
         value_ptr, current_value, deadline);
 }
 
+mx_status_t sys_futex_wait_pi(user_ptr<mx_futex_t> value_ptr, int current_value,
+                              mx_handle_t owner, mx_time_t deadline) {
+    LTRACEF("futex %p current %d owner %d\n", value_ptr.get(), current_value, owner);
+    magenta_check_deadline("futex_wait_pi", deadline);
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    // The owner may have released the futex and exited by the time we get
+    // here, taking its handle with it. The futex value check will catch that,
+    // so rather than failing, wait without lending our priority to anybody.
+    //
+    // Priority is only lent to a thread of our own process that we could
+    // read, so a handle to somebody else's thread can't be used to boost it.
+    mxtl::RefPtr<ThreadDispatcher> thread;
+    thread_t* owner_thread = nullptr;
+    mx_status_t status = up->GetDispatcherWithRights(owner, MX_RIGHT_READ, &thread);
+    if (status == ERR_ACCESS_DENIED)
+        return status;
+    if (status == NO_ERROR) {
+        if (thread->thread()->process() != up)
+            return ERR_ACCESS_DENIED;
+        owner_thread = thread->thread()->kernel_thread();
+    }
+
+    return up->futex_context()->FutexWait(value_ptr, current_value, deadline, owner_thread);
+}
+
 mx_status_t sys_futex_wake(user_ptr<const mx_futex_t> value_ptr, uint32_t count) {
     LTRACEF("futex %p count %" PRIu32 "\n", value_ptr.get(), count);
 
@@ -17,6 +17,7 @@
 #include <magenta/process_dispatcher.h>
 #include <magenta/user_copy.h>
 
+#include <mxtl/algorithm.h>
 #include <mxtl/ref_ptr.h>
 
 #include "syscalls_priv.h"
@@ -119,6 +120,51 @@ mx_status_t sys_port_wait2(mx_handle_t handle, mx_time_t deadline, user_ptr<void
     return NO_ERROR;
 }
 
+// packets dequeued at a time by port_wait_many, between copies out to the user
+static const size_t kWaitManyBatch = 8u;
+
+mx_status_t sys_port_wait_many(mx_handle_t handle, mx_time_t deadline,
+                               user_ptr<mx_port_packet_t> _packets, size_t count,
+                               user_ptr<size_t> _actual) {
+    magenta_check_deadline("port_wait_many", deadline);
+    LTRACEF("handle %d count %zu\n", handle, count);
+
+    if (!count)
+        return ERR_INVALID_ARGS;
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    mxtl::RefPtr<PortDispatcherV2> port;
+    mx_status_t status = up->GetDispatcherWithRights(handle, MX_RIGHT_WRITE, &port);
+    if (status != NO_ERROR)
+        return status;
+
+    // only wait for the first packet, then take what's already there
+    mx_port_packet_t pp[kWaitManyBatch];
+    size_t total = 0u;
+    while (total < count) {
+        size_t want = mxtl::min(count - total, kWaitManyBatch);
+        size_t got;
+        status = port->DeQueueMany(total ? 0ull : deadline, pp, want, &got);
+        if (status != NO_ERROR)
+            break;
+
+        if (_packets.copy_array_to_user(pp, got, total) != NO_ERROR)
+            return ERR_INVALID_ARGS;
+        total += got;
+
+        if (got < want)
+            break;
+    }
+
+    if (total == 0u)
+        return status;
+
+    if (_actual.copy_to_user(total) != NO_ERROR)
+        return ERR_INVALID_ARGS;
+    return NO_ERROR;
+}
+
 mx_status_t sys_port_wait(mx_handle_t handle, mx_time_t deadline,
                           user_ptr<void> _packet, size_t size) {
     magenta_check_deadline("port_wait", deadline);
@@ -7,6 +7,7 @@
 #pragma once
 
 #include <magenta/types.h>
+#include <magenta/syscalls/port.h>
 #include <magenta/syscalls/types.h>
 #include <lib/user_copy/user_ptr.h>
 
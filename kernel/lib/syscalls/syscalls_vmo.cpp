@@ -6,6 +6,7 @@
 
 #include <err.h>
 #include <inttypes.h>
+#include <new.h>
 #include <trace.h>
 
 #include <kernel/vm/vm_object.h>
@@ -16,6 +17,8 @@
 
 #include <magenta/handle_owner.h>
 #include <magenta/magenta.h>
+#include <magenta/port_dispatcher_v2.h>
+#include <magenta/port_page_source.h>
 #include <magenta/process_dispatcher.h>
 #include <magenta/user_copy.h>
 #include <magenta/vm_object_dispatcher.h>
@@ -260,3 +263,85 @@ mx_status_t sys_vmo_clone(mx_handle_t handle, uint32_t options, uint64_t offset,
 
     return NO_ERROR;
 }
+
+mx_status_t sys_pager_vmo_create(mx_handle_t port_handle, uint64_t key, uint64_t size,
+                                 uint32_t options, user_ptr<mx_handle_t> _out) {
+    LTRACEF("port %d key %#" PRIx64 " size %#" PRIx64 "\n", port_handle, key, size);
+
+    if (options)
+        return ERR_INVALID_ARGS;
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    // page requests are queued on the port
+    mxtl::RefPtr<PortDispatcherV2> port;
+    mx_status_t status = up->GetDispatcherWithRights(port_handle, MX_RIGHT_WRITE, &port);
+    if (status != NO_ERROR)
+        return status;
+
+    AllocChecker ac;
+    mxtl::RefPtr<PageSource> src = mxtl::AdoptRef(new (&ac) PortPageSource(mxtl::move(port), key));
+    if (!ac.check())
+        return ERR_NO_MEMORY;
+
+    // create a vm object whose pages come from the pager
+    mxtl::RefPtr<VmObject> vmo = VmObjectPaged::CreateWithSource(0, size, mxtl::move(src));
+    if (!vmo)
+        return ERR_NO_MEMORY;
+
+    // create a Vm Object dispatcher
+    mxtl::RefPtr<Dispatcher> dispatcher;
+    mx_rights_t rights;
+    mx_status_t result = VmObjectDispatcher::Create(mxtl::move(vmo), &dispatcher, &rights);
+    if (result != NO_ERROR)
+        return result;
+
+    // create a handle and attach the dispatcher to it
+    HandleOwner handle(MakeHandle(mxtl::move(dispatcher), rights));
+    if (!handle)
+        return ERR_NO_MEMORY;
+
+    if (_out.copy_to_user(up->MapHandleToValue(handle)) != NO_ERROR)
+        return ERR_INVALID_ARGS;
+
+    up->AddHandle(mxtl::move(handle));
+
+    return NO_ERROR;
+}
+
+mx_status_t sys_pager_supply_pages(mx_handle_t vmo_handle, uint64_t offset, uint64_t size,
+                                   mx_handle_t aux_vmo_handle, uint64_t aux_offset) {
+    LTRACEF("handle %d offset %#" PRIx64 " size %#" PRIx64 " aux %d aux_offset %#" PRIx64 "\n",
+            vmo_handle, offset, size, aux_vmo_handle, aux_offset);
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    mxtl::RefPtr<VmObjectDispatcher> vmo;
+    mx_status_t status = up->GetDispatcherWithRights(vmo_handle, MX_RIGHT_WRITE, &vmo);
+    if (status != NO_ERROR)
+        return status;
+
+    // the pages are moved out of the aux vmo, which both reads and writes it
+    mxtl::RefPtr<VmObjectDispatcher> aux_vmo;
+    status = up->GetDispatcherWithRights(aux_vmo_handle, MX_RIGHT_READ | MX_RIGHT_WRITE, &aux_vmo);
+    if (status != NO_ERROR)
+        return status;
+
+    return vmo->vmo()->SupplyPages(offset, size, aux_vmo->vmo().get(), aux_offset);
+}
+
+mx_status_t sys_pager_fail_pages(mx_handle_t vmo_handle, uint64_t offset, uint64_t size,
+                                 mx_status_t error) {
+    LTRACEF("handle %d offset %#" PRIx64 " size %#" PRIx64 " error %d\n",
+            vmo_handle, offset, size, error);
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    // the same right as supplying the pages
+    mxtl::RefPtr<VmObjectDispatcher> vmo;
+    mx_status_t status = up->GetDispatcherWithRights(vmo_handle, MX_RIGHT_WRITE, &vmo);
+    if (status != NO_ERROR)
+        return status;
+
+    return vmo->vmo()->FailPages(offset, size, error);
+}
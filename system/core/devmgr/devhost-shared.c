@@ -9,11 +9,15 @@
 #include <string.h>
 #include <unistd.h>
 
+#include <magenta/compiler.h>
 #include <magenta/syscalls.h>
 #include <magenta/syscalls/port.h>
 
 #include "devcoordinator.h"
 
+// Packets taken off the port per wait in port_dispatch().
+#define PORT_DISPATCH_BATCH 16
+
 #if TRACE_PORT_API
 #define zprintf(fmt...) printf(fmt)
 #else
@@ -170,27 +174,30 @@ mx_status_t port_queue(port_t* port, port_handler_t* ph, uint32_t evt) {
 }
 
 mx_status_t port_dispatch(port_t* port, mx_time_t deadline) {
-    for (;;) {
-        mx_port_packet_t pkt;
-        mx_status_t r;
-        if ((r = mx_port_wait(port->handle, deadline, &pkt, 0)) != NO_ERROR) {
-            if (r != ERR_TIMED_OUT) {
-                printf("port_dispatch: port wait failed %d\n", r);
-            }
-            return r;
+    // handle everything that's ready with one wait, a batch at a time
+    mx_port_packet_t pkts[PORT_DISPATCH_BATCH];
+    size_t count;
+    mx_status_t r;
+    if ((r = mx_port_wait_many(port->handle, deadline, pkts, countof(pkts), &count)) != NO_ERROR) {
+        if (r != ERR_TIMED_OUT) {
+            printf("port_dispatch: port wait failed %d\n", r);
         }
-        port_handler_t* ph = (void*) (uintptr_t) pkt.key;
-        if (pkt.type == MX_PKT_TYPE_USER) {
+        return r;
+    }
+    for (size_t i = 0; i < count; i++) {
+        mx_port_packet_t* pkt = &pkts[i];
+        port_handler_t* ph = (void*) (uintptr_t) pkt->key;
+        if (pkt->type == MX_PKT_TYPE_USER) {
             zprintf("port_dispatch(%p) port=%x ph=%p func=%p: evt=%x\n",
-                    port, port->handle, ph, ph->func, pkt.user.u32[0]);
-            ph->func(ph, 0, pkt.user.u32[0]);
+                    port, port->handle, ph, ph->func, pkt->user.u32[0]);
+            ph->func(ph, 0, pkt->user.u32[0]);
         } else {
             zprintf("port_dispatch(%p) port=%x ph=%p func=%p: signals=%x\n",
-                    port, port->handle, ph, ph->func, pkt.signal.observed);
-            if (ph->func(ph, pkt.signal.observed, 0) == NO_ERROR) {
+                    port, port->handle, ph, ph->func, pkt->signal.observed);
+            if (ph->func(ph, pkt->signal.observed, 0) == NO_ERROR) {
                 port_watch(port, ph);
             }
         }
-        return NO_ERROR;
     }
-}
\ No newline at end of file
+    return NO_ERROR;
+}
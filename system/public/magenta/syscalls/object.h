@@ -108,8 +108,8 @@ typedef struct mx_info_thread {
     uint32_t wait_exception_port_type;
 } mx_info_thread_t;
 
-// Statistics about resources (e.g., memory) used by a task. Can be relatively
-// expensive to gather.
+// Statistics about resources (e.g., memory) used by a task. Takes time in
+// proportion to the number of mappings in the task to gather.
 typedef struct mx_info_task_stats {
     // The total size of mapped memory ranges in the task.
     // Not all will be backed by physical memory.
@@ -120,6 +120,26 @@ typedef struct mx_info_task_stats {
     // Some of the pages may be double-mapped (and thus double-counted),
     // or may be shared with other tasks.
     size_t mem_committed_bytes;
+
+    // The amount of memory the kernel has given back from the VMOs the task
+    // maps because it was committed but entirely zero. Those pages read as
+    // zero again and are only committed anew when written to.
+    // This is a running total over each VMO's lifetime, counted once per VMO
+    // however many times the task maps it; VMOs shared with other tasks are
+    // counted in each of them.
+    size_t mem_zero_reclaimed_bytes;
+
+    // The part of mem_committed_bytes in VMOs mapped only once, and so only by
+    // this task.
+    size_t mem_private_bytes;
+
+    // The part of mem_committed_bytes in VMOs mapped more than once, by this
+    // task or others.
+    size_t mem_shared_bytes;
+
+    // mem_shared_bytes with every VMO's share divided by the number of times
+    // it is mapped, so that summing it across tasks counts it once.
+    size_t mem_scaled_shared_bytes;
 } mx_info_task_stats_t;
 
 typedef struct mx_info_vmar {
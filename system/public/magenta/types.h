@@ -229,6 +229,7 @@ typedef uint32_t mx_rights_t;
 #define MX_VM_FLAG_CAN_MAP_WRITE      (1u << 8)
 #define MX_VM_FLAG_CAN_MAP_EXECUTE    (1u << 9)
 #define MX_VM_FLAG_MAP_RANGE          (1u << 10)
+#define MX_VM_FLAG_FAULT_AROUND       (1u << 11)
 
 // clock ids
 #define MX_CLOCK_MONOTONIC        (0u)
@@ -257,6 +258,8 @@ typedef int64_t mx_rel_off_t;
 
 // Channel options and limits.
 #define MX_CHANNEL_READ_MAY_DISCARD         1u
+#define MX_CHANNEL_READ_ACCEPT_PAGES        2u
+#define MX_CHANNEL_WRITE_DONATE_PAGES       1u
 
 // Socket options and limits.
 #define MX_SOCKET_HALF_CLOSE                1u
@@ -0,0 +1,226 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Measures the round trip time of a message bounced between two processes,
+// each of which touches a working set of pages between hops. Every hop is an
+// address space switch, so this shows what the TLB costs across them: run it
+// with kernel.x86.pcid=false on the kernel command line to compare against
+// flushing on every switch.
+
+#include <assert.h>
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <launchpad/launchpad.h>
+#include <magenta/compiler.h>
+#include <magenta/process.h>
+#include <magenta/processargs.h>
+#include <magenta/syscalls.h>
+#include <mxtl/unique_ptr.h>
+
+namespace {
+
+constexpr char kBinName[] = "/boot/bin/aspace-pingpong";
+constexpr char kChildArg[] = "child";
+
+void argument_error(const char* argv0, const char* message) {
+    fprintf(stderr, "%s: error: %s\nRun with -h for help.\n", argv0, message);
+    exit(EXIT_FAILURE);
+}
+
+// Reads one byte from each of |pages| pages, so that the working set has to
+// be present in the TLB for every hop to be cheap.
+uint32_t touch_pages(const volatile uint8_t* buf, uint32_t pages) {
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < pages; i++)
+        sum += buf[i * PAGE_SIZE];
+    return sum;
+}
+
+mxtl::unique_ptr<uint8_t[]> alloc_working_set(uint32_t pages) {
+    mxtl::unique_ptr<uint8_t[]> buf(new uint8_t[(pages ? pages : 1) * PAGE_SIZE]);
+    memset(buf.get(), 1, (pages ? pages : 1) * PAGE_SIZE);
+    return buf;
+}
+
+// Echoes every message back on |channel| until the other end goes away.
+int run_child(uint32_t pages) {
+    mx_handle_t channel = mx_get_startup_handle(PA_USER0);
+    if (channel == MX_HANDLE_INVALID)
+        return EXIT_FAILURE;
+
+    auto buf = alloc_working_set(pages);
+    for (;;) {
+        mx_signals_t pending;
+        mx_status_t status = mx_object_wait_one(channel,
+                                                MX_CHANNEL_READABLE | MX_CHANNEL_PEER_CLOSED,
+                                                MX_TIME_INFINITE, &pending);
+        if (status != NO_ERROR || !(pending & MX_CHANNEL_READABLE))
+            break;
+
+        uint32_t msg;
+        uint32_t actual;
+        status = mx_channel_read(channel, 0u, &msg, sizeof(msg), &actual, nullptr, 0, nullptr);
+        if (status != NO_ERROR)
+            break;
+
+        msg += touch_pages(buf.get(), pages);
+        status = mx_channel_write(channel, 0u, &msg, sizeof(msg), nullptr, 0u);
+        if (status != NO_ERROR)
+            break;
+    }
+    mx_handle_close(channel);
+    return EXIT_SUCCESS;
+}
+
+mx_handle_t launch_child(mx_handle_t channel, uint32_t pages) {
+    char pages_arg[16];
+    snprintf(pages_arg, sizeof(pages_arg), "%" PRIu32, pages);
+    const char* args[] = {kBinName, kChildArg, pages_arg};
+
+    mx_handle_t job;
+    mx_status_t status = mx_handle_duplicate(mx_job_default(), MX_RIGHT_SAME_RIGHTS, &job);
+    if (status != NO_ERROR)
+        return status;
+
+    uint32_t id = PA_USER0;
+    launchpad_t* lp;
+    launchpad_create(job, "aspace-pingpong-child", &lp);
+    launchpad_load_from_file(lp, kBinName);
+    launchpad_set_args(lp, countof(args), args);
+    launchpad_add_handles(lp, 1, &channel, &id);
+
+    mx_handle_t proc;
+    const char* errmsg;
+    status = launchpad_go(lp, &proc, &errmsg);
+    if (status != NO_ERROR) {
+        fprintf(stderr, "launch failed (%d): %s\n", status, errmsg);
+        return status;
+    }
+    return proc;
+}
+
+void do_test(uint32_t duration, uint32_t pages) {
+    __UNUSED mx_status_t status;
+
+    mx_handle_t channel[2];
+    status = mx_channel_create(0u, &channel[0], &channel[1]);
+    assert(status == NO_ERROR);
+
+    mx_handle_t proc = launch_child(channel[1], pages);
+    if (proc < 0) {
+        mx_handle_close(channel[0]);
+        return;
+    }
+
+    auto buf = alloc_working_set(pages);
+    uint64_t duration_ns = duration * 1000000000ull;
+    uint64_t round_trips = 0;
+    uint64_t start_ns = mx_time_get(MX_CLOCK_MONOTONIC);
+    uint64_t end_ns;
+    uint32_t msg = 0;
+    for (;;) {
+        for (uint32_t i = 0; i < 1000; i++) {
+            msg += touch_pages(buf.get(), pages);
+            status = mx_channel_write(channel[0], 0u, &msg, sizeof(msg), nullptr, 0u);
+            assert(status == NO_ERROR);
+
+            status = mx_object_wait_one(channel[0], MX_CHANNEL_READABLE, MX_TIME_INFINITE,
+                                        nullptr);
+            assert(status == NO_ERROR);
+
+            uint32_t actual;
+            status = mx_channel_read(channel[0], 0u, &msg, sizeof(msg), &actual, nullptr, 0,
+                                     nullptr);
+            assert(status == NO_ERROR);
+        }
+        round_trips += 1000;
+
+        end_ns = mx_time_get(MX_CLOCK_MONOTONIC);
+        if (end_ns - start_ns >= duration_ns)
+            break;
+    }
+
+    mx_handle_close(channel[0]);
+    mx_object_wait_one(proc, MX_PROCESS_SIGNALED, MX_TIME_INFINITE, nullptr);
+    mx_handle_close(proc);
+
+    double ns_per_round_trip = static_cast<double>(end_ns - start_ns) /
+                               static_cast<double>(round_trips);
+    printf("%" PRIu32 " pages touched per hop: %.0f ns/round trip\n", pages, ns_per_round_trip);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    if (argc == 3 && !strcmp(argv[1], kChildArg))
+        return run_child(static_cast<uint32_t>(strtoul(argv[2], nullptr, 10)));
+
+    static constexpr char help[] =
+        "Usage: %s [options ...]\n"
+        "\n"
+        "Bounces a message between this process and a child process, touching\n"
+        "a working set of pages on each side between hops.\n"
+        "\n"
+        "Options:\n"
+        "  -h    show help (this)\n"
+        "  -s    run suite of working set sizes (ignores -p)\n"
+        "  -d N  set test duration to N seconds (default: 5)\n"
+        "  -p N  set working set to N pages per process (default: 64)\n";
+
+    bool run_suite = false;  // -s
+    uint32_t duration = 5;   // -d
+    uint32_t pages = 64;     // -p
+
+    int opt;
+    while ((opt = getopt(argc, argv, "+hsd:p:")) != -1) {
+        uint32_t value = 0;
+        if (optarg) {
+            errno = 0;
+            char* endptr = nullptr;
+            unsigned long long v = strtoull(optarg, &endptr, 10);
+            if (errno != 0 || *endptr != '\0' || v > UINT32_MAX)
+                argument_error(argv[0], "invalid numeric optional value");
+            value = static_cast<uint32_t>(v);
+        }
+
+        switch (opt) {
+            case 'h':
+                printf(help, argv[0]);
+                return EXIT_SUCCESS;
+            case 's':
+                run_suite = true;
+                break;
+            case 'd':
+                assert(optarg);
+                duration = value;
+                break;
+            case 'p':
+                assert(optarg);
+                pages = value;
+                break;
+            default:  // '?'
+                argument_error(argv[0], "invalid option");
+                break;
+        }
+    }
+    if (optind < argc)
+        argument_error(argv[0], "unexpected positional argument");
+
+    if (run_suite) {
+        static constexpr uint32_t suite[] = {0, 16, 64, 256, 1024};
+        for (size_t i = 0; i < countof(suite); i++)
+            do_test(duration, suite[i]);
+    } else {
+        do_test(duration, pages);
+    }
+
+    return EXIT_SUCCESS;
+}
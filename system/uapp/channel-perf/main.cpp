@@ -6,9 +6,11 @@
 #include <errno.h>
 #include <getopt.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <threads.h>
 
 #include <magenta/compiler.h>
 #include <magenta/syscalls.h>
@@ -31,9 +33,12 @@ struct TestArgs {
     uint32_t size;
     uint32_t handles;
     uint32_t queue;
+    bool pages;
 };
 
-void do_test(uint32_t duration, const TestArgs& test_args) {
+// Runs the test on one channel for |duration| seconds and returns the number of
+// iterations per second.
+double run_test(uint32_t duration, const TestArgs& test_args) {
     __UNUSED mx_status_t status;
 
     uint64_t duration_ns = duration * 1000000000ull;
@@ -48,12 +53,17 @@ void do_test(uint32_t duration, const TestArgs& test_args) {
     assert(mx_event_create(0u, &event) == NO_ERROR);
 
     // Storage space for our messages' stuff.
-    mxtl::unique_ptr<uint8_t[]> data;
+    uint8_t* data = nullptr;
     if (test_args.size) {
-        data.reset(new uint8_t[test_args.size]);
+        // Page aligned, so that whole pages of it can be donated.
+        void* ptr = nullptr;
+        assert(posix_memalign(&ptr, PAGE_SIZE, test_args.size) == 0);
+        data = static_cast<uint8_t*>(ptr);
         for (uint32_t i = 0; i < test_args.size; i++)
             data[i] = static_cast<uint8_t>(i);
     }
+    uint32_t write_options = test_args.pages ? MX_CHANNEL_WRITE_DONATE_PAGES : 0u;
+    uint32_t read_options = test_args.pages ? MX_CHANNEL_READ_ACCEPT_PAGES : 0u;
     mxtl::unique_ptr<mx_handle_t[]> handles;
     if (test_args.handles)
         handles.reset(new mx_handle_t[test_args.handles]);
@@ -61,7 +71,7 @@ void do_test(uint32_t duration, const TestArgs& test_args) {
     // Pre-queue |test_args.queue| messages (there'll always be this many messages in the queue).
     for (uint32_t i = 0; i < test_args.queue; i++) {
         duplicate_handles(test_args.handles, event, handles.get());
-        status = mx_channel_write(mp[0], 0u, data.get(), test_args.size,
+        status = mx_channel_write(mp[0], 0u, data, test_args.size,
                                   handles.get(), test_args.handles);
         assert(status == NO_ERROR);
     }
@@ -75,13 +85,13 @@ void do_test(uint32_t duration, const TestArgs& test_args) {
     for (;;) {
         big_its++;
         for (uint32_t i = 0; i < big_it_size; i++) {
-            status = mx_channel_write(mp[0], 0, data.get(), test_args.size,
+            status = mx_channel_write(mp[0], write_options, data, test_args.size,
                                       handles.get(), test_args.handles);
             assert(status == NO_ERROR);
 
             uint32_t r_size = test_args.size;
             uint32_t r_handles = test_args.handles;
-            status = mx_channel_read(mp[1], 0u, data.get(), handles.get(), r_size,
+            status = mx_channel_read(mp[1], read_options, data, handles.get(), r_size,
                                      r_handles, &r_size, &r_handles);
             assert(status == NO_ERROR);
             assert(r_size == test_args.size);
@@ -103,12 +113,53 @@ void do_test(uint32_t duration, const TestArgs& test_args) {
     assert(status == NO_ERROR);
     status = mx_handle_close(mp[1]);
     assert(status == NO_ERROR);
+    free(data);
 
     double real_duration = static_cast<double>(end_ns - start_ns) / 1000000000.0;
-    double its_per_second = static_cast<double>(big_its) * big_it_size / real_duration;
-    printf("write/read %" PRIu32 " bytes, %" PRIu32 " handles (%" PRIu32 " pre-queued): "
-               "%.0f iterations/second\n",
-           test_args.size, test_args.handles, test_args.queue, its_per_second);
+    return static_cast<double>(big_its) * big_it_size / real_duration;
+}
+
+struct ThreadArgs {
+    uint32_t duration;
+    const TestArgs* test_args;
+    double its_per_second;
+};
+
+int test_thread(void* arg) {
+    auto thread_args = static_cast<ThreadArgs*>(arg);
+    thread_args->its_per_second = run_test(thread_args->duration, *thread_args->test_args);
+    return 0;
+}
+
+// With |per_cpu|, runs one copy of the test per cpu at once, each on its own
+// channel, and reports the average per cpu as well as the total.
+void do_test(uint32_t duration, const TestArgs& test_args, bool per_cpu) {
+    printf("write/read %" PRIu32 " bytes, %" PRIu32 " handles (%" PRIu32 " pre-queued%s): ",
+           test_args.size, test_args.handles, test_args.queue,
+           test_args.pages ? ", pages donated" : "");
+
+    if (!per_cpu) {
+        printf("%.0f iterations/second\n", run_test(duration, test_args));
+        return;
+    }
+
+    uint32_t num_cpus = mx_system_get_num_cpus();
+    mxtl::unique_ptr<ThreadArgs[]> thread_args(new ThreadArgs[num_cpus]);
+    mxtl::unique_ptr<thrd_t[]> threads(new thrd_t[num_cpus]);
+    for (uint32_t i = 0; i < num_cpus; i++) {
+        thread_args[i] = {duration, &test_args, 0.0};
+        __UNUSED int rc = thrd_create(&threads[i], test_thread, &thread_args[i]);
+        assert(rc == thrd_success);
+    }
+
+    double total = 0.0;
+    for (uint32_t i = 0; i < num_cpus; i++) {
+        __UNUSED int rc = thrd_join(threads[i], nullptr);
+        assert(rc == thrd_success);
+        total += thread_args[i].its_per_second;
+    }
+    printf("%.0f iterations/second per cpu, %.0f in total on %" PRIu32 " cpus\n",
+           total / num_cpus, total, num_cpus);
 }
 
 }  // namespace
@@ -120,25 +171,29 @@ int main(int argc, char** argv) {
         "Options:\n"
         "  -h    show help (this)\n"
         "  -o    run single test (default)\n"
-        "  -s    run suite (ignores -S/-H/-Q)\n"
+        "  -s    run suite (ignores -S/-H/-Q/-P)\n"
+        "  -c    run a copy of the test on every cpu at once (default: one copy)\n"
         "  -n N  set test repetition count to N (default: 1)\n"
         "  -d N  set test duration to N seconds (default: 5)\n"
         "  -S N  set message size to N bytes (default: 10)\n"
         "  -H N  set message handle count to N handles (default: 0)\n"
-        "  -Q N  set message pre-queue count to N messages (default: 0)\n";
+        "  -Q N  set message pre-queue count to N messages (default: 0)\n"
+        "  -P    donate and accept whole pages of the message (default: copy)\n";
 
     bool run_suite = false;  // -o/-s
     uint32_t duration = 5;   // -d
     uint32_t repeats = 1;    // -n
+    bool per_cpu = false;    // -c
     // Ignored when running a suite:
     TestArgs test_args = {
         10,                  // -S (size)
         0,                   // -H (handles)
-        0                    // -Q (queue)
+        0,                   // -Q (queue)
+        false                // -P (pages)
     };
 
     int opt;
-    while ((opt = getopt(argc, argv, "+hosn:d:S:H:Q:")) != -1) {
+    while ((opt = getopt(argc, argv, "+hoscn:d:S:H:Q:P")) != -1) {
         // Our option values are always unsigned numbers.
         uint32_t value = 0;
         if (optarg) {
@@ -160,6 +215,9 @@ int main(int argc, char** argv) {
             case 's':
                 run_suite = true;
                 break;
+            case 'c':
+                per_cpu = true;
+                break;
             case 'n':
                 assert(optarg);
                 repeats = value;
@@ -180,6 +238,9 @@ int main(int argc, char** argv) {
                 assert(optarg);
                 test_args.queue = value;
                 break;
+            case 'P':
+                test_args.pages = true;
+                break;
             default:  // '?'
                 argument_error(argv[0], "invalid option");
                 break;
@@ -213,11 +274,15 @@ int main(int argc, char** argv) {
                 {10, 0, 1},
                 {100, 0, 1},
                 {1000, 0, 1},
+                {16384, 0, 0},
+                {65536, 0, 0},
+                {16384, 0, 0, true},
+                {65536, 0, 0, true},
             };
             for (size_t i = 0; i < countof(suite); i++)
-                do_test(duration, suite[i]);
+                do_test(duration, suite[i], per_cpu);
         } else {
-            do_test(duration, test_args);
+            do_test(duration, test_args, per_cpu);
         }
     }
 
@@ -0,0 +1,250 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <assert.h>
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+#include <magenta/compiler.h>
+#include <magenta/syscalls.h>
+#include <magenta/syscalls/object.h>
+#include <mxtl/algorithm.h>
+#include <mxtl/atomic.h>
+#include <mxtl/unique_ptr.h>
+
+// Measures how handle operations scale as more threads of one process do them
+// at once: looking up a handle they all share, creating and closing handles,
+// and passing a handle over a channel.
+
+namespace {
+
+void argument_error(const char* argv0, const char* message) {
+    fprintf(stderr, "%s: error: %s\nRun with -h for help.\n", argv0, message);
+    exit(EXIT_FAILURE);
+}
+
+enum class TestType {
+    INFO,     // mx_object_get_info() on a handle shared by all the threads
+    DUP,      // mx_handle_duplicate() and mx_handle_close()
+    CHANNEL,  // mx_channel_write() and mx_channel_read() of a message with a handle
+};
+
+const char* test_name(TestType type) {
+    switch (type) {
+        case TestType::INFO:
+            return "get_info";
+        case TestType::DUP:
+            return "duplicate/close";
+        case TestType::CHANNEL:
+            return "channel write/read of a handle";
+    }
+    return "?";
+}
+
+struct ThreadArgs {
+    TestType type;
+    mx_handle_t shared;
+    uint64_t duration_ns;
+    mxtl::atomic<uint32_t>* ready;
+    uint32_t num_threads;
+    double its_per_second;
+};
+
+// Does one iteration of the test.
+void run_iteration(TestType type, mx_handle_t shared, mx_handle_t* mp) {
+    __UNUSED mx_status_t status;
+
+    switch (type) {
+        case TestType::INFO: {
+            mx_info_handle_basic_t info;
+            status = mx_object_get_info(shared, MX_INFO_HANDLE_BASIC, &info, sizeof(info),
+                                        nullptr, nullptr);
+            assert(status == NO_ERROR);
+            break;
+        }
+        case TestType::DUP: {
+            mx_handle_t dup;
+            status = mx_handle_duplicate(shared, MX_RIGHT_SAME_RIGHTS, &dup);
+            assert(status == NO_ERROR);
+            status = mx_handle_close(dup);
+            assert(status == NO_ERROR);
+            break;
+        }
+        case TestType::CHANNEL: {
+            uint32_t data = 0u;
+            status = mx_channel_write(mp[0], 0u, &data, sizeof(data), &mp[2], 1u);
+            assert(status == NO_ERROR);
+            uint32_t r_size, r_handles;
+            status = mx_channel_read(mp[1], 0u, &data, &mp[2], sizeof(data), 1u,
+                                     &r_size, &r_handles);
+            assert(status == NO_ERROR);
+            assert(r_handles == 1u);
+            break;
+        }
+    }
+}
+
+int test_thread(void* arg) {
+    auto thread_args = static_cast<ThreadArgs*>(arg);
+    __UNUSED mx_status_t status;
+
+    // mp[0] and mp[1] are this thread's channel, mp[2] the handle sent over it.
+    mx_handle_t mp[3] = {MX_HANDLE_INVALID, MX_HANDLE_INVALID, MX_HANDLE_INVALID};
+    if (thread_args->type == TestType::CHANNEL) {
+        status = mx_channel_create(0u, &mp[0], &mp[1]);
+        assert(status == NO_ERROR);
+        status = mx_event_create(0u, &mp[2]);
+        assert(status == NO_ERROR);
+    }
+
+    // Start all the threads at once.
+    thread_args->ready->fetch_add(1u);
+    while (thread_args->ready->load() < thread_args->num_threads)
+        thrd_yield();
+
+    static constexpr uint32_t big_it_size = 10000;
+    uint64_t big_its = 0;
+    uint64_t start_ns = mx_time_get(MX_CLOCK_MONOTONIC);
+    uint64_t end_ns;
+    for (;;) {
+        big_its++;
+        for (uint32_t i = 0; i < big_it_size; i++)
+            run_iteration(thread_args->type, thread_args->shared, mp);
+
+        end_ns = mx_time_get(MX_CLOCK_MONOTONIC);
+        if ((end_ns - start_ns) >= thread_args->duration_ns)
+            break;
+    }
+
+    for (mx_handle_t handle : mp) {
+        if (handle != MX_HANDLE_INVALID) {
+            status = mx_handle_close(handle);
+            assert(status == NO_ERROR);
+        }
+    }
+
+    double real_duration = static_cast<double>(end_ns - start_ns) / 1000000000.0;
+    thread_args->its_per_second = static_cast<double>(big_its) * big_it_size / real_duration;
+    return 0;
+}
+
+// Runs the test on |num_threads| threads at once for |duration| seconds.
+void do_test(TestType type, uint32_t duration, uint32_t num_threads) {
+    __UNUSED mx_status_t status;
+
+    mx_handle_t shared;
+    status = mx_event_create(0u, &shared);
+    assert(status == NO_ERROR);
+
+    mxtl::atomic<uint32_t> ready(0u);
+    mxtl::unique_ptr<ThreadArgs[]> thread_args(new ThreadArgs[num_threads]);
+    mxtl::unique_ptr<thrd_t[]> threads(new thrd_t[num_threads]);
+    for (uint32_t i = 0; i < num_threads; i++) {
+        thread_args[i] = {type, shared, duration * 1000000000ull, &ready, num_threads, 0.0};
+        __UNUSED int rc = thrd_create(&threads[i], test_thread, &thread_args[i]);
+        assert(rc == thrd_success);
+    }
+
+    double total = 0.0;
+    for (uint32_t i = 0; i < num_threads; i++) {
+        __UNUSED int rc = thrd_join(threads[i], nullptr);
+        assert(rc == thrd_success);
+        total += thread_args[i].its_per_second;
+    }
+
+    status = mx_handle_close(shared);
+    assert(status == NO_ERROR);
+
+    printf("%s, %" PRIu32 " threads: %.0f iterations/second per thread, %.0f in total\n",
+           test_name(type), num_threads, total / num_threads, total);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    static constexpr char help[] =
+        "Usage: %s [options ...]\n"
+        "\n"
+        "Runs each test on 1, 2, 4, ... threads at once, up to the number of cpus.\n"
+        "\n"
+        "Options:\n"
+        "  -h    show help (this)\n"
+        "  -t T  only run test T: info, dup or channel (default: all of them)\n"
+        "  -T N  set the most threads to run at once to N (default: number of cpus)\n"
+        "  -d N  set test duration to N seconds (default: 2)\n";
+
+    uint32_t duration = 2;                               // -d
+    uint32_t max_threads = mx_system_get_num_cpus();     // -T
+    const char* only = nullptr;                          // -t
+
+    int opt;
+    while ((opt = getopt(argc, argv, "+ht:T:d:")) != -1) {
+        uint32_t value = 0;
+        if (optarg && opt != 't') {
+            errno = 0;
+            char* endptr = nullptr;
+            unsigned long long v = strtoull(optarg, &endptr, 10);
+            if (errno != 0 || *endptr != '\0' || v > UINT32_MAX)
+                argument_error(argv[0], "invalid numeric optional value");
+            value = static_cast<uint32_t>(v);
+        }
+
+        switch (opt) {
+            case 'h':
+                printf(help, argv[0]);
+                return EXIT_SUCCESS;
+            case 't':
+                assert(optarg);
+                only = optarg;
+                break;
+            case 'T':
+                assert(optarg);
+                if (value == 0u)
+                    argument_error(argv[0], "need at least one thread");
+                max_threads = value;
+                break;
+            case 'd':
+                assert(optarg);
+                duration = value;
+                break;
+            default:  // '?'
+                argument_error(argv[0], "invalid option");
+                break;
+        }
+    }
+    if (optind < argc)
+        argument_error(argv[0], "unexpected positional argument");
+
+    static constexpr struct {
+        const char* name;
+        TestType type;
+    } tests[] = {
+        {"info", TestType::INFO},
+        {"dup", TestType::DUP},
+        {"channel", TestType::CHANNEL},
+    };
+
+    bool found = false;
+    for (size_t i = 0; i < countof(tests); i++) {
+        if (only && strcmp(only, tests[i].name) != 0)
+            continue;
+        found = true;
+        for (uint32_t n = 1u;; n = mxtl::min(n * 2u, max_threads)) {
+            do_test(tests[i].type, duration, n);
+            if (n == max_threads)
+                break;
+        }
+    }
+    if (!found)
+        argument_error(argv[0], "unknown test");
+
+    return EXIT_SUCCESS;
+}
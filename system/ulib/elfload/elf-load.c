@@ -144,11 +144,15 @@ static mx_status_t finish_load_segment(
         ((ph->p_flags & PF_W) ? MX_VM_FLAG_PERM_WRITE : 0) |
         ((ph->p_flags & PF_X) ? MX_VM_FLAG_PERM_EXECUTE : 0);
 
+    // Pages of the file are usually touched in order, so have read faults
+    // on them map in whatever neighbouring pages are already resident.
+    const uint32_t file_flags = flags | MX_VM_FLAG_FAULT_AROUND;
+
     uintptr_t start;
     if (ph->p_filesz == ph->p_memsz)
         // Straightforward segment, map all the whole pages from the file.
-        return mx_vmar_map(vmar, start_offset, vmo, file_start, size, flags,
-                           &start);
+        return mx_vmar_map(vmar, start_offset, vmo, file_start, size,
+                           file_flags, &start);
 
     const size_t file_size = file_end - file_start;
 
@@ -156,7 +160,7 @@ static mx_status_t finish_load_segment(
     // Only the leading portion is directly mapped in from the file.
     if (file_size > 0) {
         mx_status_t status = mx_vmar_map(vmar, start_offset, vmo, file_start,
-                                         file_size, flags, &start);
+                                         file_size, file_flags, &start);
         if (status != NO_ERROR)
             return status;
 
@@ -123,61 +123,77 @@ int VfsDispatcher::Loop() {
     // when draining queue, limit the number of messages you take
     // at once, so you don't dominate the cpu
     constexpr unsigned kMaxMessageBatchSize = 4;
+    // likewise for the packets taken off the port in one wait, which
+    // would otherwise be spread over the other threads of the pool
+    constexpr size_t kMaxPacketBatchSize = 4;
     char tname[128];
     GetThreadName(tname, sizeof(tname));
 
     for (;;) {
-        mx_port_packet_t packet;
+        mx_port_packet_t packets[kMaxPacketBatchSize];
+        size_t count;
 
-        if ((r = mx_port_wait(ioport_, MX_TIME_INFINITE, &packet, 0u)) < 0) {
+        if ((r = mx_port_wait_many(ioport_, MX_TIME_INFINITE, packets,
+                                   kMaxPacketBatchSize, &count)) < 0) {
             xprintf("mxio_dispatcher: port wait failed %d, worker exiting\n", r);
             return NO_ERROR;
         }
 
-        xprintf("port_wait: thread %s \n", tname);
+        xprintf("port_wait: thread %s got %zu\n", tname, count);
 
-        if ((packet.signal.observed & MX_EVENT_SIGNALED) != 0) {
-            // reset for the next thread
-            r = mx_object_wait_async(shutdown_event_, ioport_, 0u,
-                                     MX_EVENT_SIGNALED,
-                                     MX_WAIT_ASYNC_ONCE);
-            if (r != NO_ERROR) {
-                error("vfs-dispatcher: error, couldn't reset thread event\n");
+        bool shutdown = false;
+        mx_status_t shutdown_status = NO_ERROR;
+        for (size_t i = 0; i < count; ++i) {
+            const mx_port_packet_t& packet = packets[i];
+
+            if ((packet.signal.observed & MX_EVENT_SIGNALED) != 0) {
+                // reset for the next thread
+                r = mx_object_wait_async(shutdown_event_, ioport_, 0u,
+                                         MX_EVENT_SIGNALED,
+                                         MX_WAIT_ASYNC_ONCE);
+                if (r != NO_ERROR) {
+                    error("vfs-dispatcher: error, couldn't reset thread event\n");
+                }
+                // exit thread, once the rest of the batch is handled
+                shutdown = true;
+                shutdown_status = r;
+                continue;
             }
-            // exit thread
-            xprintf("%s: suicide\n", tname);
-            return r;
-        }
 
-        xprintf("thrd_: port_wait: returns key %p effective:%#x \n",
-                (void*)packet.key, packet.signal.observed);
+            xprintf("thrd_: port_wait: returns key %p effective:%#x \n",
+                    (void*)packet.key, packet.signal.observed);
 
-        Handler* handler = (Handler*)(uintptr_t)packet.key;
+            Handler* handler = (Handler*)(uintptr_t)packet.key;
 
-        if (packet.signal.observed & MX_CHANNEL_READABLE) {
-            // hit cb multiple times if we know multi packets available
-            for (unsigned ix = 0; ix < mxtl::min(kMaxMessageBatchSize, (unsigned)packet.signal.count); ++ix) {
-                if ((r = handler->ExecuteCallback(cb_)) != NO_ERROR) {
-                    // error or close: invoke callback in case of error
-                    DisconnectHandler(handler, r < 0);
+            if (packet.signal.observed & MX_CHANNEL_READABLE) {
+                // hit cb multiple times if we know multi packets available
+                for (unsigned ix = 0; ix < mxtl::min(kMaxMessageBatchSize, (unsigned)packet.signal.count); ++ix) {
+                    if ((r = handler->ExecuteCallback(cb_)) != NO_ERROR) {
+                        // error or close: invoke callback in case of error
+                        DisconnectHandler(handler, r < 0);
+                        goto free_handler;
+                    }
+                }
+                // maybe more work to do: re-arm handler to fire again
+                if ((r = handler->SetAsyncCallback(ioport_))!= NO_ERROR){
+                    DisconnectHandler(handler, true);
                     goto free_handler;
                 }
-            }
-            // maybe more work to do: re-arm handler to fire again
-            if ((r = handler->SetAsyncCallback(ioport_))!= NO_ERROR){
+            } else if (packet.signal.observed & MX_CHANNEL_PEER_CLOSED) {
                 DisconnectHandler(handler, true);
-                goto free_handler;
+            free_handler:
+                mtx_lock(&lock_);
+                handlers_.erase(*handler);
+                mtx_unlock(&lock_);
+
+                delete handler;
             }
-        } else if (packet.signal.observed & MX_CHANNEL_PEER_CLOSED) {
-            DisconnectHandler(handler, true);
-        free_handler:
-            mtx_lock(&lock_);
-            handlers_.erase(*handler);
-            mtx_unlock(&lock_);
-
-            delete handler;
         }
 
+        if (shutdown) {
+            xprintf("%s: suicide\n", tname);
+            return shutdown_status;
+        }
     }
 
     // fatal error -- exiting thread
@@ -8,6 +8,7 @@
 #include <string.h>
 #include <threads.h>
 
+#include <magenta/compiler.h>
 #include <magenta/syscalls.h>
 #include <magenta/syscalls/port.h>
 #include <mxio/dispatcher.h>
@@ -17,6 +18,9 @@
 // but it is not ready for prime time yet.  This feature flag enables testing.
 #define USE_WAIT_ONCE 1
 
+// Packets taken off the port per wait.
+#define DISPATCH_BATCH 16
+
 #define VERBOSE_DEBUG 0
 
 #if VERBOSE_DEBUG
@@ -103,46 +107,52 @@ static int mxio_dispatcher_thread(void* _md) {
     xprintf("dispatcher: start %p\n", md);
 
     for (;;) {
-        mx_port_packet_t packet;
-        if ((r = mx_port_wait(md->ioport, MX_TIME_INFINITE, &packet, 0)) < 0) {
+        // take whatever is ready in one go, rather than a syscall per event
+        mx_port_packet_t packets[DISPATCH_BATCH];
+        size_t count;
+        if ((r = mx_port_wait_many(md->ioport, MX_TIME_INFINITE,
+                                   packets, countof(packets), &count)) < 0) {
             printf("dispatcher: ioport wait failed %d\n", r);
             break;
         }
-        handler_t* handler = (void*)(uintptr_t)packet.key;
+        for (size_t i = 0; i < count; i++) {
+            mx_port_packet_t packet = packets[i];
+            handler_t* handler = (void*)(uintptr_t)packet.key;
 #if !USE_WAIT_ONCE
-        if (handler->flags & FLAG_DISCONNECTED) {
-            // handler is awaiting gc
-            // ignore events for it until we get the synthetic "destroy" event
-            if (packet.type == MX_PKT_TYPE_USER) {
-                destroy_handler(md, handler, packet.signal.observed & SIGNAL_NEEDS_CLOSE_CB);
-                printf("dispatcher: destroy %p\n", handler);
-            } else {
-                printf("dispatcher: spurious packet for %p\n", handler);
-            }
-            continue;
-        }
-#endif
-        if (packet.signal.observed & MX_CHANNEL_READABLE) {
-            if ((r = handler->cb(handler->h, handler->func, handler->cookie)) != 0) {
-                if (r == ERR_DISPATCHER_NO_WORK) {
-                    printf("mxio: dispatcher found no work to do!\n");
+            if (handler->flags & FLAG_DISCONNECTED) {
+                // handler is awaiting gc
+                // ignore events for it until we get the synthetic "destroy" event
+                if (packet.type == MX_PKT_TYPE_USER) {
+                    destroy_handler(md, handler, packet.signal.observed & SIGNAL_NEEDS_CLOSE_CB);
+                    printf("dispatcher: destroy %p\n", handler);
                 } else {
-                    disconnect_handler(md, handler, r < 0);
-                    continue;
+                    printf("dispatcher: spurious packet for %p\n", handler);
                 }
+                continue;
             }
+#endif
+            if (packet.signal.observed & MX_CHANNEL_READABLE) {
+                if ((r = handler->cb(handler->h, handler->func, handler->cookie)) != 0) {
+                    if (r == ERR_DISPATCHER_NO_WORK) {
+                        printf("mxio: dispatcher found no work to do!\n");
+                    } else {
+                        disconnect_handler(md, handler, r < 0);
+                        continue;
+                    }
+                }
 #if USE_WAIT_ONCE
-            if ((r = mx_object_wait_async(handler->h, md->ioport, (uint64_t)(uintptr_t)handler,
-                                          MX_CHANNEL_READABLE | MX_CHANNEL_PEER_CLOSED,
-                                          MX_WAIT_ASYNC_ONCE)) < 0) {
-                printf("dispatcher: could not re-arm: %p\n", handler);
-            }
+                if ((r = mx_object_wait_async(handler->h, md->ioport, (uint64_t)(uintptr_t)handler,
+                                              MX_CHANNEL_READABLE | MX_CHANNEL_PEER_CLOSED,
+                                              MX_WAIT_ASYNC_ONCE)) < 0) {
+                    printf("dispatcher: could not re-arm: %p\n", handler);
+                }
 #endif
-            continue;
-        }
-        if (packet.signal.observed & MX_CHANNEL_PEER_CLOSED) {
-            // synthesize a close
-            disconnect_handler(md, handler, true);
+                continue;
+            }
+            if (packet.signal.observed & MX_CHANNEL_PEER_CLOSED) {
+                // synthesize a close
+                disconnect_handler(md, handler, true);
+            }
         }
     }
 
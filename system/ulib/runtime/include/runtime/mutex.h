@@ -43,6 +43,13 @@ void mxr_mutex_unlock(mxr_mutex_t* mutex);
 // mxr_mutex_unlock() will wake that thread.
 void mxr_mutex_lock_with_waiter(mxr_mutex_t* mutex);
 
+// Priority inheriting variants of lock and unlock.  While the lock is
+// held, the futex contains the handle of the owning thread, |self|, so
+// that threads blocking on the lock can lend their priority to it.  A
+// mutex must be used only with these or only with the functions above.
+void mxr_mutex_lock_pi(mxr_mutex_t* mutex, mx_handle_t self);
+void mxr_mutex_unlock_pi(mxr_mutex_t* mutex);
+
 #pragma GCC visibility pop
 
 __END_CDECLS
@@ -4,6 +4,7 @@
 
 #include <runtime/mutex.h>
 
+#include <limits.h>
 #include <magenta/syscalls.h>
 #include <stdatomic.h>
 
@@ -111,3 +112,56 @@ void mxr_mutex_unlock(mxr_mutex_t* mutex) {
             break;
     }
 }
+
+// The priority inheriting mutex stores the owner's handle in the futex
+// rather than LOCKED_WITHOUT_WAITERS, and sets this bit on top of it
+// instead of using LOCKED_WITH_WAITERS.  Handle values never have the
+// high bit set, so the two can't be confused.
+#define PI_WAITERS INT_MIN
+
+void mxr_mutex_lock_pi(mxr_mutex_t* mutex, mx_handle_t self) {
+    int old_state = UNLOCKED;
+    if (atomic_compare_exchange_strong(&mutex->futex, &old_state, self))
+        return;
+
+    for (;;) {
+        if (old_state == UNLOCKED) {
+            // As in lock_slow_path(), we may have been woken with other
+            // threads still waiting, so claim the mutex with the waiters
+            // bit set.
+            if (atomic_compare_exchange_strong(&mutex->futex, &old_state,
+                                               self | PI_WAITERS))
+                return;
+            continue;
+        }
+
+        // Mark the mutex as having waiters so that the owner will wake us.
+        if (!(old_state & PI_WAITERS)) {
+            int new_state = old_state | PI_WAITERS;
+            if (!atomic_compare_exchange_strong(&mutex->futex, &old_state,
+                                                new_state))
+                continue;
+            old_state = new_state;
+        }
+
+        mx_status_t status = _mx_futex_wait_pi(
+                &mutex->futex, old_state, old_state & ~PI_WAITERS,
+                MX_TIME_INFINITE);
+        if (status != NO_ERROR && status != ERR_BAD_STATE)
+            __builtin_trap();
+
+        old_state = atomic_load(&mutex->futex);
+    }
+}
+
+void mxr_mutex_unlock_pi(mxr_mutex_t* mutex) {
+    int old_state = atomic_exchange(&mutex->futex, UNLOCKED);
+    if (old_state == UNLOCKED)
+        __builtin_trap();
+
+    if (old_state & PI_WAITERS) {
+        mx_status_t status = _mx_futex_wake(&mutex->futex, 1);
+        if (status != NO_ERROR)
+            __builtin_trap();
+    }
+}
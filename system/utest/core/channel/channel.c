@@ -3,13 +3,16 @@
 // found in the LICENSE file.
 
 #include <assert.h>
+#include <limits.h>
 #include <magenta/compiler.h>
+#include <magenta/process.h>
 #include <magenta/syscalls.h>
 #include <magenta/syscalls/object.h>
 #include <unittest/unittest.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <threads.h>
 #include <unistd.h>
 
@@ -773,6 +776,88 @@ static bool channel_nest(void) {
     END_TEST;
 }
 
+static bool channel_donate_pages(void) {
+    BEGIN_TEST;
+
+    mx_handle_t channel[2];
+    ASSERT_EQ(mx_channel_create(0, &channel[0], &channel[1]), NO_ERROR, "");
+
+    // Two page aligned buffers of 8 pages each, committed by filling them in.
+    const size_t len = 8 * PAGE_SIZE;
+    uintptr_t addr[2];
+    for (int i = 0; i < 2; i++) {
+        mx_handle_t vmo;
+        ASSERT_EQ(mx_vmo_create(len, 0, &vmo), NO_ERROR, "");
+        ASSERT_EQ(mx_vmar_map(mx_vmar_root_self(), 0, vmo, 0, len,
+                              MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE, &addr[i]),
+                  NO_ERROR, "");
+        EXPECT_EQ(mx_handle_close(vmo), NO_ERROR, "");
+    }
+    uint8_t* src = (uint8_t*)addr[0];
+    uint8_t* dst = (uint8_t*)addr[1];
+    for (size_t i = 0; i < len; i++)
+        src[i] = (uint8_t)(i / PAGE_SIZE + i);
+    memset(dst, 0xff, len);
+
+    EXPECT_EQ(mx_channel_write(channel[0], MX_CHANNEL_WRITE_DONATE_PAGES, src, len, NULL, 0),
+              NO_ERROR, "");
+
+    // The pages past the first one have been taken, the first one was copied.
+    for (size_t i = 0; i < len; i++) {
+        uint8_t expected = i < PAGE_SIZE ? (uint8_t)i : 0u;
+        if (src[i] != expected) {
+            EXPECT_EQ(src[i], expected, "donated page not zeroed");
+            break;
+        }
+    }
+
+    uint32_t size = 0;
+    EXPECT_EQ(mx_channel_read(channel[1], MX_CHANNEL_READ_ACCEPT_PAGES, dst, NULL, len, 0,
+                              &size, NULL),
+              NO_ERROR, "");
+    EXPECT_EQ(size, len, "wrong size");
+    for (size_t i = 0; i < len; i++) {
+        if (dst[i] != (uint8_t)(i / PAGE_SIZE + i)) {
+            EXPECT_EQ(dst[i], (uint8_t)(i / PAGE_SIZE + i), "wrong data");
+            break;
+        }
+    }
+
+    // Too few whole pages to be worth donating, so they are copied.
+    EXPECT_EQ(mx_channel_write(channel[0], MX_CHANNEL_WRITE_DONATE_PAGES, dst, 2 * PAGE_SIZE,
+                               NULL, 0),
+              NO_ERROR, "");
+    EXPECT_EQ(mx_channel_read(channel[1], 0u, src, NULL, len, 0, &size, NULL), NO_ERROR, "");
+    EXPECT_EQ(size, 2 * PAGE_SIZE, "wrong size");
+    EXPECT_EQ(memcmp(src, dst, 2 * PAGE_SIZE), 0, "wrong data");
+
+    EXPECT_EQ(mx_channel_read(channel[1], ~0u, dst, NULL, len, 0, &size, NULL),
+              ERR_NOT_SUPPORTED, "");
+
+    // Writes that fail leave the caller's memory as it was.
+    for (size_t i = 0; i < len; i++)
+        src[i] = (uint8_t)(i / PAGE_SIZE + i);
+    mx_handle_t bad_handle = MX_HANDLE_INVALID;
+    EXPECT_EQ(mx_channel_write(channel[0], MX_CHANNEL_WRITE_DONATE_PAGES, src, len,
+                               &bad_handle, 1),
+              ERR_BAD_HANDLE, "");
+    EXPECT_EQ(mx_handle_close(channel[1]), NO_ERROR, "");
+    EXPECT_EQ(mx_channel_write(channel[0], MX_CHANNEL_WRITE_DONATE_PAGES, src, len, NULL, 0),
+              ERR_PEER_CLOSED, "");
+    for (size_t i = 0; i < len; i++) {
+        if (src[i] != (uint8_t)(i / PAGE_SIZE + i)) {
+            EXPECT_EQ(src[i], (uint8_t)(i / PAGE_SIZE + i), "failed write lost data");
+            break;
+        }
+    }
+
+    for (int i = 0; i < 2; i++)
+        EXPECT_EQ(mx_vmar_unmap(mx_vmar_root_self(), addr[i], len), NO_ERROR, "");
+    EXPECT_EQ(mx_handle_close(channel[0]), NO_ERROR, "");
+
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(channel_tests)
 RUN_TEST(channel_test)
 RUN_TEST(channel_read_error_test)
@@ -784,6 +869,7 @@ RUN_TEST(channel_may_discard)
 RUN_TEST(channel_call)
 RUN_TEST(channel_call2)
 RUN_TEST(channel_nest)
+RUN_TEST(channel_donate_pages)
 END_TEST_CASE(channel_tests)
 
 #ifndef BUILD_COMBINED_TESTS
@@ -3,6 +3,7 @@
 // found in the LICENSE file.
 
 #include <magenta/syscalls.h>
+#include <magenta/threads.h>
 #include <runtime/mutex.h>
 #include <unittest/unittest.h>
 #include <inttypes.h>
@@ -59,6 +60,23 @@ static int mutex_thread_3(void* arg) {
     return 0;
 }
 
+static mxr_mutex_t pi_mutex = MXR_MUTEX_INIT;
+static int pi_counter = 0;
+
+static int pi_mutex_thread(void* arg) {
+    mx_handle_t self = thrd_get_mx_handle(thrd_current());
+
+    for (int times = 0; times < 200; times++) {
+        mxr_mutex_lock_pi(&pi_mutex, self);
+        int counter = pi_counter;
+        mx_nanosleep(mx_deadline_after(MX_USEC(1)));
+        pi_counter = counter + 1;
+        mxr_mutex_unlock_pi(&pi_mutex);
+    }
+
+    return 0;
+}
+
 static bool got_lock_1 = false;
 static bool got_lock_2 = false;
 static bool got_lock_3 = false;
@@ -136,6 +154,24 @@ static bool test_mutexes(void) {
     END_TEST;
 }
 
+static bool test_pi_mutexes(void) {
+    BEGIN_TEST;
+    thrd_t thread1, thread2, thread3;
+
+    thrd_create_with_name(&thread1, pi_mutex_thread, NULL, "thread 1");
+    thrd_create_with_name(&thread2, pi_mutex_thread, NULL, "thread 2");
+    thrd_create_with_name(&thread3, pi_mutex_thread, NULL, "thread 3");
+
+    thrd_join(thread1, NULL);
+    thrd_join(thread2, NULL);
+    thrd_join(thread3, NULL);
+
+    EXPECT_EQ(pi_counter, 600, "pi mutex did not provide mutual exclusion");
+    EXPECT_EQ(atomic_load(&pi_mutex.futex), 0, "pi mutex left locked");
+
+    END_TEST;
+}
+
 static bool test_try_mutexes(void) {
     BEGIN_TEST;
     thrd_t thread1, thread2, thread3;
@@ -159,6 +195,7 @@ static bool test_try_mutexes(void) {
 BEGIN_TEST_CASE(mxr_mutex_tests)
 RUN_TEST(test_initializer)
 RUN_TEST(test_mutexes)
+RUN_TEST(test_pi_mutexes)
 RUN_TEST(test_try_mutexes)
 END_TEST_CASE(mxr_mutex_tests)
 
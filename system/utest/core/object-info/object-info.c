@@ -31,6 +31,8 @@ bool info_task_stats_smoke(void) {
               NO_ERROR, "");
     ASSERT_GT(info.mem_committed_bytes, 0u, "");
     ASSERT_GE(info.mem_mapped_bytes, info.mem_committed_bytes, "");
+    EXPECT_EQ(info.mem_private_bytes + info.mem_shared_bytes, info.mem_committed_bytes, "");
+    EXPECT_GE(info.mem_shared_bytes, info.mem_scaled_shared_bytes, "");
     END_TEST;
 }
 
@@ -76,6 +76,52 @@ static bool queue_and_close_test(void) {
     END_TEST;
 }
 
+static bool wait_many_test(void) {
+    BEGIN_TEST;
+    mx_status_t status;
+
+    mx_handle_t port;
+    status = mx_port_create(MX_PORT_OPT_V2, &port);
+    EXPECT_EQ(status, NO_ERROR, "could not create port v2");
+
+    mx_port_packet_t out[12] = {};
+    size_t actual = 0u;
+
+    status = mx_port_wait_many(port, 0ull, out, 0u, &actual);
+    EXPECT_EQ(status, ERR_INVALID_ARGS, "");
+
+    status = mx_port_wait_many(port, mx_deadline_after(MX_USEC(1)), out, 12u, &actual);
+    EXPECT_EQ(status, ERR_TIMED_OUT, "");
+
+    // more than the kernel takes in one go, and fewer than we ask for
+    for (uint64_t key = 0u; key < 10u; ++key) {
+        const mx_port_packet_t in = { key, MX_PKT_TYPE_USER, 0, { {} } };
+        status = mx_port_queue(port, &in, 0u);
+        EXPECT_EQ(status, NO_ERROR, "");
+    }
+
+    status = mx_port_wait_many(port, MX_TIME_INFINITE, out, 3u, &actual);
+    EXPECT_EQ(status, NO_ERROR, "");
+    EXPECT_EQ(actual, 3u, "");
+
+    status = mx_port_wait_many(port, MX_TIME_INFINITE, out + 3, 9u, &actual);
+    EXPECT_EQ(status, NO_ERROR, "");
+    EXPECT_EQ(actual, 7u, "");
+
+    for (uint64_t key = 0u; key < 10u; ++key) {
+        EXPECT_EQ(out[key].key, key, "packets out of order");
+        EXPECT_EQ(out[key].type, MX_PKT_TYPE_USER, "");
+    }
+
+    status = mx_port_wait_many(port, 0ull, out, 12u, &actual);
+    EXPECT_EQ(status, ERR_TIMED_OUT, "");
+
+    status = mx_handle_close(port);
+    EXPECT_EQ(status, NO_ERROR, "");
+
+    END_TEST;
+}
+
 static bool async_wait_channel_test(void) {
     BEGIN_TEST;
     mx_status_t status;
@@ -478,6 +524,7 @@ static bool threads_event_repeat() {
 BEGIN_TEST_CASE(port_tests)
 RUN_TEST(basic_test)
 RUN_TEST(queue_and_close_test)
+RUN_TEST(wait_many_test)
 RUN_TEST(async_wait_channel_test)
 RUN_TEST(async_wait_event_test_single)
 RUN_TEST(async_wait_event_test_repeat)
@@ -8,11 +8,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <threads.h>
 #include <unistd.h>
 
 #include <magenta/process.h>
 #include <magenta/syscalls.h>
 #include <magenta/syscalls/object.h>
+#include <magenta/syscalls/port.h>
 #include <pretty/hexdump.h>
 #include <unittest/unittest.h>
 
@@ -866,6 +868,143 @@ bool vmo_clone_test_4() {
     END_TEST;
 }
 
+struct pager_args {
+    mx_handle_t port;
+    mx_handle_t vmo;
+    mx_port_packet_t packet;
+    mx_status_t status;
+};
+
+// serves a single page request, filling each word with its index in the vmo plus one
+static int pager_thread(void* arg) {
+    pager_args* args = static_cast<pager_args*>(arg);
+    args->status = mx_port_wait(args->port, MX_TIME_INFINITE, &args->packet, 0u);
+    if (args->status != NO_ERROR)
+        return 0;
+
+    const uint64_t offset = args->packet.page_request.offset;
+    const uint64_t length = args->packet.page_request.length;
+    size_t* buf = static_cast<size_t*>(malloc(length));
+    for (size_t i = 0; i < length / sizeof(size_t); i++)
+        buf[i] = offset / sizeof(size_t) + i + 1;
+
+    mx_handle_t aux;
+    size_t written;
+    args->status = mx_vmo_create(length, 0, &aux);
+    if (args->status == NO_ERROR)
+        args->status = mx_vmo_write(aux, buf, 0, length, &written);
+    if (args->status == NO_ERROR)
+        args->status = mx_pager_supply_pages(args->vmo, offset, length, aux, 0);
+    mx_handle_close(aux);
+    free(buf);
+    return 0;
+}
+
+bool vmo_pager_test() {
+    BEGIN_TEST;
+
+    const size_t size = PAGE_SIZE * 4;
+    pager_args args = {};
+    ASSERT_EQ(NO_ERROR, mx_port_create(MX_PORT_OPT_V2, &args.port), "port_create");
+    ASSERT_EQ(NO_ERROR, mx_pager_vmo_create(args.port, 7u, size, 0, &args.vmo), "pager_vmo_create");
+
+    // the pager decides what's in the pages, they can't be committed for it
+    EXPECT_EQ(ERR_NOT_SUPPORTED, mx_vmo_op_range(args.vmo, MX_VMO_OP_COMMIT, 0, size, nullptr, 0),
+              "committing");
+
+    thrd_t thread;
+    ASSERT_EQ(thrd_success, thrd_create(&thread, pager_thread, &args), "thrd_create");
+
+    // touching the first page blocks until the pager has supplied it, along with
+    // the rest of the missing pages it was asked for
+    uintptr_t ptr;
+    ASSERT_EQ(NO_ERROR,
+              mx_vmar_map(mx_vmar_root_self(), 0, args.vmo, 0, size, MX_VM_FLAG_PERM_READ, &ptr),
+              "map");
+    volatile size_t* p = reinterpret_cast<volatile size_t*>(ptr);
+    EXPECT_EQ(1u, p[0], "first word");
+
+    EXPECT_EQ(thrd_success, thrd_join(thread, nullptr), "thrd_join");
+    EXPECT_EQ(NO_ERROR, args.status, "pager status");
+    EXPECT_EQ(7u, args.packet.key, "packet key");
+    EXPECT_EQ(MX_PKT_TYPE_PAGE_REQUEST, args.packet.type, "packet type");
+    EXPECT_EQ(0u, args.packet.page_request.offset, "request offset");
+    EXPECT_EQ(size, args.packet.page_request.length, "request length");
+
+    // everything is there now, without asking again
+    for (size_t i = 0; i < size / sizeof(size_t); i++) {
+        if (p[i] != i + 1) {
+            EXPECT_EQ(i + 1, p[i], "reading pager vmo");
+            break;
+        }
+    }
+    size_t val, actual;
+    EXPECT_EQ(NO_ERROR, mx_vmo_read(args.vmo, &val, size - sizeof(val), sizeof(val), &actual),
+              "vmo_read");
+    EXPECT_EQ(size / sizeof(size_t), val, "last word");
+    mx_port_packet_t packet;
+    EXPECT_EQ(ERR_TIMED_OUT, mx_port_wait(args.port, 0, &packet, 0u), "no more requests");
+
+    // only vmos created by a pager can be supplied with pages
+    mx_handle_t vmo;
+    EXPECT_EQ(NO_ERROR, mx_vmo_create(size, 0, &vmo), "vmo_create");
+    EXPECT_EQ(ERR_NOT_SUPPORTED, mx_pager_supply_pages(vmo, 0, PAGE_SIZE, args.vmo, 0),
+              "supplying a regular vmo");
+    EXPECT_EQ(NO_ERROR, mx_handle_close(vmo), "handle_close");
+
+    EXPECT_EQ(NO_ERROR, mx_vmar_unmap(mx_vmar_root_self(), ptr, size), "unmap");
+    EXPECT_EQ(NO_ERROR, mx_handle_close(args.vmo), "handle_close");
+    EXPECT_EQ(NO_ERROR, mx_handle_close(args.port), "handle_close");
+
+    END_TEST;
+}
+
+struct pager_reader_args {
+    mx_handle_t vmo;
+    mx_status_t status;
+};
+
+static int pager_reader_thread(void* arg) {
+    pager_reader_args* args = static_cast<pager_reader_args*>(arg);
+    size_t val, actual;
+    args->status = mx_vmo_read(args->vmo, &val, 0, sizeof(val), &actual);
+    return 0;
+}
+
+bool vmo_pager_fail_test() {
+    BEGIN_TEST;
+
+    const size_t size = PAGE_SIZE * 4;
+    mx_handle_t port;
+    ASSERT_EQ(NO_ERROR, mx_port_create(MX_PORT_OPT_V2, &port), "port_create");
+    pager_reader_args args = {};
+    ASSERT_EQ(NO_ERROR, mx_pager_vmo_create(port, 0u, size, 0, &args.vmo), "pager_vmo_create");
+
+    // the pager can't supply the pages, and the reader gets its error
+    thrd_t thread;
+    ASSERT_EQ(thrd_success, thrd_create(&thread, pager_reader_thread, &args), "thrd_create");
+    mx_port_packet_t packet;
+    ASSERT_EQ(NO_ERROR, mx_port_wait(port, MX_TIME_INFINITE, &packet, 0u), "port_wait");
+    EXPECT_EQ(ERR_INVALID_ARGS, mx_pager_fail_pages(args.vmo, 0, PAGE_SIZE, NO_ERROR),
+              "failing without an error");
+    EXPECT_EQ(NO_ERROR, mx_pager_fail_pages(args.vmo, packet.page_request.offset,
+                                            packet.page_request.length, ERR_IO),
+              "pager_fail_pages");
+    EXPECT_EQ(thrd_success, thrd_join(thread, nullptr), "thrd_join");
+    EXPECT_EQ(ERR_IO, args.status, "read status");
+
+    // asking again once the pager has gone away fails too, rather than waiting forever
+    ASSERT_EQ(thrd_success, thrd_create(&thread, pager_reader_thread, &args), "thrd_create");
+    ASSERT_EQ(NO_ERROR, mx_port_wait(port, MX_TIME_INFINITE, &packet, 0u), "port_wait");
+    EXPECT_EQ(NO_ERROR, mx_handle_close(port), "handle_close");
+    EXPECT_EQ(thrd_success, thrd_join(thread, nullptr), "thrd_join");
+    EXPECT_EQ(ERR_PEER_CLOSED, args.status, "read status");
+
+    EXPECT_EQ(NO_ERROR, mx_handle_close(args.vmo), "handle_close");
+
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(vmo_tests)
 RUN_TEST(vmo_create_test);
 RUN_TEST(vmo_read_write_test);
@@ -880,6 +1019,8 @@ RUN_TEST(vmo_clone_test_1);
 RUN_TEST(vmo_clone_test_2);
 RUN_TEST(vmo_clone_test_3);
 RUN_TEST(vmo_clone_test_4);
+RUN_TEST(vmo_pager_test);
+RUN_TEST(vmo_pager_fail_test);
 END_TEST_CASE(vmo_tests)
 
 int main(int argc, char** argv) {